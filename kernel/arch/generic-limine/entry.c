@@ -176,7 +176,7 @@ static void load_modules()
 	struct limine_module_response *res = module_request.response;
 	for (size_t i = 0; i < res->module_count; i++) {
 		struct limine_file *mod = res->modules[i];
-		initrd_unpack_tar("/", mod->address, mod->size);
+		initrd_unpack("/", mod->address, mod->size);
 	}
 }
 
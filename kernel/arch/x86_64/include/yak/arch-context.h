@@ -4,6 +4,7 @@
 
 #define CTX_SYS_IP(ctx) (ctx->rcx)
 #define CTX_SYS_SP(ctx) (ctx->rsp)
+#define CTX_SYS_ARG0(ctx) (ctx->rdi)
 
 struct syscall_frame {
 	uint64_t rax;
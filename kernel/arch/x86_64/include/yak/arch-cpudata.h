@@ -9,6 +9,8 @@ extern "C" {
 struct cpu_md {
 	uint32_t apic_id;
 	uint64_t apic_ticks_per_ms;
+	// the fpu registers hold some user thread's state
+	bool fpu_dirty;
 };
 
 extern char __kernel_percpu_start[];
@@ -16,7 +16,7 @@ extern "C" {
 #define PMAP_MAX_LEVELS 5
 extern size_t PMAP_LEVELS;
 
-#define BUDDY_ORDERS 7 // 512 Kb
+#define BUDDY_ORDERS 10 // up to 2 MiB blocks
 
 #define KERNEL_HEAP_BASE 0xFFFFFFe000000000
 #define KERNEL_HEAP_LENGTH GiB(32)
@@ -148,6 +148,24 @@ static inline pte_t pte_make(size_t level, uintptr_t pa, vm_prot_t prot,
 	return pte;
 }
 
+// derive the idx'th entry of the next lower level from a large pte
+static inline pte_t pte_split(pte_t pte, size_t level, size_t idx)
+{
+	uintptr_t pa = (pte & pteLargeAddress) +
+		       (idx << PMAP_LEVEL_SHIFTS[level - 1]);
+	pte_t flags = pte & ~pteAddress;
+
+	if (level - 1 == 0) {
+		flags &= ~ptePagesize;
+		if (pte & ptePatLarge)
+			flags |= ptePat;
+	} else if (pte & ptePatLarge) {
+		flags |= ptePatLarge;
+	}
+
+	return flags | pa;
+}
+
 static inline bool pte_check_pt_empty(size_t level, pte_t *pt)
 {
 	for (size_t i = 0; i < PMAP_LEVEL_ENTRIES[level]; i++) {
@@ -11,7 +11,12 @@ struct md_pcb {
 
 	uint64_t fsbase, gsbase;
 
+	// allocated on first use
 	void *fp_state;
+	// the registers hold the state, it has to be saved on switch
+	bool fpu_live;
+	// switches left that load the state up front
+	uint8_t fpu_eager;
 };
 
 #ifdef __cplusplus
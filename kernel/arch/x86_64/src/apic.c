@@ -107,6 +107,14 @@ void plat_ipi(struct cpu *cpu)
 	lapic_send_ipi(cpu->md.apic_id, ipi_vector);
 }
 
+void arch_msi_compose(size_t cpu, irq_vec_t vector, uint64_t *address,
+		      uint32_t *data)
+{
+	// fixed delivery, physical destination, edge triggered
+	*address = 0xFEE00000 | ((uint64_t)getcpu(cpu)->md.apic_id << 12);
+	*data = vector;
+}
+
 static void lapic_mask(uint16_t offset)
 {
 	lapic_write(offset, (1 << 16));
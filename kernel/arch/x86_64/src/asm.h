@@ -12,6 +12,7 @@ enum msr {
 	MSR_FSBASE = 0xC0000100,
 	MSR_GSBASE = 0xC0000101,
 	MSR_KERNEL_GSBASE = 0xC0000102,
+	MSR_XSS = 0xDA0,
 };
 
 static inline void wrmsr(uint32_t index, uint64_t value)
@@ -1,22 +1,47 @@
+#include <assert.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdint.h>
+#include <yak/cpudata.h>
+#include <yak/ipl.h>
 #include <yak/panic.h>
+#include <yak/sched.h>
 #include <yak/vm/kmem.h>
 #include <yak/init.h>
 
 #include "asm.h"
 #include "fpu.h"
 
+#define CR0_TS (1UL << 3)
+
+#define FXSAVE_FCW 0
+#define FXSAVE_MXCSR 24
+#define XSAVE_HEADER 512
+#define XCOMP_BV_COMPACT (1UL << 63)
+
+#define FCW_DEFAULT 0x37F
+#define MXCSR_DEFAULT 0x1F80
+
+/*
+ * A thread that trapped on the fpu gets its state loaded eagerly on the
+ * next few switches. One that stops using it goes back to being lazy.
+ */
+#define FPU_EAGER_SWITCHES 5
+
 static kmem_cache_t *fpstate_cache;
 static size_t fpstate_size;
-static enum { FP_FXSAVE, FP_XSAVE } fp_ctx_type;
+static enum { FP_FXSAVE, FP_XSAVE, FP_XSAVEOPT, FP_XSAVES } fp_ctx_type;
+static uint64_t xfeatures;
+
+// what the registers are reset to before a lazy thread runs
+static void *fpu_init_state;
 
 static void local_fpu_enable(bool xsave)
 {
 	uint64_t cr0 = read_cr0();
 	cr0 &= ~(1UL << 2); // disable emulation
 	cr0 |= (1 << 1); // monitor co-processor
+	cr0 &= ~CR0_TS;
 	write_cr0(cr0);
 
 	uint64_t cr4 = read_cr4();
@@ -39,7 +64,15 @@ static void local_fpu_enable(bool xsave)
 		xcr0 |= ((uint64_t)edx << 32) | eax;
 
 		xsetbv(0, xcr0);
+		xfeatures = xcr0;
+
+		// no supervisor states, xsaves only for its optimizations
+		cpuid(0xd, 1, &eax, &ebx, &ecx, &edx);
+		if (eax & (1 << 3))
+			wrmsr(MSR_XSS, 0);
 	}
+
+	curcpu().md.fpu_dirty = false;
 }
 
 void fpu_ap_init()
@@ -47,6 +80,18 @@ void fpu_ap_init()
 	local_fpu_enable(fp_ctx_type != FP_FXSAVE);
 }
 
+static void fpu_state_init(void *ptr)
+{
+	memset(ptr, 0, fpstate_size);
+	*(uint16_t *)((uintptr_t)ptr + FXSAVE_FCW) = FCW_DEFAULT;
+	*(uint32_t *)((uintptr_t)ptr + FXSAVE_MXCSR) = MXCSR_DEFAULT;
+
+	// xstate_bv stays zero, every component starts in its init state
+	if (fp_ctx_type == FP_XSAVES)
+		*(uint64_t *)((uintptr_t)ptr + XSAVE_HEADER + 8) =
+			XCOMP_BV_COMPACT | xfeatures;
+}
+
 void fpu_init()
 {
 	uint32_t eax, ebx, ecx, edx;
@@ -60,13 +105,20 @@ void fpu_init()
 	if (ecx & (1 << 26)) {
 		local_fpu_enable(true);
 
-		cpuid(0xd, 0, &eax, &ebx, &ecx, &edx);
-		fpstate_cache = kmem_cache_create("fpu_state", ebx, 64, NULL,
-						  NULL, NULL, NULL, NULL,
-						  KM_SLEEP);
+		cpuid(0xd, 1, &eax, &ebx, &ecx, &edx);
+		if (eax & (1 << 3)) {
+			// compacted, sized for what xcr0 | xss enable
+			fp_ctx_type = FP_XSAVES;
+			fpstate_size = ebx;
+		} else {
+			fp_ctx_type = (eax & (1 << 0)) ? FP_XSAVEOPT : FP_XSAVE;
+			cpuid(0xd, 0, &eax, &ebx, &ecx, &edx);
+			fpstate_size = ebx;
+		}
 
-		fpstate_size = ebx;
-		fp_ctx_type = FP_XSAVE;
+		fpstate_cache = kmem_cache_create("fpu_state", fpstate_size, 64,
+						  NULL, NULL, NULL, NULL, NULL,
+						  KM_SLEEP);
 	} else {
 		local_fpu_enable(false);
 
@@ -76,52 +128,160 @@ void fpu_init()
 		fpstate_size = 512;
 		fp_ctx_type = FP_FXSAVE;
 	}
+
+	fpu_init_state = kmem_cache_alloc(fpstate_cache, KM_SLEEP);
+	fpu_state_init(fpu_init_state);
 }
 
 INIT_ENTAILS(x86_fpu_setup, bsp_ready);
 INIT_DEPS(x86_fpu_setup, heap_ready_stage);
 INIT_NODE(x86_fpu_setup, fpu_init);
 
-void *fpu_alloc()
+static void *fpu_alloc()
 {
 	void *ptr = kmem_cache_alloc(fpstate_cache, KM_SLEEP);
-	memset(ptr, 0, fpstate_size);
-	if (fp_ctx_type == FP_XSAVE) {
-		fpu_save(ptr);
-	}
+	if (ptr)
+		fpu_state_init(ptr);
 	return ptr;
 }
 
-size_t fpu_statesize()
-{
-	return fpstate_size;
-}
-
 void fpu_free(void *ptr)
 {
 	kmem_cache_free(fpstate_cache, ptr);
 }
 
-void fpu_save(void *ptr)
+// xsaveopt and xsaves skip what is in its init state or wasn't modified
+// since the last restore from the same area
+static void fpu_save(void *ptr)
 {
+	uint32_t lo = (uint32_t)xfeatures, hi = (uint32_t)(xfeatures >> 32);
+
 	switch (fp_ctx_type) {
 	case FP_FXSAVE:
-		asm volatile("fxsaveq (%0)" ::"r"(ptr));
+		asm volatile("fxsaveq (%0)" ::"r"(ptr) : "memory");
 		break;
 	case FP_XSAVE:
-		asm volatile("xsaveq (%0)" ::"r"(ptr), "a"(-1), "d"(-1));
+		asm volatile("xsaveq (%0)" ::"r"(ptr), "a"(lo), "d"(hi)
+			     : "memory");
+		break;
+	case FP_XSAVEOPT:
+		asm volatile("xsaveoptq (%0)" ::"r"(ptr), "a"(lo), "d"(hi)
+			     : "memory");
+		break;
+	case FP_XSAVES:
+		asm volatile("xsavesq (%0)" ::"r"(ptr), "a"(lo), "d"(hi)
+			     : "memory");
 		break;
 	}
 }
 
-void fpu_restore(void *ptr)
+static void fpu_restore(void *ptr)
 {
+	uint32_t lo = (uint32_t)xfeatures, hi = (uint32_t)(xfeatures >> 32);
+
 	switch (fp_ctx_type) {
 	case FP_FXSAVE:
-		asm volatile("fxrstorq (%0)" ::"r"(ptr));
+		asm volatile("fxrstorq (%0)" ::"r"(ptr) : "memory");
 		break;
 	case FP_XSAVE:
-		asm volatile("xrstorq (%0)" ::"r"(ptr), "a"(-1), "d"(-1));
+	case FP_XSAVEOPT:
+		asm volatile("xrstorq (%0)" ::"r"(ptr), "a"(lo), "d"(hi)
+			     : "memory");
+		break;
+	case FP_XSAVES:
+		asm volatile("xrstorsq (%0)" ::"r"(ptr), "a"(lo), "d"(hi)
+			     : "memory");
 		break;
 	}
 }
+
+static inline void clts()
+{
+	asm volatile("clts");
+}
+
+static inline void stts()
+{
+	write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_load(struct kthread *thread)
+{
+	clts();
+	fpu_restore(thread->pcb.fp_state);
+	thread->pcb.fpu_live = true;
+	curcpu().md.fpu_dirty = true;
+}
+
+/*
+ * Only threads that used the fpu since they were switched in get saved.
+ * Everybody else runs with TS set and traps on first use, after the
+ * registers were reset so they can't even speculatively see the last
+ * owner's state.
+ */
+void fpu_switch(struct kthread *current, struct kthread *thread)
+{
+	if (current->user_thread && current->pcb.fpu_live) {
+		fpu_save(current->pcb.fp_state);
+		current->pcb.fpu_live = false;
+	}
+
+	// kernel threads never touch the fpu
+	if (!thread->user_thread)
+		return;
+
+	if (thread->pcb.fpu_eager > 0) {
+		thread->pcb.fpu_eager--;
+		fpu_load(thread);
+		return;
+	}
+
+	if (curcpu().md.fpu_dirty) {
+		clts();
+		fpu_restore(fpu_init_state);
+		curcpu().md.fpu_dirty = false;
+	}
+	stts();
+}
+
+// #NM from userspace
+void fpu_trap()
+{
+	struct kthread *thread = curthread();
+	assert(thread->user_thread);
+
+	// may sleep, so before anything is loaded
+	if (!thread->pcb.fp_state) {
+		thread->pcb.fp_state = fpu_alloc();
+		if (!thread->pcb.fp_state)
+			panic("no memory for fpu state\n");
+	}
+
+	ipl_t ipl = ripl(IPL_DPC);
+	fpu_load(thread);
+	thread->pcb.fpu_eager = FPU_EAGER_SWITCHES;
+	xipl(ipl);
+}
+
+// the state in memory is stale while the thread's registers are live
+void fpu_sync(const struct kthread *thread)
+{
+	ipl_t ipl = ripl(IPL_DPC);
+	if (thread == curthread() && thread->pcb.fpu_live)
+		fpu_save(thread->pcb.fp_state);
+	xipl(ipl);
+}
+
+void fpu_copy(const struct kthread *source, struct kthread *dest)
+{
+	dest->pcb.fpu_live = false;
+	dest->pcb.fpu_eager = 0;
+	dest->pcb.fp_state = NULL;
+
+	if (!source->pcb.fp_state)
+		return;
+
+	dest->pcb.fp_state = fpu_alloc();
+	if (dest->pcb.fp_state)
+		memcpy(dest->pcb.fp_state, source->pcb.fp_state, fpstate_size);
+}
@@ -2,10 +2,16 @@
 
 #include <stddef.h>
 
+struct kthread;
+
 void fpu_init();
 void fpu_ap_init();
-void *fpu_alloc();
-size_t fpu_statesize();
 void fpu_free(void *ptr);
-void fpu_save(void *ptr);
-void fpu_restore(void *ptr);
+
+// save the outgoing thread if it used the fpu, prepare the incoming one
+void fpu_switch(struct kthread *current, struct kthread *thread);
+// first fpu use since the thread was switched in
+void fpu_trap();
+// write back the live state of the current thread
+void fpu_sync(const struct kthread *thread);
+void fpu_copy(const struct kthread *source, struct kthread *dest);
@@ -0,0 +1,102 @@
+#define pr_fmt(fmt) "idle: " fmt
+
+#include <stdint.h>
+#include <yak/arch-cpu.h>
+#include <yak/cpudata.h>
+#include <yak/idle.h>
+#include <yak/log.h>
+#include <yak/timer.h>
+
+#include "asm.h"
+
+// below this we don't bother with anything deeper than C1
+#define IDLE_DEEP_MIN USTIME(500)
+
+#define MWAIT_HINT_C1 0
+
+static bool have_mwait;
+static uint32_t deep_hint = MWAIT_HINT_C1;
+
+static inline void monitor(const void *addr)
+{
+	asm volatile("monitor" ::"a"(addr), "c"(0), "d"(0));
+}
+
+// sti shadows the mwait, so an interrupt can't slip in between
+static inline void sti_mwait(uint32_t hint)
+{
+	asm volatile("sti; mwait" ::"a"(hint), "c"(0) : "memory");
+}
+
+/*
+ * Without an always running apic timer (ARAT) the timer may stop in
+ * anything deeper than C1 and we'd miss our own deadline.
+ */
+void idle_init()
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	uint32_t max_leaf = eax;
+	if (max_leaf < 5)
+		return;
+
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	if (!(ecx & (1 << 3)))
+		return;
+
+	cpuid(5, 0, &eax, &ebx, &ecx, &edx);
+	// a zero line size means the leaf isn't really filled in
+	if ((eax & 0xffff) == 0)
+		return;
+
+	uint32_t cstates = edx;
+	have_mwait = true;
+
+	if (max_leaf < 6)
+		return;
+	cpuid(6, 0, &eax, &ebx, &ecx, &edx);
+	if (!(eax & (1 << 2)))
+		return;
+
+	// each nibble counts the sub states of C0..C7, take the deepest
+	for (int n = 7; n >= 1; n--) {
+		if ((cstates >> (n * 4)) & 0xf) {
+			deep_hint = (n - 1) << 4;
+			break;
+		}
+	}
+
+	if (curcpu().cpu_id == 0)
+		pr_info("mwait supported, deepest hint 0x%x\n", deep_hint);
+}
+
+bool plat_idle_watches()
+{
+	return have_mwait;
+}
+
+void plat_idle(struct cpu *cpu, nstime_t deadline)
+{
+	if (!have_mwait) {
+		if (idle_work_pending(cpu))
+			enable_interrupts();
+		else
+			asm volatile("sti; hlt");
+		return;
+	}
+
+	// arm first, a write after this ends the mwait straight away
+	monitor(&cpu->softint_pending);
+	if (idle_work_pending(cpu)) {
+		enable_interrupts();
+		return;
+	}
+
+	nstime_t now = plat_getnanos();
+	uint32_t hint = MWAIT_HINT_C1;
+	if (deadline > now && deadline - now >= IDLE_DEEP_MIN)
+		hint = deep_hint;
+
+	sti_mwait(hint);
+}
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <yak/acct.h>
 #include <yak/init.h>
 #include <yak/arch-context.h>
 #include <yak/arch-cpu.h>
@@ -86,16 +87,19 @@ extern char __init_stack_top[];
 
 __no_san void plat_syscall_handler(struct syscall_frame *frame)
 {
+	acct_enter_kernel();
+
 	if (frame->rax >= MAX_SYSCALLS) {
 		pr_error("request syscall >= MAX_SYSCALLS\n");
-		return;
+	} else {
+		struct syscall_result res = syscall_table[frame->rax](
+			frame, frame->rdi, frame->rsi, frame->rdx, frame->r10,
+			frame->r8, frame->r9);
+		frame->rax = res.retval;
+		frame->rdx = res.errno;
 	}
 
-	struct syscall_result res = syscall_table[frame->rax](
-		frame, frame->rdi, frame->rsi, frame->rdx, frame->r10,
-		frame->r8, frame->r9);
-	frame->rax = res.retval;
-	frame->rdx = res.errno;
+	acct_return_user();
 }
 
 // XXX: move this to a seperate .S file!
@@ -209,8 +213,14 @@ static void setup_syscall_msrs()
 	wrmsr(MSR_STAR, star);
 }
 
+void topology_init();
+void idle_init();
+
 static void setup_cpu()
 {
+	topology_init();
+	idle_init();
+
 	setup_syscall_msrs();
 
 	// load the global idt
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <yak/acct.h>
 #include <yak/log.h>
 #include <yak/arch-cpu.h>
 #include <yak/ipl.h>
@@ -10,6 +11,7 @@
 #include "gdt.h"
 #include "apic.h"
 #include "asm.h"
+#include "fpu.h"
 
 struct [[gnu::packed]] idt_entry {
 	uint16_t isr_low;
@@ -141,6 +143,7 @@ void __isr_c_entry(struct context *frame)
 	if (frame->number >= 0 && frame->number <= 31) {
 		if (frame->number == 14) {
 			uintptr_t address = read_cr2();
+			bool from_user = (frame->cs & 3) != 0;
 
 			unsigned long flags = 0;
 
@@ -153,9 +156,15 @@ void __isr_c_entry(struct context *frame)
 				flags |= VM_FAULT_READ;
 			}
 
+			if (from_user)
+				acct_enter_kernel();
+
 			status_t status = vm_handle_fault(curcpu().current_map,
 							  address, flags);
 
+			if (from_user)
+				acct_return_user();
+
 			IF_OK(status) return;
 
 			pr_error("#PF handling failed with status '%s'\n",
@@ -167,6 +176,12 @@ void __isr_c_entry(struct context *frame)
 			if (curthread()->user_thread || curthread()->vm_ctx) {
 				sched_exit_self();
 			}
+		} else if (frame->number == 7 && (frame->cs & 3)) {
+			// #NM, the thread's first fpu use since it was switched in
+			acct_enter_kernel();
+			fpu_trap();
+			acct_return_user();
+			return;
 		} else {
 			pr_error("fault 0x%lx received\n", frame->number);
 		}
@@ -175,6 +190,7 @@ void __isr_c_entry(struct context *frame)
 		hcf();
 	} else {
 		ipl_t ipl = ripl(frame->number >> 4);
+		acct_irq_enter();
 		irq_vec_t vec = frame->number - 32;
 		struct irq_slot *sl = &slots[vec];
 
@@ -189,6 +205,7 @@ void __isr_c_entry(struct context *frame)
 			lapic_eoi();
 		}
 
+		acct_irq_exit();
 		xipl(ipl);
 	}
 }
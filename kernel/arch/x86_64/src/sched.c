@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <string.h>
+#include <yak/acct.h>
 #include <yak/cpudata.h>
 #include <yak/sched.h>
 #include <yak/heap.h>
@@ -17,12 +18,24 @@ void kthread_context_copy(const struct kthread *source_thread,
 {
 	memcpy(&dest_thread->pcb, &source_thread->pcb, sizeof(struct md_pcb));
 	if (source_thread->user_thread) {
-		dest_thread->pcb.fp_state = fpu_alloc();
-		memcpy(dest_thread->pcb.fp_state, source_thread->pcb.fp_state,
-		       fpu_statesize());
+		fpu_sync(source_thread);
+		fpu_copy(source_thread, dest_thread);
 	}
 }
 
+void kthread_context_destroy(struct kthread *thread)
+{
+	if (thread->pcb.fp_state) {
+		fpu_free(thread->pcb.fp_state);
+		thread->pcb.fp_state = NULL;
+	}
+}
+
+void kthread_set_tls(struct kthread *thread, uintptr_t tls)
+{
+	thread->pcb.fsbase = tls;
+}
+
 void kthread_context_init(struct kthread *thread, void *kstack_top,
 			  void *entrypoint, void *context1, void *context2)
 {
@@ -40,15 +53,17 @@ void kthread_context_init(struct kthread *thread, void *kstack_top,
 	thread->pcb.fsbase = 0;
 	thread->pcb.gsbase = 0;
 
-	if (thread->user_thread) {
-		thread->pcb.fp_state = fpu_alloc();
-	}
+	// user threads get theirs on first use
+	thread->pcb.fp_state = NULL;
+	thread->pcb.fpu_live = false;
+	thread->pcb.fpu_eager = 0;
 }
 
 [[gnu::noreturn]]
 void kernel_enter_userspace(uint64_t ip, uint64_t sp)
 {
 	pr_debug("enter userspace: 0x%lx rsp: 0x%lx\n", ip, sp);
+	acct_return_user();
 
 	uint64_t frame[5];
 	frame[0] = ip;
@@ -87,18 +102,12 @@ extern void asm_swtch(struct kthread *current, struct kthread *new);
 __no_prof __no_san void plat_swtch(struct kthread *current,
 				   struct kthread *thread)
 {
-	if (current->user_thread) {
-		assert(current->pcb.fp_state);
-		fpu_save(current->pcb.fp_state);
-	}
+	fpu_switch(current, thread);
 
 	if (thread->user_thread) {
 		t_tss.rsp0 = (uint64_t)thread->kstack_top;
 		wrmsr(MSR_FSBASE, thread->pcb.fsbase);
 		wrmsr(MSR_KERNEL_GSBASE, thread->pcb.gsbase);
-
-		assert(thread->pcb.fp_state);
-		fpu_restore(thread->pcb.fp_state);
 	} else {
 		wrmsr(MSR_FSBASE, 0);
 	}
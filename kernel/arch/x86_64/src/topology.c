@@ -0,0 +1,99 @@
+#define pr_fmt(fmt) "topology: " fmt
+
+#include <stdint.h>
+#include <yak/cpudata.h>
+#include <yak/log.h>
+
+#include "asm.h"
+
+#define CPUID_VENDOR_AMD 0x68747541 // "Auth"
+
+#define CACHE_TYPE_NULL 0
+
+// bits needed to number n things
+static uint32_t count_order(uint32_t n)
+{
+	return n <= 1 ? 0 : 32 - __builtin_clz(n - 1);
+}
+
+/*
+ * Leaf 0xb gives the full x2apic id and how many of its low bits select
+ * the thread within a core. Older parts only have the 8 bit initial id.
+ */
+static uint32_t read_apic_id(uint32_t max_leaf, uint32_t *smt_shift)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	*smt_shift = 0;
+
+	if (max_leaf >= 0xb) {
+		cpuid(0xb, 0, &eax, &ebx, &ecx, &edx);
+		// subleaf 0 is the smt level whenever the leaf is implemented
+		if (ebx != 0 && ((ecx >> 8) & 0xff) == 1) {
+			*smt_shift = eax & 0x1f;
+			return edx;
+		}
+	}
+
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	return ebx >> 24;
+}
+
+// how many logical cpus share the outermost cache, 0 if we can't tell
+static uint32_t llc_sharing(uint32_t max_leaf, bool amd)
+{
+	uint32_t eax, ebx, ecx, edx;
+	uint32_t leaf = 4;
+
+	if (amd) {
+		cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+		if (eax < 0x8000001d)
+			return 0;
+		cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+		if (!(ecx & (1 << 22))) // topology extensions
+			return 0;
+		leaf = 0x8000001d;
+	} else if (max_leaf < 4) {
+		return 0;
+	}
+
+	uint32_t best_level = 0, sharing = 0;
+	for (int i = 0;; i++) {
+		cpuid(leaf, i, &eax, &ebx, &ecx, &edx);
+		if ((eax & 0x1f) == CACHE_TYPE_NULL)
+			break;
+
+		uint32_t level = (eax >> 5) & 0x7;
+		if (level >= best_level) {
+			best_level = level;
+			sharing = ((eax >> 14) & 0xfff) + 1;
+		}
+	}
+
+	return sharing;
+}
+
+void topology_init()
+{
+	struct cpu *cpu = curcpu_ptr();
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	uint32_t max_leaf = eax;
+	bool amd = ebx == CPUID_VENDOR_AMD;
+
+	uint32_t smt_shift;
+	uint32_t apic_id = read_apic_id(max_leaf, &smt_shift);
+
+	cpu->core_id = apic_id >> smt_shift;
+
+	uint32_t sharing = llc_sharing(max_leaf, amd);
+	// without cache info, assume nothing beyond the core is shared
+	if (sharing)
+		cpu->llc_id = apic_id >> count_order(sharing);
+	else
+		cpu->llc_id = cpu->core_id;
+
+	pr_debug("cpu%zu: apic %u core %u llc %u\n", cpu->cpu_id, apic_id,
+		 cpu->core_id, cpu->llc_id);
+}
@@ -5,6 +5,7 @@
 #include <yak/fs/devfs.h>
 #include <yak/queue.h>
 #include <yak/hashtable.h>
+#include <yak/tree.h>
 #include <yak/fs/vfs.h>
 #include <yak/macro.h>
 #include <yak/status.h>
@@ -18,19 +19,41 @@
 #include <string.h>
 #include <stddef.h>
 
+struct devfs_node;
+RBT_HEAD(devfs_dir_tree, devfs_node);
+
 struct devfs_node {
 	struct vnode vnode;
 	char *name;
 	size_t name_len;
 
+	// position in the parent directory, stable d_off for getdents
+	off_t cookie;
+	RBT_ENTRY(devfs_node) dir_entry;
+
 	size_t inode;
 	size_t major, minor;
 
 	struct device_ops *dev_ops;
 
 	struct hashtable children;
+	// children ordered by cookie
+	struct devfs_dir_tree dir_tree;
+	off_t next_cookie;
 };
 
+static int devfs_dir_cmp(const struct devfs_node *a, const struct devfs_node *b)
+{
+	if (a->cookie < b->cookie)
+		return -1;
+	if (a->cookie > b->cookie)
+		return 1;
+	return 0;
+}
+
+RBT_PROTOTYPE(devfs_dir_tree, devfs_node, dir_entry, devfs_dir_cmp);
+RBT_GENERATE(devfs_dir_tree, devfs_node, dir_entry, devfs_dir_cmp);
+
 struct devfs {
 	struct vfs vfs;
 
@@ -87,12 +110,17 @@ static status_t devfs_create(struct vnode *parent, enum vtype type, char *name,
 	node->name = strndup(name, node->name_len);
 
 	status_t ret;
-	IF_ERR((ret = ht_set(&parent_node->children, name, name_len, node, 0)))
+	ret = ht_set_seq(&parent_node->children, name, name_len, node,
+			 &parent->seq);
+	IF_ERR(ret)
 	{
 		vnode_deref(parent);
 		return ret;
 	};
 
+	node->cookie = parent_node->next_cookie++;
+	RBT_INSERT(devfs_dir_tree, &parent_node->dir_tree, node);
+
 	*out = &node->vnode;
 	return YAK_SUCCESS;
 }
@@ -104,7 +132,8 @@ static status_t devfs_symlink(struct vnode *parent, char *name, char *path,
 }
 
 static status_t devfs_getdents(struct vnode *vn, struct dirent *buf,
-			       size_t bufsize, size_t *bytes_read)
+			       size_t bufsize, off_t *offset,
+			       size_t *bytes_read)
 {
 	if (vn->type != VDIR) {
 		return YAK_NODIR;
@@ -116,12 +145,13 @@ static status_t devfs_getdents(struct vnode *vn, struct dirent *buf,
 	size_t remaining = bufsize;
 	size_t written = 0;
 
-	struct ht_entry *elm;
-	HASHTABLE_FOR_EACH(&tvn->children, elm)
-	{
-		struct devfs_node *child = elm->value;
-		const char *name = elm->key;
-		size_t namelen = elm->key_len + 1;
+	// resume after the last returned cookie
+	struct devfs_node key = { .cookie = *offset + 1 };
+	struct devfs_node *child =
+		RBT_NFIND(devfs_dir_tree, &tvn->dir_tree, &key);
+
+	for (; child; child = RBT_NEXT(devfs_dir_tree, child)) {
+		size_t namelen = child->name_len + 1;
 		size_t reclen = offsetof(struct dirent, d_name) + namelen;
 		reclen = ALIGN_UP(reclen, sizeof(long));
 
@@ -131,16 +161,23 @@ static status_t devfs_getdents(struct vnode *vn, struct dirent *buf,
 
 		struct dirent *d = (struct dirent *)outp;
 		d->d_ino = child->inode;
-		d->d_off = 0; // ?
+		d->d_off = child->cookie;
 		d->d_reclen = (unsigned short)reclen;
 		d->d_type = child->vnode.type; // DT_* = V*
-		memcpy(d->d_name, name, namelen);
+		memcpy(d->d_name, child->name, child->name_len);
+		d->d_name[child->name_len] = '\0';
 
 		outp += reclen;
 		remaining -= reclen;
 		written += reclen;
+
+		*offset = child->cookie;
 	}
 
+	// the buffer can't hold a single entry
+	if (written == 0 && child != NULL)
+		return YAK_INVALID_ARGS;
+
 	*bytes_read = written;
 
 	return YAK_SUCCESS;
@@ -161,6 +198,22 @@ static status_t devfs_lookup(struct vnode *vn, char *name, struct vnode **out)
 	return YAK_SUCCESS;
 }
 
+static status_t devfs_lookup_rcu(struct vnode *vn, const char *name,
+				struct vnode **out)
+{
+	if (vn->type != VDIR) {
+		return YAK_NODIR;
+	}
+
+	struct devfs_node *elm = ht_get_rcu(&((struct devfs_node *)vn)->children,
+					    name, strlen(name));
+	if (!elm)
+		return YAK_NOENT;
+
+	*out = &elm->vnode;
+	return YAK_SUCCESS;
+}
+
 static status_t devfs_lock(struct vnode *vn)
 {
 	kmutex_acquire(&vn->lock, TIMEOUT_INFINITE);
@@ -211,6 +264,7 @@ static status_t devfs_ioctl(struct vnode *vn, unsigned long com, void *data)
 
 static struct vn_ops devfs_vn_op = {
 	.vn_lookup = devfs_lookup,
+	.vn_lookup_rcu = devfs_lookup_rcu,
 	.vn_create = devfs_create,
 	.vn_lock = devfs_lock,
 	.vn_unlock = devfs_unlock,
@@ -224,7 +278,8 @@ static struct vn_ops devfs_vn_op = {
 	.vn_ioctl = devfs_ioctl,
 };
 
-static status_t devfs_mount(struct vnode *vn);
+static status_t devfs_mount(struct vnode *vn, const char *source,
+			   struct vfs **out);
 
 static struct vfs_ops devfs_op = {
 	.vfs_mount = devfs_mount,
@@ -242,11 +297,13 @@ INIT_NODE(devfs, devfs_init);
 
 static struct devfs *shared_devfs = NULL;
 
-static status_t devfs_mount(struct vnode *vn)
+static status_t devfs_mount(struct vnode *vn,
+			   [[maybe_unused]] const char *source,
+			   struct vfs **out)
 {
 	if (shared_devfs) {
 		vnode_ref(vn);
-		vn->mountedvfs = &shared_devfs->vfs;
+		*out = &shared_devfs->vfs;
 		return YAK_SUCCESS;
 	}
 
@@ -256,9 +313,12 @@ static status_t devfs_mount(struct vnode *vn)
 	shared_devfs->vfs.ops = &devfs_op;
 	shared_devfs->vfs.vnodecovered = vn;
 
+	// create the root now: getroot must not allocate during rcu walks
+	devfs_getroot(&shared_devfs->vfs);
+
 	vnode_ref(vn);
 
-	vn->mountedvfs = &shared_devfs->vfs;
+	*out = &shared_devfs->vfs;
 	return YAK_SUCCESS;
 }
 
@@ -273,6 +333,9 @@ static struct devfs_node *create_node(struct vfs *vfs, enum vtype type,
 
 	if (type == VDIR) {
 		ht_init(&node->children, ht_hash_str, ht_eq_str);
+		RBT_INIT(devfs_dir_tree, &node->dir_tree);
+		// 0 is the start of the directory
+		node->next_cookie = 1;
 	} else {
 		node->vnode.filesize = 0;
 
@@ -294,8 +357,11 @@ status_t devfs_register(char *name, int type, int major, int minor,
 			struct device_ops *ops, struct vnode **out)
 {
 	assert(shared_devfs);
-	struct vnode *vn = devfs_getroot(&shared_devfs->vfs);
-	EXPECT(VOP_CREATE(vn, type, name, &vn));
+	struct vnode *root = devfs_getroot(&shared_devfs->vfs), *vn;
+	VOP_LOCK(root);
+	status_t res = VOP_CREATE(root, type, name, &vn);
+	VOP_UNLOCK(root);
+	EXPECT(res);
 	struct devfs_node *dnode = (struct devfs_node *)vn;
 	dnode->major = major;
 	dnode->minor = minor;
@@ -306,7 +372,7 @@ status_t devfs_register(char *name, int type, int major, int minor,
 
 void devfs_fs_mount()
 {
-	EXPECT(vfs_mount("/dev", "devfs"));
+	EXPECT(vfs_mount("/dev", "devfs", NULL));
 }
 
 INIT_ENTAILS(fs_devfs_mount);
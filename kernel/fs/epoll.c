@@ -0,0 +1,425 @@
+#define pr_fmt(fmt) "epoll: " fmt
+
+#include <assert.h>
+#include <yak/file.h>
+#include <yak/heap.h>
+#include <yak/init.h>
+#include <yak/kevent.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/mutex.h>
+#include <yak/poll.h>
+#include <yak/queue.h>
+#include <yak/spinlock.h>
+#include <yak/status.h>
+#include <yak/timer.h>
+#include <yak/tree.h>
+#include <yak/fs/epoll.h>
+#include <yak/fs/vfs.h>
+
+// the part of the event mask vn_poll understands
+#define EP_POLL_MASK 0xffffU
+
+struct epitem;
+
+RBT_HEAD(epitem_tree, epitem);
+
+struct eventpoll {
+	struct vnode vnode;
+
+	// the interest set, also held while harvesting the ready list
+	struct kmutex lock;
+	struct epitem_tree items;
+
+	// items whose pollhead fired since they were last looked at
+	struct spinlock rdlock;
+	TAILQ_HEAD(, epitem) rdlist;
+	size_t nready;
+
+	struct kevent ev;
+
+	// watchers of the epoll fd itself
+	struct pollhead ph;
+};
+
+struct epitem {
+	struct eventpoll *ep;
+
+	// not referenced, the item goes away with the open file
+	struct file *file;
+	int fd;
+
+	uint32_t events;
+	uint64_t data;
+
+	// on the ready list, under rdlock
+	bool ready;
+
+	struct poll_entry pe;
+
+	RBT_ENTRY(epitem) tree_entry;
+	TAILQ_ENTRY(epitem) rd_entry;
+	LIST_ENTRY(epitem) file_entry;
+};
+
+static int epitem_cmp(const struct epitem *a, const struct epitem *b)
+{
+	if (a->file != b->file)
+		return a->file < b->file ? -1 : 1;
+	if (a->fd != b->fd)
+		return a->fd < b->fd ? -1 : 1;
+	return 0;
+}
+
+RBT_PROTOTYPE(epitem_tree, epitem, tree_entry, epitem_cmp);
+RBT_GENERATE(epitem_tree, epitem, tree_entry, epitem_cmp);
+
+/*
+ * Serializes adding and removing items against open files going away.
+ * Taken before any eventpoll's lock.
+ */
+static struct kmutex epmutex;
+
+static struct vn_ops ep_vn_op;
+
+static void ep_queue(struct eventpoll *ep, struct epitem *epi)
+{
+	ipl_t ipl = spinlock_lock(&ep->rdlock);
+	bool queued = !epi->ready;
+	if (queued) {
+		epi->ready = true;
+		TAILQ_INSERT_TAIL(&ep->rdlist, epi, rd_entry);
+		ep->nready++;
+	}
+	spinlock_unlock(&ep->rdlock, ipl);
+
+	// already queued items will be seen by whoever was woken for them
+	if (queued) {
+		event_alarm(&ep->ev);
+		pollhead_notify(&ep->ph, POLLIN | POLLRDNORM);
+	}
+}
+
+static void ep_notify(struct poll_entry *pe, [[maybe_unused]] short revents)
+{
+	struct epitem *epi = container_of(pe, struct epitem, pe);
+
+	// disabled after a oneshot event
+	if (!(__atomic_load_n(&epi->events, __ATOMIC_RELAXED) & EP_POLL_MASK))
+		return;
+
+	ep_queue(epi->ep, epi);
+}
+
+static uint32_t ep_item_poll(struct epitem *epi, struct poll_entry *pe)
+{
+	uint32_t events = epi->events & EP_POLL_MASK;
+	uint16_t revents = vfs_poll(epi->file->vnode, events, pe);
+	return revents & events;
+}
+
+static void ep_set_events(struct epitem *epi, uint32_t events)
+{
+	__atomic_store_n(&epi->events, events, __ATOMIC_RELAXED);
+	__atomic_store_n(&epi->pe.events, (short)(events & EP_POLL_MASK),
+			 __ATOMIC_RELAXED);
+}
+
+static status_t ep_insert(struct eventpoll *ep, struct file *file, int fd,
+			  const struct epoll_event *event)
+{
+	struct epitem *epi = kzalloc(sizeof(struct epitem));
+	if (!epi)
+		return YAK_OOM;
+
+	epi->ep = ep;
+	epi->file = file;
+	epi->fd = fd;
+	epi->events = event->events | EPOLLERR | EPOLLHUP;
+	epi->data = event->data.u64;
+	epi->ready = false;
+	poll_entry_init(&epi->pe, epi->events & EP_POLL_MASK, ep_notify);
+
+	RBT_INSERT(epitem_tree, &ep->items, epi);
+	LIST_INSERT_HEAD(&file->epitems, epi, file_entry);
+
+	// attach, and queue right away if it's ready already
+	if (ep_item_poll(epi, &epi->pe))
+		ep_queue(ep, epi);
+
+	return YAK_SUCCESS;
+}
+
+static void ep_modify(struct eventpoll *ep, struct epitem *epi,
+		      const struct epoll_event *event)
+{
+	pollhead_detach(&epi->pe);
+
+	ep_set_events(epi, event->events | EPOLLERR | EPOLLHUP);
+	epi->data = event->data.u64;
+
+	if (ep_item_poll(epi, &epi->pe))
+		ep_queue(ep, epi);
+}
+
+// with epmutex and ep->lock held
+static void ep_remove(struct eventpoll *ep, struct epitem *epi)
+{
+	// no notification can queue it again after this
+	pollhead_detach(&epi->pe);
+
+	ipl_t ipl = spinlock_lock(&ep->rdlock);
+	if (epi->ready) {
+		TAILQ_REMOVE(&ep->rdlist, epi, rd_entry);
+		ep->nready--;
+	}
+	spinlock_unlock(&ep->rdlock, ipl);
+
+	RBT_REMOVE(epitem_tree, &ep->items, epi);
+	LIST_REMOVE(epi, file_entry);
+	kfree(epi, sizeof(struct epitem));
+}
+
+/*
+ * Look at the items on the ready list once each. Items are taken off
+ * one at a time, so a notification while we poll one requeues it.
+ * Level triggered items that are still ready go back to the tail.
+ */
+static int ep_harvest(struct eventpoll *ep, struct epoll_event *events,
+		      int maxevents)
+{
+	int n = 0;
+
+	ipl_t ipl = spinlock_lock(&ep->rdlock);
+	size_t todo = ep->nready;
+
+	while (n < maxevents && todo-- > 0) {
+		struct epitem *epi = TAILQ_FIRST(&ep->rdlist);
+		if (!epi)
+			break;
+
+		TAILQ_REMOVE(&ep->rdlist, epi, rd_entry);
+		epi->ready = false;
+		ep->nready--;
+		spinlock_unlock(&ep->rdlock, ipl);
+
+		bool requeue = false;
+		uint32_t revents = ep_item_poll(epi, NULL);
+		if (revents) {
+			events[n].events = revents;
+			events[n].data.u64 = epi->data;
+			n++;
+
+			if (epi->events & EPOLLONESHOT)
+				ep_set_events(epi, epi->events & ~EP_POLL_MASK);
+			else if (!(epi->events & EPOLLET))
+				requeue = true;
+		}
+
+		ipl = spinlock_lock(&ep->rdlock);
+		if (requeue && !epi->ready) {
+			epi->ready = true;
+			TAILQ_INSERT_TAIL(&ep->rdlist, epi, rd_entry);
+			ep->nready++;
+		}
+	}
+
+	spinlock_unlock(&ep->rdlock, ipl);
+	return n;
+}
+
+status_t epoll_ctl(struct vnode *vn, int op, struct file *file, int fd,
+		   const struct epoll_event *event)
+{
+	struct eventpoll *ep = (struct eventpoll *)vn;
+
+	// epolls watching each other could notify in circles
+	if (vn_is_epoll(file->vnode))
+		return YAK_INVALID_ARGS;
+
+	struct epitem key = { .file = file, .fd = fd };
+
+	if (op == EPOLL_CTL_MOD) {
+		// the caller's file reference keeps the item from going away
+		guard(mutex)(&ep->lock);
+		struct epitem *epi = RBT_FIND(epitem_tree, &ep->items, &key);
+		if (!epi)
+			return YAK_NOENT;
+		ep_modify(ep, epi, event);
+		return YAK_SUCCESS;
+	}
+
+	guard(mutex)(&epmutex);
+	guard(mutex)(&ep->lock);
+
+	struct epitem *epi = RBT_FIND(epitem_tree, &ep->items, &key);
+
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		if (epi)
+			return YAK_EXISTS;
+		return ep_insert(ep, file, fd, event);
+	case EPOLL_CTL_DEL:
+		if (!epi)
+			return YAK_NOENT;
+		ep_remove(ep, epi);
+		return YAK_SUCCESS;
+	}
+
+	return YAK_INVALID_ARGS;
+}
+
+status_t epoll_wait(struct vnode *vn, struct epoll_event *events,
+		    int maxevents, nstime_t timeout, int *nready)
+{
+	struct eventpoll *ep = (struct eventpoll *)vn;
+
+	nstime_t deadline = TIMER_INFINITE;
+	if (timeout != TIMER_INFINITE)
+		deadline = plat_getnanos() + timeout;
+
+	for (;;) {
+		kmutex_acquire(&ep->lock, TIMEOUT_INFINITE);
+		int n = ep_harvest(ep, events, maxevents);
+		kmutex_release(&ep->lock);
+
+		if (n || timeout == 0) {
+			*nready = n;
+			return YAK_SUCCESS;
+		}
+
+		if (poll_sleep(&ep->ev, deadline) == YAK_TIMEOUT) {
+			*nready = 0;
+			return YAK_SUCCESS;
+		}
+	}
+}
+
+void epoll_release_file(struct file *file)
+{
+	guard(mutex)(&epmutex);
+
+	struct epitem *epi;
+	while ((epi = LIST_FIRST(&file->epitems)) != NULL) {
+		struct eventpoll *ep = epi->ep;
+		kmutex_acquire(&ep->lock, TIMEOUT_INFINITE);
+		ep_remove(ep, epi);
+		kmutex_release(&ep->lock);
+	}
+}
+
+// level triggered items that stopped being ready may still be queued
+static short ep_poll(struct vnode *vn, short events, struct poll_entry *pe)
+{
+	struct eventpoll *ep = (struct eventpoll *)vn;
+
+	if (pe)
+		pollhead_attach(&ep->ph, pe);
+
+	ipl_t ipl = spinlock_lock(&ep->rdlock);
+	bool ready = !TAILQ_EMPTY(&ep->rdlist);
+	spinlock_unlock(&ep->rdlock, ipl);
+
+	return ready ? events & (POLLIN | POLLRDNORM) : 0;
+}
+
+static status_t ep_inactive(struct vnode *vn)
+{
+	struct eventpoll *ep = (struct eventpoll *)vn;
+
+	kmutex_acquire(&epmutex, TIMEOUT_INFINITE);
+	kmutex_acquire(&ep->lock, TIMEOUT_INFINITE);
+
+	struct epitem *epi, *tmp;
+	RBT_FOREACH_SAFE(epi, epitem_tree, &ep->items, tmp)
+	{
+		ep_remove(ep, epi);
+	}
+
+	kmutex_release(&ep->lock);
+	kmutex_release(&epmutex);
+
+	assert(LIST_EMPTY(&ep->ph.entries));
+	kfree(ep, sizeof(struct eventpoll));
+	return YAK_SUCCESS;
+}
+
+static status_t ep_read([[maybe_unused]] struct vnode *vn,
+			[[maybe_unused]] voff_t offset,
+			[[maybe_unused]] void *buf, [[maybe_unused]] size_t length,
+			[[maybe_unused]] size_t *read_bytes)
+{
+	return YAK_INVALID_ARGS;
+}
+
+static status_t ep_write([[maybe_unused]] struct vnode *vn,
+			 [[maybe_unused]] voff_t offset,
+			 [[maybe_unused]] const void *buf,
+			 [[maybe_unused]] size_t length,
+			 [[maybe_unused]] size_t *written_bytes)
+{
+	return YAK_INVALID_ARGS;
+}
+
+static status_t ep_lock(struct vnode *vn)
+{
+	kmutex_acquire(&vn->lock, TIMEOUT_INFINITE);
+	return YAK_SUCCESS;
+}
+
+static status_t ep_unlock(struct vnode *vn)
+{
+	kmutex_release(&vn->lock);
+	return YAK_SUCCESS;
+}
+
+static status_t ep_open([[maybe_unused]] struct vnode **vn)
+{
+	return YAK_SUCCESS;
+}
+
+static struct vn_ops ep_vn_op = {
+	.vn_lock = ep_lock,
+	.vn_unlock = ep_unlock,
+	.vn_inactive = ep_inactive,
+	.vn_read = ep_read,
+	.vn_write = ep_write,
+	.vn_open = ep_open,
+	.vn_poll = ep_poll,
+};
+
+bool vn_is_epoll(struct vnode *vn)
+{
+	return vn->ops == &ep_vn_op;
+}
+
+status_t epoll_create(struct vnode **out)
+{
+	struct eventpoll *ep = kzalloc(sizeof(struct eventpoll));
+	if (!ep)
+		return YAK_OOM;
+
+	kmutex_init(&ep->lock, "epoll");
+	RBT_INIT(epitem_tree, &ep->items);
+	spinlock_init(&ep->rdlock);
+	TAILQ_INIT(&ep->rdlist);
+	ep->nready = 0;
+	event_init(&ep->ev, 0);
+	pollhead_init(&ep->ph);
+
+	VOP_INIT(&ep->vnode, NULL, &ep_vn_op, VCHR);
+	ep->vnode.filesize = 0;
+	ep->vnode.vobj = NULL;
+
+	*out = &ep->vnode;
+	return YAK_SUCCESS;
+}
+
+void epoll_init()
+{
+	kmutex_init(&epmutex, "epmutex");
+}
+
+INIT_ENTAILS(epoll);
+INIT_DEPS(epoll, vfs_stage);
+INIT_NODE(epoll, epoll_init);
@@ -0,0 +1,1661 @@
+#define pr_fmt(fmt) "ext2: " fmt
+
+#include <assert.h>
+#include <string.h>
+#include <stddef.h>
+#include <yak/blk.h>
+#include <yak/cleanup.h>
+#include <yak/hashtable.h>
+#include <yak/heap.h>
+#include <yak/init.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/queue.h>
+#include <yak/sched.h>
+#include <yak/status.h>
+#include <yak/timer.h>
+#include <yak/types.h>
+#include <yak/fs/vfs.h>
+#include <yak/fs/ext2.h>
+#include <yak/vm/map.h>
+#include <yak/vm/page.h>
+#include <yak/vm/object.h>
+
+#define EXT2_SYNC_INTERVAL STIME(5)
+#define EXT2_READAHEAD 8
+#define EXT2_NAME_MAX 255
+// inline symlink targets live in i_block
+#define EXT2_FAST_LINK_MAX (EXT2_N_BLOCKS * sizeof(uint32_t))
+
+/* cached metadata block: bitmaps, inode tables and indirect blocks */
+struct ext2_buf {
+	uint32_t blk;
+	bool dirty;
+	char data[];
+};
+
+struct ext2_node;
+
+struct ext2_dentry {
+	uint32_t ino;
+	uint8_t file_type;
+	// set once the inode was looked up, read locklessly
+	struct ext2_node *node;
+};
+
+struct ext2_node {
+	struct vnode vnode;
+	// file data, backed by the pager below
+	struct vm_object obj;
+
+	struct ext2fs *fs;
+	uint32_t ino;
+
+	// protected by fs->lock
+	struct ext2_inode di;
+	bool di_dirty;
+	// blocks held back for data past rsv_end, see ext2_write_begin
+	uint32_t reserved;
+	size_t rsv_end;
+
+	// directories: name -> ext2_dentry, filled on first lookup
+	struct hashtable dcache;
+	bool dcache_loaded;
+
+	TAILQ_ENTRY(ext2_node) entry;
+};
+
+struct ext2fs {
+	struct vfs vfs;
+	struct blkdev *dev;
+
+	/*
+	 * Protects the buffer cache, allocation state and the on-disk
+	 * inodes. Taken after vnode and object locks, never before.
+	 */
+	struct kmutex lock;
+	struct kmutex sync_lock;
+
+	struct ext2_super_block sb;
+	struct ext2_group_desc *gd;
+	size_t gd_blocks;
+	bool sb_dirty;
+	// free blocks promised to written but not yet allocated data
+	uint32_t reserved;
+
+	uint32_t block_size, block_shift;
+	uint32_t ngroups;
+	uint32_t inode_size, first_ino;
+	bool readonly;
+	bool filetype;
+
+	struct hashtable bufs; // block number -> ext2_buf
+	struct hashtable inodes; // inode number -> ext2_node
+	// all nodes, in creation order; nodes live as long as the mount
+	TAILQ_HEAD(ext2_node_list, ext2_node) nodes;
+
+	struct ext2_node *root;
+};
+
+static struct vn_ops ext2_vn_op;
+static struct vfs_ops ext2_op;
+static struct vm_pagerops ext2_pagerops;
+
+static status_t ext2_iget(struct ext2fs *fs, uint32_t ino,
+			  struct ext2_node **out);
+
+static inline struct ext2_node *obj_to_node(struct vm_object *obj)
+{
+	return container_of(obj, struct ext2_node, obj);
+}
+
+/*
+ * Metadata buffers, fs->lock held.
+ * They are only loaded on first use, e.g. a group's block bitmap is read
+ * when the allocator first looks at that group.
+ */
+
+static status_t ext2_bread(struct ext2fs *fs, uint32_t blk,
+			   struct ext2_buf **out)
+{
+	struct ext2_buf *b = ht_get(&fs->bufs, &blk, sizeof(blk));
+	if (b) {
+		*out = b;
+		return YAK_SUCCESS;
+	}
+
+	if (blk == 0 || blk >= fs->sb.s_blocks_count) {
+		pr_warn("block %u out of range\n", blk);
+		return YAK_IO;
+	}
+
+	b = kmalloc(sizeof(struct ext2_buf) + fs->block_size);
+	if (!b)
+		return YAK_OOM;
+
+	size_t done;
+	status_t rv = blkdev_rw(fs->dev, BIO_READ, (voff_t)blk << fs->block_shift,
+				b->data, fs->block_size, &done);
+	if (IS_ERR(rv) || done != fs->block_size) {
+		kfree(b, sizeof(struct ext2_buf) + fs->block_size);
+		return IS_ERR(rv) ? rv : YAK_IO;
+	}
+
+	b->blk = blk;
+	b->dirty = false;
+
+	rv = ht_set(&fs->bufs, &blk, sizeof(blk), b, 0);
+	IF_ERR(rv)
+	{
+		kfree(b, sizeof(struct ext2_buf) + fs->block_size);
+		return rv;
+	}
+
+	*out = b;
+	return YAK_SUCCESS;
+}
+
+// buffer for a freshly allocated block, no need to read it
+static status_t ext2_bzero(struct ext2fs *fs, uint32_t blk,
+			   struct ext2_buf **out)
+{
+	struct ext2_buf *b = ht_get(&fs->bufs, &blk, sizeof(blk));
+	if (!b) {
+		b = kmalloc(sizeof(struct ext2_buf) + fs->block_size);
+		if (!b)
+			return YAK_OOM;
+		b->blk = blk;
+
+		status_t rv = ht_set(&fs->bufs, &blk, sizeof(blk), b, 0);
+		IF_ERR(rv)
+		{
+			kfree(b, sizeof(struct ext2_buf) + fs->block_size);
+			return rv;
+		}
+	}
+
+	memset(b->data, 0, fs->block_size);
+	b->dirty = true;
+	*out = b;
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_bflush(struct ext2fs *fs, struct ext2_buf *b)
+{
+	size_t done;
+	status_t rv = blkdev_rw(fs->dev, BIO_WRITE,
+				(voff_t)b->blk << fs->block_shift, b->data,
+				fs->block_size, &done);
+	IF_ERR(rv) return rv;
+	b->dirty = false;
+	return YAK_SUCCESS;
+}
+
+/* allocation, fs->lock held */
+
+static uint32_t group_nblocks(struct ext2fs *fs, uint32_t group)
+{
+	uint32_t start = fs->sb.s_first_data_block +
+			 group * fs->sb.s_blocks_per_group;
+	return MIN(fs->sb.s_blocks_per_group, fs->sb.s_blocks_count - start);
+}
+
+static uint32_t group_ninodes(struct ext2fs *fs, uint32_t group)
+{
+	uint32_t start = group * fs->sb.s_inodes_per_group;
+	return MIN(fs->sb.s_inodes_per_group, fs->sb.s_inodes_count - start);
+}
+
+// claim the first clear bit at or after min, -1 if there is none
+static long bitmap_claim(struct ext2_buf *b, uint32_t nbits, uint32_t min)
+{
+	uint8_t *map = (uint8_t *)b->data;
+
+	for (uint32_t i = min; i < nbits; i++) {
+		if (map[i / 8] == 0xFF) {
+			i |= 7;
+			continue;
+		}
+		if (!(map[i / 8] & (1 << (i % 8)))) {
+			map[i / 8] |= 1 << (i % 8);
+			b->dirty = true;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// rsv: the block was reserved earlier, otherwise reservations are kept
+static status_t ext2_alloc_block(struct ext2fs *fs, uint32_t goal, bool rsv,
+				 uint32_t *out)
+{
+	if (fs->sb.s_free_blocks_count <= (rsv ? 0 : fs->reserved))
+		return YAK_NOSPACE;
+
+	for (uint32_t n = 0; n < fs->ngroups; n++) {
+		uint32_t g = (goal + n) % fs->ngroups;
+		struct ext2_group_desc *gd = &fs->gd[g];
+		if (gd->bg_free_blocks_count == 0)
+			continue;
+
+		struct ext2_buf *b;
+		status_t rv = ext2_bread(fs, gd->bg_block_bitmap, &b);
+		IF_ERR(rv) return rv;
+
+		long bit = bitmap_claim(b, group_nblocks(fs, g), 0);
+		if (bit < 0) {
+			pr_warn("group %u: free count and bitmap disagree\n",
+				g);
+			continue;
+		}
+
+		gd->bg_free_blocks_count--;
+		fs->sb.s_free_blocks_count--;
+		fs->sb_dirty = true;
+
+		*out = fs->sb.s_first_data_block +
+		       g * fs->sb.s_blocks_per_group + bit;
+		return YAK_SUCCESS;
+	}
+
+	return YAK_NOSPACE;
+}
+
+static status_t ext2_alloc_inode(struct ext2fs *fs, uint32_t goal, bool dir,
+				 uint32_t *out)
+{
+	if (fs->sb.s_free_inodes_count == 0)
+		return YAK_NOSPACE;
+
+	for (uint32_t n = 0; n < fs->ngroups; n++) {
+		uint32_t g = (goal + n) % fs->ngroups;
+		struct ext2_group_desc *gd = &fs->gd[g];
+		if (gd->bg_free_inodes_count == 0)
+			continue;
+
+		struct ext2_buf *b;
+		status_t rv = ext2_bread(fs, gd->bg_inode_bitmap, &b);
+		IF_ERR(rv) return rv;
+
+		// the first inodes are reserved
+		uint32_t base = g * fs->sb.s_inodes_per_group;
+		uint32_t min = fs->first_ino > base + 1 ?
+				       fs->first_ino - base - 1 :
+				       0;
+
+		long bit = bitmap_claim(b, group_ninodes(fs, g), min);
+		if (bit < 0)
+			continue;
+
+		gd->bg_free_inodes_count--;
+		if (dir)
+			gd->bg_used_dirs_count++;
+		fs->sb.s_free_inodes_count--;
+		fs->sb_dirty = true;
+
+		*out = base + bit + 1;
+		return YAK_SUCCESS;
+	}
+
+	return YAK_NOSPACE;
+}
+
+// undo ext2_alloc_inode for an inode that never got linked
+static void ext2_free_inode(struct ext2fs *fs, uint32_t ino, bool dir)
+{
+	uint32_t g = (ino - 1) / fs->sb.s_inodes_per_group;
+	uint32_t bit = (ino - 1) % fs->sb.s_inodes_per_group;
+	struct ext2_group_desc *gd = &fs->gd[g];
+
+	struct ext2_buf *b;
+	status_t rv = ext2_bread(fs, gd->bg_inode_bitmap, &b);
+	IF_ERR(rv)
+	{
+		pr_warn("inode %u: leaked: %s\n", ino, status_str(rv));
+		return;
+	}
+
+	b->data[bit / 8] &= ~(1 << (bit % 8));
+	b->dirty = true;
+
+	gd->bg_free_inodes_count++;
+	if (dir)
+		gd->bg_used_dirs_count--;
+	fs->sb.s_free_inodes_count++;
+	fs->sb_dirty = true;
+}
+
+/* inodes, fs->lock held */
+
+static status_t ext2_inode_buf(struct ext2fs *fs, uint32_t ino,
+			       struct ext2_buf **bp, size_t *offp)
+{
+	if (ino == 0 || ino > fs->sb.s_inodes_count)
+		return YAK_INVALID_ARGS;
+
+	uint32_t group = (ino - 1) / fs->sb.s_inodes_per_group;
+	uint32_t index = (ino - 1) % fs->sb.s_inodes_per_group;
+	size_t byte = (size_t)index * fs->inode_size;
+	if (group >= fs->ngroups)
+		return YAK_IO;
+
+	status_t rv = ext2_bread(fs,
+				 fs->gd[group].bg_inode_table +
+					 (byte >> fs->block_shift),
+				 bp);
+	IF_ERR(rv) return rv;
+
+	*offp = byte & (fs->block_size - 1);
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_write_inode(struct ext2_node *n)
+{
+	struct ext2_buf *b;
+	size_t off;
+	status_t rv = ext2_inode_buf(n->fs, n->ino, &b, &off);
+	IF_ERR(rv) return rv;
+
+	memcpy(b->data + off, &n->di, sizeof(struct ext2_inode));
+	b->dirty = true;
+	n->di_dirty = false;
+	return YAK_SUCCESS;
+}
+
+static inline size_t ext2_isize(struct ext2_node *n)
+{
+	size_t size = n->di.i_size;
+	if (n->vnode.type == VREG)
+		size |= (size_t)n->di.i_size_high << 32;
+	return size;
+}
+
+/*
+ * Disk block of file block lblk, 0 for a hole. With create, holes are
+ * filled, allocating indirect blocks on the way. fs->lock held.
+ */
+static status_t ext2_bmap(struct ext2_node *n, uint64_t lblk, bool create,
+			  uint32_t *out)
+{
+	struct ext2fs *fs = n->fs;
+	const uint64_t apb = fs->block_size / sizeof(uint32_t);
+	uint32_t offsets[3];
+	int depth;
+	uint32_t *slot;
+
+	if (lblk < EXT2_NDIR_BLOCKS) {
+		depth = 0;
+		slot = &n->di.i_block[lblk];
+	} else if ((lblk -= EXT2_NDIR_BLOCKS) < apb) {
+		depth = 1;
+		slot = &n->di.i_block[EXT2_IND_BLOCK];
+		offsets[0] = lblk;
+	} else if ((lblk -= apb) < apb * apb) {
+		depth = 2;
+		slot = &n->di.i_block[EXT2_DIND_BLOCK];
+		offsets[0] = lblk / apb;
+		offsets[1] = lblk % apb;
+	} else if ((lblk -= apb * apb) < apb * apb * apb) {
+		depth = 3;
+		slot = &n->di.i_block[EXT2_TIND_BLOCK];
+		offsets[0] = lblk / (apb * apb);
+		offsets[1] = (lblk / apb) % apb;
+		offsets[2] = lblk % apb;
+	} else {
+		return YAK_INVALID_ARGS;
+	}
+
+	uint32_t goal = (n->ino - 1) / fs->sb.s_inodes_per_group;
+	struct ext2_buf *owner = NULL;
+
+	for (int level = 0;; level++) {
+		bool fresh = false;
+
+		if (*slot == 0) {
+			if (!create) {
+				*out = 0;
+				return YAK_SUCCESS;
+			}
+
+			uint32_t blk;
+			bool rsv = n->reserved > 0;
+			status_t rv = ext2_alloc_block(fs, goal, rsv, &blk);
+			IF_ERR(rv) return rv;
+
+			if (rsv) {
+				n->reserved--;
+				fs->reserved--;
+			}
+
+			*slot = blk;
+			if (owner)
+				owner->dirty = true;
+			n->di.i_blocks += fs->block_size >> SECTOR_SHIFT;
+			n->di_dirty = true;
+			fresh = true;
+		}
+
+		if (level == depth) {
+			*out = *slot;
+			return YAK_SUCCESS;
+		}
+
+		struct ext2_buf *b;
+		status_t rv = fresh ? ext2_bzero(fs, *slot, &b) :
+				      ext2_bread(fs, *slot, &b);
+		IF_ERR(rv) return rv;
+
+		slot = &((uint32_t *)b->data)[offsets[level]];
+		owner = b;
+	}
+}
+
+/*
+ * Pager. File pages are read and written straight between the page and
+ * the disk, in runs of blocks that are contiguous on disk.
+ */
+
+static status_t ext2_page_io(struct ext2_node *n, enum bio_op op,
+			     struct page **pages, unsigned int npages)
+{
+	struct ext2fs *fs = n->fs;
+	const unsigned int bpp = PAGE_SIZE >> fs->block_shift;
+	const size_t nblocks = (size_t)npages * bpp;
+	uint32_t map[(VM_MAX_READAHEAD + 1) * (PAGE_SIZE / 1024)];
+	assert(nblocks <= elementsof(map));
+
+	size_t filesize = n->vnode.filesize;
+
+	kmutex_acquire(&fs->lock, TIMEOUT_INFINITE);
+	for (size_t i = 0; i < nblocks; i++) {
+		uint64_t lblk = (pages[i / bpp]->offset >> fs->block_shift) +
+				i % bpp;
+
+		// never allocate past the end of the file
+		bool create = op == BIO_WRITE &&
+			      (lblk << fs->block_shift) < filesize;
+
+		status_t rv = ext2_bmap(n, lblk, create, &map[i]);
+		IF_ERR(rv)
+		{
+			kmutex_release(&fs->lock);
+			return rv;
+		}
+	}
+	kmutex_release(&fs->lock);
+
+	struct bio *bio = NULL;
+	uint32_t next = 0;
+	status_t rv = YAK_SUCCESS;
+
+	for (size_t i = 0; i < nblocks; i++) {
+		struct page *pg = pages[i / bpp];
+		unsigned int off = (i % bpp) << fs->block_shift;
+
+		if (map[i] == 0) {
+			// holes read back as zeroes
+			if (op == BIO_READ)
+				memset((char *)page_to_mapped_addr(pg) + off, 0,
+				       fs->block_size);
+			continue;
+		}
+
+		if (bio && map[i] == next &&
+		    IS_OK(bio_add_page(bio, pg, fs->block_size, off))) {
+			next++;
+			continue;
+		}
+
+		if (bio) {
+			rv = blk_submit_wait(bio);
+			bio_free(bio);
+			bio = NULL;
+			IF_ERR(rv) return rv;
+		}
+
+		unsigned short maxvecs = MIN(nblocks - i,
+					     (size_t)fs->dev->max_segments);
+		bio = bio_alloc(fs->dev, op,
+				(sector_t)map[i]
+					<< (fs->block_shift - SECTOR_SHIFT),
+				maxvecs);
+		if (!bio)
+			return YAK_OOM;
+
+		EXPECT(bio_add_page(bio, pg, fs->block_size, off));
+		next = map[i] + 1;
+	}
+
+	if (bio) {
+		rv = blk_submit_wait(bio);
+		bio_free(bio);
+	}
+
+	return rv;
+}
+
+static status_t ext2_pager_get(struct vm_object *obj, voff_t offset,
+			       struct page **pages, unsigned int *npages,
+			       [[maybe_unused]] unsigned int centeridx,
+			       [[maybe_unused]] vm_prot_t access_type,
+			       [[maybe_unused]] unsigned int flags)
+{
+	assert(IS_ALIGNED_POW2(offset, PAGE_SIZE));
+	struct ext2_node *n = obj_to_node(obj);
+
+	// don't read ahead past the end of the file
+	voff_t end = ALIGN_UP(n->vnode.filesize, PAGE_SIZE);
+	unsigned int count = 1;
+	if (offset < end)
+		count = MIN(*npages, (end - offset) >> PAGE_SHIFT);
+
+	for (unsigned int i = 0; i < count; i++) {
+		pages[i] = vm_pagealloc(obj, offset + (voff_t)i * PAGE_SIZE);
+		if (!pages[i]) {
+			while (i-- > 0)
+				vm_pagefree(pages[i]);
+			return YAK_OOM;
+		}
+	}
+
+	status_t rv = ext2_page_io(n, BIO_READ, pages, count);
+	IF_ERR(rv)
+	{
+		for (unsigned int i = 0; i < count; i++)
+			vm_pagefree(pages[i]);
+		return rv;
+	}
+
+	*npages = count;
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_pager_put(struct vm_object *obj, struct page **pages,
+			       unsigned int npages)
+{
+	struct ext2_node *n = obj_to_node(obj);
+	if (n->fs->readonly)
+		return YAK_PERM_DENIED;
+	return ext2_page_io(n, BIO_WRITE, pages, npages);
+}
+
+static void ext2_pager_ref(struct vm_object *obj)
+{
+	__atomic_fetch_add(&obj->refcnt, 1, __ATOMIC_SEQ_CST);
+}
+
+static void ext2_pager_cleanup([[maybe_unused]] struct vm_object *obj)
+{
+	// the node holds a reference for as long as the mount exists
+	panic("ext2: last reference to a file object dropped\n");
+}
+
+static struct vm_pagerops ext2_pagerops = {
+	.pgo_name = "ext2",
+	.pgo_readahead = EXT2_READAHEAD,
+	.pgo_init = NULL,
+	.pgo_get = ext2_pager_get,
+	.pa_put = ext2_pager_put,
+	.pgo_ref = ext2_pager_ref,
+	.pgo_cleanup = ext2_pager_cleanup,
+};
+
+/* writeback */
+
+static status_t ext2_write_super(struct ext2fs *fs)
+{
+	size_t done;
+	status_t rv = blkdev_rw(fs->dev, BIO_WRITE, EXT2_SUPERBLOCK_OFFSET,
+				&fs->sb, sizeof(struct ext2_super_block), &done);
+	IF_ERR(rv) return rv;
+
+	voff_t gd_off = (voff_t)(fs->sb.s_first_data_block + 1)
+			<< fs->block_shift;
+	rv = blkdev_rw(fs->dev, BIO_WRITE, gd_off, fs->gd,
+		       fs->gd_blocks << fs->block_shift, &done);
+	IF_ERR(rv) return rv;
+
+	fs->sb_dirty = false;
+	return YAK_SUCCESS;
+}
+
+static void ext2_sync(struct ext2fs *fs)
+{
+	guard(mutex)(&fs->sync_lock);
+
+	// nodes up to here are stable, later ones are only appended
+	kmutex_acquire(&fs->lock, TIMEOUT_INFINITE);
+	struct ext2_node *last = TAILQ_LAST(&fs->nodes, ext2_node_list);
+	kmutex_release(&fs->lock);
+
+	// file data first, it allocates blocks and dirties inodes
+	struct ext2_node *n;
+	TAILQ_FOREACH(n, &fs->nodes, entry)
+	{
+		// writers copy in under the vnode lock, see ext2_write_begin
+		struct vnode *vn = &n->vnode;
+		bool file = vn->type == VREG;
+		if (file)
+			VOP_LOCK(vn);
+
+		status_t rv = YAK_SUCCESS;
+		if (__atomic_load_n(&n->obj.flags, __ATOMIC_ACQUIRE) &
+		    VM_OBJ_DIRTY) {
+			rv = vm_object_sync(&n->obj);
+			IF_ERR(rv)
+			pr_warn("inode %u: writeback failed: %s\n", n->ino,
+				status_str(rv));
+		}
+
+		// everything written so far has its blocks now
+		if (file && IS_OK(rv)) {
+			guard(mutex)(&fs->lock);
+			fs->reserved -= n->reserved;
+			n->reserved = 0;
+			n->rsv_end = vn->filesize;
+		}
+
+		if (file)
+			VOP_UNLOCK(vn);
+		if (n == last)
+			break;
+	}
+
+	guard(mutex)(&fs->lock);
+
+	TAILQ_FOREACH(n, &fs->nodes, entry)
+	{
+		if (n->vnode.vobj && ext2_isize(n) != n->vnode.filesize) {
+			n->di.i_size = (uint32_t)n->vnode.filesize;
+			if (n->vnode.type == VREG)
+				n->di.i_size_high = n->vnode.filesize >> 32;
+			n->di_dirty = true;
+		}
+		if (n->di_dirty)
+			ext2_write_inode(n);
+		if (n == last)
+			break;
+	}
+
+	bool wrote = false;
+	struct ht_entry *ent;
+	HASHTABLE_FOR_EACH(&fs->bufs, ent)
+	{
+		struct ext2_buf *b = ent->value;
+		if (b->dirty) {
+			status_t rv = ext2_bflush(fs, b);
+			IF_ERR(rv)
+			pr_warn("block %u: writeback failed: %s\n", b->blk,
+				status_str(rv));
+			wrote = true;
+		}
+	}
+
+	if (fs->sb_dirty) {
+		ext2_write_super(fs);
+		wrote = true;
+	}
+
+	if (wrote) {
+		struct bio *bio = bio_alloc(fs->dev, BIO_FLUSH, 0, 0);
+		if (bio) {
+			blk_submit_wait(bio);
+			bio_free(bio);
+		}
+	}
+}
+
+static void ext2_syncer(struct ext2fs *fs)
+{
+	for (;;) {
+		ksleep(EXT2_SYNC_INTERVAL);
+		ext2_sync(fs);
+	}
+}
+
+/* nodes */
+
+static enum vtype mode_to_vtype(uint16_t mode)
+{
+	switch (mode & EXT2_S_IFMT) {
+	case EXT2_S_IFREG:
+		return VREG;
+	case EXT2_S_IFDIR:
+		return VDIR;
+	case EXT2_S_IFLNK:
+		return VLNK;
+	case EXT2_S_IFCHR:
+		return VCHR;
+	case EXT2_S_IFBLK:
+		return VBLK;
+	case EXT2_S_IFIFO:
+		return VFIFO;
+	default:
+		return VSOCK;
+	}
+}
+
+static uint8_t ft_to_dtype(uint8_t ft)
+{
+	switch (ft) {
+	case EXT2_FT_REG_FILE:
+		return VREG;
+	case EXT2_FT_DIR:
+		return VDIR;
+	case EXT2_FT_CHRDEV:
+		return VCHR;
+	case EXT2_FT_BLKDEV:
+		return VBLK;
+	case EXT2_FT_FIFO:
+		return VFIFO;
+	case EXT2_FT_SOCK:
+		return VSOCK;
+	case EXT2_FT_SYMLINK:
+		return VLNK;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Instantiate a node for ino, fs->lock held. It is only put on fs->nodes,
+ * where writeback finds it, by the caller.
+ */
+static struct ext2_node *ext2_node_new(struct ext2fs *fs, uint32_t ino,
+				       const struct ext2_inode *di)
+{
+	struct ext2_node *n = kzalloc(sizeof(struct ext2_node));
+	if (!n)
+		return NULL;
+
+	n->fs = fs;
+	n->ino = ino;
+	memcpy(&n->di, di, sizeof(struct ext2_inode));
+
+	enum vtype type = mode_to_vtype(di->i_mode);
+	VOP_INIT(&n->vnode, &fs->vfs, &ext2_vn_op, type);
+
+	if (type == VREG || type == VDIR || type == VLNK) {
+		vm_object_common_init(&n->obj, &ext2_pagerops);
+		n->vnode.vobj = &n->obj;
+	}
+	n->vnode.filesize = ext2_isize(n);
+	n->rsv_end = n->vnode.filesize;
+
+	if (type == VDIR)
+		ht_init(&n->dcache, ht_hash_str, ht_eq_str);
+
+	if (IS_ERR(ht_set(&fs->inodes, &ino, sizeof(ino), n, 0))) {
+		if (type == VDIR)
+			ht_destroy(&n->dcache);
+		kfree(n, sizeof(struct ext2_node));
+		return NULL;
+	}
+
+	return n;
+}
+
+// drop a node that writeback never saw, fs->lock held
+static void ext2_node_discard(struct ext2_node *n)
+{
+	struct ext2fs *fs = n->fs;
+
+	ht_del(&fs->inodes, &n->ino, sizeof(n->ino));
+
+	if (n->vnode.vobj) {
+		struct page *pg, *tmp;
+		RBT_FOREACH_SAFE(pg, vm_page_tree, &n->obj.memq, tmp)
+		{
+			page_deref(pg);
+		}
+	}
+
+	if (n->vnode.type == VDIR)
+		ht_destroy(&n->dcache);
+
+	ext2_free_inode(fs, n->ino, n->vnode.type == VDIR);
+	kfree(n, sizeof(struct ext2_node));
+}
+
+static status_t ext2_iget(struct ext2fs *fs, uint32_t ino,
+			  struct ext2_node **out)
+{
+	guard(mutex)(&fs->lock);
+
+	struct ext2_node *n = ht_get(&fs->inodes, &ino, sizeof(ino));
+	if (n) {
+		*out = n;
+		return YAK_SUCCESS;
+	}
+
+	struct ext2_buf *b;
+	size_t off;
+	status_t rv = ext2_inode_buf(fs, ino, &b, &off);
+	IF_ERR(rv) return rv;
+
+	n = ext2_node_new(fs, ino, (struct ext2_inode *)(b->data + off));
+	if (!n)
+		return YAK_OOM;
+
+	TAILQ_INSERT_TAIL(&fs->nodes, n, entry);
+	*out = n;
+	return YAK_SUCCESS;
+}
+
+/* directories, vnode lock held */
+
+// map block lblk of the directory through its page cache
+static status_t ext2_dir_block(struct ext2_node *dir, uint64_t lblk,
+			       struct page **pgp, char **datap)
+{
+	voff_t off = lblk << dir->fs->block_shift;
+	voff_t pageoff = ALIGN_DOWN(off, PAGE_SIZE);
+
+	status_t rv = vm_lookuppage(&dir->obj, pageoff, 0, pgp);
+	IF_ERR(rv) return rv;
+
+	*datap = (char *)page_to_mapped_addr(*pgp) + (off - pageoff);
+	return YAK_SUCCESS;
+}
+
+static bool dirent_valid(struct ext2fs *fs, struct ext2_dir_entry *de,
+			 size_t pos)
+{
+	return de->rec_len >= 8 && (de->rec_len & 3) == 0 &&
+	       pos + de->rec_len <= fs->block_size &&
+	       (size_t)de->name_len + 8 <= de->rec_len;
+}
+
+static bool is_dot(const char *name, size_t len)
+{
+	return (len == 1 && name[0] == '.') ||
+	       (len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+static status_t dcache_insert(struct ext2_node *dir, const char *name,
+			      size_t len, uint32_t ino, uint8_t ft,
+			      struct ext2_node *node)
+{
+	struct ext2_dentry *d = kmalloc(sizeof(struct ext2_dentry));
+	if (!d)
+		return YAK_OOM;
+
+	d->ino = ino;
+	d->file_type = ft;
+	d->node = node;
+
+	status_t rv = ht_set_seq(&dir->dcache, name, len, d, &dir->vnode.seq);
+
+	IF_ERR(rv) kfree(d, sizeof(struct ext2_dentry));
+	return rv;
+}
+
+static status_t ext2_dcache_load(struct ext2_node *dir)
+{
+	if (dir->dcache_loaded)
+		return YAK_SUCCESS;
+
+	struct ext2fs *fs = dir->fs;
+	size_t nblocks = dir->vnode.filesize >> fs->block_shift;
+
+	for (size_t blk = 0; blk < nblocks; blk++) {
+		struct page *pg;
+		char *data;
+		status_t rv = ext2_dir_block(dir, blk, &pg, &data);
+		IF_ERR(rv) return rv;
+
+		for (size_t pos = 0; pos < fs->block_size;) {
+			struct ext2_dir_entry *de =
+				(struct ext2_dir_entry *)(data + pos);
+			if (!dirent_valid(fs, de, pos)) {
+				pr_warn("inode %u: bad entry at block %zu\n",
+					dir->ino, blk);
+				return YAK_IO;
+			}
+
+			if (de->inode != 0 && !is_dot(de->name, de->name_len)) {
+				rv = dcache_insert(dir, de->name, de->name_len,
+						   de->inode, de->file_type,
+						   NULL);
+				if (IS_ERR(rv) && rv != YAK_EXISTS)
+					return rv;
+			}
+
+			pos += de->rec_len;
+		}
+	}
+
+	__atomic_store_n(&dir->dcache_loaded, true, __ATOMIC_RELEASE);
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_lookup(struct vnode *vn, char *name, struct vnode **out)
+{
+	if (vn->type != VDIR)
+		return YAK_NODIR;
+
+	struct ext2_node *dir = (struct ext2_node *)vn;
+	status_t rv = ext2_dcache_load(dir);
+	IF_ERR(rv) return rv;
+
+	struct ext2_dentry *d = ht_get(&dir->dcache, name, strlen(name));
+	if (!d)
+		return YAK_NOENT;
+
+	if (!d->node) {
+		struct ext2_node *n;
+		rv = ext2_iget(dir->fs, d->ino, &n);
+		IF_ERR(rv) return rv;
+		__atomic_store_n(&d->node, n, __ATOMIC_RELEASE);
+	}
+
+	*out = &d->node->vnode;
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_lookup_rcu(struct vnode *vn, const char *name,
+				struct vnode **out)
+{
+	if (vn->type != VDIR)
+		return YAK_NODIR;
+
+	struct ext2_node *dir = (struct ext2_node *)vn;
+	if (!__atomic_load_n(&dir->dcache_loaded, __ATOMIC_ACQUIRE))
+		return YAK_BUSY;
+
+	struct ext2_dentry *d = ht_get_rcu(&dir->dcache, name, strlen(name));
+	if (!d)
+		return YAK_NOENT;
+
+	// the inode still has to be read, leave it to the locked walk
+	struct ext2_node *n = __atomic_load_n(&d->node, __ATOMIC_ACQUIRE);
+	if (!n)
+		return YAK_BUSY;
+
+	*out = &n->vnode;
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_getdents(struct vnode *vn, struct dirent *buf,
+			      size_t bufsize, off_t *offset, size_t *bytes_read)
+{
+	if (vn->type != VDIR)
+		return YAK_NODIR;
+
+	struct ext2_node *dir = (struct ext2_node *)vn;
+	struct ext2fs *fs = dir->fs;
+
+	char *outp = (char *)buf;
+	size_t remaining = bufsize;
+	size_t written = 0;
+	bool full = false;
+
+	// d_off is the position of the following entry
+	size_t pos = *offset;
+	while (!full && pos < vn->filesize) {
+		uint64_t blk = pos >> fs->block_shift;
+		size_t blkpos = blk << fs->block_shift;
+
+		struct page *pg;
+		char *data;
+		status_t rv = ext2_dir_block(dir, blk, &pg, &data);
+		IF_ERR(rv) return rv;
+
+		for (size_t p = 0; p < fs->block_size;) {
+			struct ext2_dir_entry *de =
+				(struct ext2_dir_entry *)(data + p);
+			if (!dirent_valid(fs, de, p))
+				return YAK_IO;
+
+			size_t next = blkpos + p + de->rec_len;
+			if (blkpos + p < pos || de->inode == 0 ||
+			    is_dot(de->name, de->name_len)) {
+				p += de->rec_len;
+				continue;
+			}
+
+			size_t reclen = offsetof(struct dirent, d_name) +
+					de->name_len + 1;
+			reclen = ALIGN_UP(reclen, sizeof(long));
+			if (reclen > remaining) {
+				full = true;
+				break;
+			}
+
+			struct dirent *d = (struct dirent *)outp;
+			d->d_ino = de->inode;
+			d->d_off = next;
+			d->d_reclen = (unsigned short)reclen;
+			d->d_type = fs->filetype ? ft_to_dtype(de->file_type) :
+						   0;
+			memcpy(d->d_name, de->name, de->name_len);
+			d->d_name[de->name_len] = '\0';
+
+			outp += reclen;
+			remaining -= reclen;
+			written += reclen;
+			*offset = next;
+
+			p += de->rec_len;
+		}
+
+		if (!full)
+			pos = blkpos + fs->block_size;
+	}
+
+	// the buffer can't hold a single entry
+	if (written == 0 && full)
+		return YAK_INVALID_ARGS;
+
+	*bytes_read = written;
+	return YAK_SUCCESS;
+}
+
+// the new entry is returned in dep, so that it can be taken back
+static status_t ext2_dir_add(struct ext2_node *dir, const char *name,
+			     size_t len, uint32_t ino, uint8_t ft,
+			     struct page **pgp, struct ext2_dir_entry **dep)
+{
+	struct ext2fs *fs = dir->fs;
+	size_t need = EXT2_DIR_REC_LEN(len);
+	size_t nblocks = dir->vnode.filesize >> fs->block_shift;
+
+	struct page *pg;
+	char *data;
+	struct ext2_dir_entry *de = NULL;
+
+	// look for slack behind an existing entry
+	for (size_t blk = 0; blk < nblocks && !de; blk++) {
+		status_t rv = ext2_dir_block(dir, blk, &pg, &data);
+		IF_ERR(rv) return rv;
+
+		for (size_t pos = 0; pos < fs->block_size;) {
+			struct ext2_dir_entry *cur =
+				(struct ext2_dir_entry *)(data + pos);
+			if (!dirent_valid(fs, cur, pos))
+				return YAK_IO;
+
+			size_t used = cur->inode ?
+					      EXT2_DIR_REC_LEN(cur->name_len) :
+					      0;
+			if (cur->rec_len - used >= need) {
+				if (used) {
+					de = (struct ext2_dir_entry
+						      *)((char *)cur + used);
+					de->rec_len = cur->rec_len - used;
+					cur->rec_len = used;
+				} else {
+					de = cur;
+				}
+				break;
+			}
+
+			pos += cur->rec_len;
+		}
+	}
+
+	if (!de) {
+		// append a block, it is allocated on writeback
+		dir->vnode.filesize += fs->block_size;
+		status_t rv = ext2_dir_block(dir, nblocks, &pg, &data);
+		IF_ERR(rv)
+		{
+			dir->vnode.filesize -= fs->block_size;
+			return rv;
+		}
+		de = (struct ext2_dir_entry *)data;
+		de->rec_len = fs->block_size;
+	}
+
+	de->inode = ino;
+	de->name_len = len;
+	de->file_type = fs->filetype ? ft : 0;
+	memcpy(de->name, name, len);
+
+	vm_page_dirty(pg);
+	*pgp = pg;
+	*dep = de;
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_dir_init(struct ext2_node *dir, uint32_t parent)
+{
+	struct ext2fs *fs = dir->fs;
+
+	struct page *pg;
+	char *data;
+	status_t rv = ext2_dir_block(dir, 0, &pg, &data);
+	IF_ERR(rv) return rv;
+
+	struct ext2_dir_entry *dot = (struct ext2_dir_entry *)data;
+	dot->inode = dir->ino;
+	dot->rec_len = EXT2_DIR_REC_LEN(1);
+	dot->name_len = 1;
+	dot->file_type = fs->filetype ? EXT2_FT_DIR : 0;
+	dot->name[0] = '.';
+
+	struct ext2_dir_entry *dotdot =
+		(struct ext2_dir_entry *)(data + dot->rec_len);
+	dotdot->inode = parent;
+	dotdot->rec_len = fs->block_size - dot->rec_len;
+	dotdot->name_len = 2;
+	dotdot->file_type = fs->filetype ? EXT2_FT_DIR : 0;
+	dotdot->name[0] = '.';
+	dotdot->name[1] = '.';
+
+	vm_page_dirty(pg);
+	return YAK_SUCCESS;
+}
+
+// slow symlinks keep their target in the first block
+static status_t ext2_link_init(struct ext2_node *n, const char *path,
+			       size_t len)
+{
+	struct ext2fs *fs = n->fs;
+
+	if (len < EXT2_FAST_LINK_MAX) {
+		guard(mutex)(&fs->lock);
+		memcpy(n->di.i_block, path, len);
+		n->di.i_size = len;
+		n->di_dirty = true;
+		n->vnode.filesize = len;
+		return YAK_SUCCESS;
+	}
+
+	struct page *pg;
+	char *data;
+	n->vnode.filesize = len;
+	status_t rv = ext2_dir_block(n, 0, &pg, &data);
+	IF_ERR(rv) return rv;
+
+	memcpy(data, path, len);
+	vm_page_dirty(pg);
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_new_node(struct ext2_node *parent, enum vtype type,
+			      struct ext2_node **out)
+{
+	struct ext2fs *fs = parent->fs;
+	uint16_t mode;
+
+	switch (type) {
+	case VREG:
+		mode = EXT2_S_IFREG | 0644;
+		break;
+	case VDIR:
+		mode = EXT2_S_IFDIR | 0755;
+		break;
+	case VLNK:
+		mode = EXT2_S_IFLNK | 0777;
+		break;
+	default:
+		return YAK_NOT_SUPPORTED;
+	}
+
+	guard(mutex)(&fs->lock);
+
+	uint32_t ino;
+	uint32_t goal = (parent->ino - 1) / fs->sb.s_inodes_per_group;
+	status_t rv = ext2_alloc_inode(fs, goal, type == VDIR, &ino);
+	IF_ERR(rv) return rv;
+
+	struct ext2_inode di;
+	memset(&di, 0, sizeof(di));
+	di.i_mode = mode;
+	di.i_links_count = type == VDIR ? 2 : 1;
+
+	struct ext2_node *n = ext2_node_new(fs, ino, &di);
+	if (!n) {
+		ext2_free_inode(fs, ino, type == VDIR);
+		return YAK_OOM;
+	}
+	n->di_dirty = true;
+
+	if (type == VDIR) {
+		n->vnode.filesize = fs->block_size;
+		n->dcache_loaded = true;
+	}
+
+	*out = n;
+	return YAK_SUCCESS;
+}
+
+static uint8_t vtype_to_ft(enum vtype type)
+{
+	switch (type) {
+	case VREG:
+		return EXT2_FT_REG_FILE;
+	case VDIR:
+		return EXT2_FT_DIR;
+	case VLNK:
+		return EXT2_FT_SYMLINK;
+	default:
+		return EXT2_FT_UNKNOWN;
+	}
+}
+
+/*
+ * The node stays off fs->nodes until its name is linked, so every
+ * failure can hand the inode back without writeback having seen it.
+ */
+static status_t ext2_create_common(struct ext2_node *dir, enum vtype type,
+				   const char *name, const char *target,
+				   struct vnode **out)
+{
+	struct ext2fs *fs = dir->fs;
+	if (fs->readonly)
+		return YAK_PERM_DENIED;
+
+	size_t len = strlen(name);
+	if (len == 0 || len > EXT2_NAME_MAX)
+		return YAK_INVALID_ARGS;
+
+	status_t rv = ext2_dcache_load(dir);
+	IF_ERR(rv) return rv;
+
+	if (ht_get(&dir->dcache, name, len))
+		return YAK_EXISTS;
+
+	struct ext2_node *n;
+	rv = ext2_new_node(dir, type, &n);
+	IF_ERR(rv) return rv;
+
+	if (type == VDIR)
+		rv = ext2_dir_init(n, dir->ino);
+	else if (target)
+		rv = ext2_link_init(n, target, strlen(target));
+	IF_ERR(rv) goto err_node;
+
+	struct page *pg;
+	struct ext2_dir_entry *de;
+	rv = ext2_dir_add(dir, name, len, n->ino, vtype_to_ft(type), &pg, &de);
+	IF_ERR(rv) goto err_node;
+
+	rv = dcache_insert(dir, name, len, n->ino, vtype_to_ft(type), n);
+	IF_ERR(rv)
+	{
+		// an unused entry keeps its space, like after an unlink
+		de->inode = 0;
+		vm_page_dirty(pg);
+		goto err_node;
+	}
+
+	kmutex_acquire(&fs->lock, TIMEOUT_INFINITE);
+	if (type == VDIR) {
+		dir->di.i_links_count++;
+		dir->di_dirty = true;
+	}
+	TAILQ_INSERT_TAIL(&fs->nodes, n, entry);
+	kmutex_release(&fs->lock);
+
+	*out = &n->vnode;
+	return YAK_SUCCESS;
+
+err_node:
+	kmutex_acquire(&fs->lock, TIMEOUT_INFINITE);
+	ext2_node_discard(n);
+	kmutex_release(&fs->lock);
+	return rv;
+}
+
+static status_t ext2_create(struct vnode *parent, enum vtype type, char *name,
+			    struct vnode **out)
+{
+	if (parent->type != VDIR)
+		return YAK_NODIR;
+
+	return ext2_create_common((struct ext2_node *)parent, type, name, NULL,
+				  out);
+}
+
+static status_t ext2_symlink(struct vnode *parent, char *name, char *path,
+			     struct vnode **out)
+{
+	if (parent->type != VDIR)
+		return YAK_NODIR;
+
+	struct ext2_node *dir = (struct ext2_node *)parent;
+	if (strlen(path) >= dir->fs->block_size)
+		return YAK_INVALID_ARGS;
+
+	return ext2_create_common(dir, VLNK, name, path, out);
+}
+
+static status_t ext2_readlink(struct vnode *vn, char **path)
+{
+	if (vn->type != VLNK || path == NULL)
+		return YAK_INVALID_ARGS;
+
+	struct ext2_node *n = (struct ext2_node *)vn;
+	size_t len = vn->filesize;
+
+	// short targets are stored inline, see ext2_symlink
+	if (len < EXT2_FAST_LINK_MAX) {
+		*path = strndup((char *)n->di.i_block, len);
+		return *path ? YAK_SUCCESS : YAK_OOM;
+	}
+
+	struct page *pg;
+	char *data;
+	status_t rv = ext2_dir_block(n, 0, &pg, &data);
+	IF_ERR(rv) return rv;
+
+	*path = strndup(data, MIN(len, (size_t)n->fs->block_size));
+	return *path ? YAK_SUCCESS : YAK_OOM;
+}
+
+static status_t ext2_lock(struct vnode *vn)
+{
+	kmutex_acquire(&vn->lock, TIMEOUT_INFINITE);
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_unlock(struct vnode *vn)
+{
+	kmutex_release(&vn->lock);
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_inactive([[maybe_unused]] struct vnode *vn)
+{
+	// nodes stay cached until unmount
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_open([[maybe_unused]] struct vnode **vn)
+{
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_mmap(struct vnode *vn, struct vm_map *map, size_t length,
+			  voff_t offset, vm_prot_t prot,
+			  vm_inheritance_t inheritance, vaddr_t hint, int flags,
+			  vaddr_t *out)
+{
+	assert(vn->type == VREG);
+	return vm_map(map, vn->vobj, length, offset, prot, inheritance,
+		      VM_CACHE_DEFAULT, hint, flags, out);
+}
+
+/*
+ * Blocks are allocated on writeback. Data written past rsv_end reserves
+ * its blocks and the indirect blocks they may need here, so that a full
+ * disk fails the write rather than the writeback. Holes below rsv_end,
+ * and stores through shared mappings, aren't reserved.
+ */
+static status_t ext2_write_begin(struct vnode *vn, voff_t offset,
+				 size_t length)
+{
+	if (vn->type != VREG)
+		return YAK_SUCCESS;
+
+	struct ext2_node *n = (struct ext2_node *)vn;
+	struct ext2fs *fs = n->fs;
+	if (fs->readonly)
+		return YAK_PERM_DENIED;
+
+	size_t end = offset + length;
+	if (end <= n->rsv_end)
+		return YAK_SUCCESS;
+
+	uint64_t first = MAX(DIV_ROUNDUP(n->rsv_end, fs->block_size),
+			     offset >> fs->block_shift);
+	uint64_t last = DIV_ROUNDUP(end, fs->block_size);
+	uint64_t need = 0;
+	if (last > first) {
+		uint64_t data = last - first;
+		need = data + DIV_ROUNDUP(data, fs->block_size / 4) + 2;
+	}
+
+	guard(mutex)(&fs->lock);
+	if (fs->sb.s_free_blocks_count < fs->reserved ||
+	    need > fs->sb.s_free_blocks_count - fs->reserved)
+		return YAK_NOSPACE;
+
+	fs->reserved += (uint32_t)need;
+	n->reserved += (uint32_t)need;
+	n->rsv_end = end;
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_fallocate(struct vnode *vn, int mode, off_t offset,
+			       off_t size)
+{
+	if (offset < 0 || size <= 0)
+		return YAK_INVALID_ARGS;
+
+	if (mode != 0 || vn->type != VREG)
+		return YAK_NOT_SUPPORTED;
+
+	struct ext2_node *n = (struct ext2_node *)vn;
+	struct ext2fs *fs = n->fs;
+	if (fs->readonly)
+		return YAK_PERM_DENIED;
+
+	// there are no unwritten extents, new blocks must read back as zeroes
+	char *zero = kzalloc(fs->block_size);
+	if (!zero)
+		return YAK_OOM;
+	guard(autofree)(zero, fs->block_size);
+
+	uint64_t first = offset >> fs->block_shift;
+	uint64_t last = DIV_ROUNDUP((uint64_t)(offset + size), fs->block_size);
+	status_t rv = YAK_SUCCESS;
+
+	VOP_LOCK(vn);
+	kmutex_acquire(&fs->lock, TIMEOUT_INFINITE);
+	for (uint64_t lblk = first; lblk < last; lblk++) {
+		uint32_t blk;
+		rv = ext2_bmap(n, lblk, false, &blk);
+		IF_ERR(rv) break;
+		if (blk != 0)
+			continue;
+
+		rv = ext2_bmap(n, lblk, true, &blk);
+		IF_ERR(rv) break;
+
+		// under fs->lock, so no reader maps the block before this
+		size_t done;
+		rv = blkdev_rw(fs->dev, BIO_WRITE, (voff_t)blk << fs->block_shift,
+			       zero, fs->block_size, &done);
+		IF_ERR(rv) break;
+	}
+	kmutex_release(&fs->lock);
+
+	if (IS_OK(rv) && (size_t)(offset + size) > vn->filesize)
+		vn->filesize = offset + size;
+	VOP_UNLOCK(vn);
+	return rv;
+}
+
+static struct vn_ops ext2_vn_op = {
+	.vn_lookup = ext2_lookup,
+	.vn_lookup_rcu = ext2_lookup_rcu,
+	.vn_create = ext2_create,
+	.vn_lock = ext2_lock,
+	.vn_unlock = ext2_unlock,
+	.vn_inactive = ext2_inactive,
+	.vn_getdents = ext2_getdents,
+	.vn_symlink = ext2_symlink,
+	.vn_readlink = ext2_readlink,
+	.vn_read = NULL,
+	.vn_write = NULL,
+	.vn_open = ext2_open,
+	.vn_mmap = ext2_mmap,
+	.vn_fallocate = ext2_fallocate,
+	.vn_write_begin = ext2_write_begin,
+};
+
+/* mounting */
+
+static struct vnode *ext2_getroot(struct vfs *vfs)
+{
+	return &((struct ext2fs *)vfs)->root->vnode;
+}
+
+static status_t ext2_read_super(struct ext2fs *fs)
+{
+	size_t done;
+	status_t rv = blkdev_rw(fs->dev, BIO_READ, EXT2_SUPERBLOCK_OFFSET,
+				&fs->sb, sizeof(struct ext2_super_block), &done);
+	IF_ERR(rv) return rv;
+
+	struct ext2_super_block *sb = &fs->sb;
+	if (done != sizeof(*sb) || sb->s_magic != EXT2_SUPER_MAGIC)
+		return YAK_UNKNOWN_FS;
+
+	if (sb->s_log_block_size > 2 || sb->s_blocks_per_group == 0 ||
+	    sb->s_inodes_per_group == 0 ||
+	    sb->s_first_data_block >= sb->s_blocks_count)
+		return YAK_UNKNOWN_FS;
+
+	fs->block_shift = 10 + sb->s_log_block_size;
+	fs->block_size = 1U << fs->block_shift;
+	if (fs->block_size > PAGE_SIZE)
+		return YAK_NOT_SUPPORTED;
+
+	if (sb->s_rev_level == EXT2_GOOD_OLD_REV) {
+		fs->inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+		fs->first_ino = EXT2_GOOD_OLD_FIRST_INO;
+	} else {
+		fs->inode_size = sb->s_inode_size;
+		fs->first_ino = sb->s_first_ino;
+
+		if (sb->s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_FILETYPE) {
+			pr_warn("incompatible features %#x\n",
+				sb->s_feature_incompat);
+			return YAK_NOT_SUPPORTED;
+		}
+
+		if (sb->s_feature_ro_compat &
+		    ~(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER |
+		      EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+			pr_warn("read-only compatible features %#x\n",
+				sb->s_feature_ro_compat);
+			fs->readonly = true;
+		}
+
+		fs->filetype = sb->s_feature_incompat &
+			       EXT2_FEATURE_INCOMPAT_FILETYPE;
+	}
+
+	if (fs->inode_size < EXT2_GOOD_OLD_INODE_SIZE ||
+	    fs->inode_size > fs->block_size ||
+	    (fs->inode_size & (fs->inode_size - 1)))
+		return YAK_UNKNOWN_FS;
+
+	fs->ngroups = DIV_ROUNDUP(sb->s_blocks_count - sb->s_first_data_block,
+				  sb->s_blocks_per_group);
+
+	// every inode needs a group descriptor for its table
+	if (sb->s_inodes_count < EXT2_ROOT_INO ||
+	    sb->s_inodes_count > (uint64_t)fs->ngroups * sb->s_inodes_per_group)
+		return YAK_UNKNOWN_FS;
+
+	if (fs->first_ino <= EXT2_ROOT_INO || fs->first_ino > sb->s_inodes_count)
+		return YAK_UNKNOWN_FS;
+
+	return YAK_SUCCESS;
+}
+
+static status_t ext2_read_groups(struct ext2fs *fs)
+{
+	fs->gd_blocks = DIV_ROUNDUP(fs->ngroups * sizeof(struct ext2_group_desc),
+				    fs->block_size);
+	fs->gd = kzalloc(fs->gd_blocks << fs->block_shift);
+	if (!fs->gd)
+		return YAK_OOM;
+
+	size_t done;
+	voff_t off = (voff_t)(fs->sb.s_first_data_block + 1) << fs->block_shift;
+	status_t rv = blkdev_rw(fs->dev, BIO_READ, off, fs->gd,
+				fs->gd_blocks << fs->block_shift, &done);
+	if (IS_OK(rv) && done != fs->gd_blocks << fs->block_shift)
+		rv = YAK_IO;
+	IF_ERR(rv)
+	{
+		kfree(fs->gd, fs->gd_blocks << fs->block_shift);
+		fs->gd = NULL;
+	}
+	return rv;
+}
+
+static status_t ext2_mount(struct vnode *vn, const char *source,
+			  struct vfs **out)
+{
+	if (!source)
+		return YAK_INVALID_ARGS;
+
+	struct blkdev *dev = blkdev_find(source);
+	if (!dev)
+		return YAK_NODEV;
+
+	struct ext2fs *fs = kzalloc(sizeof(struct ext2fs));
+	if (!fs)
+		return YAK_OOM;
+
+	fs->dev = dev;
+	fs->vfs.ops = &ext2_op;
+	kmutex_init(&fs->lock, "ext2");
+	kmutex_init(&fs->sync_lock, "ext2_sync");
+	ht_init(&fs->bufs, ht_hash_str, ht_eq_str);
+	ht_init(&fs->inodes, ht_hash_str, ht_eq_str);
+	TAILQ_INIT(&fs->nodes);
+
+	status_t rv = ext2_read_super(fs);
+	IF_ERR(rv) goto err;
+
+	rv = ext2_read_groups(fs);
+	IF_ERR(rv) goto err;
+
+	// create the root now: getroot must not allocate during rcu walks
+	rv = ext2_iget(fs, EXT2_ROOT_INO, &fs->root);
+	IF_ERR(rv) goto err_gd;
+
+	if (fs->root->vnode.type != VDIR) {
+		rv = YAK_UNKNOWN_FS;
+		goto err_gd;
+	}
+
+	if (!fs->readonly) {
+		guard(mutex)(&fs->lock);
+		fs->sb.s_mnt_count++;
+		fs->sb_dirty = true;
+
+		rv = kernel_thread_create("ext2sync", SCHED_PRIO_TIME_SHARE,
+					  ext2_syncer, fs, 1, NULL);
+		IF_ERR(rv) goto err_gd;
+	}
+
+	vnode_ref(vn);
+	fs->vfs.vnodecovered = vn;
+	*out = &fs->vfs;
+
+	pr_info("%s: %u blocks of %u bytes in %u groups%s\n", dev->name,
+		fs->sb.s_blocks_count, fs->block_size, fs->ngroups,
+		fs->readonly ? ", read-only" : "");
+	return YAK_SUCCESS;
+
+err_gd:
+	// nodes and buffers of a failed mount are leaked
+	kfree(fs->gd, fs->gd_blocks << fs->block_shift);
+err:
+	kfree(fs, sizeof(struct ext2fs));
+	return rv;
+}
+
+static struct vfs_ops ext2_op = {
+	.vfs_mount = ext2_mount,
+	.vfs_getroot = ext2_getroot,
+};
+
+void ext2_init()
+{
+	EXPECT(vfs_register("ext2", &ext2_op));
+}
+
+INIT_ENTAILS(ext2);
+INIT_DEPS(ext2, vfs_stage);
+INIT_NODE(ext2, ext2_init);
@@ -0,0 +1,502 @@
+#define pr_fmt(fmt) "ioring: " fmt
+
+#include <assert.h>
+#include <yak/cpudata.h>
+#include <yak/file.h>
+#include <yak/heap.h>
+#include <yak/kevent.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/mutex.h>
+#include <yak/poll.h>
+#include <yak/process.h>
+#include <yak/rcu.h>
+#include <yak/sched.h>
+#include <yak/status.h>
+#include <yak/timer.h>
+#include <yak/vmflags.h>
+#include <yak/wait.h>
+#include <yak/fs/ioring.h>
+#include <yak/fs/vfs.h>
+#include <yak/vm/aobj.h>
+#include <yak/vm/map.h>
+#include <yak/vm/object.h>
+#include <yak/vm/page.h>
+#include <yak-abi/errno.h>
+#include <yak-abi/poll.h>
+
+// shared words in the header page, a cache line each
+#define RING_SQ_HEAD 0
+#define RING_SQ_TAIL 64
+#define RING_SQ_FLAGS 128
+#define RING_CQ_HEAD 192
+#define RING_CQ_TAIL 256
+
+// how often the polling thread looks at the sq while it is not idle
+#define SQPOLL_INTERVAL USTIME(50)
+#define SQPOLL_DEFAULT_IDLE MSTIME(1)
+
+struct ioring {
+	struct vnode vnode;
+
+	// ops run against this process' fd table
+	struct kprocess *proc;
+
+	// serializes consuming the sq and posting to the cq
+	struct kmutex lock;
+
+	// the mapped ring, kept resident and accessed through the hhdm
+	struct vm_object *obj;
+	struct page **pages;
+	size_t npages;
+
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	size_t sqes_off;
+	size_t cqes_off;
+
+	// fired after each batch that posted completions
+	struct kevent cq_ev;
+	struct pollhead ph;
+
+	unsigned int flags;
+	nstime_t sq_idle;
+	struct kevent sq_ev;
+	bool dying;
+};
+
+static struct vn_ops ioring_vn_op;
+
+static void *ring_ptr(struct ioring *ring, size_t off)
+{
+	struct page *pg = ring->pages[off / PAGE_SIZE];
+	return (void *)(page_to_mapped_addr(pg) + off % PAGE_SIZE);
+}
+
+static uint32_t *ring_word(struct ioring *ring, size_t off)
+{
+	return ring_ptr(ring, off);
+}
+
+// entries are a power of two in size and never straddle a page
+static struct ioring_sqe *ring_sqe(struct ioring *ring, uint32_t idx)
+{
+	idx &= ring->sq_entries - 1;
+	return ring_ptr(ring, ring->sqes_off + idx * sizeof(struct ioring_sqe));
+}
+
+static struct ioring_cqe *ring_cqe(struct ioring *ring, uint32_t idx)
+{
+	idx &= ring->cq_entries - 1;
+	return ring_ptr(ring, ring->cqes_off + idx * sizeof(struct ioring_cqe));
+}
+
+static bool sq_pending(struct ioring *ring)
+{
+	return __atomic_load_n(ring_word(ring, RING_SQ_TAIL), __ATOMIC_ACQUIRE) !=
+	       *ring_word(ring, RING_SQ_HEAD);
+}
+
+static uint32_t cq_ready(struct ioring *ring)
+{
+	return __atomic_load_n(ring_word(ring, RING_CQ_TAIL), __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(ring_word(ring, RING_CQ_HEAD), __ATOMIC_ACQUIRE);
+}
+
+static int32_t errno_of(status_t rv)
+{
+	return -status_errno(rv);
+}
+
+static int32_t ioring_rw(struct ioring *ring, const struct ioring_sqe *sqe,
+			 bool write)
+{
+	struct file *file = fd_get_file(ring->proc, sqe->fd);
+	if (!file)
+		return -EBADF;
+
+	guard_ref_adopt(file, file);
+
+	if (!(file->flags & (write ? FILE_WRITE : FILE_READ)))
+		return -EBADF;
+
+	bool positional = sqe->off != IORING_OFF_CURRENT;
+	if (positional && file->vnode->type == VFIFO)
+		return -ESPIPE;
+	if (positional && sqe->off > INT64_MAX)
+		return -EINVAL;
+
+	// res has to fit the count
+	size_t count = MIN(sqe->len, (uint32_t)INT32_MAX);
+	size_t off = positional ? sqe->off :
+				  (size_t)__atomic_load_n(&file->offset,
+							  __ATOMIC_SEQ_CST);
+
+	size_t done = 0;
+	status_t rv = write ? vfs_write(file->vnode, off,
+					(const void *)sqe->addr, count, &done) :
+			      vfs_read(file->vnode, off, (void *)sqe->addr,
+				       count, &done);
+	if (rv != YAK_EOF && IS_ERR(rv))
+		return errno_of(rv);
+
+	if (!positional)
+		__atomic_fetch_add(&file->offset, done, __ATOMIC_SEQ_CST);
+
+	return done;
+}
+
+static int32_t ioring_exec(struct ioring *ring, const struct ioring_sqe *sqe)
+{
+	struct kprocess *proc = ring->proc;
+	status_t rv;
+
+	switch (sqe->opcode) {
+	case IORING_OP_NOP:
+		return 0;
+	case IORING_OP_READ:
+		return ioring_rw(ring, sqe, false);
+	case IORING_OP_WRITE:
+		return ioring_rw(ring, sqe, true);
+	case IORING_OP_OPEN: {
+		int fd;
+		rv = fd_open(proc, (char *)sqe->addr, sqe->op_flags, &fd);
+		IF_ERR(rv) return errno_of(rv);
+		return fd;
+	}
+	case IORING_OP_CLOSE: {
+		guard(mutex)(&proc->fd_mutex);
+		struct fd *desc = fd_safe_get(proc, sqe->fd);
+		// the ring can't drop what may be its last reference itself
+		if (desc && desc->file->vnode == &ring->vnode)
+			return -EINVAL;
+		return errno_of(fd_close(proc, sqe->fd));
+	}
+	case IORING_OP_FSYNC: {
+		struct file *file = fd_get_file(proc, sqe->fd);
+		if (!file)
+			return -EBADF;
+		guard_ref_adopt(file, file);
+		return errno_of(vfs_fsync(file->vnode));
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * Consume up to max sqes, posting one cqe each. Stops early rather
+ * than overflow the cq, the rest stays queued for the next call.
+ */
+static uint32_t ioring_submit(struct ioring *ring, uint32_t max)
+{
+	uint32_t *sq_head = ring_word(ring, RING_SQ_HEAD);
+	uint32_t *cq_tail = ring_word(ring, RING_CQ_TAIL);
+	uint32_t *cq_head = ring_word(ring, RING_CQ_HEAD);
+	uint32_t n = 0;
+
+	kmutex_acquire(&ring->lock, TIMEOUT_INFINITE);
+
+	// both are only written by us, under the lock
+	uint32_t head = *sq_head;
+	uint32_t ctail = *cq_tail;
+	uint32_t tail = __atomic_load_n(ring_word(ring, RING_SQ_TAIL),
+					__ATOMIC_ACQUIRE);
+
+	while (head != tail && n < max) {
+		uint32_t chead = __atomic_load_n(cq_head, __ATOMIC_ACQUIRE);
+		if (ctail - chead >= ring->cq_entries)
+			break;
+
+		// userspace may reuse the slot as soon as sq_head moves on
+		struct ioring_sqe sqe = *ring_sqe(ring, head);
+		head++;
+
+		struct ioring_cqe *cqe = ring_cqe(ring, ctail);
+		cqe->user_data = sqe.user_data;
+		cqe->res = ioring_exec(ring, &sqe);
+		cqe->flags = 0;
+		__atomic_store_n(cq_tail, ++ctail, __ATOMIC_RELEASE);
+		n++;
+	}
+
+	__atomic_store_n(sq_head, head, __ATOMIC_RELEASE);
+
+	kmutex_release(&ring->lock);
+
+	if (n) {
+		event_alarm(&ring->cq_ev);
+		// pairs with the fence in ioring_poll
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		pollhead_notify(&ring->ph, POLLIN | POLLRDNORM);
+	}
+
+	return n;
+}
+
+static void sqpoll_thread(struct ioring *ring)
+{
+	uint32_t *sq_flags = ring_word(ring, RING_SQ_FLAGS);
+
+	vm_map_tmp_switch(ring->proc->map);
+
+	nstime_t last_work = plat_getnanos();
+
+	while (!__atomic_load_n(&ring->dying, __ATOMIC_ACQUIRE)) {
+		if (ioring_submit(ring, UINT32_MAX)) {
+			last_work = plat_getnanos();
+			continue;
+		}
+
+		// nothing preempts us, so even the busy phase has to sleep
+		if (plat_getnanos() - last_work < ring->sq_idle) {
+			ksleep(SQPOLL_INTERVAL);
+			continue;
+		}
+
+		__atomic_fetch_or(sq_flags, IORING_SQ_NEED_WAKEUP,
+				  __ATOMIC_SEQ_CST);
+
+		// the submitter may have looked at the flag before it was set
+		if (!sq_pending(ring) &&
+		    !__atomic_load_n(&ring->dying, __ATOMIC_ACQUIRE))
+			sched_wait_single(&ring->sq_ev, WAIT_MODE_BLOCK,
+					  WAIT_TYPE_ANY, TIMEOUT_INFINITE);
+
+		__atomic_fetch_and(sq_flags, ~IORING_SQ_NEED_WAKEUP,
+				   __ATOMIC_SEQ_CST);
+		last_work = plat_getnanos();
+	}
+
+	vm_map_tmp_disable();
+
+	vm_object_deref(ring->obj);
+	kfree(ring->pages, ring->npages * sizeof(struct page *));
+	// whoever woke us may still be inside event_alarm
+	kfree_rcu(ring, sizeof(struct ioring));
+
+	sched_exit_self();
+}
+
+static status_t ioring_read([[maybe_unused]] struct vnode *vn,
+			    [[maybe_unused]] voff_t offset,
+			    [[maybe_unused]] void *buf,
+			    [[maybe_unused]] size_t length,
+			    [[maybe_unused]] size_t *read_bytes)
+{
+	return YAK_INVALID_ARGS;
+}
+
+static status_t ioring_write([[maybe_unused]] struct vnode *vn,
+			     [[maybe_unused]] voff_t offset,
+			     [[maybe_unused]] const void *buf,
+			     [[maybe_unused]] size_t length,
+			     [[maybe_unused]] size_t *written_bytes)
+{
+	return YAK_INVALID_ARGS;
+}
+
+static short ioring_poll(struct vnode *vn, short events, struct poll_entry *pe)
+{
+	struct ioring *ring = (struct ioring *)vn;
+
+	if (pe) {
+		pollhead_attach(&ring->ph, pe);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+
+	return cq_ready(ring) ? events & (POLLIN | POLLRDNORM) : 0;
+}
+
+static status_t ioring_inactive(struct vnode *vn)
+{
+	struct ioring *ring = (struct ioring *)vn;
+
+	assert(LIST_EMPTY(&ring->ph.entries));
+
+	// the polling thread owns the ring and frees it on its way out
+	if (ring->flags & IORING_SETUP_SQPOLL) {
+		__atomic_store_n(&ring->dying, true, __ATOMIC_RELEASE);
+		event_alarm(&ring->sq_ev);
+		return YAK_SUCCESS;
+	}
+
+	vm_object_deref(ring->obj);
+	kfree(ring->pages, ring->npages * sizeof(struct page *));
+	kfree(ring, sizeof(struct ioring));
+	return YAK_SUCCESS;
+}
+
+static status_t ioring_lock(struct vnode *vn)
+{
+	kmutex_acquire(&vn->lock, TIMEOUT_INFINITE);
+	return YAK_SUCCESS;
+}
+
+static status_t ioring_unlock(struct vnode *vn)
+{
+	kmutex_release(&vn->lock);
+	return YAK_SUCCESS;
+}
+
+static status_t ioring_open([[maybe_unused]] struct vnode **vn)
+{
+	return YAK_SUCCESS;
+}
+
+static struct vn_ops ioring_vn_op = {
+	.vn_lock = ioring_lock,
+	.vn_unlock = ioring_unlock,
+	.vn_inactive = ioring_inactive,
+	.vn_read = ioring_read,
+	.vn_write = ioring_write,
+	.vn_open = ioring_open,
+	.vn_poll = ioring_poll,
+};
+
+bool vn_is_ioring(struct vnode *vn)
+{
+	return vn->ops == &ioring_vn_op;
+}
+
+static status_t ioring_map(struct ioring *ring, size_t size)
+{
+	ring->obj = vm_aobj_create();
+	if (!ring->obj)
+		return YAK_OOM;
+
+	ring->npages = size / PAGE_SIZE;
+	ring->pages = kcalloc(ring->npages, sizeof(struct page *));
+	if (!ring->pages) {
+		vm_object_deref(ring->obj);
+		return YAK_OOM;
+	}
+
+	status_t rv = vm_aobj_reserve(ring->obj, 0, size);
+	for (size_t i = 0; IS_OK(rv) && i < ring->npages; i++)
+		rv = vm_lookuppage(ring->obj, i * PAGE_SIZE, LOOKUP_ONLY,
+				   &ring->pages[i]);
+
+	IF_ERR(rv)
+	{
+		kfree(ring->pages, ring->npages * sizeof(struct page *));
+		vm_object_deref(ring->obj);
+	}
+
+	return rv;
+}
+
+status_t ioring_create(struct kprocess *proc, struct ioring_params *p,
+		       struct vnode **out)
+{
+	if (p->sq_entries == 0 || p->sq_entries > IORING_MAX_ENTRIES)
+		return YAK_INVALID_ARGS;
+	if (p->flags & ~IORING_SETUP_SQPOLL)
+		return YAK_INVALID_ARGS;
+
+	uint32_t sq_entries = 1;
+	while (sq_entries < p->sq_entries)
+		sq_entries <<= 1;
+	uint32_t cq_entries = sq_entries * 2;
+
+	struct ioring *ring = kzalloc(sizeof(struct ioring));
+	if (!ring)
+		return YAK_OOM;
+
+	ring->proc = proc;
+	ring->flags = p->flags;
+	ring->sq_entries = sq_entries;
+	ring->cq_entries = cq_entries;
+	ring->sq_idle = p->sq_idle_ms ? MSTIME((nstime_t)p->sq_idle_ms) :
+					SQPOLL_DEFAULT_IDLE;
+
+	// header page, then the cqes, then the sqes
+	ring->cqes_off = PAGE_SIZE;
+	ring->sqes_off = ring->cqes_off +
+			 ALIGN_UP(cq_entries * sizeof(struct ioring_cqe),
+				  PAGE_SIZE);
+	size_t size = ring->sqes_off +
+		      ALIGN_UP(sq_entries * sizeof(struct ioring_sqe),
+			       PAGE_SIZE);
+
+	status_t rv = ioring_map(ring, size);
+	IF_ERR(rv)
+	{
+		kfree(ring, sizeof(struct ioring));
+		return rv;
+	}
+
+	vaddr_t va = 0;
+	rv = vm_map(proc->map, ring->obj, size, 0, VM_READ | VM_WRITE | VM_USER,
+		    VM_INHERIT_SHARED, VM_CACHE_DEFAULT, 0, 0, &va);
+	IF_ERR(rv) goto err_free;
+
+	kmutex_init(&ring->lock, "ioring");
+	event_init(&ring->cq_ev, 0);
+	event_init(&ring->sq_ev, 0);
+	pollhead_init(&ring->ph);
+
+	VOP_INIT(&ring->vnode, NULL, &ioring_vn_op, VCHR);
+	ring->vnode.filesize = 0;
+	ring->vnode.vobj = NULL;
+
+	if (ring->flags & IORING_SETUP_SQPOLL) {
+		rv = kernel_thread_create("ioring-sq", SCHED_PRIO_TIME_SHARE_END,
+					  sqpoll_thread, ring, 1, NULL);
+		IF_ERR(rv)
+		{
+			vm_unmap(proc->map, va, size, 0);
+			goto err_free;
+		}
+	}
+
+	p->cq_entries = cq_entries;
+	p->sq_entries = sq_entries;
+	p->ring = (void *)va;
+	p->ring_size = size;
+	p->off = (struct ioring_offsets){
+		.sq_head = RING_SQ_HEAD,
+		.sq_tail = RING_SQ_TAIL,
+		.sq_flags = RING_SQ_FLAGS,
+		.cq_head = RING_CQ_HEAD,
+		.cq_tail = RING_CQ_TAIL,
+		.sqes = ring->sqes_off,
+		.cqes = ring->cqes_off,
+	};
+
+	*out = &ring->vnode;
+	return YAK_SUCCESS;
+
+err_free:
+	vm_object_deref(ring->obj);
+	kfree(ring->pages, ring->npages * sizeof(struct page *));
+	kfree(ring, sizeof(struct ioring));
+	return rv;
+}
+
+status_t ioring_enter(struct vnode *vn, uint32_t to_submit,
+		      uint32_t min_complete, unsigned int flags,
+		      uint32_t *submitted)
+{
+	struct ioring *ring = (struct ioring *)vn;
+
+	if (ring->flags & IORING_SETUP_SQPOLL) {
+		// the thread picks them up, to_submit is only an estimate
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			event_alarm(&ring->sq_ev);
+		*submitted = to_submit;
+	} else {
+		*submitted = to_submit ? ioring_submit(ring, to_submit) : 0;
+	}
+
+	if (!(flags & IORING_ENTER_GETEVENTS))
+		return YAK_SUCCESS;
+
+	min_complete = MIN(min_complete, ring->cq_entries);
+	while (cq_ready(ring) < min_complete) {
+		sched_wait_single(&ring->cq_ev, WAIT_MODE_BLOCK, WAIT_TYPE_ANY,
+				  TIMEOUT_INFINITE);
+	}
+
+	return YAK_SUCCESS;
+}
@@ -0,0 +1,515 @@
+#define pr_fmt(fmt) "pipe: " fmt
+
+#include <assert.h>
+#include <string.h>
+#include <yak/heap.h>
+#include <yak/kevent.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/mutex.h>
+#include <yak/poll.h>
+#include <yak/sched.h>
+#include <yak/status.h>
+#include <yak/fs/pipe.h>
+#include <yak/fs/vfs.h>
+#include <yak/vm/object.h>
+#include <yak/vm/page.h>
+#include <yak/vm/pmm.h>
+#include <yak-abi/limits.h>
+
+// 64KiB of buffered data
+#define PIPE_RING 16
+
+// the page belongs to the pipe alone, writes may append to it
+#define PIPE_BUF_OWNED 0x1
+
+struct pipe_buf {
+	struct page *page;
+	unsigned int offset;
+	unsigned int len;
+	unsigned int flags;
+};
+
+struct pipe;
+
+struct pipe_end {
+	struct vnode vnode;
+	struct pipe *pipe;
+};
+
+struct pipe {
+	struct kmutex lock;
+
+	struct pipe_buf ring[PIPE_RING];
+	// free running, head - tail buffers are in use
+	unsigned int head, tail;
+
+	int readers, writers;
+
+	// sleepers on the events, only woken if there are any
+	unsigned int rwait, wwait;
+	struct kevent read_ev, write_ev;
+
+	struct pollhead ph;
+
+	struct pipe_end ends[2];
+};
+
+static struct vn_ops pipe_vn_op;
+
+static inline unsigned int pipe_used(struct pipe *p)
+{
+	return p->head - p->tail;
+}
+
+static inline bool pipe_empty(struct pipe *p)
+{
+	return p->head == p->tail;
+}
+
+static inline struct pipe_buf *pipe_last(struct pipe *p)
+{
+	return &p->ring[(p->head - 1) % PIPE_RING];
+}
+
+static inline char *buf_addr(struct pipe_buf *b)
+{
+	return (char *)page_to_mapped_addr(b->page) + b->offset;
+}
+
+// room behind the newest buffer that a write may append to
+static size_t pipe_tail_room(struct pipe *p)
+{
+	if (pipe_empty(p))
+		return 0;
+
+	struct pipe_buf *b = pipe_last(p);
+	if (!(b->flags & PIPE_BUF_OWNED))
+		return 0;
+
+	return PAGE_SIZE - (b->offset + b->len);
+}
+
+static size_t pipe_space(struct pipe *p)
+{
+	return pipe_tail_room(p) + (PIPE_RING - pipe_used(p)) * PAGE_SIZE;
+}
+
+/*
+ * Events wake a single sleeper. Whoever is woken passes the wakeup on
+ * if there is still something left for the others.
+ */
+static void pipe_wake_readers(struct pipe *p)
+{
+	if (p->rwait)
+		event_alarm(&p->read_ev);
+}
+
+static void pipe_wake_writers(struct pipe *p)
+{
+	if (p->wwait)
+		event_alarm(&p->write_ev);
+}
+
+// sleep until the other side made progress, drops the lock meanwhile
+static void pipe_wait(struct pipe *p, bool reader)
+{
+	unsigned int *count = reader ? &p->rwait : &p->wwait;
+
+	(*count)++;
+	kmutex_release(&p->lock);
+	EXPECT(sched_wait_single(reader ? &p->read_ev : &p->write_ev,
+				 WAIT_MODE_BLOCK, WAIT_TYPE_ANY,
+				 TIMEOUT_INFINITE));
+	kmutex_acquire(&p->lock, TIMEOUT_INFINITE);
+	(*count)--;
+}
+
+static void pipe_buf_release(struct pipe *p)
+{
+	struct pipe_buf *b = &p->ring[p->tail % PIPE_RING];
+	page_deref(b->page);
+	b->page = NULL;
+	p->tail++;
+}
+
+// copy as much of src as fits into the ring
+static status_t pipe_push(struct pipe *p, const char *src, size_t len,
+			  size_t *pushed)
+{
+	size_t done = 0;
+
+	size_t room = pipe_tail_room(p);
+	if (room) {
+		struct pipe_buf *b = pipe_last(p);
+		size_t n = MIN(room, len);
+		memcpy(buf_addr(b) + b->len, src, n);
+		b->len += n;
+		done += n;
+	}
+
+	while (done < len && pipe_used(p) < PIPE_RING) {
+		struct page *pg = pmm_alloc_order(0);
+		if (!pg) {
+			*pushed = done;
+			return YAK_OOM;
+		}
+
+		size_t n = MIN((size_t)PAGE_SIZE, len - done);
+		memcpy((void *)page_to_mapped_addr(pg), src + done, n);
+
+		p->ring[p->head % PIPE_RING] = (struct pipe_buf){
+			.page = pg,
+			.offset = 0,
+			.len = n,
+			.flags = PIPE_BUF_OWNED,
+		};
+		p->head++;
+		done += n;
+	}
+
+	*pushed = done;
+	return YAK_SUCCESS;
+}
+
+static size_t pipe_pop(struct pipe *p, char *dst, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len && !pipe_empty(p)) {
+		struct pipe_buf *b = &p->ring[p->tail % PIPE_RING];
+		size_t n = MIN(b->len, len - done);
+
+		memcpy(dst + done, buf_addr(b), n);
+		b->offset += n;
+		b->len -= n;
+		done += n;
+
+		if (b->len == 0)
+			pipe_buf_release(p);
+	}
+
+	return done;
+}
+
+static short pipe_revents(struct pipe *p, bool reader)
+{
+	short revents = 0;
+
+	if (reader) {
+		if (!pipe_empty(p))
+			revents |= POLLIN | POLLRDNORM;
+		if (p->writers == 0)
+			revents |= POLLHUP;
+	} else {
+		// room for an atomic write, so it won't block
+		if (pipe_space(p) >= PIPE_BUF)
+			revents |= POLLOUT | POLLWRNORM;
+		if (p->readers == 0)
+			revents |= POLLERR;
+	}
+
+	return revents;
+}
+
+// done with a transfer: wake the other side once, and pass wakeups on
+static void pipe_finish(struct pipe *p)
+{
+	if (!pipe_empty(p) || p->writers == 0)
+		pipe_wake_readers(p);
+	if (pipe_space(p) > 0 || p->readers == 0)
+		pipe_wake_writers(p);
+
+	pollhead_notify(&p->ph, pipe_revents(p, true) | pipe_revents(p, false));
+}
+
+static status_t pipe_write(struct vnode *vn, [[maybe_unused]] voff_t offset,
+			   const void *buf, size_t length, size_t *written)
+{
+	struct pipe *p = ((struct pipe_end *)vn)->pipe;
+	const char *src = buf;
+	size_t done = 0;
+	status_t rv = YAK_SUCCESS;
+
+	// small writes are never interleaved with other writers
+	bool atomic = length <= PIPE_BUF;
+
+	kmutex_acquire(&p->lock, TIMEOUT_INFINITE);
+
+	while (done < length) {
+		if (p->readers == 0) {
+			rv = YAK_PIPE;
+			break;
+		}
+
+		size_t space = pipe_space(p);
+		if (space == 0 || (atomic && space < length)) {
+			pipe_wake_readers(p);
+			pipe_wait(p, false);
+			continue;
+		}
+
+		size_t n;
+		rv = pipe_push(p, src + done, length - done, &n);
+		done += n;
+		IF_ERR(rv) break;
+	}
+
+	pipe_finish(p);
+	kmutex_release(&p->lock);
+
+	*written = done;
+	return done ? YAK_SUCCESS : rv;
+}
+
+static status_t pipe_read(struct vnode *vn, [[maybe_unused]] voff_t offset,
+			  void *buf, size_t length, size_t *read)
+{
+	struct pipe *p = ((struct pipe_end *)vn)->pipe;
+
+	kmutex_acquire(&p->lock, TIMEOUT_INFINITE);
+
+	// wait for data, or for the last writer to go away
+	while (pipe_empty(p) && p->writers > 0 && length > 0)
+		pipe_wait(p, true);
+
+	*read = pipe_pop(p, buf, length);
+
+	pipe_finish(p);
+	kmutex_release(&p->lock);
+
+	return YAK_SUCCESS;
+}
+
+status_t pipe_splice_in(struct vnode *vn, struct vnode *src, voff_t offset,
+			size_t len, size_t *donep)
+{
+	if (!vn_is_pipe(vn) || vn == src)
+		return YAK_INVALID_ARGS;
+
+	if (src->ops->vn_read || !src->vobj)
+		return YAK_NOT_SUPPORTED;
+
+	struct pipe *p = ((struct pipe_end *)vn)->pipe;
+	size_t done = 0;
+	status_t rv = YAK_SUCCESS;
+
+	kmutex_acquire(&p->lock, TIMEOUT_INFINITE);
+
+	while (done < len) {
+		if (p->readers == 0) {
+			rv = YAK_PIPE;
+			break;
+		}
+
+		voff_t pos = offset + done;
+		if (pos >= src->filesize)
+			break;
+
+		if (pipe_used(p) == PIPE_RING) {
+			// hand over what we have before blocking
+			if (done)
+				break;
+			pipe_wake_readers(p);
+			pipe_wait(p, false);
+			continue;
+		}
+
+		voff_t pageoff = ALIGN_DOWN(pos, PAGE_SIZE);
+		size_t n = MIN(PAGE_SIZE - (pos - pageoff), len - done);
+		n = MIN(n, src->filesize - pos);
+
+		struct page *pg;
+		rv = vm_lookuppage(src->vobj, pageoff, 0, &pg);
+		IF_ERR(rv) break;
+
+		// shared with the page cache, so never appended to
+		page_ref(pg);
+		p->ring[p->head % PIPE_RING] = (struct pipe_buf){
+			.page = pg,
+			.offset = pos - pageoff,
+			.len = n,
+			.flags = 0,
+		};
+		p->head++;
+		done += n;
+	}
+
+	pipe_finish(p);
+	kmutex_release(&p->lock);
+
+	*donep = done;
+	return done ? YAK_SUCCESS : rv;
+}
+
+// a buffer that can become dst's page at pos as it is
+static bool pipe_buf_donatable(struct pipe_buf *b, struct vnode *dst,
+			       voff_t pos)
+{
+	return dst->ops->vn_write == NULL && dst->vobj &&
+	       (b->flags & PIPE_BUF_OWNED) && b->offset == 0 &&
+	       b->len == PAGE_SIZE && IS_ALIGNED_POW2(pos, PAGE_SIZE) &&
+	       __atomic_load_n(&b->page->shares, __ATOMIC_ACQUIRE) == 1;
+}
+
+status_t pipe_splice_out(struct vnode *vn, struct vnode *dst, voff_t offset,
+			 size_t len, size_t *donep)
+{
+	if (!vn_is_pipe(vn) || vn == dst)
+		return YAK_INVALID_ARGS;
+
+	if (dst->type == VDIR)
+		return YAK_INVALID_ARGS;
+
+	struct pipe *p = ((struct pipe_end *)vn)->pipe;
+	size_t done = 0;
+	status_t rv = YAK_SUCCESS;
+
+	kmutex_acquire(&p->lock, TIMEOUT_INFINITE);
+
+	while (pipe_empty(p) && p->writers > 0 && len > 0)
+		pipe_wait(p, true);
+
+	while (done < len && !pipe_empty(p)) {
+		struct pipe_buf *b = &p->ring[p->tail % PIPE_RING];
+		voff_t pos = offset + done;
+
+		if (len - done >= PAGE_SIZE && pipe_buf_donatable(b, dst, pos)) {
+			VOP_LOCK(dst);
+			if (pos + PAGE_SIZE > dst->filesize)
+				dst->filesize = pos + PAGE_SIZE;
+			VOP_UNLOCK(dst);
+
+			// the page changes owners, nothing is copied
+			rv = vm_object_donate(dst->vobj, pos, b->page);
+			IF_ERR(rv) break;
+
+			b->page = NULL;
+			p->tail++;
+			done += PAGE_SIZE;
+			continue;
+		}
+
+		size_t n = MIN(b->len, len - done);
+		size_t written = 0;
+		rv = vfs_write(dst, pos, buf_addr(b), n, &written);
+		IF_ERR(rv) break;
+
+		b->offset += written;
+		b->len -= written;
+		done += written;
+
+		if (b->len == 0)
+			pipe_buf_release(p);
+		if (written < n)
+			break;
+	}
+
+	pipe_finish(p);
+	kmutex_release(&p->lock);
+
+	*donep = done;
+	return done ? YAK_SUCCESS : rv;
+}
+
+static void pipe_destroy(struct pipe *p)
+{
+	while (!pipe_empty(p))
+		pipe_buf_release(p);
+	kfree(p, sizeof(struct pipe));
+}
+
+static status_t pipe_inactive(struct vnode *vn)
+{
+	struct pipe_end *end = (struct pipe_end *)vn;
+	struct pipe *p = end->pipe;
+
+	kmutex_acquire(&p->lock, TIMEOUT_INFINITE);
+
+	// readers see EOF, writers get EPIPE
+	if (end == &p->ends[0])
+		p->readers--;
+	else
+		p->writers--;
+	pipe_finish(p);
+
+	bool last = p->readers == 0 && p->writers == 0;
+	kmutex_release(&p->lock);
+
+	if (last)
+		pipe_destroy(p);
+
+	return YAK_SUCCESS;
+}
+
+static short pipe_poll(struct vnode *vn, short events, struct poll_entry *pe)
+{
+	struct pipe_end *end = (struct pipe_end *)vn;
+	struct pipe *p = end->pipe;
+
+	if (pe)
+		pollhead_attach(&p->ph, pe);
+
+	kmutex_acquire(&p->lock, TIMEOUT_INFINITE);
+	short revents = pipe_revents(p, end == &p->ends[0]);
+	kmutex_release(&p->lock);
+
+	return revents & (events | POLLERR | POLLHUP);
+}
+
+static status_t pipe_lock(struct vnode *vn)
+{
+	kmutex_acquire(&vn->lock, TIMEOUT_INFINITE);
+	return YAK_SUCCESS;
+}
+
+static status_t pipe_unlock(struct vnode *vn)
+{
+	kmutex_release(&vn->lock);
+	return YAK_SUCCESS;
+}
+
+static status_t pipe_open([[maybe_unused]] struct vnode **vn)
+{
+	return YAK_SUCCESS;
+}
+
+static struct vn_ops pipe_vn_op = {
+	.vn_lock = pipe_lock,
+	.vn_unlock = pipe_unlock,
+	.vn_inactive = pipe_inactive,
+	.vn_read = pipe_read,
+	.vn_write = pipe_write,
+	.vn_open = pipe_open,
+	.vn_poll = pipe_poll,
+};
+
+bool vn_is_pipe(struct vnode *vn)
+{
+	return vn->ops == &pipe_vn_op;
+}
+
+status_t pipe_create(struct vnode **readp, struct vnode **writep)
+{
+	struct pipe *p = kzalloc(sizeof(struct pipe));
+	if (!p)
+		return YAK_OOM;
+
+	kmutex_init(&p->lock, "pipe");
+	event_init(&p->read_ev, 0);
+	event_init(&p->write_ev, 0);
+	pollhead_init(&p->ph);
+	p->readers = 1;
+	p->writers = 1;
+
+	for (int i = 0; i < 2; i++) {
+		VOP_INIT(&p->ends[i].vnode, NULL, &pipe_vn_op, VFIFO);
+		p->ends[i].vnode.filesize = 0;
+		p->ends[i].vnode.vobj = NULL;
+		p->ends[i].pipe = p;
+	}
+
+	*readp = &p->ends[0].vnode;
+	*writep = &p->ends[1].vnode;
+	return YAK_SUCCESS;
+}
@@ -4,31 +4,56 @@
 #include <yak/heap.h>
 #include <yak/queue.h>
 #include <yak/hashtable.h>
+#include <yak/tree.h>
 #include <yak/fs/vfs.h>
+#include <yak/fs/tmpfs.h>
 #include <yak/macro.h>
 #include <yak/status.h>
 #include <yak/vm/map.h>
 #include <yak/vm/page.h>
 #include <yak/vm/pmm.h>
 #include <yak/vm/aobj.h>
+#include <yak/vm/object.h>
 #include <yak/types.h>
 #include <yak/init.h>
 #include <yak/log.h>
 #include <string.h>
 #include <stddef.h>
 
+struct tmpfs_node;
+RBT_HEAD(tmpfs_dir_tree, tmpfs_node);
+
 struct tmpfs_node {
 	struct vnode vnode;
 	char *name;
 	size_t name_len;
 
+	// position in the parent directory, stable d_off for getdents
+	off_t cookie;
+	RBT_ENTRY(tmpfs_node) dir_entry;
+
 	char *link_path;
 
 	size_t inode;
 
 	struct hashtable children;
+	// children ordered by cookie
+	struct tmpfs_dir_tree dir_tree;
+	off_t next_cookie;
 };
 
+static int tmpfs_dir_cmp(const struct tmpfs_node *a, const struct tmpfs_node *b)
+{
+	if (a->cookie < b->cookie)
+		return -1;
+	if (a->cookie > b->cookie)
+		return 1;
+	return 0;
+}
+
+RBT_PROTOTYPE(tmpfs_dir_tree, tmpfs_node, dir_entry, tmpfs_dir_cmp);
+RBT_GENERATE(tmpfs_dir_tree, tmpfs_node, dir_entry, tmpfs_dir_cmp);
+
 struct tmpfs {
 	struct vfs vfs;
 
@@ -77,13 +102,18 @@ static status_t tmpfs_create(struct vnode *parent, enum vtype type, char *name,
 	node->name = strndup(name, node->name_len);
 
 	status_t ret;
-	IF_ERR((ret = ht_set(&parent_node->children, name, name_len, node, 0)))
+	ret = ht_set_seq(&parent_node->children, name, name_len, node,
+			 &parent->seq);
+	IF_ERR(ret)
 	{
 		return ret;
 	};
 
 	vnode_ref(parent);
 
+	node->cookie = parent_node->next_cookie++;
+	RBT_INSERT(tmpfs_dir_tree, &parent_node->dir_tree, node);
+
 	*out = &node->vnode;
 	return YAK_SUCCESS;
 }
@@ -120,7 +150,8 @@ static status_t tmpfs_readlink(struct vnode *vn, char **path)
 }
 
 static status_t tmpfs_getdents(struct vnode *vn, struct dirent *buf,
-			       size_t bufsize, size_t *bytes_read)
+			       size_t bufsize, off_t *offset,
+			       size_t *bytes_read)
 {
 	if (vn->type != VDIR) {
 		return YAK_NODIR;
@@ -132,12 +163,13 @@ static status_t tmpfs_getdents(struct vnode *vn, struct dirent *buf,
 	size_t remaining = bufsize;
 	size_t written = 0;
 
-	struct ht_entry *elm;
-	HASHTABLE_FOR_EACH(&tvn->children, elm)
-	{
-		struct tmpfs_node *child = elm->value;
-		const char *name = elm->key;
-		size_t namelen = elm->key_len + 1;
+	// resume after the last returned cookie
+	struct tmpfs_node key = { .cookie = *offset + 1 };
+	struct tmpfs_node *child =
+		RBT_NFIND(tmpfs_dir_tree, &tvn->dir_tree, &key);
+
+	for (; child; child = RBT_NEXT(tmpfs_dir_tree, child)) {
+		size_t namelen = child->name_len + 1;
 		size_t reclen = offsetof(struct dirent, d_name) + namelen;
 		reclen = ALIGN_UP(reclen, sizeof(long));
 
@@ -147,16 +179,23 @@ static status_t tmpfs_getdents(struct vnode *vn, struct dirent *buf,
 
 		struct dirent *d = (struct dirent *)outp;
 		d->d_ino = child->inode;
-		d->d_off = 0; // ?
+		d->d_off = child->cookie;
 		d->d_reclen = (unsigned short)reclen;
 		d->d_type = child->vnode.type; // DT_* = V*
-		memcpy(d->d_name, name, namelen);
+		memcpy(d->d_name, child->name, child->name_len);
+		d->d_name[child->name_len] = '\0';
 
 		outp += reclen;
 		remaining -= reclen;
 		written += reclen;
+
+		*offset = child->cookie;
 	}
 
+	// the buffer can't hold a single entry
+	if (written == 0 && child != NULL)
+		return YAK_INVALID_ARGS;
+
 	*bytes_read = written;
 
 	return YAK_SUCCESS;
@@ -177,6 +216,22 @@ static status_t tmpfs_lookup(struct vnode *vn, char *name, struct vnode **out)
 	return YAK_SUCCESS;
 }
 
+static status_t tmpfs_lookup_rcu(struct vnode *vn, const char *name,
+				struct vnode **out)
+{
+	if (vn->type != VDIR) {
+		return YAK_NODIR;
+	}
+
+	struct tmpfs_node *elm = ht_get_rcu(&((struct tmpfs_node *)vn)->children,
+					    name, strlen(name));
+	if (!elm)
+		return YAK_NOENT;
+
+	*out = &elm->vnode;
+	return YAK_SUCCESS;
+}
+
 static status_t tmpfs_lock(struct vnode *vn)
 {
 	kmutex_acquire(&vn->lock, TIMEOUT_INFINITE);
@@ -208,10 +263,21 @@ static status_t tmpfs_mmap(struct vnode *vn, struct vm_map *map, size_t length,
 static status_t tmpfs_fallocate(struct vnode *vn, int mode, off_t offset,
 				off_t size)
 {
+	if (offset < 0 || size <= 0)
+		return YAK_INVALID_ARGS;
+
 	switch (mode) {
 	case 0:
+		VOP_LOCK(vn);
+		// imported files are not anonymous and fault in lazily
+		status_t rv = vm_aobj_reserve(vn->vobj, offset, size);
+		if (IS_ERR(rv) && rv != YAK_NOT_SUPPORTED) {
+			VOP_UNLOCK(vn);
+			return rv;
+		}
 		if ((size_t)(offset + size) > vn->filesize)
 			vn->filesize = offset + size;
+		VOP_UNLOCK(vn);
 		return YAK_SUCCESS;
 	default:
 		return YAK_NOT_SUPPORTED;
@@ -220,6 +286,7 @@ static status_t tmpfs_fallocate(struct vnode *vn, int mode, off_t offset,
 
 static struct vn_ops tmpfs_vn_op = {
 	.vn_lookup = tmpfs_lookup,
+	.vn_lookup_rcu = tmpfs_lookup_rcu,
 	.vn_create = tmpfs_create,
 	.vn_lock = tmpfs_lock,
 	.vn_unlock = tmpfs_unlock,
@@ -234,7 +301,24 @@ static struct vn_ops tmpfs_vn_op = {
 	.vn_fallocate = tmpfs_fallocate,
 };
 
-static status_t tmpfs_mount(struct vnode *vn);
+status_t tmpfs_import(struct vnode *vn, struct vm_object *obj, size_t size)
+{
+	if (vn->ops != &tmpfs_vn_op || vn->type != VREG)
+		return YAK_NOT_SUPPORTED;
+
+	VOP_LOCK(vn);
+	struct vm_object *old = vn->vobj;
+	vn->vobj = obj;
+	vn->filesize = size;
+	VOP_UNLOCK(vn);
+
+	vm_object_deref(old);
+
+	return YAK_SUCCESS;
+}
+
+static status_t tmpfs_mount(struct vnode *vn, const char *source,
+			   struct vfs **out);
 
 static struct vfs_ops tmpfs_op = {
 	.vfs_mount = tmpfs_mount,
@@ -250,18 +334,27 @@ INIT_ENTAILS(tmpfs);
 INIT_DEPS(tmpfs, vfs_stage);
 INIT_NODE(tmpfs, tmpfs_init);
 
-static status_t tmpfs_mount(struct vnode *vn)
+static status_t tmpfs_mount(struct vnode *vn,
+			   [[maybe_unused]] const char *source,
+			   struct vfs **out)
 {
 	struct tmpfs *fs = kmalloc(sizeof(struct tmpfs));
 	fs->root = NULL;
 	fs->seq_ino = 1;
 
+	// create the root now: getroot must not allocate during rcu walks
+	fs->root = create_node(&fs->vfs, VDIR);
+	if (!fs->root) {
+		kfree(fs, sizeof(struct tmpfs));
+		return YAK_OOM;
+	}
+
 	vnode_ref(vn);
 	fs->vfs.vnodecovered = vn;
 
 	fs->vfs.ops = &tmpfs_op;
 
-	vn->mountedvfs = &fs->vfs;
+	*out = &fs->vfs;
 	return YAK_SUCCESS;
 }
 
@@ -275,6 +368,9 @@ static struct tmpfs_node *create_node(struct vfs *vfs, enum vtype type)
 
 	if (type == VDIR) {
 		ht_init(&node->children, ht_hash_str, ht_eq_str);
+		RBT_INIT(tmpfs_dir_tree, &node->dir_tree);
+		// 0 is the start of the directory
+		node->next_cookie = 1;
 	} else {
 		node->vnode.filesize = 0;
 		node->vnode.vobj = vm_aobj_create();
@@ -0,0 +1,17 @@
+#ifndef _ABIBITS_FUTEX_H
+#define _ABIBITS_FUTEX_H
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_REQUEUE 3
+#define FUTEX_CMP_REQUEUE 4
+#define FUTEX_WAIT_BITSET 9
+#define FUTEX_WAKE_BITSET 10
+
+/* the futex word isn't shared with other processes */
+#define FUTEX_PRIVATE_FLAG 128
+#define FUTEX_CMD_MASK (~FUTEX_PRIVATE_FLAG)
+
+#define FUTEX_BITSET_MATCH_ANY 0xffffffff
+
+#endif /* _ABIBITS_FUTEX_H */
@@ -0,0 +1,77 @@
+#ifndef _ABIBITS_IORING_H
+#define _ABIBITS_IORING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IORING_MAX_ENTRIES 4096
+
+enum {
+	IORING_OP_NOP,
+	IORING_OP_READ,
+	IORING_OP_WRITE,
+	IORING_OP_OPEN,
+	IORING_OP_CLOSE,
+	IORING_OP_FSYNC,
+};
+
+/* ioring_params.flags */
+#define IORING_SETUP_SQPOLL 0x1
+
+/* the sq flags word */
+#define IORING_SQ_NEED_WAKEUP 0x1
+
+/* ioring_enter() flags */
+#define IORING_ENTER_GETEVENTS 0x1
+#define IORING_ENTER_SQ_WAKEUP 0x2
+
+/* sqe.off for reads and writes at the file offset */
+#define IORING_OFF_CURRENT ((uint64_t)-1)
+
+struct ioring_sqe {
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t ioprio;
+	int32_t fd;
+	uint64_t off;
+	// buffer, or path for IORING_OP_OPEN
+	uint64_t addr;
+	uint32_t len;
+	// O_* flags for IORING_OP_OPEN
+	uint32_t op_flags;
+	uint64_t user_data;
+	uint64_t __pad[3];
+};
+
+struct ioring_cqe {
+	uint64_t user_data;
+	// result, or a negative errno
+	int32_t res;
+	uint32_t flags;
+};
+
+/* byte offsets into the mapped ring */
+struct ioring_offsets {
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t sq_flags;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+	uint32_t sqes;
+	uint32_t cqes;
+};
+
+struct ioring_params {
+	// rounded up to a power of two
+	uint32_t sq_entries;
+	// set by the kernel, twice sq_entries
+	uint32_t cq_entries;
+	uint32_t flags;
+	// how long the polling thread spins before it needs a wakeup
+	uint32_t sq_idle_ms;
+	void *ring;
+	size_t ring_size;
+	struct ioring_offsets off;
+};
+
+#endif /* _ABIBITS_IORING_H */
@@ -0,0 +1,7 @@
+#ifndef _ABIBITS_LIMITS_H
+#define _ABIBITS_LIMITS_H
+
+/* pipe writes up to this size are atomic */
+#define PIPE_BUF 4096
+
+#endif /* _ABIBITS_LIMITS_H */
@@ -0,0 +1,10 @@
+#ifndef _ABIBITS_SCHED_H
+#define _ABIBITS_SCHED_H
+
+/* including the terminating nul */
+#define CPUSET_NAME_MAX 32
+
+/* every process starts out in here, it spans all cpus and can't change */
+#define CPUSET_ROOT "root"
+
+#endif
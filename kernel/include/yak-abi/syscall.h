@@ -61,6 +61,38 @@ enum {
 	SYS_FALLOCATE,
 	SYS_DEBUG_SLEEP,
 	SYS_DEBUG_LOG,
+	SYS_GETDENTS,
+	SYS_PREAD,
+	SYS_PWRITE,
+	SYS_READV,
+	SYS_WRITEV,
+	SYS_PREADV,
+	SYS_PWRITEV,
+	SYS_COPY_FILE_RANGE,
+	SYS_SENDFILE,
+	SYS_PIPE,
+	SYS_SPLICE,
+	SYS_VMSPLICE,
+	SYS_POLL,
+	SYS_PPOLL,
+	SYS_EPOLL_CREATE,
+	SYS_EPOLL_CTL,
+	SYS_EPOLL_WAIT,
+	SYS_IORING_SETUP,
+	SYS_IORING_ENTER,
+	SYS_FSYNC,
+	SYS_FUTEX,
+	SYS_THREAD_CREATE,
+	SYS_THREAD_EXIT,
+	SYS_THREAD_JOIN,
+	SYS_GETTID,
+	SYS_SCHED_SETAFFINITY,
+	SYS_SCHED_GETAFFINITY,
+	SYS_CPUSET_CREATE,
+	SYS_CPUSET_DESTROY,
+	SYS_CPUSET_ATTACH,
+	SYS_GETRUSAGE,
+	SYS_TIMES,
 };
 
 #endif
@@ -0,0 +1,13 @@
+#ifndef _ABIBITS_UIO_H
+#define _ABIBITS_UIO_H
+
+#include <stddef.h>
+
+#define IOV_MAX 1024
+
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+#endif /* _ABIBITS_UIO_H */
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <yak/types.h>
+
+struct cpu;
+struct kthread;
+struct kprocess;
+
+/*
+ * CPU time is charged to the current thread whenever it changes mode:
+ * at syscall entry and exit, around interrupts and on context switches.
+ */
+
+// coming from userspace, through a syscall or a fault
+void acct_enter_kernel();
+// about to drop back to userspace
+void acct_return_user();
+
+// only the outermost interrupt on a cpu counts
+void acct_irq_enter();
+void acct_irq_exit();
+
+// charge the outgoing thread, start the clock for the incoming one
+void acct_switch(struct kthread *from, struct kthread *to);
+
+struct acct_times {
+	nstime_t utime;
+	nstime_t stime;
+	nstime_t itime;
+};
+
+void acct_thread_times(struct kthread *thread, struct acct_times *times);
+// live threads plus the ones that already exited
+void acct_process_times(struct kprocess *proc, struct acct_times *times);
+// with the thread list lock held, once the thread is off the list. An
+// exiting curthread is charged up to now first. The last thread also
+// hands the process totals to the parent.
+void acct_thread_exit(struct kthread *thread);
+
+/*
+ * Load averages over 1, 5 and 15 minutes, in fixed point with
+ * LOADAVG_SHIFT fractional bits, like the classic unix avenrun.
+ */
+#define LOADAVG_SHIFT 11
+#define LOADAVG_ONE (1UL << LOADAVG_SHIFT)
+
+// integer part and hundredths, for printing
+#define LOAD_INT(x) ((x) >> LOADAVG_SHIFT)
+#define LOAD_FRAC(x) LOAD_INT(((x) & (LOADAVG_ONE - 1)) * 100)
+
+// cpu may be NULL for the whole system
+void acct_loadavg(struct cpu *cpu, unsigned long avg[3]);
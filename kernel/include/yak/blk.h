@@ -0,0 +1,168 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <yak/dpc.h>
+#include <yak/queue.h>
+#include <yak/semaphore.h>
+#include <yak/spinlock.h>
+#include <yak/status.h>
+#include <yak/types.h>
+#include <yak/vm/page.h>
+
+#define SECTOR_SHIFT 9
+#define SECTOR_SIZE (1UL << SECTOR_SHIFT)
+
+#define BLK_MAJOR 8
+#define BLK_MAX_DEVS 64
+#define BLK_MAX_HW_QUEUES 64U
+
+typedef uint64_t sector_t;
+
+struct blkdev;
+
+enum bio_op {
+	BIO_READ = 0,
+	BIO_WRITE,
+	BIO_FLUSH,
+};
+
+/* a segment may span several physically contiguous pages */
+struct bio_vec {
+	struct page *page;
+	unsigned int offset;
+	unsigned int len;
+};
+
+/*
+ * A single scatter/gather transfer. end_io is called at IPL_DPC once the
+ * transfer finished and must not block.
+ */
+struct bio {
+	struct blkdev *dev;
+	enum bio_op op;
+	sector_t sector; /* start, in 512 byte sectors */
+	size_t size; /* total bytes in vecs */
+
+	unsigned short nvecs, maxvecs;
+	struct bio_vec *vecs;
+
+	status_t status;
+	void (*end_io)(struct bio *bio);
+	void *private_data;
+
+	struct bio *next; /* next bio merged into the same request */
+};
+
+#define bio_for_each_vec(vec, bio) \
+	for (vec = (bio)->vecs; vec < (bio)->vecs + (bio)->nvecs; vec++)
+
+struct bio *bio_alloc(struct blkdev *dev, enum bio_op op, sector_t sector,
+		      unsigned short maxvecs);
+void bio_free(struct bio *bio);
+status_t bio_add_page(struct bio *bio, struct page *page, unsigned int len,
+		      unsigned int offset);
+
+struct blk_swq;
+struct blk_hwq;
+
+/* One or more adjacent bios handed to the driver as a unit */
+struct blk_request {
+	struct blkdev *dev;
+	struct blk_swq *swq; /* submission queue it was taken from */
+	struct blk_hwq *hwq; /* hardware queue it was dispatched to */
+	enum bio_op op;
+	sector_t sector;
+	size_t size;
+	unsigned int nsegs;
+
+	struct bio *bio, *biotail;
+
+	status_t status;
+	void *driver_data;
+
+	TAILQ_ENTRY(blk_request) entry;
+};
+
+#define rq_for_each_bio(bio, rq) for (bio = (rq)->bio; bio; bio = bio->next)
+
+TAILQ_HEAD(blk_rq_list, blk_request);
+
+/* per-cpu software queue, merges happen here, completions are per-cpu */
+struct blk_swq {
+	struct blkdev *dev;
+	struct blk_hwq *hwq;
+
+	struct spinlock lock;
+	struct blk_rq_list pending;
+};
+
+/* dispatch context of one hardware queue, fed by a subset of the swqs */
+struct blk_hwq {
+	struct blkdev *dev;
+	unsigned int index;
+
+	unsigned int inflight;
+	int dispatching;
+	int rerun;
+	size_t next_swq;
+
+	void *driver_data;
+};
+
+struct blkdev_ops {
+	/*
+	 * Start a request on rq->hwq, called at IPL_DPC. The driver finishes
+	 * it later with blk_complete(). YAK_BUSY puts it back onto the queue
+	 * until another request of the same hwq completes.
+	 */
+	status_t (*queue_rq)(struct blkdev *dev, struct blk_request *rq);
+};
+
+struct blkdev {
+	/* filled in by the driver */
+	char name[16];
+	struct blkdev_ops *ops;
+	void *driver_data;
+	sector_t nsectors;
+	unsigned int nr_hw_queues; /* 0 is treated as 1 */
+	unsigned int queue_depth; /* max requests owned per hw queue */
+	unsigned int max_segments; /* per request */
+	size_t max_request_size; /* in bytes */
+
+	/* block layer private */
+	int minor;
+	struct vnode *vnode;
+
+	struct blk_swq *swqs;
+	size_t nswqs;
+	struct blk_hwq *hwqs;
+
+	struct spinlock rq_lock;
+	struct blk_request *rq_free;
+	struct semaphore rq_sem;
+};
+
+status_t blkdev_register(struct blkdev *dev);
+struct blkdev *blkdev_lookup(int minor);
+/* accepts "vda" as well as "/dev/vda" */
+struct blkdev *blkdev_find(const char *name);
+
+/* may block for a free request, call at IPL_PASSIVE */
+void blk_submit(struct bio *bio);
+status_t blk_submit_wait(struct bio *bio);
+
+/* called by the driver, from any context */
+void blk_complete(struct blk_request *rq, status_t status);
+
+/* synchronous, byte granular i/o on a kernel buffer */
+status_t blkdev_rw(struct blkdev *dev, enum bio_op op, voff_t offset,
+		   void *buf, size_t length, size_t *done);
+
+#ifdef __cplusplus
+}
+#endif
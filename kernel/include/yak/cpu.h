@@ -19,6 +19,43 @@ struct cpumask {
 
 extern struct cpumask cpumask_active;
 
+static inline void cpumask_fill(struct cpumask *mask)
+{
+	for (size_t i = 0; i < CPUMASK_BITS_SIZE; i++)
+		mask->bits[i] = ~(cpumask_word_t)0;
+}
+
+static inline void cpumask_zero(struct cpumask *mask)
+{
+	for (size_t i = 0; i < CPUMASK_BITS_SIZE; i++)
+		mask->bits[i] = 0;
+}
+
+static inline void cpumask_set(struct cpumask *mask, size_t cpu)
+{
+	mask->bits[cpu / CPUMASK_BITS_PER_IDX] |=
+		(cpumask_word_t)1 << (cpu % CPUMASK_BITS_PER_IDX);
+}
+
+static inline bool cpumask_test(const struct cpumask *mask, size_t cpu)
+{
+	return (mask->bits[cpu / CPUMASK_BITS_PER_IDX] >>
+		(cpu % CPUMASK_BITS_PER_IDX)) &
+	       1;
+}
+
+// dst = a & b, returns whether any cpu is left
+static inline bool cpumask_and(struct cpumask *dst, const struct cpumask *a,
+			       const struct cpumask *b)
+{
+	cpumask_word_t any = 0;
+	for (size_t i = 0; i < CPUMASK_BITS_SIZE; i++) {
+		dst->bits[i] = a->bits[i] & b->bits[i];
+		any |= dst->bits[i];
+	}
+	return any != 0;
+}
+
 void cpu_init();
 void cpu_up(size_t id);
 
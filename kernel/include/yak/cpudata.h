@@ -14,6 +14,15 @@ extern "C" {
 #include <yak/kernel-file.h>
 #include <yak/sched.h>
 #include <yak/spinlock.h>
+#include <yak/vm/kstack.h>
+
+enum {
+	CPU_TIME_USER,
+	CPU_TIME_SYSTEM,
+	CPU_TIME_IRQ,
+	CPU_TIME_IDLE,
+	CPU_TIME_NR,
+};
 
 struct cpu {
 	struct cpu_md md;
@@ -21,6 +30,10 @@ struct cpu {
 
 	size_t cpu_id;
 
+	// cpus with the same id share a core or the last level cache
+	uint32_t core_id;
+	uint32_t llc_id;
+
 	void *syscall_temp;
 	void *kstack_top;
 
@@ -34,6 +47,12 @@ struct cpu {
 	struct kthread *next_thread;
 
 	unsigned long softint_pending;
+	// next to softint_pending, see idle.h
+	unsigned long idle_polling;
+	nstime_t idle_poll_ns;
+
+	// bumped whenever this cpu passes through a quiescent state
+	unsigned long rcu_qs;
 
 	struct spinlock dpc_lock;
 	LIST_HEAD(, dpc) dpc_queue;
@@ -42,6 +61,25 @@ struct cpu {
 	struct spinlock timer_lock;
 	HEAP_HEAD(timer_heap, timer) timer_heap;
 	struct dpc timer_update_dpc;
+
+	// only touched by this cpu, with interrupts off
+	nstime_t cpu_time[CPU_TIME_NR];
+	unsigned int irq_depth;
+	// see acct_loadavg
+	unsigned long loadavg[3];
+
+	// freed kernel stacks, only touched by this cpu at IPL_DPC
+	void *kstack_cache[KSTACK_CACHE_SIZE];
+	size_t kstack_cached;
+
+	// ends the slice of a running time-share thread
+	struct timer slice_timer;
+	struct dpc slice_dpc;
+	nstime_t slice_end;
+
+	// block requests completed here, only touched with interrupts off
+	TAILQ_HEAD(, blk_request) blk_done;
+	struct dpc blk_done_dpc;
 };
 
 #define curthread() curcpu().current_thread
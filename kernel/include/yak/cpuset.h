@@ -0,0 +1,35 @@
+#pragma once
+
+#include <yak/cpu.h>
+#include <yak/queue.h>
+#include <yak/status.h>
+#include <yak/types.h>
+#include <yak-abi/sched.h>
+
+struct kprocess;
+
+/*
+ * A named partition of the cpus. Threads of member processes only run on
+ * the cpus of their set, narrowed further by their own affinity mask.
+ */
+struct cpuset {
+	char name[CPUSET_NAME_MAX];
+	struct cpumask cpus;
+
+	LIST_HEAD(, kprocess) members;
+	LIST_ENTRY(cpuset) list_entry;
+};
+
+// the child starts out in the cpuset of its parent
+void cpuset_fork(struct kprocess *child, struct kprocess *parent);
+
+// create a set, or move an existing one to other cpus
+status_t cpuset_define(const char *name, const struct cpumask *cpus);
+status_t cpuset_destroy(const char *name);
+status_t cpuset_attach(struct kprocess *proc, const char *name);
+
+// tid names one of the threads of proc
+status_t cpuset_set_affinity(struct kprocess *proc, pid_t tid,
+			     const struct cpumask *mask);
+status_t cpuset_get_affinity(struct kprocess *proc, pid_t tid,
+			     struct cpumask *mask);
@@ -2,12 +2,16 @@
 
 #include <yak/refcount.h>
 #include <yak/mutex.h>
+#include <yak/queue.h>
 
 #define FILE_READ 0x1
 #define FILE_WRITE 0x2
 
+#define FD_LIMIT 65535
+
 struct vnode;
 struct kprocess;
+struct epitem;
 
 struct file {
 	struct vnode *vnode;
@@ -15,19 +19,55 @@ struct file {
 	unsigned long refcnt;
 	off_t offset;
 	unsigned int flags;
+	// epoll items watching this file, under the epoll mutex
+	LIST_HEAD(, epitem) epitems;
 };
 
 struct fd {
+	// never changes while the fd is installed
 	struct file *file;
 	unsigned int flags;
 };
 
+/*
+ * Per-process fd table, published with RCU so lookups take no lock.
+ * Changes are made under the process' fd_mutex; growing replaces the
+ * whole table.
+ */
+struct fdtable {
+	int cap;
+	// lowest fd that may be free
+	int next_fd;
+	struct fd **fds;
+	// one bit per installed or reserved fd
+	unsigned long *open_fds;
+	// one bit per open_fds word without a clear bit
+	unsigned long *full_fds;
+};
+
 void file_init(struct file *file);
+struct file *file_alloc();
 DECLARE_REFMAINT(file);
 
-status_t fd_alloc(struct kprocess *proc, int *fd);
-status_t fd_alloc_at(struct kprocess *proc, int fd);
+/* open path with O_* flags and install it at the lowest free fd */
+status_t fd_open(struct kprocess *proc, char *path, int flags, int *fdp);
+
+/* lockless, returns the file referenced or NULL if fd isn't open */
+struct file *fd_get_file(struct kprocess *proc, int fd);
+
+/* the following are called with fd_mutex held */
+
 status_t fd_grow(struct kprocess *proc, int new_cap);
-int fd_getnext(struct kprocess *proc);
+
+// install file at the lowest free fd, consuming the caller's reference;
+// flags are set before the fd becomes visible to lockless lookups
+status_t fd_alloc(struct kprocess *proc, struct file *file,
+		  unsigned int flags, int *fd);
+// same, at the given fd, which must not be open
+status_t fd_alloc_at(struct kprocess *proc, int fd, struct file *file,
+		     unsigned int flags);
 
 struct fd *fd_safe_get(struct kprocess *proc, int fd);
+
+// uninstall fd and drop its file reference once readers are done
+status_t fd_close(struct kprocess *proc, int fd);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <yak/status.h>
+#include <yak/types.h>
+#include <yak/fs/vfs.h>
+#include <yak-abi/epoll.h>
+
+struct file;
+
+status_t epoll_create(struct vnode **out);
+
+bool vn_is_epoll(struct vnode *vn);
+
+/* items are keyed by file and fd, like the fd they were added under */
+status_t epoll_ctl(struct vnode *vn, int op, struct file *file, int fd,
+		   const struct epoll_event *event);
+
+/*
+ * Report up to maxevents ready items, waiting up to timeout ns for the
+ * first one (0 doesn't wait, TIMER_INFINITE waits forever). Only the
+ * ready list is walked, never the whole interest set.
+ */
+status_t epoll_wait(struct vnode *vn, struct epoll_event *events,
+		    int maxevents, nstime_t timeout, int *nready);
+
+/* drop every item watching file, called as its last reference goes */
+void epoll_release_file(struct file *file);
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+
+/* on-disk ext2 structures, all little endian */
+
+#define EXT2_SUPER_MAGIC 0xEF53
+#define EXT2_SUPERBLOCK_OFFSET 1024
+
+#define EXT2_ROOT_INO 2
+#define EXT2_GOOD_OLD_REV 0
+#define EXT2_GOOD_OLD_FIRST_INO 11
+#define EXT2_GOOD_OLD_INODE_SIZE 128
+
+#define EXT2_NDIR_BLOCKS 12
+#define EXT2_IND_BLOCK 12
+#define EXT2_DIND_BLOCK 13
+#define EXT2_TIND_BLOCK 14
+#define EXT2_N_BLOCKS 15
+
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002
+
+#define EXT2_VALID_FS 0x0001
+
+#define EXT2_S_IFMT 0xF000
+#define EXT2_S_IFLNK 0xA000
+#define EXT2_S_IFREG 0x8000
+#define EXT2_S_IFBLK 0x6000
+#define EXT2_S_IFDIR 0x4000
+#define EXT2_S_IFCHR 0x2000
+#define EXT2_S_IFIFO 0x1000
+
+enum {
+	EXT2_FT_UNKNOWN = 0,
+	EXT2_FT_REG_FILE,
+	EXT2_FT_DIR,
+	EXT2_FT_CHRDEV,
+	EXT2_FT_BLKDEV,
+	EXT2_FT_FIFO,
+	EXT2_FT_SOCK,
+	EXT2_FT_SYMLINK,
+};
+
+struct ext2_super_block {
+	uint32_t s_inodes_count;
+	uint32_t s_blocks_count;
+	uint32_t s_r_blocks_count;
+	uint32_t s_free_blocks_count;
+	uint32_t s_free_inodes_count;
+	uint32_t s_first_data_block;
+	uint32_t s_log_block_size;
+	uint32_t s_log_frag_size;
+	uint32_t s_blocks_per_group;
+	uint32_t s_frags_per_group;
+	uint32_t s_inodes_per_group;
+	uint32_t s_mtime;
+	uint32_t s_wtime;
+	uint16_t s_mnt_count;
+	uint16_t s_max_mnt_count;
+	uint16_t s_magic;
+	uint16_t s_state;
+	uint16_t s_errors;
+	uint16_t s_minor_rev_level;
+	uint32_t s_lastcheck;
+	uint32_t s_checkinterval;
+	uint32_t s_creator_os;
+	uint32_t s_rev_level;
+	uint16_t s_def_resuid;
+	uint16_t s_def_resgid;
+	/* EXT2_DYNAMIC_REV */
+	uint32_t s_first_ino;
+	uint16_t s_inode_size;
+	uint16_t s_block_group_nr;
+	uint32_t s_feature_compat;
+	uint32_t s_feature_incompat;
+	uint32_t s_feature_ro_compat;
+	uint8_t s_uuid[16];
+	char s_volume_name[16];
+	char s_last_mounted[64];
+	uint32_t s_algo_bitmap;
+	uint8_t s_reserved[820];
+};
+
+_Static_assert(sizeof(struct ext2_super_block) == 1024);
+
+struct ext2_group_desc {
+	uint32_t bg_block_bitmap;
+	uint32_t bg_inode_bitmap;
+	uint32_t bg_inode_table;
+	uint16_t bg_free_blocks_count;
+	uint16_t bg_free_inodes_count;
+	uint16_t bg_used_dirs_count;
+	uint16_t bg_pad;
+	uint32_t bg_reserved[3];
+};
+
+_Static_assert(sizeof(struct ext2_group_desc) == 32);
+
+struct ext2_inode {
+	uint16_t i_mode;
+	uint16_t i_uid;
+	uint32_t i_size;
+	uint32_t i_atime;
+	uint32_t i_ctime;
+	uint32_t i_mtime;
+	uint32_t i_dtime;
+	uint16_t i_gid;
+	uint16_t i_links_count;
+	uint32_t i_blocks; /* in 512 byte units */
+	uint32_t i_flags;
+	uint32_t i_osd1;
+	uint32_t i_block[EXT2_N_BLOCKS];
+	uint32_t i_generation;
+	uint32_t i_file_acl;
+	uint32_t i_size_high; /* i_dir_acl before LARGE_FILE */
+	uint32_t i_faddr;
+	uint8_t i_osd2[12];
+};
+
+_Static_assert(sizeof(struct ext2_inode) == 128);
+
+struct ext2_dir_entry {
+	uint32_t inode;
+	uint16_t rec_len;
+	uint8_t name_len;
+	uint8_t file_type;
+	char name[];
+};
+
+#define EXT2_DIR_REC_LEN(name_len) (((name_len) + 8 + 3) & ~3)
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <yak/status.h>
+#include <yak/types.h>
+#include <yak/fs/vfs.h>
+#include <yak-abi/ioring.h>
+
+struct kprocess;
+
+/*
+ * Create a ring for proc and map it into its address space. The
+ * sizes, mapping address and offsets are reported back through p.
+ */
+status_t ioring_create(struct kprocess *proc, struct ioring_params *p,
+		       struct vnode **out);
+
+bool vn_is_ioring(struct vnode *vn);
+
+/*
+ * Submit up to to_submit queued sqes, then with IORING_ENTER_GETEVENTS
+ * wait until at least min_complete cqes are ready.
+ */
+status_t ioring_enter(struct vnode *vn, uint32_t to_submit,
+		      uint32_t min_complete, unsigned int flags,
+		      uint32_t *submitted);
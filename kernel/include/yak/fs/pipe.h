@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <yak/types.h>
+#include <yak/status.h>
+#include <yak/fs/vfs.h>
+
+/* both ends start with one reference, owned by the caller */
+status_t pipe_create(struct vnode **readp, struct vnode **writep);
+
+bool vn_is_pipe(struct vnode *vn);
+
+/*
+ * Move up to len bytes of src's page cache into the pipe, starting at
+ * offset. The pipe takes page references, no data is copied.
+ */
+status_t pipe_splice_in(struct vnode *pipe, struct vnode *src, voff_t offset,
+			size_t len, size_t *done);
+
+/*
+ * Move up to len bytes from the pipe to dst at offset. Whole pages the
+ * pipe owns are handed to dst's page cache instead of being copied.
+ */
+status_t pipe_splice_out(struct vnode *pipe, struct vnode *dst, voff_t offset,
+			 size_t len, size_t *done);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+#include <yak/status.h>
+#include <yak/fs/vfs.h>
+
+struct vm_object;
+
+// replace the contents of a regular tmpfs file, takes over the object ref
+status_t tmpfs_import(struct vnode *vn, struct vm_object *obj, size_t size);
@@ -4,9 +4,12 @@
 #include <yak/status.h>
 #include <yak/mutex.h>
 #include <yak/refcount.h>
+#include <yak/seqcount.h>
 #include <yak/vmflags.h>
+#include <yak-abi/uio.h>
 
 struct vm_map;
+struct poll_entry;
 
 struct vnode;
 
@@ -16,7 +19,12 @@ struct vfs {
 };
 
 struct vfs_ops {
-	status_t (*vfs_mount)(struct vnode *vroot);
+	/*
+	 * source names the backing device, NULL for virtual filesystems.
+	 * The new vfs is returned in out, vfs_mount makes it visible on vroot.
+	 */
+	status_t (*vfs_mount)(struct vnode *vroot, const char *source,
+			      struct vfs **out);
 	status_t (*vfs_unmount)(struct vfs *vfsp);
 	struct vnode *(*vfs_getroot)(struct vfs *vfsp);
 };
@@ -43,6 +51,9 @@ struct vnode {
 	refcount_t refcnt;
 	struct kmutex lock;
 
+	// bumped (under lock) on directory entry and mount changes
+	struct seqcount seq;
+
 	struct vfs *vfs;
 	struct vfs *mountedvfs;
 
@@ -62,6 +73,13 @@ struct dirent {
 struct vn_ops {
 	status_t (*vn_lookup)(struct vnode *vp, char *name, struct vnode **out);
 
+	/*
+	 * Optional. Called inside an rcu read section without the vnode lock;
+	 * must not block. Results are validated against vp->seq by the caller.
+	 */
+	status_t (*vn_lookup_rcu)(struct vnode *vp, const char *name,
+				  struct vnode **out);
+
 	status_t (*vn_create)(struct vnode *vp, enum vtype type, char *name,
 			      struct vnode **out);
 
@@ -70,8 +88,13 @@ struct vn_ops {
 
 	status_t (*vn_inactive)(struct vnode *vp);
 
+	/*
+	 * Fill buf with entries following the cookie at *offset (0 is the
+	 * start of the directory), and advance it to the last returned d_off.
+	 */
 	status_t (*vn_getdents)(struct vnode *vp, struct dirent *buf,
-				size_t bufsize, size_t *bytes_read);
+				size_t bufsize, off_t *offset,
+				size_t *bytes_read);
 
 	status_t (*vn_symlink)(struct vnode *parent, char *name, char *path,
 			       struct vnode **out);
@@ -95,6 +118,20 @@ struct vn_ops {
 
 	status_t (*vn_fallocate)(struct vnode *vp, int mode, off_t offset,
 				 off_t size);
+
+	/*
+	 * Optional. Called with the vnode lock held before length bytes at
+	 * offset are written through the page cache; the lock stays held
+	 * until they are copied in. Fails e.g. if there is no space for them.
+	 */
+	status_t (*vn_write_begin)(struct vnode *vp, voff_t offset,
+				   size_t length);
+
+	/*
+	 * Optional. Return which of events are ready. If pe is set, attach it
+	 * to the vnode's pollhead before looking at the state.
+	 */
+	short (*vn_poll)(struct vnode *vp, short events, struct poll_entry *pe);
 };
 
 #define VOP_INIT(vn, vfs_, ops_, type_)    \
@@ -102,13 +139,15 @@ struct vn_ops {
 	(vn)->type = type_;                \
 	(vn)->refcnt = 1;                  \
 	kmutex_init(&(vn)->lock, "vnode"); \
+	seqcount_init(&(vn)->seq);         \
 	(vn)->vfs = vfs_;                  \
 	(vn)->mountedvfs = NULL;
 
 #define VOP_LOOKUP(vp, name, out) vp->ops->vn_lookup(vp, name, out)
+#define VOP_LOOKUP_RCU(vp, name, out) vp->ops->vn_lookup_rcu(vp, name, out)
 #define VOP_CREATE(vp, type, name, out) vp->ops->vn_create(vp, type, name, out)
-#define VOP_GETDENTS(vp, buf, bufsize, bytes_read) \
-	vp->ops->vn_getdents(vp, buf, bufsize, bytes_read)
+#define VOP_GETDENTS(vp, buf, bufsize, offset, bytes_read) \
+	vp->ops->vn_getdents(vp, buf, bufsize, offset, bytes_read)
 
 #define VOP_WRITE(vp, offset, buf, count) \
 	vp->ops->vn_write(vp, offset, buf, count)
@@ -134,16 +173,18 @@ struct vn_ops {
 #define VOP_FALLOCATE(vp, mode, offset, size) \
 	vp->ops->vn_fallocate(vp, mode, offset, size)
 
+#define VOP_POLL(vp, events, pe) vp->ops->vn_poll(vp, events, pe)
+
 GENERATE_REFMAINT_INLINE(vnode, refcnt, p->ops->vn_inactive)
 
 void vfs_init();
 
 status_t vfs_register(const char *name, struct vfs_ops *ops);
 
-status_t vfs_mount(const char *path, char *fsname);
+status_t vfs_mount(const char *path, char *fsname, const char *source);
 
 status_t vfs_getdents(struct vnode *vn, struct dirent *buf, size_t bufsize,
-		      size_t *bytes_read);
+		      off_t *offset, size_t *bytes_read);
 
 status_t vfs_write(struct vnode *vn, size_t offset, const void *buf,
 		   size_t count, size_t *writtenp);
@@ -151,6 +192,20 @@ status_t vfs_write(struct vnode *vn, size_t offset, const void *buf,
 status_t vfs_read(struct vnode *vn, size_t offset, void *buf, size_t count,
 		  size_t *readp);
 
+/* scatter/gather variants, the whole iovec is one contiguous file range */
+status_t vfs_writev(struct vnode *vn, voff_t offset, const struct iovec *iov,
+		    int iovcnt, size_t *writtenp);
+
+status_t vfs_readv(struct vnode *vn, voff_t offset, const struct iovec *iov,
+		   int iovcnt, size_t *readp);
+
+/*
+ * Copy a range from src's page cache to dst without a bounce buffer,
+ * whole destination pages are replaced without being read in first.
+ */
+status_t vfs_copy_range(struct vnode *src, voff_t srcoff, struct vnode *dst,
+			voff_t dstoff, size_t length, size_t *copiedp);
+
 status_t vfs_create(char *path, enum vtype type, struct vnode **out);
 
 status_t vfs_open(char *path, struct vnode **out);
@@ -159,6 +214,12 @@ status_t vfs_symlink(char *link_path, char *dest_path, struct vnode **out);
 
 status_t vfs_ioctl(struct vnode *vn, unsigned long com, void *data);
 
+/* write back vn's dirty page cache pages */
+status_t vfs_fsync(struct vnode *vn);
+
+/* vnodes without vn_poll never block and are always ready */
+short vfs_poll(struct vnode *vn, short events, struct poll_entry *pe);
+
 status_t vfs_mmap(struct vnode *vn, struct vm_map *map, size_t length,
 		  voff_t offset, vm_prot_t prot, vm_inheritance_t inheritance,
 		  vaddr_t hint, int flags, vaddr_t *out);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <yak/status.h>
+#include <yak/types.h>
+
+/*
+ * Sleep while *uaddr == val until woken through a bitset that overlaps
+ * ours, or until the plat_getnanos() deadline (TIMER_INFINITE for none).
+ * A changed value fails with YAK_AGAIN without sleeping.
+ */
+status_t futex_wait(uint32_t *uaddr, uint32_t val, uint32_t bitset,
+		    bool shared, nstime_t deadline);
+
+status_t futex_wake(uint32_t *uaddr, int nr_wake, uint32_t bitset,
+		    bool shared, int *woken);
+
+/*
+ * Wake nr_wake waiters on uaddr and move up to nr_requeue more over to
+ * uaddr2. With cmpval, fails with YAK_AGAIN unless *uaddr still matches.
+ * count receives both woken and moved waiters.
+ */
+status_t futex_requeue(uint32_t *uaddr, uint32_t *uaddr2, int nr_wake,
+		       int nr_requeue, const uint32_t *cmpval, bool shared,
+		       int *count);
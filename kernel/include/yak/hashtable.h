@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <yak/status.h>
+#include <yak/seqcount.h>
 
 typedef uintptr_t hash_t;
 
@@ -37,8 +38,30 @@ status_t ht_resize(struct hashtable *tbl, size_t new_cap);
 status_t ht_set(struct hashtable *tbl, const void *key, size_t ken_len,
 		void *value, int overwrite);
 
+// grow ahead of time so that the next n ht_set_owned calls can't fail
+status_t ht_reserve(struct hashtable *tbl, size_t n);
+
+/*
+ * Never allocates or frees: the table takes over the kmalloc'ed key on
+ * success, and must have room for it, see ht_reserve.
+ */
+status_t ht_set_owned(struct hashtable *tbl, void *key, size_t key_len,
+		      void *value);
+
+// insert a new key inside a write section of sc, allocating beforehand;
+// growing the table is published inside the section as well
+status_t ht_set_seq(struct hashtable *tbl, const void *key, size_t key_len,
+		    void *value, struct seqcount *sc);
+
 void *ht_get(struct hashtable *tbl, const void *key, size_t key_len);
 
+/*
+ * Lookup without the lock serializing writers, inside an rcu read section.
+ * May spuriously fail or return a stale value while the table is being
+ * modified; callers must validate the result against their own seqcount.
+ */
+void *ht_get_rcu(struct hashtable *tbl, const void *key, size_t key_len);
+
 bool ht_del(struct hashtable *tbl, const void *key, size_t key_len);
 
 void ht_debug_dump(struct hashtable *tbl);
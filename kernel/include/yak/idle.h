@@ -0,0 +1,33 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yak/cpudata.h>
+#include <yak/types.h>
+
+/*
+ * An idle cpu first spins for a short, adaptive window and then sleeps
+ * through the platform. While idle_polling is set it notices writes to its
+ * softint_pending by itself, so softint_issue_other leaves out the ipi.
+ */
+
+static inline bool idle_work_pending(struct cpu *cpu)
+{
+	return __atomic_load_n(&cpu->softint_pending, __ATOMIC_SEQ_CST) ||
+	       __atomic_load_n(&cpu->next_thread, __ATOMIC_RELAXED);
+}
+
+// run by the idle thread at IPL_DPC, returns once there is work
+void cpu_idle(struct cpu *cpu);
+
+// whether a write to softint_pending wakes plat_idle
+bool plat_idle_watches();
+// called with interrupts disabled, returns with them enabled. Sleeps
+// unless idle_work_pending, deeper if deadline is far away.
+void plat_idle(struct cpu *cpu, nstime_t deadline);
+
+#ifdef __cplusplus
+}
+#endif
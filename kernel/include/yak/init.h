@@ -5,10 +5,8 @@ extern "C" {
 #endif
 
 #ifdef __cplusplus
-#define INIT_MODIFIER extern "C"
 #define INIT_DECL_MODIFIER "C"
 #else
-#define INIT_MODIFIER
 #define INIT_DECL_MODIFIER
 #endif
 
@@ -91,8 +89,10 @@ struct init_stage {
 	static init_node_t *node_name##_deps[] = { APPLY( \
 		DEP_PTR, ##__VA_ARGS__) NULL };
 
+// Declare first so C++ gets C linkage without an extern initializer
 #define INIT_NODE(node_name, node_func)                                     \
-	INIT_MODIFIER [[gnu::section(".init_node." #node_name), gnu::used]] \
+	INIT_GET_NODE(node_name)                                            \
+	[[gnu::section(".init_node." #node_name), gnu::used]]               \
 	init_node_t node_name = { .name = #node_name,                       \
 				  .func = node_func,                        \
 				  .entails_stages = node_name##_entails,    \
@@ -103,7 +103,9 @@ struct init_stage {
 				  .next = NULL };
 
 #define INIT_STAGE(stage_name)                                                \
-	INIT_MODIFIER init_node_t stage_name##_stage = {                      \
+	INIT_GET_NODE(stage_name##_stage)                                     \
+	INIT_GET_STAGE(stage_name)                                            \
+	init_node_t stage_name##_stage = {                                    \
 		.name = #stage_name "_stage",                                 \
 		.func = NULL,                                                 \
 		.entails_stages = NULL,                                       \
@@ -112,7 +114,7 @@ struct init_stage {
 		.executed = false,                                            \
 		.next = NULL                                                  \
 	};                                                                    \
-	INIT_MODIFIER [[gnu::section(".init_stage." #stage_name), gnu::used]] \
+	[[gnu::section(".init_stage." #stage_name), gnu::used]]               \
 	init_stage_t stage_name##_struct_stage = {                            \
 		.name = #stage_name,                                          \
 		.phony_node = &stage_name##_stage,                            \
@@ -3,3 +3,6 @@
 #include <stddef.h>
 
 void initrd_unpack_tar(const char *path, const char *data, size_t len);
+
+// unpack a plain or lz4-compressed tar archive
+void initrd_unpack(const char *path, const char *data, size_t len);
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <yak/queue.h>
+#include <yak/types.h>
+#include <yak/irq.h>
 #include <yak/io/pci/PciPersonality.hh>
 #include <yak/io/pci/Pci.hh>
 
@@ -15,7 +17,29 @@ struct PciDevice : public Device {
 	void initWithPci(uint32_t segment, uint32_t bus, uint32_t slot,
 			 uint32_t function);
 
+	uint8_t configRead8(uint32_t offset);
+	uint16_t configRead16(uint32_t offset);
+	uint32_t configRead32(uint32_t offset);
+	void configWrite16(uint32_t offset, uint16_t value);
+	void configWrite32(uint32_t offset, uint32_t value);
+
+	// enable memory decoding and optionally DMA
+	void enableMemory(bool busMaster);
+
+	// physical base of a memory BAR, 0 for io or unused BARs
+	paddr_t barAddress(unsigned int bar);
+
+	// config offset of the next capability with id after start, or 0
+	uint8_t findCapability(uint8_t id, uint8_t start = 0);
+
+	// number of MSI-X table entries, 0 if MSI-X is unsupported
+	size_t msixCount();
+	bool msixEnable();
+	void msixRoute(size_t entry, size_t cpu, irq_vec_t vector);
+
     private:
 	PciPersonality personality;
 	PciCoordinates coords;
+
+	volatile uint32_t *msixTable = nullptr;
 };
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <yak/types.h>
+#include <yak/spinlock.h>
+#include <yak/io/pci/PciDevice.hh>
+
+#define VIRTIO_PCI_VENDOR 0x1af4
+
+// device status
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED 128
+
+// transport and ring feature bits
+#define VIRTIO_F_INDIRECT_DESC (1ULL << 28)
+#define VIRTIO_F_EVENT_IDX (1ULL << 29)
+#define VIRTIO_F_VERSION_1 (1ULL << 32)
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_DESC_F_INDIRECT 4
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+#define VIRTIO_MSI_NO_VECTOR 0xffff
+
+struct virtq_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+
+struct virtq_avail {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];
+	// uint16_t used_event follows the ring
+};
+
+struct virtq_used_elem {
+	uint32_t id;
+	uint32_t len;
+};
+
+struct virtq_used {
+	uint16_t flags;
+	uint16_t idx;
+	struct virtq_used_elem ring[];
+	// uint16_t avail_event follows the ring
+};
+
+/*
+ * Split virtqueue. Every request occupies exactly one ring descriptor
+ * pointing to an indirect table, so descriptor ids double as request
+ * slots. Not locked, the owner serializes access.
+ */
+class Virtqueue {
+    public:
+	bool init(uint16_t index, uint16_t size, bool eventIdx);
+
+	// id of a free descriptor, or -1 if the ring is full
+	int allocDesc();
+
+	// publish descriptor id pointing to an indirect table
+	void pushIndirect(int id, paddr_t table, uint16_t count);
+
+	// make pushed descriptors visible, true if the device wants a kick
+	bool kickPrepare();
+
+	// next completed descriptor id, or -1
+	int popUsed(uint32_t *len);
+
+	/*
+	 * Ask for an interrupt on the next completion. Returns false if
+	 * completions arrived meanwhile and must be popped first.
+	 */
+	bool enableInterrupts();
+	void disableInterrupts();
+
+	uint16_t index = 0;
+	uint16_t size = 0;
+
+	paddr_t descPhys = 0, availPhys = 0, usedPhys = 0;
+	volatile uint16_t *notifyAddr = nullptr;
+
+    private:
+	volatile virtq_desc *desc = nullptr;
+	volatile virtq_avail *avail = nullptr;
+	volatile virtq_used *used = nullptr;
+
+	volatile uint16_t *usedEvent()
+	{
+		return &avail->ring[size];
+	}
+
+	volatile uint16_t *availEvent()
+	{
+		return (volatile uint16_t *)&used->ring[size];
+	}
+
+	bool eventIdx = false;
+
+	uint16_t freeHead = 0;
+	uint16_t numFree = 0;
+	uint16_t availIdx = 0;
+	uint16_t kickedIdx = 0;
+	uint16_t lastUsed = 0;
+};
+
+/* modern (virtio 1.x) PCI transport */
+class VirtioPci {
+    public:
+	bool init(PciDevice *pci);
+
+	void reset();
+	void setStatus(uint8_t status);
+	uint8_t getStatus();
+
+	uint64_t deviceFeatures();
+	// write the driver features and check the device accepted them
+	bool negotiate(uint64_t features);
+
+	uint16_t numQueues();
+	uint16_t maxQueueSize(uint16_t index);
+	bool setupQueue(Virtqueue *vq, uint16_t msixVector);
+	// config changes are not handled, keep them off the queue vectors
+	void disableConfigInterrupt();
+
+	volatile void *deviceConfig()
+	{
+		return devCfg;
+	}
+
+	void notify(Virtqueue *vq)
+	{
+		*vq->notifyAddr = vq->index;
+	}
+
+	PciDevice *pci = nullptr;
+
+    private:
+	volatile void *mapCap(uint8_t cap, size_t *len);
+
+	volatile uint8_t *common = nullptr;
+	volatile uint8_t *notifyBase = nullptr;
+	uint32_t notifyMultiplier = 0;
+	volatile void *devCfg = nullptr;
+};
@@ -97,6 +97,10 @@ void plat_set_irq_handler(irq_vec_t vec, irq_handler *fn);
 
 void arch_program_intr(uint8_t irq, irq_vec_t vector, int masked);
 
+// message address/data that deliver vector to the given cpu
+void arch_msi_compose(size_t cpu, irq_vec_t vector, uint64_t *address,
+		      uint32_t *data);
+
 #ifdef __cplusplus
 }
 #endif
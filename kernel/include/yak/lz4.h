@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <yak/status.h>
+
+#define LZ4_FRAME_MAGIC 0x184D2204
+#define LZ4_SKIPPABLE_MAGIC 0x184D2A50
+#define LZ4_SKIPPABLE_MASK 0xFFFFFFF0
+
+/*
+ * Decompress one raw lz4 block into dst. Matches may reach up to 64KiB
+ * back into dict, which must be the output immediately preceding dst
+ * (only needed for frames with linked blocks).
+ */
+status_t lz4_decompress_block(const void *src, size_t srclen, void *dst,
+			      size_t dstcap, const void *dict, size_t dictlen,
+			      size_t *outlen);
+
+struct lz4_block {
+	const void *data;
+	size_t size;
+	// stored as-is
+	bool uncompressed;
+};
+
+struct lz4_frame {
+	const uint8_t *pos, *end;
+	// within a frame
+	bool in_frame;
+	bool block_checksum;
+	bool content_checksum;
+	bool independent;
+	size_t block_max;
+};
+
+void lz4_frame_init(struct lz4_frame *fr, const void *data, size_t len);
+
+/*
+ * Returns YAK_SUCCESS with the next block, YAK_EOF after the last frame,
+ * or an error for malformed input. Concatenated and skippable frames
+ * are handled transparently; fr->block_max and fr->independent
+ * describe the frame the returned block belongs to.
+ */
+status_t lz4_frame_next(struct lz4_frame *fr, struct lz4_block *blk);
+
+bool lz4_is_frame(const void *data, size_t len);
@@ -5,6 +5,7 @@ extern "C" {
 #endif
 
 #include <yak/types.h>
+#include <yak/queue.h>
 #include <yak/object.h>
 #include <yak/status.h>
 #include <yak/wait.h>
@@ -18,6 +19,13 @@ struct kmutex {
 	const char *name;
 #endif
 	struct kthread *owner;
+
+	// priority inheritance, under the pi lock in mutex.c
+	size_t pi_waitcount;
+	TAILQ_HEAD(, kthread) pi_waiters;
+	// whose pi_held list we are on while there are waiters
+	struct kthread *pi_owner;
+	LIST_ENTRY(kmutex) pi_entry;
 };
 
 void kmutex_init(struct kmutex *mutex, const char *name);
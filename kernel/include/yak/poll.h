@@ -0,0 +1,48 @@
+#pragma once
+
+#include <yak/queue.h>
+#include <yak/spinlock.h>
+#include <yak/status.h>
+#include <yak/types.h>
+#include <yak-abi/poll.h>
+
+struct kevent;
+struct poll_entry;
+
+typedef void (*poll_notify_fn)(struct poll_entry *pe, short revents);
+
+/* kept by anything that can become ready, lists who is watching */
+struct pollhead {
+	struct spinlock lock;
+	LIST_HEAD(, poll_entry) entries;
+};
+
+struct poll_entry {
+	struct pollhead *head;
+	// POLLERR and POLLHUP are always of interest
+	short events;
+	// runs with the pollhead lock held, must not block
+	poll_notify_fn notify;
+	LIST_ENTRY(poll_entry) list_entry;
+};
+
+void pollhead_init(struct pollhead *ph);
+
+void poll_entry_init(struct poll_entry *pe, short events,
+		     poll_notify_fn notify);
+
+/* vn_poll attaches before sampling its state, so no change is missed */
+void pollhead_attach(struct pollhead *ph, struct poll_entry *pe);
+void pollhead_detach(struct poll_entry *pe);
+
+/*
+ * Tell watchers that revents may be ready now. The change has to be
+ * made under the lock vn_poll samples the state with.
+ */
+void pollhead_notify(struct pollhead *ph, short revents);
+
+/*
+ * Sleep on ev until it fires or the plat_getnanos() deadline passes,
+ * TIMER_INFINITE never passes. Returns YAK_TIMEOUT past the deadline.
+ */
+status_t poll_sleep(struct kevent *ev, nstime_t deadline);
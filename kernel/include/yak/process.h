@@ -5,6 +5,7 @@
 #include <yak/types.h>
 #include <yak/spinlock.h>
 #include <yak/file.h>
+#include <yak/kevent.h>
 #include <yak/refcount.h>
 #include <yak/vm/map.h>
 #include <yak/tty.h>
@@ -52,13 +53,26 @@ struct kprocess {
 	struct spinlock thread_list_lock;
 	size_t thread_count;
 	thread_list_t thread_list;
+	// exit codes waiting to be joined, oldest last, under thread_list_lock
+	TAILQ_HEAD(thread_exit_list, thread_exit) exited_threads;
+	size_t nexited;
+	struct kevent thread_exit_ev;
 
+	// serializes fd table changes, lookups go through fd_get_file()
 	struct kmutex fd_mutex;
-	int fd_cap;
-	struct fd **fds;
+	struct fdtable *fdtable;
 
 	struct vm_map *map;
 
+	// cpu time of exited threads and of exited children, under
+	// thread_list_lock
+	nstime_t utime, stime, itime;
+	nstime_t cutime, cstime;
+
+	// NULL for the kernel, which may run anywhere
+	struct cpuset *cpuset;
+	LIST_ENTRY(kprocess) cpuset_entry;
+
 	struct spinlock jobctl_lock;
 	struct session *session;
 	struct pgrp *pgrp;
@@ -80,6 +94,12 @@ void kprocess_init(struct kprocess *process);
 // initialize the kernel+user parts of a process
 void uprocess_init(struct kprocess *process, struct kprocess *parent);
 
+// free the exit records of threads nobody joined
+void kprocess_drop_thread_exits(struct kprocess *process);
+
+// process and thread ids come from the same space
+pid_t alloc_pid();
+
 struct kprocess *lookup_pid(pid_t pid);
 struct session *lookup_sid(pid_t sid);
 struct pgrp *lookup_pgid(pid_t pgid);
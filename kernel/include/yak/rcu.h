@@ -0,0 +1,49 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <yak/ipl.h>
+
+/*
+ * Read-side critical sections run at IPL_DPC, so they can neither be
+ * preempted nor block. A CPU that dispatches its DPC softint has left
+ * any reader it was in, which is what grace period detection relies on.
+ */
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+static inline ipl_t rcu_read_lock()
+{
+	return ripl(IPL_DPC);
+}
+
+static inline void rcu_read_unlock(ipl_t ipl)
+{
+	xipl(ipl);
+}
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+struct cpu;
+// called from the DPC softint handler
+void rcu_quiescent(struct cpu *cpu);
+
+// wait until all readers that may observe old data are gone
+void synchronize_rcu();
+
+// run func after a grace period, from the rcu thread
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+
+// free memory after a grace period
+void kfree_rcu(void *ptr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
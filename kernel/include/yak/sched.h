@@ -6,6 +6,7 @@ extern "C" {
 
 #include <stddef.h>
 #include <stdint.h>
+#include <yak/cpu.h>
 #include <yak/status.h>
 #include <yak/spinlock.h>
 #include <yak/types.h>
@@ -73,6 +74,8 @@ enum {
 
 #define KTHREAD_MAX_NAME_LEN 32
 
+struct kmutex;
+
 struct kthread {
 	struct md_pcb pcb;
 
@@ -94,16 +97,44 @@ struct kthread {
 	struct wait_block timeout_wait_block;
 	struct timer timeout_timer;
 
+	// time-share threads drift away from base_priority with their score
+	unsigned int base_priority;
 	unsigned int priority;
 	unsigned int status;
 
-	struct cpu *affinity_cpu;
+	// priority inheritance through kmutexes, see mutex.c
+	unsigned int pi_priority;
+	struct kmutex *pi_blocked_on;
+	LIST_HEAD(, kmutex) pi_held;
+	TAILQ_ENTRY(kthread) pi_wait_entry;
+
+	// decayed time spent running and sleeping, for the interactivity score
+	nstime_t run_time;
+	nstime_t sleep_time;
+	// when it last went on-cpu or was last charged for running
+	nstime_t slice_start;
+	bool interactive;
+
+	// cpu time, see acct.h
+	nstime_t utime;
+	nstime_t stime;
+	nstime_t itime;
+	nstime_t acct_stamp;
+	bool acct_user;
+
+	// what was asked for, and that narrowed down to the process's cpuset
+	struct cpumask affinity;
+	struct cpumask cpus_allowed;
 	struct cpu *last_cpu;
+	// when it last went off-cpu, for judging if its cache is still warm
+	nstime_t last_ran;
 
 	/* you can temporarily switch to another vm context */
 	struct vm_map *vm_ctx;
 
 	struct kprocess *owner_process;
+	// the first thread of a process shares its id
+	pid_t tid;
 
 #ifdef KERNEL_PROFILER
 	call_frame_t frames[MAX_FRAMES];
@@ -116,6 +147,22 @@ struct kthread {
 
 typedef TAILQ_HEAD(thread_queue, kthread) thread_queue_t;
 
+// what it competes with, including a priority it inherited
+static inline unsigned int sched_priority(const struct kthread *thread)
+{
+	unsigned int pi = __atomic_load_n(&thread->pi_priority,
+					  __ATOMIC_RELAXED);
+	return thread->priority > pi ? thread->priority : pi;
+}
+
+// what a thread keeps across being freed and reused, threads that don't
+// come from kthread_alloc need it before kthread_init
+void kthread_construct(struct kthread *thread);
+
+// constructed, from the kthread cache
+struct kthread *kthread_alloc();
+void kthread_free(struct kthread *thread);
+
 void kthread_init(struct kthread *thread, const char *name,
 		  unsigned int initial_priority, struct kprocess *process,
 		  int user_thread);
@@ -129,9 +176,15 @@ void kthread_destroy(struct kthread *thread);
 void kthread_context_init(struct kthread *thread, void *kstack_top,
 			  void *entrypoint, void *context1, void *context2);
 
+// set the thread pointer the thread enters userspace with
+void kthread_set_tls(struct kthread *thread, uintptr_t tls);
+
 void kthread_context_copy(const struct kthread *source_thread,
 			  struct kthread *dest_thread);
 
+// release what the context holds beyond the thread and its stack
+void kthread_context_destroy(struct kthread *thread);
+
 [[gnu::noreturn]]
 void kernel_enter_userspace(uint64_t ip, uint64_t sp);
 
@@ -147,6 +200,9 @@ struct sched {
 	struct runqueue *next_rq;
 
 	thread_queue_t idle_rq;
+
+	// threads on any of the queues, read locklessly by the balancer
+	size_t nr_ready;
 };
 
 void sched_init();
@@ -154,6 +210,9 @@ void sched_dynamic_init();
 
 void sched_insert(struct cpu *cpu, struct kthread *thread, int isOther);
 
+// hand the scheduling history of the parent down to a new thread
+void sched_fork(struct kthread *parent, struct kthread *child);
+
 void sched_preempt(struct cpu *cpu);
 
 void sched_resume(struct kthread *thread);
@@ -164,8 +223,24 @@ void sched_exit_self();
 
 void sched_yield(struct kthread *current, struct cpu *cpu);
 
+// restrict where the thread may run, it is moved off a cpu it just lost
+void sched_set_cpus_allowed(struct kthread *thread,
+			    const struct cpumask *allowed);
+
+// move the current thread if it may no longer run on this cpu
+void sched_migrate_self();
+
+// threads ready or running on the cpu, not counting its idle thread
+size_t sched_nr_running(struct cpu *cpu);
+
+// look for local or stealable work, called from the idle loop at IPL_DPC
+void sched_idle(struct cpu *cpu);
+
 void sched_wake_thread(struct kthread *thread, status_t status);
 
+// returns whether the inherited priority changed, called under the pi lock
+bool sched_set_pi_priority(struct kthread *thread, unsigned int priority);
+
 status_t launch_elf(struct kprocess *proc, char *path, int priority,
 		    char **argv, char **envp);
 
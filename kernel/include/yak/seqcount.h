@@ -0,0 +1,56 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yak/spinlock.h>
+
+/*
+ * Writers must be serialized by some other lock. An odd sequence means
+ * a write is in progress, write sections run at IPL_DPC and must neither
+ * block nor allocate. Readers never wait for a writer, they fail the read
+ * and take the writers' lock instead.
+ */
+struct seqcount {
+	unsigned int sequence;
+};
+
+#define SEQCOUNT_INITIALIZER() { .sequence = 0 }
+
+#define seqcount_init(sc)                                              \
+	do {                                                           \
+		__atomic_store_n(&(sc)->sequence, 0, __ATOMIC_RELAXED); \
+	} while (0)
+
+// false if a write is in progress
+static inline bool seqcount_read_begin(struct seqcount *sc, unsigned int *seq)
+{
+	*seq = __atomic_load_n(&sc->sequence, __ATOMIC_ACQUIRE);
+	return (*seq & 1) == 0;
+}
+
+// nonzero if a writer raced with the read section started at seq
+static inline int seqcount_read_retry(struct seqcount *sc, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&sc->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+static inline ipl_t seqcount_write_begin(struct seqcount *sc)
+{
+	ipl_t ipl = ripl(IPL_DPC);
+	__atomic_store_n(&sc->sequence, sc->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return ipl;
+}
+
+static inline void seqcount_write_end(struct seqcount *sc, ipl_t ipl)
+{
+	__atomic_store_n(&sc->sequence, sc->sequence + 1, __ATOMIC_RELEASE);
+	xipl(ipl);
+}
+
+#ifdef __cplusplus
+}
+#endif
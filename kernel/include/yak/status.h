@@ -27,6 +27,9 @@ typedef enum status {
 	YAK_EOF,
 	YAK_MFILE, /* process has too many opened files */
 	YAK_PERM_DENIED,
+	YAK_BADF, /* not an open file descriptor */
+	YAK_PIPE, /* write to a pipe without readers */
+	YAK_AGAIN, /* state changed under us, try again */
 } status_t;
 
 #define IS_OK(x) (likely((x) == YAK_SUCCESS))
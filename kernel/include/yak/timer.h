@@ -42,6 +42,9 @@ struct timer {
 	nstime_t deadline;
 	short state;
 
+	// enqueued on the timer's cpu when it fires, if set
+	struct dpc *dpc;
+
 	HEAP_ENTRY(timer) entry;
 };
 
@@ -51,6 +54,9 @@ void timer_reset(struct timer *timer);
 status_t timer_install(struct timer *timer, nstime_t ns_delta);
 void timer_uninstall(struct timer *timer);
 
+// earliest deadline queued on this cpu, TIMER_INFINITE if none
+nstime_t timer_next_deadline();
+
 void ksleep(nstime_t ns);
 void kstall(nstime_t ns);
 
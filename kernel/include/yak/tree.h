@@ -881,31 +881,36 @@ int _rb_check(const struct rb_type *, void *, unsigned long);
 	__unused static inline struct _type *_name##_RBT_INSERT(               \
 		struct _name *head, struct _type *elm)                         \
 	{                                                                      \
-		return _rb_insert(_name##_RBT_TYPE, &head->rbh_root, elm);     \
+		return (struct _type *)                                        \
+			_rb_insert(_name##_RBT_TYPE, &head->rbh_root, elm);    \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_REMOVE(               \
 		struct _name *head, struct _type *elm)                         \
 	{                                                                      \
-		return _rb_remove(_name##_RBT_TYPE, &head->rbh_root, elm);     \
+		return (struct _type *)                                        \
+			_rb_remove(_name##_RBT_TYPE, &head->rbh_root, elm);    \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_FIND(                 \
 		struct _name *head, const struct _type *key)                   \
 	{                                                                      \
-		return _rb_find(_name##_RBT_TYPE, &head->rbh_root, key);       \
+		return (struct _type *)                                        \
+			_rb_find(_name##_RBT_TYPE, &head->rbh_root, key);      \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_NFIND(                \
 		struct _name *head, const struct _type *key)                   \
 	{                                                                      \
-		return _rb_nfind(_name##_RBT_TYPE, &head->rbh_root, key);      \
+		return (struct _type *)                                        \
+			_rb_nfind(_name##_RBT_TYPE, &head->rbh_root, key);     \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_ROOT(                 \
 		struct _name *head)                                            \
 	{                                                                      \
-		return _rb_root(_name##_RBT_TYPE, &head->rbh_root);            \
+		return (struct _type *)                                        \
+			_rb_root(_name##_RBT_TYPE, &head->rbh_root);           \
 	}                                                                      \
                                                                                \
 	__unused static inline int _name##_RBT_EMPTY(struct _name *head)       \
@@ -916,43 +921,45 @@ int _rb_check(const struct rb_type *, void *, unsigned long);
 	__unused static inline struct _type *_name##_RBT_MIN(                  \
 		struct _name *head)                                            \
 	{                                                                      \
-		return _rb_min(_name##_RBT_TYPE, &head->rbh_root);             \
+		return (struct _type *)                                        \
+			_rb_min(_name##_RBT_TYPE, &head->rbh_root);            \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_MAX(                  \
 		struct _name *head)                                            \
 	{                                                                      \
-		return _rb_max(_name##_RBT_TYPE, &head->rbh_root);             \
+		return (struct _type *)                                        \
+			_rb_max(_name##_RBT_TYPE, &head->rbh_root);            \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_NEXT(                 \
 		struct _type *elm)                                             \
 	{                                                                      \
-		return _rb_next(_name##_RBT_TYPE, elm);                        \
+		return (struct _type *)_rb_next(_name##_RBT_TYPE, elm);        \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_PREV(                 \
 		struct _type *elm)                                             \
 	{                                                                      \
-		return _rb_prev(_name##_RBT_TYPE, elm);                        \
+		return (struct _type *)_rb_prev(_name##_RBT_TYPE, elm);        \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_LEFT(                 \
 		struct _type *elm)                                             \
 	{                                                                      \
-		return _rb_left(_name##_RBT_TYPE, elm);                        \
+		return (struct _type *)_rb_left(_name##_RBT_TYPE, elm);        \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_RIGHT(                \
 		struct _type *elm)                                             \
 	{                                                                      \
-		return _rb_right(_name##_RBT_TYPE, elm);                       \
+		return (struct _type *)_rb_right(_name##_RBT_TYPE, elm);       \
 	}                                                                      \
                                                                                \
 	__unused static inline struct _type *_name##_RBT_PARENT(               \
 		struct _type *elm)                                             \
 	{                                                                      \
-		return _rb_parent(_name##_RBT_TYPE, elm);                      \
+		return (struct _type *)_rb_parent(_name##_RBT_TYPE, elm);      \
 	}                                                                      \
                                                                                \
 	__unused static inline void _name##_RBT_SET_LEFT(struct _type *elm,    \
@@ -1,3 +1,14 @@
 #pragma once
 
+#include <yak/status.h>
+#include <yak/types.h>
+
+struct vm_object;
+
 struct vm_object *vm_aobj_create();
+
+/*
+ * Populate [offset, offset+length) with zeroed pages, using the largest
+ * buddy blocks that fit so the range can be mapped with large pages.
+ */
+status_t vm_aobj_reserve(struct vm_object *obj, voff_t offset, size_t length);
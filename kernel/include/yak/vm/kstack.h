@@ -0,0 +1,22 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Kernel stacks are KSTACK_SIZE of mapped memory above an unmapped guard
+ * page, so an overflow faults instead of running into the neighbour. Freed
+ * stacks stay mapped, first in a small per-cpu cache and then in a global
+ * list.
+ */
+
+#define KSTACK_CACHE_SIZE 8
+
+// returns the top of the new stack, or NULL
+void *kstack_alloc();
+void kstack_free(void *top);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,12 @@ struct vm_pagerops {
 	/*! Pager name */
 	const char *pgo_name;
 
+	/*!
+	 * Pages following a missing one that vm_lookuppage() asks for in the
+	 * same pgo_get call, capped at VM_MAX_READAHEAD. 0 disables readahead.
+	 */
+	unsigned int pgo_readahead;
+
 	/*! Init private pager data structures, run once at boot */
 	void (*pgo_init)();
 
@@ -43,9 +49,12 @@ struct vm_pagerops {
 			    unsigned int centeridx, vm_prot_t access_type,
 			    unsigned int flags);
 
-	// put page(s) into backing store
-	uintptr_t (*pa_put)(struct vm_object *object, struct page **pages,
-			    voff_t offset);
+	/*!
+	 * Write back npages pages of consecutive offsets, called by
+	 * vm_object_sync() with the object lock held
+	 */
+	status_t (*pa_put)(struct vm_object *object, struct page **pages,
+			   unsigned int npages);
 
 	// makes additional bookkeeping possible
 	// like inc'ing vnode reference??
@@ -56,16 +65,42 @@ struct vm_pagerops {
 	void (*pgo_cleanup)(struct vm_object *obj);
 };
 
+#define VM_MAX_READAHEAD 16U
+
+// some page in memq has VM_PG_DIRTY set
+#define VM_OBJ_DIRTY 0x1
+
 struct vm_object {
 	struct kmutex obj_lock;
 	struct vm_pagerops *pg_ops;
 	struct vm_page_tree memq;
 	refcount_t refcnt;
+	unsigned long flags;
 };
 
 DECLARE_REFMAINT(vm_object);
 
 void vm_object_common_init(struct vm_object *obj, struct vm_pagerops *pgops);
 
+#define LOOKUP_ONLY 0x1
+// the caller is about to modify the page or map it shared
+#define LOOKUP_WRITE 0x2
 status_t vm_lookuppage(struct vm_object *obj, voff_t offset, int flags,
 		       struct page **pagep);
+
+// mark a resident page modified, it is written back by the next sync
+void vm_page_dirty(struct page *pg);
+
+// write all dirty pages back to the pager
+status_t vm_object_sync(struct vm_object *obj);
+
+/*
+ * Overwrite the page at offset with src, the pager isn't asked to fill it.
+ * This and vm_object_donate drop a VM_PG_RDONLY page instead of writing it.
+ */
+status_t vm_object_copyin(struct vm_object *obj, voff_t offset,
+			  struct page *src);
+
+// insert an unowned page at offset, consuming the caller's reference
+status_t vm_object_donate(struct vm_object *obj, voff_t offset,
+			  struct page *pg);
@@ -13,6 +13,12 @@ extern "C" {
 #include <yak/queue.h>
 
 #define VM_PG_FAKE 0x1
+// part of a physically contiguous, large page aligned run in its object
+#define VM_PG_LARGE 0x2
+// modified since it was last written back to the pager
+#define VM_PG_DIRTY 0x4
+// backed by memory that isn't ours to write, copied before the first write
+#define VM_PG_RDONLY 0x8
 
 struct page {
 	paddr_t pfn;
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+#include <yak/types.h>
+
+/*
+ * Object backed by a range of physical memory that isn't managed by the
+ * pmm (e.g. a bootloader module). Whole, page-aligned pages of the range
+ * are handed out directly; partial pages are copied on first access and
+ * anything past the range is zero-filled like anonymous memory.
+ * The range must stay allocated and belong to this object only.
+ */
+struct vm_object *vm_physobj_create(paddr_t base, size_t size);
@@ -19,6 +19,9 @@ void pmap_init(struct pmap *pmap);
 void pmap_map(struct pmap *pmap, uintptr_t va, uintptr_t pa, size_t level,
 	      vm_prot_t prot, vm_cache_t cache);
 
+// true if nothing is mapped in the level-sized slot around va
+bool pmap_is_vacant(struct pmap *pmap, uintptr_t va, size_t level);
+
 paddr_t pmap_unmap(struct pmap *pmap, uintptr_t va, size_t level);
 
 void pmap_unmap_range(struct pmap *pmap, uintptr_t va, size_t length,
@@ -34,6 +34,9 @@ struct page *pmm_alloc_order(unsigned int order);
 
 void pmm_free_pages_order(struct page *page, unsigned int order);
 
+// turn an allocated block into individually freeable order 0 pages
+void pmm_split_order(struct page *page, unsigned int order);
+
 void pmm_free_order(paddr_t addr, unsigned int order);
 
 void pmm_dump();
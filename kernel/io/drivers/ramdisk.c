@@ -0,0 +1,126 @@
+#define pr_fmt(fmt) "ramdisk: " fmt
+
+#include <string.h>
+#include <yak/blk.h>
+#include <yak/heap.h>
+#include <yak/init.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/vm/page.h>
+#include <yak/vm/pmm.h>
+
+#define RAMDISK_SIZE MiB(64)
+#define RAMDISK_QUEUE_DEPTH 32
+
+/*
+ * Memory backed block device. Pages are only allocated once written,
+ * unwritten ranges read back as zeroes.
+ */
+struct ramdisk {
+	struct blkdev dev;
+	struct page **pages;
+	size_t npages;
+};
+
+// copy len bytes at byte offset pos of the disk from/to buf
+static status_t ramdisk_copy(struct ramdisk *rd, enum bio_op op, voff_t pos,
+			     char *buf, size_t len)
+{
+	while (len > 0) {
+		size_t idx = pos >> PAGE_SHIFT;
+		size_t off = pos & (PAGE_SIZE - 1);
+		size_t n = MIN(len, PAGE_SIZE - off);
+
+		struct page *pg = rd->pages[idx];
+
+		if (op == BIO_READ) {
+			if (pg)
+				memcpy(buf, (char *)page_to_mapped_addr(pg) + off,
+				       n);
+			else
+				memset(buf, 0, n);
+		} else {
+			if (!pg) {
+				pg = pmm_alloc_order(0);
+				if (!pg)
+					return YAK_OOM;
+				page_zero(pg, 0);
+				rd->pages[idx] = pg;
+			}
+			memcpy((char *)page_to_mapped_addr(pg) + off, buf, n);
+		}
+
+		pos += n;
+		buf += n;
+		len -= n;
+	}
+
+	return YAK_SUCCESS;
+}
+
+static status_t ramdisk_queue_rq(struct blkdev *dev, struct blk_request *rq)
+{
+	struct ramdisk *rd = dev->driver_data;
+
+	if (rq->op == BIO_FLUSH) {
+		blk_complete(rq, YAK_SUCCESS);
+		return YAK_SUCCESS;
+	}
+
+	voff_t pos = rq->sector << SECTOR_SHIFT;
+	status_t rv = YAK_SUCCESS;
+
+	struct bio *bio;
+	struct bio_vec *vec;
+	rq_for_each_bio(bio, rq)
+	{
+		bio_for_each_vec(vec, bio)
+		{
+			char *buf = (char *)page_to_mapped_addr(vec->page) +
+				    vec->offset;
+			rv = ramdisk_copy(rd, rq->op, pos, buf, vec->len);
+			IF_ERR(rv) goto out;
+			pos += vec->len;
+		}
+	}
+
+out:
+	blk_complete(rq, rv);
+	return YAK_SUCCESS;
+}
+
+static struct blkdev_ops ramdisk_ops = {
+	.queue_rq = ramdisk_queue_rq,
+};
+
+static void ramdisk_init()
+{
+	struct ramdisk *rd = kzalloc(sizeof(struct ramdisk));
+	if (!rd)
+		goto oom;
+
+	rd->npages = RAMDISK_SIZE >> PAGE_SHIFT;
+	rd->pages = kcalloc(rd->npages, sizeof(struct page *));
+	if (!rd->pages) {
+		kfree(rd, sizeof(struct ramdisk));
+		goto oom;
+	}
+
+	strncpy(rd->dev.name, "ram0", sizeof(rd->dev.name));
+	rd->dev.ops = &ramdisk_ops;
+	rd->dev.driver_data = rd;
+	rd->dev.nsectors = RAMDISK_SIZE >> SECTOR_SHIFT;
+	rd->dev.queue_depth = RAMDISK_QUEUE_DEPTH;
+	rd->dev.max_segments = 128;
+	rd->dev.max_request_size = MiB(1);
+
+	EXPECT(blkdev_register(&rd->dev));
+	return;
+
+oom:
+	pr_warn("not enough memory\n");
+}
+
+INIT_ENTAILS(ramdisk);
+INIT_DEPS(ramdisk, fs_devfs_mount);
+INIT_NODE(ramdisk, ramdisk_init);
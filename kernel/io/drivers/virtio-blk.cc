@@ -0,0 +1,403 @@
+#define pr_fmt(fmt) "virtio-blk: " fmt
+
+#include <string.h>
+#include <nanoprintf.h>
+#include <yak/blk.h>
+#include <yak/cpu.h>
+#include <yak/heap.h>
+#include <yak/init.h>
+#include <yak/irq.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/vm.h>
+#include <yak/vm/page.h>
+#include <yak/vm/pmm.h>
+#include <yak/io/base.hh>
+#include <yak/io/Device.hh>
+#include <yak/io/pci/PciDevice.hh>
+#include <yak/io/pci/PciPersonality.hh>
+#include <yak/io/virtio/Virtio.hh>
+
+#define VIRTIO_BLK_F_SIZE_MAX (1ULL << 1)
+#define VIRTIO_BLK_F_SEG_MAX (1ULL << 2)
+#define VIRTIO_BLK_F_RO (1ULL << 5)
+#define VIRTIO_BLK_F_BLK_SIZE (1ULL << 6)
+#define VIRTIO_BLK_F_FLUSH (1ULL << 9)
+#define VIRTIO_BLK_F_MQ (1ULL << 12)
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_BLK_S_OK 0
+
+// virtio_blk_config
+#define CFG_CAPACITY 0
+#define CFG_SEG_MAX 12
+#define CFG_NUM_QUEUES 34
+
+#define VBLK_MAX_QUEUE_SIZE 128
+// header and status take two entries of the indirect table
+#define VBLK_MAX_SEGMENTS 126
+
+struct virtio_blk_req_hdr {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+};
+
+/*
+ * Per ring slot page: request header, status byte and the indirect
+ * descriptor table describing the whole request.
+ */
+struct vblk_slot {
+	struct virtio_blk_req_hdr hdr;
+	uint8_t status;
+	uint8_t pad[15];
+	struct virtq_desc table[VBLK_MAX_SEGMENTS + 2];
+};
+
+static_assert(sizeof(struct vblk_slot) <= PAGE_SIZE);
+
+class VirtioBlk;
+
+struct VblkQueue {
+	Virtqueue vq;
+	struct spinlock lock;
+	struct irq_object irq;
+
+	paddr_t *slots;
+	struct blk_request **rqs;
+};
+
+class VirtioBlk final : public Device {
+	IO_OBJ_DECLARE(VirtioBlk);
+
+    public:
+	int probe([[maybe_unused]] Device *provider) override
+	{
+		return 100;
+	}
+
+	bool start(Device *provider) override;
+
+	void stop(Device *provider) override
+	{
+		(void)provider;
+	};
+
+	static status_t queueRq(struct blkdev *dev, struct blk_request *rq);
+	static int irqHandler(void *arg);
+
+    private:
+	bool setupQueues(uint16_t count, uint16_t qsize);
+	void fail(const char *why);
+
+	VirtioPci transport;
+	uint64_t features = 0;
+
+	VblkQueue *queues = nullptr;
+	uint16_t nqueues = 0;
+
+	struct blkdev dev;
+};
+
+IO_OBJ_DEFINE(VirtioBlk, Device);
+
+static struct blkdev_ops vblk_ops = {
+	.queue_rq = VirtioBlk::queueRq,
+};
+
+static size_t vblk_count;
+
+static inline struct vblk_slot *slot_ptr(VblkQueue *q, int id)
+{
+	return (struct vblk_slot *)p2v(q->slots[id]);
+}
+
+status_t VirtioBlk::queueRq(struct blkdev *dev, struct blk_request *rq)
+{
+	VirtioBlk *self = (VirtioBlk *)dev->driver_data;
+	VblkQueue *q = &self->queues[rq->hwq->index];
+
+	if (rq->op == BIO_FLUSH && !(self->features & VIRTIO_BLK_F_FLUSH)) {
+		blk_complete(rq, YAK_SUCCESS);
+		return YAK_SUCCESS;
+	} else if (rq->op == BIO_WRITE &&
+		   (self->features & VIRTIO_BLK_F_RO)) {
+		blk_complete(rq, YAK_PERM_DENIED);
+		return YAK_SUCCESS;
+	}
+
+	int state = spinlock_lock_interrupts(&q->lock);
+
+	int id = q->vq.allocDesc();
+	if (id == -1) {
+		spinlock_unlock_interrupts(&q->lock, state);
+		return YAK_BUSY;
+	}
+
+	struct vblk_slot *slot = slot_ptr(q, id);
+	paddr_t slotPhys = q->slots[id];
+
+	switch (rq->op) {
+	case BIO_READ:
+		slot->hdr.type = VIRTIO_BLK_T_IN;
+		break;
+	case BIO_WRITE:
+		slot->hdr.type = VIRTIO_BLK_T_OUT;
+		break;
+	case BIO_FLUSH:
+		slot->hdr.type = VIRTIO_BLK_T_FLUSH;
+		break;
+	}
+	slot->hdr.reserved = 0;
+	slot->hdr.sector = rq->op == BIO_FLUSH ? 0 : rq->sector;
+	slot->status = 0xff;
+
+	uint16_t n = 0;
+	slot->table[n].addr = slotPhys + offsetof(struct vblk_slot, hdr);
+	slot->table[n].len = sizeof(struct virtio_blk_req_hdr);
+	slot->table[n].flags = VIRTQ_DESC_F_NEXT;
+	slot->table[n].next = n + 1;
+	n++;
+
+	uint16_t dataFlags = VIRTQ_DESC_F_NEXT;
+	if (rq->op == BIO_READ)
+		dataFlags |= VIRTQ_DESC_F_WRITE;
+
+	struct bio *bio;
+	struct bio_vec *vec;
+	rq_for_each_bio(bio, rq)
+	{
+		bio_for_each_vec(vec, bio)
+		{
+			assert(n <= VBLK_MAX_SEGMENTS);
+			slot->table[n].addr = page_to_addr(vec->page) +
+					      vec->offset;
+			slot->table[n].len = vec->len;
+			slot->table[n].flags = dataFlags;
+			slot->table[n].next = n + 1;
+			n++;
+		}
+	}
+
+	slot->table[n].addr = slotPhys + offsetof(struct vblk_slot, status);
+	slot->table[n].len = 1;
+	slot->table[n].flags = VIRTQ_DESC_F_WRITE;
+	slot->table[n].next = 0;
+	n++;
+
+	q->rqs[id] = rq;
+	q->vq.pushIndirect(id, slotPhys + offsetof(struct vblk_slot, table), n);
+
+	if (q->vq.kickPrepare())
+		self->transport.notify(&q->vq);
+
+	spinlock_unlock_interrupts(&q->lock, state);
+	return YAK_SUCCESS;
+}
+
+/*
+ * Drain everything the device completed. With event index the device
+ * only raises another interrupt once it passes used_event, so completions
+ * that pile up while we run are picked up by the same interrupt.
+ */
+int VirtioBlk::irqHandler(void *arg)
+{
+	VblkQueue *q = (VblkQueue *)arg;
+
+	int state = spinlock_lock_interrupts(&q->lock);
+
+	do {
+		q->vq.disableInterrupts();
+
+		int id;
+		while ((id = q->vq.popUsed(nullptr)) != -1) {
+			struct blk_request *rq = q->rqs[id];
+			q->rqs[id] = nullptr;
+			assert(rq);
+
+			uint8_t st = slot_ptr(q, id)->status;
+			blk_complete(rq,
+				     st == VIRTIO_BLK_S_OK ? YAK_SUCCESS : YAK_IO);
+		}
+	} while (!q->vq.enableInterrupts());
+
+	spinlock_unlock_interrupts(&q->lock, state);
+	return IRQ_ACK;
+}
+
+void VirtioBlk::fail(const char *why)
+{
+	pr_warn("%s\n", why);
+	transport.setStatus(VIRTIO_STATUS_FAILED);
+}
+
+bool VirtioBlk::setupQueues(uint16_t count, uint16_t qsize)
+{
+	queues = (VblkQueue *)kcalloc(count, sizeof(VblkQueue));
+	if (!queues)
+		return false;
+
+	bool eventIdx = features & VIRTIO_F_EVENT_IDX;
+
+	for (uint16_t i = 0; i < count; i++) {
+		VblkQueue *q = &queues[i];
+		spinlock_init(&q->lock);
+
+		q->slots = (paddr_t *)kcalloc(qsize, sizeof(paddr_t));
+		q->rqs = (struct blk_request **)kcalloc(
+			qsize, sizeof(struct blk_request *));
+		if (!q->slots || !q->rqs)
+			return false;
+
+		for (uint16_t s = 0; s < qsize; s++) {
+			q->slots[s] = pmm_alloc_zeroed();
+			if (!q->slots[s])
+				return false;
+		}
+
+		if (!q->vq.init(i, qsize, eventIdx))
+			return false;
+
+		irq_object_init(&q->irq, irqHandler, q);
+		if (IS_ERR(irq_alloc_ipl(&q->irq, IPL_DEVICE, IRQ_MIN_IPL,
+					 PIN_CONFIG_ANY)))
+			return false;
+
+		// completions come back to the cpu that owns the queue
+		transport.pci->msixRoute(i, i, q->irq.slot->vector);
+
+		if (!transport.setupQueue(&q->vq, i))
+			return false;
+
+		nqueues++;
+	}
+
+	return true;
+}
+
+bool VirtioBlk::start(Device *provider)
+{
+	if (!Device::start(provider))
+		return false;
+
+	auto pci = provider->safe_cast<PciDevice>();
+	if (!pci || !transport.init(pci))
+		return false;
+
+	// INTx can't be routed as level triggered yet
+	size_t nvec = pci->msixCount();
+	if (nvec == 0 || !pci->msixEnable()) {
+		pr_warn("device has no msi-x\n");
+		return false;
+	}
+
+	transport.reset();
+	transport.setStatus(VIRTIO_STATUS_ACKNOWLEDGE);
+	transport.setStatus(VIRTIO_STATUS_DRIVER);
+
+	uint64_t offered = transport.deviceFeatures();
+	if (!(offered & VIRTIO_F_VERSION_1)) {
+		fail("legacy devices are not supported");
+		return false;
+	}
+
+	features = offered &
+		   (VIRTIO_F_VERSION_1 | VIRTIO_F_EVENT_IDX |
+		    VIRTIO_F_INDIRECT_DESC | VIRTIO_BLK_F_SEG_MAX |
+		    VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_MQ);
+
+	if (!(features & VIRTIO_F_INDIRECT_DESC)) {
+		fail("indirect descriptors are required");
+		return false;
+	}
+
+	if (!transport.negotiate(features)) {
+		fail("feature negotiation failed");
+		return false;
+	}
+
+	volatile uint8_t *cfg = (volatile uint8_t *)transport.deviceConfig();
+	if (!cfg) {
+		fail("no device config");
+		return false;
+	}
+
+	uint64_t capacity = *(volatile uint64_t *)(cfg + CFG_CAPACITY);
+	unsigned int segMax = VBLK_MAX_SEGMENTS;
+	if (features & VIRTIO_BLK_F_SEG_MAX)
+		segMax = MIN(*(volatile uint32_t *)(cfg + CFG_SEG_MAX),
+			     (unsigned int)VBLK_MAX_SEGMENTS);
+
+	size_t count = 1;
+	if (features & VIRTIO_BLK_F_MQ)
+		count = *(volatile uint16_t *)(cfg + CFG_NUM_QUEUES);
+	count = MIN(count, (size_t)transport.numQueues());
+	count = MIN(count, cpus_online());
+	count = MIN(count, nvec);
+	count = MIN(count, (size_t)BLK_MAX_HW_QUEUES);
+
+	// the ring size must be a power of two and is the same for all queues
+	uint16_t qsize = MIN(transport.maxQueueSize(0),
+			     (uint16_t)VBLK_MAX_QUEUE_SIZE);
+	while (qsize & (qsize - 1))
+		qsize &= qsize - 1;
+
+	if (count == 0 || qsize == 0 || segMax == 0) {
+		fail("bad device configuration");
+		return false;
+	}
+
+	transport.disableConfigInterrupt();
+
+	if (!setupQueues(count, qsize)) {
+		fail("queue setup failed");
+		return false;
+	}
+
+	transport.setStatus(VIRTIO_STATUS_DRIVER_OK);
+
+	npf_snprintf(dev.name, sizeof(dev.name), "vd%c",
+		 (char)('a' + __atomic_fetch_add(&vblk_count, 1,
+						__ATOMIC_RELAXED)));
+	dev.ops = &vblk_ops;
+	dev.driver_data = this;
+	dev.nsectors = capacity;
+	dev.nr_hw_queues = nqueues;
+	dev.queue_depth = qsize;
+	dev.max_segments = segMax;
+	dev.max_request_size = MiB(1);
+
+	pr_info("%s: %lu MiB, %u queues of %u, event idx %s\n", dev.name,
+		(capacity << SECTOR_SHIFT) / MiB(1), nqueues, qsize,
+		(features & VIRTIO_F_EVENT_IDX) ? "on" : "off");
+
+	if (IS_ERR(blkdev_register(&dev))) {
+		pr_warn("%s: could not register\n", dev.name);
+		return false;
+	}
+
+	return true;
+}
+
+// transitional and modern device ids
+static PciPersonality vblkLegacyPers = PciPersonality(
+	&VirtioBlk::classInfo, VIRTIO_PCI_VENDOR, 0x1001,
+	PciPersonality::MATCH_ANY, PciPersonality::MATCH_ANY);
+static PciPersonality vblkPers = PciPersonality(&VirtioBlk::classInfo,
+						VIRTIO_PCI_VENDOR, 0x1042,
+						PciPersonality::MATCH_ANY,
+						PciPersonality::MATCH_ANY);
+
+void virtio_blk_register()
+{
+	auto &reg = IoRegistry::getRegistry();
+	reg.registerPersonality(&vblkLegacyPers);
+	reg.registerPersonality(&vblkPers);
+}
+
+INIT_ENTAILS(virtio_blk_drv);
+INIT_DEPS(virtio_blk_drv, io_stage, fs_devfs_mount);
+INIT_NODE(virtio_blk_drv, virtio_blk_register);
@@ -5,6 +5,7 @@
 #include <yak/log.h>
 #include <yak/io/pci/PciBus.hh>
 #include <yak/io/pci/PciDevice.hh>
+#include <yak/vm/map.h>
 
 #define PCI_UTILS
 #include "pci-utils.h"
@@ -40,3 +41,149 @@ Personality *PciDevice::getPersonality()
 {
 	return &personality;
 }
+
+#define PCI_COMMAND 0x4
+#define PCI_COMMAND_MEMORY (1 << 1)
+#define PCI_COMMAND_MASTER (1 << 2)
+#define PCI_COMMAND_INTX_DISABLE (1 << 10)
+#define PCI_STATUS 0x6
+#define PCI_STATUS_CAP_LIST (1 << 4)
+#define PCI_CAP_PTR 0x34
+#define PCI_BAR0 0x10
+
+#define PCI_CAP_MSIX 0x11
+#define MSIX_CTRL_ENABLE (1 << 15)
+#define MSIX_CTRL_MASK (1 << 14)
+#define MSIX_ENTRY_SIZE 16
+
+uint8_t PciDevice::configRead8(uint32_t offset)
+{
+	return pci_read8(coords.segment, coords.bus, coords.slot,
+			 coords.function, offset);
+}
+
+uint16_t PciDevice::configRead16(uint32_t offset)
+{
+	return pci_read16(coords.segment, coords.bus, coords.slot,
+			  coords.function, offset);
+}
+
+uint32_t PciDevice::configRead32(uint32_t offset)
+{
+	return pci_read32(coords.segment, coords.bus, coords.slot,
+			  coords.function, offset);
+}
+
+void PciDevice::configWrite16(uint32_t offset, uint16_t value)
+{
+	pci_write16(coords.segment, coords.bus, coords.slot, coords.function,
+		    offset, value);
+}
+
+void PciDevice::configWrite32(uint32_t offset, uint32_t value)
+{
+	pci_write32(coords.segment, coords.bus, coords.slot, coords.function,
+		    offset, value);
+}
+
+void PciDevice::enableMemory(bool busMaster)
+{
+	uint16_t cmd = configRead16(PCI_COMMAND);
+	cmd |= PCI_COMMAND_MEMORY;
+	if (busMaster)
+		cmd |= PCI_COMMAND_MASTER;
+	configWrite16(PCI_COMMAND, cmd);
+}
+
+paddr_t PciDevice::barAddress(unsigned int bar)
+{
+	if (bar >= 6)
+		return 0;
+
+	uint32_t lo = configRead32(PCI_BAR0 + bar * 4);
+	// io space
+	if (lo & 0x1)
+		return 0;
+
+	paddr_t addr = lo & ~0xFULL;
+	// 64-bit bar, the upper half lives in the next one
+	if (((lo >> 1) & 0x3) == 0x2 && bar < 5)
+		addr |= (paddr_t)configRead32(PCI_BAR0 + (bar + 1) * 4) << 32;
+
+	return addr;
+}
+
+uint8_t PciDevice::findCapability(uint8_t id, uint8_t start)
+{
+	if (!(configRead16(PCI_STATUS) & PCI_STATUS_CAP_LIST))
+		return 0;
+
+	uint8_t ptr = start ? configRead8(start + 1) : configRead8(PCI_CAP_PTR);
+
+	// bounded, a broken list could loop
+	for (int i = 0; ptr != 0 && i < 48; i++) {
+		ptr &= ~0x3;
+		if (configRead8(ptr) == id)
+			return ptr;
+		ptr = configRead8(ptr + 1);
+	}
+
+	return 0;
+}
+
+size_t PciDevice::msixCount()
+{
+	uint8_t cap = findCapability(PCI_CAP_MSIX);
+	if (!cap)
+		return 0;
+	return (configRead16(cap + 2) & 0x7FF) + 1;
+}
+
+bool PciDevice::msixEnable()
+{
+	uint8_t cap = findCapability(PCI_CAP_MSIX);
+	if (!cap)
+		return false;
+
+	uint16_t ctrl = configRead16(cap + 2);
+	uint32_t table = configRead32(cap + 4);
+
+	paddr_t base = barAddress(table & 0x7);
+	if (!base)
+		return false;
+
+	size_t count = (ctrl & 0x7FF) + 1;
+	vaddr_t va;
+	if (IS_ERR(vm_map_mmio(kmap(), base + (table & ~0x7),
+			       count * MSIX_ENTRY_SIZE, VM_RW,
+			       VM_CACHE_DISABLE, &va)))
+		return false;
+
+	msixTable = (volatile uint32_t *)va;
+
+	// everything starts out masked until routed
+	for (size_t i = 0; i < count; i++)
+		msixTable[i * 4 + 3] = 1;
+
+	enableMemory(true);
+	configWrite16(PCI_COMMAND,
+		      configRead16(PCI_COMMAND) | PCI_COMMAND_INTX_DISABLE);
+	configWrite16(cap + 2, (ctrl | MSIX_CTRL_ENABLE) & ~MSIX_CTRL_MASK);
+	return true;
+}
+
+void PciDevice::msixRoute(size_t entry, size_t cpu, irq_vec_t vector)
+{
+	assert(msixTable);
+
+	uint64_t address;
+	uint32_t data;
+	arch_msi_compose(cpu, vector, &address, &data);
+
+	volatile uint32_t *ent = &msixTable[entry * 4];
+	ent[3] = 1;
+	ent[0] = (uint32_t)address;
+	ent[1] = (uint32_t)(address >> 32);
+	ent[2] = data;
+	ent[3] = 0;
+}
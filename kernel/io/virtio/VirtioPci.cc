@@ -0,0 +1,182 @@
+#define pr_fmt(fmt) "virtio-pci: " fmt
+
+#include <assert.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/spinlock.h>
+#include <yak/vm/map.h>
+#include <yak/io/virtio/Virtio.hh>
+
+#define PCI_CAP_VENDOR 0x09
+
+enum {
+	VIRTIO_PCI_CAP_COMMON_CFG = 1,
+	VIRTIO_PCI_CAP_NOTIFY_CFG = 2,
+	VIRTIO_PCI_CAP_ISR_CFG = 3,
+	VIRTIO_PCI_CAP_DEVICE_CFG = 4,
+};
+
+// virtio_pci_common_cfg
+#define COMMON_DFSELECT 0x00
+#define COMMON_DF 0x04
+#define COMMON_GFSELECT 0x08
+#define COMMON_GF 0x0C
+#define COMMON_MSIX 0x10
+#define COMMON_NUMQ 0x12
+#define COMMON_STATUS 0x14
+#define COMMON_CFGGENERATION 0x15
+#define COMMON_Q_SELECT 0x16
+#define COMMON_Q_SIZE 0x18
+#define COMMON_Q_MSIX 0x1A
+#define COMMON_Q_ENABLE 0x1C
+#define COMMON_Q_NOFF 0x1E
+#define COMMON_Q_DESCLO 0x20
+#define COMMON_Q_DESCHI 0x24
+#define COMMON_Q_AVAILLO 0x28
+#define COMMON_Q_AVAILHI 0x2C
+#define COMMON_Q_USEDLO 0x30
+#define COMMON_Q_USEDHI 0x34
+
+#define cfg8(off) (*(volatile uint8_t *)(common + (off)))
+#define cfg16(off) (*(volatile uint16_t *)(common + (off)))
+#define cfg32(off) (*(volatile uint32_t *)(common + (off)))
+
+volatile void *VirtioPci::mapCap(uint8_t cap, size_t *len)
+{
+	uint8_t bar = pci->configRead8(cap + 4);
+	uint32_t offset = pci->configRead32(cap + 8);
+	uint32_t length = pci->configRead32(cap + 12);
+
+	paddr_t base = pci->barAddress(bar);
+	if (!base || !length)
+		return nullptr;
+
+	paddr_t pa = base + offset;
+	paddr_t start = ALIGN_DOWN(pa, PAGE_SIZE);
+	size_t maplen = ALIGN_UP(pa + length, PAGE_SIZE) - start;
+
+	vaddr_t va;
+	if (IS_ERR(vm_map_mmio(kmap(), start, maplen, VM_RW, VM_CACHE_DISABLE,
+			       &va)))
+		return nullptr;
+
+	if (len)
+		*len = length;
+	return (volatile void *)(va + (pa - start));
+}
+
+bool VirtioPci::init(PciDevice *pci)
+{
+	this->pci = pci;
+
+	for (uint8_t cap = pci->findCapability(PCI_CAP_VENDOR); cap;
+	     cap = pci->findCapability(PCI_CAP_VENDOR, cap)) {
+		uint8_t type = pci->configRead8(cap + 3);
+
+		switch (type) {
+		case VIRTIO_PCI_CAP_COMMON_CFG:
+			if (!common)
+				common = (volatile uint8_t *)mapCap(cap, nullptr);
+			break;
+		case VIRTIO_PCI_CAP_NOTIFY_CFG:
+			if (!notifyBase) {
+				notifyBase =
+					(volatile uint8_t *)mapCap(cap, nullptr);
+				notifyMultiplier = pci->configRead32(cap + 16);
+			}
+			break;
+		case VIRTIO_PCI_CAP_DEVICE_CFG:
+			if (!devCfg)
+				devCfg = mapCap(cap, nullptr);
+			break;
+		}
+	}
+
+	if (!common || !notifyBase) {
+		pr_warn("no modern virtio capabilities\n");
+		return false;
+	}
+
+	pci->enableMemory(true);
+	return true;
+}
+
+void VirtioPci::reset()
+{
+	cfg8(COMMON_STATUS) = 0;
+	// the reset is complete once status reads back as 0
+	while (cfg8(COMMON_STATUS) != 0)
+		busyloop_hint();
+}
+
+void VirtioPci::setStatus(uint8_t status)
+{
+	cfg8(COMMON_STATUS) = cfg8(COMMON_STATUS) | status;
+}
+
+uint8_t VirtioPci::getStatus()
+{
+	return cfg8(COMMON_STATUS);
+}
+
+uint64_t VirtioPci::deviceFeatures()
+{
+	cfg32(COMMON_DFSELECT) = 0;
+	uint64_t lo = cfg32(COMMON_DF);
+	cfg32(COMMON_DFSELECT) = 1;
+	uint64_t hi = cfg32(COMMON_DF);
+	return lo | (hi << 32);
+}
+
+bool VirtioPci::negotiate(uint64_t features)
+{
+	cfg32(COMMON_GFSELECT) = 0;
+	cfg32(COMMON_GF) = (uint32_t)features;
+	cfg32(COMMON_GFSELECT) = 1;
+	cfg32(COMMON_GF) = (uint32_t)(features >> 32);
+
+	setStatus(VIRTIO_STATUS_FEATURES_OK);
+	return getStatus() & VIRTIO_STATUS_FEATURES_OK;
+}
+
+uint16_t VirtioPci::numQueues()
+{
+	return cfg16(COMMON_NUMQ);
+}
+
+uint16_t VirtioPci::maxQueueSize(uint16_t index)
+{
+	cfg16(COMMON_Q_SELECT) = index;
+	return cfg16(COMMON_Q_SIZE);
+}
+
+bool VirtioPci::setupQueue(Virtqueue *vq, uint16_t msixVector)
+{
+	cfg16(COMMON_Q_SELECT) = vq->index;
+	cfg16(COMMON_Q_SIZE) = vq->size;
+
+	cfg16(COMMON_Q_MSIX) = msixVector;
+	if (cfg16(COMMON_Q_MSIX) != msixVector) {
+		pr_warn("queue %u: msi-x vector rejected\n", vq->index);
+		return false;
+	}
+
+	cfg32(COMMON_Q_DESCLO) = (uint32_t)vq->descPhys;
+	cfg32(COMMON_Q_DESCHI) = (uint32_t)(vq->descPhys >> 32);
+	cfg32(COMMON_Q_AVAILLO) = (uint32_t)vq->availPhys;
+	cfg32(COMMON_Q_AVAILHI) = (uint32_t)(vq->availPhys >> 32);
+	cfg32(COMMON_Q_USEDLO) = (uint32_t)vq->usedPhys;
+	cfg32(COMMON_Q_USEDHI) = (uint32_t)(vq->usedPhys >> 32);
+
+	uint16_t noff = cfg16(COMMON_Q_NOFF);
+	vq->notifyAddr = (volatile uint16_t *)(notifyBase +
+					       noff * notifyMultiplier);
+
+	cfg16(COMMON_Q_ENABLE) = 1;
+	return true;
+}
+
+void VirtioPci::disableConfigInterrupt()
+{
+	cfg16(COMMON_MSIX) = VIRTIO_MSI_NO_VECTOR;
+}
@@ -0,0 +1,135 @@
+#define pr_fmt(fmt) "virtq: " fmt
+
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/vm.h>
+#include <yak/vm/page.h>
+#include <yak/vm/pmm.h>
+#include <yak/io/virtio/Virtio.hh>
+
+static inline bool vring_need_event(uint16_t event, uint16_t newIdx,
+				    uint16_t oldIdx)
+{
+	return (uint16_t)(newIdx - event - 1) < (uint16_t)(newIdx - oldIdx);
+}
+
+bool Virtqueue::init(uint16_t index, uint16_t size, bool eventIdx)
+{
+	assert(size && (size & (size - 1)) == 0);
+
+	this->index = index;
+	this->size = size;
+	this->eventIdx = eventIdx;
+
+	// descriptors and avail ring share the first part, used is page aligned
+	size_t availOff = sizeof(virtq_desc) * size;
+	size_t usedOff = ALIGN_UP(availOff + 6 + 2 * size, PAGE_SIZE);
+	size_t total = usedOff + ALIGN_UP(6 + sizeof(virtq_used_elem) * size,
+					  PAGE_SIZE);
+
+	unsigned int order = 0;
+	while (((size_t)PAGE_SIZE << order) < total)
+		order++;
+
+	struct page *pg = pmm_alloc_order(order);
+	if (!pg)
+		return false;
+	page_zero(pg, order);
+
+	paddr_t pa = page_to_addr(pg);
+	vaddr_t va = p2v(pa);
+
+	desc = (volatile virtq_desc *)va;
+	avail = (volatile virtq_avail *)(va + availOff);
+	used = (volatile virtq_used *)(va + usedOff);
+	descPhys = pa;
+	availPhys = pa + availOff;
+	usedPhys = pa + usedOff;
+
+	for (uint16_t i = 0; i < size; i++)
+		desc[i].next = i + 1;
+	freeHead = 0;
+	numFree = size;
+
+	return true;
+}
+
+int Virtqueue::allocDesc()
+{
+	if (numFree == 0)
+		return -1;
+
+	uint16_t id = freeHead;
+	freeHead = desc[id].next;
+	numFree--;
+	return id;
+}
+
+void Virtqueue::pushIndirect(int id, paddr_t table, uint16_t count)
+{
+	desc[id].addr = table;
+	desc[id].len = count * sizeof(virtq_desc);
+	desc[id].flags = VIRTQ_DESC_F_INDIRECT;
+	desc[id].next = 0;
+
+	avail->ring[availIdx % size] = id;
+	availIdx++;
+}
+
+bool Virtqueue::kickPrepare()
+{
+	uint16_t old = kickedIdx;
+
+	// descriptors and ring entries before the index
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	avail->idx = availIdx;
+	kickedIdx = availIdx;
+
+	// the index store against reading the device's suppression state
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (eventIdx)
+		return vring_need_event(*availEvent(), availIdx, old);
+
+	return !(used->flags & VIRTQ_USED_F_NO_NOTIFY);
+}
+
+int Virtqueue::popUsed(uint32_t *len)
+{
+	if (lastUsed == used->idx)
+		return -1;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	volatile virtq_used_elem *elem = &used->ring[lastUsed % size];
+	uint16_t id = elem->id;
+	if (len)
+		*len = elem->len;
+	lastUsed++;
+
+	assert(id < size);
+	desc[id].next = freeHead;
+	freeHead = id;
+	numFree++;
+
+	return id;
+}
+
+bool Virtqueue::enableInterrupts()
+{
+	if (eventIdx)
+		*usedEvent() = lastUsed;
+	else
+		avail->flags = 0;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	return lastUsed == used->idx;
+}
+
+void Virtqueue::disableInterrupts()
+{
+	// with event idx the device only interrupts once used_event is passed
+	if (!eventIdx)
+		avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+}
@@ -0,0 +1,600 @@
+#define pr_fmt(fmt) "blk: " fmt
+
+#include <assert.h>
+#include <string.h>
+#include <yak/blk.h>
+#include <yak/cpu.h>
+#include <yak/cpudata.h>
+#include <yak/dpc.h>
+#include <yak/heap.h>
+#include <yak/ipl.h>
+#include <yak/kevent.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/sched.h>
+#include <yak/fs/devfs.h>
+#include <yak/vm/page.h>
+#include <yak/vm/pmm.h>
+
+#define BLK_NR_REQUESTS 128
+// how far back a new bio looks for a request to merge with
+#define BLK_MERGE_SCAN 8
+// bounce buffer size of blkdev_rw, in pages
+#define BLK_BOUNCE_ORDER 4
+
+static SPINLOCK(blkdevs_lock);
+static struct blkdev *blkdevs[BLK_MAX_DEVS];
+// claimed under blkdevs_lock, the device is only published once complete
+static bool blkdev_minors[BLK_MAX_DEVS];
+
+struct bio *bio_alloc(struct blkdev *dev, enum bio_op op, sector_t sector,
+		      unsigned short maxvecs)
+{
+	struct bio *bio =
+		kzalloc(sizeof(struct bio) + maxvecs * sizeof(struct bio_vec));
+	if (!bio)
+		return NULL;
+
+	bio->dev = dev;
+	bio->op = op;
+	bio->sector = sector;
+	bio->maxvecs = maxvecs;
+	bio->vecs = (struct bio_vec *)(bio + 1);
+	bio->status = YAK_SUCCESS;
+	return bio;
+}
+
+void bio_free(struct bio *bio)
+{
+	kfree(bio, sizeof(struct bio) + bio->maxvecs * sizeof(struct bio_vec));
+}
+
+status_t bio_add_page(struct bio *bio, struct page *page, unsigned int len,
+		      unsigned int offset)
+{
+	assert(offset + len <= PAGE_SIZE);
+
+	// physically contiguous with the last segment: just extend it
+	if (bio->nvecs > 0) {
+		struct bio_vec *last = &bio->vecs[bio->nvecs - 1];
+		if (page_to_addr(last->page) + last->offset + last->len ==
+		    page_to_addr(page) + offset) {
+			last->len += len;
+			bio->size += len;
+			return YAK_SUCCESS;
+		}
+	}
+
+	if (bio->nvecs >= bio->maxvecs)
+		return YAK_NOSPACE;
+
+	bio->vecs[bio->nvecs++] = (struct bio_vec){
+		.page = page,
+		.offset = offset,
+		.len = len,
+	};
+	bio->size += len;
+	return YAK_SUCCESS;
+}
+
+static struct blk_request *rq_get(struct blkdev *dev)
+{
+	EXPECT(sched_wait_single(&dev->rq_sem, WAIT_MODE_BLOCK, WAIT_TYPE_ANY,
+				 TIMEOUT_INFINITE));
+
+	ipl_t ipl = spinlock_lock(&dev->rq_lock);
+	struct blk_request *rq = dev->rq_free;
+	assert(rq);
+	dev->rq_free = rq->driver_data;
+	spinlock_unlock(&dev->rq_lock, ipl);
+
+	memset(rq, 0, sizeof(struct blk_request));
+	rq->dev = dev;
+	return rq;
+}
+
+static void rq_put(struct blkdev *dev, struct blk_request *rq)
+{
+	ipl_t ipl = spinlock_lock(&dev->rq_lock);
+	// the free list is threaded through driver_data
+	rq->driver_data = dev->rq_free;
+	dev->rq_free = rq;
+	spinlock_unlock(&dev->rq_lock, ipl);
+
+	semaphore_signal(&dev->rq_sem);
+}
+
+static inline sector_t rq_end(struct blk_request *rq)
+{
+	return rq->sector + (rq->size >> SECTOR_SHIFT);
+}
+
+static inline sector_t bio_end(struct bio *bio)
+{
+	return bio->sector + (bio->size >> SECTOR_SHIFT);
+}
+
+static bool rq_can_merge(struct blkdev *dev, struct blk_request *rq,
+			 struct bio *bio)
+{
+	return rq->op == bio->op && bio->op != BIO_FLUSH &&
+	       rq->nsegs + bio->nvecs <= dev->max_segments &&
+	       rq->size + bio->size <= dev->max_request_size;
+}
+
+// try to attach bio to a pending request, swq->lock held
+static bool blk_merge(struct blkdev *dev, struct blk_swq *swq,
+		      struct bio *bio)
+{
+	struct blk_request *rq;
+	int scanned = 0;
+
+	TAILQ_FOREACH_REVERSE(rq, &swq->pending, blk_rq_list, entry)
+	{
+		if (++scanned > BLK_MERGE_SCAN || rq->op == BIO_FLUSH)
+			break;
+
+		if (rq_can_merge(dev, rq, bio)) {
+			if (rq_end(rq) == bio->sector) {
+				rq->biotail->next = bio;
+				rq->biotail = bio;
+				goto merged;
+			} else if (bio_end(bio) == rq->sector) {
+				bio->next = rq->bio;
+				rq->bio = bio;
+				rq->sector = bio->sector;
+				goto merged;
+			}
+		}
+
+		// don't reorder around an overlapping request
+		if (bio->sector < rq_end(rq) && rq->sector < bio_end(bio))
+			break;
+	}
+
+	return false;
+
+merged:
+	rq->size += bio->size;
+	rq->nsegs += bio->nvecs;
+	return true;
+}
+
+// round-robin over the swqs feeding hwq
+static struct blk_request *blk_pop(struct blk_hwq *hwq)
+{
+	struct blkdev *dev = hwq->dev;
+
+	for (size_t i = 0; i < dev->nswqs; i++) {
+		struct blk_swq *swq = &dev->swqs[hwq->next_swq];
+		hwq->next_swq = (hwq->next_swq + 1) % dev->nswqs;
+		if (swq->hwq != hwq)
+			continue;
+
+		ipl_t ipl = spinlock_lock(&swq->lock);
+		struct blk_request *rq = TAILQ_FIRST(&swq->pending);
+		if (rq)
+			TAILQ_REMOVE(&swq->pending, rq, entry);
+		spinlock_unlock(&swq->lock, ipl);
+
+		if (rq)
+			return rq;
+	}
+
+	return NULL;
+}
+
+static void blk_dispatch(struct blk_hwq *hwq)
+{
+	struct blkdev *dev = hwq->dev;
+
+	for (;;) {
+		if (__atomic_load_n(&hwq->inflight, __ATOMIC_ACQUIRE) >=
+		    dev->queue_depth)
+			return;
+
+		struct blk_request *rq = blk_pop(hwq);
+		if (!rq)
+			return;
+
+		rq->hwq = hwq;
+		__atomic_fetch_add(&hwq->inflight, 1, __ATOMIC_ACQ_REL);
+
+		status_t rv = dev->ops->queue_rq(dev, rq);
+		if (rv == YAK_BUSY) {
+			__atomic_fetch_sub(&hwq->inflight, 1, __ATOMIC_ACQ_REL);
+
+			ipl_t ipl = spinlock_lock(&rq->swq->lock);
+			TAILQ_INSERT_HEAD(&rq->swq->pending, rq, entry);
+			spinlock_unlock(&rq->swq->lock, ipl);
+			return;
+		}
+
+		IF_ERR(rv)
+		{
+			blk_complete(rq, rv);
+		}
+	}
+}
+
+/*
+ * Feed a hardware queue from its software queues. Only one cpu dispatches
+ * to a hwq at a time; anyone arriving meanwhile leaves a note for it to go
+ * again.
+ */
+static void blk_run_hwq(struct blk_hwq *hwq)
+{
+	__atomic_store_n(&hwq->rerun, 1, __ATOMIC_SEQ_CST);
+
+	// don't get preempted while others rely on us to dispatch
+	ipl_t ipl = ripl(IPL_DPC);
+	while (!__atomic_exchange_n(&hwq->dispatching, 1, __ATOMIC_SEQ_CST)) {
+		__atomic_store_n(&hwq->rerun, 0, __ATOMIC_SEQ_CST);
+		blk_dispatch(hwq);
+		__atomic_store_n(&hwq->dispatching, 0, __ATOMIC_SEQ_CST);
+
+		if (!__atomic_load_n(&hwq->rerun, __ATOMIC_SEQ_CST))
+			break;
+	}
+	xipl(ipl);
+}
+
+// cpus that came up after registration share a queue, it is locked
+static struct blk_swq *blk_cur_swq(struct blkdev *dev)
+{
+	return &dev->swqs[curcpu().cpu_id % dev->nswqs];
+}
+
+void blk_submit(struct bio *bio)
+{
+	struct blkdev *dev = bio->dev;
+	assert(dev);
+	assert(IS_ALIGNED_POW2(bio->size, SECTOR_SIZE));
+
+	bio->next = NULL;
+	bio->status = YAK_SUCCESS;
+
+	if (bio->size > dev->max_request_size ||
+	    bio->nvecs > dev->max_segments || bio_end(bio) > dev->nsectors ||
+	    (bio->op != BIO_FLUSH && bio->size == 0)) {
+		bio->status = YAK_INVALID_ARGS;
+		if (bio->end_io)
+			bio->end_io(bio);
+		return;
+	}
+
+	// pinned to this cpu while looking at its queue
+	struct blk_swq *swq;
+	ipl_t ipl = ripl(IPL_DPC);
+	swq = blk_cur_swq(dev);
+	spinlock_lock_noipl(&swq->lock);
+	bool merged = blk_merge(dev, swq, bio);
+	spinlock_unlock_noipl(&swq->lock);
+	xipl(ipl);
+
+	struct blk_hwq *hwq = swq->hwq;
+
+	if (!merged) {
+		struct blk_request *rq = rq_get(dev);
+		rq->op = bio->op;
+		rq->sector = bio->sector;
+		rq->size = bio->size;
+		rq->nsegs = bio->nvecs;
+		rq->bio = rq->biotail = bio;
+		rq->status = YAK_SUCCESS;
+
+		ipl = ripl(IPL_DPC);
+		swq = blk_cur_swq(dev);
+		rq->swq = swq;
+		spinlock_lock_noipl(&swq->lock);
+		TAILQ_INSERT_TAIL(&swq->pending, rq, entry);
+		spinlock_unlock_noipl(&swq->lock);
+		xipl(ipl);
+		hwq = swq->hwq;
+	}
+
+	blk_run_hwq(hwq);
+}
+
+void blk_complete(struct blk_request *rq, status_t status)
+{
+	rq->status = status;
+
+	// completions go to the cpu they happen on, whatever the device
+	int state = disable_interrupts();
+	struct cpu *cpu = curcpu_ptr();
+	TAILQ_INSERT_TAIL(&cpu->blk_done, rq, entry);
+	dpc_enqueue(&cpu->blk_done_dpc, NULL);
+	if (state)
+		enable_interrupts();
+}
+
+// a hw queue that got room again is kicked once its run of requests ends
+void blk_done_dpc(struct dpc *, void *)
+{
+	struct cpu *cpu = curcpu_ptr();
+	struct blk_hwq *kick = NULL;
+	struct blk_rq_list list = TAILQ_HEAD_INITIALIZER(list);
+
+	int state = disable_interrupts();
+	TAILQ_CONCAT(&list, &cpu->blk_done, entry);
+	if (state)
+		enable_interrupts();
+
+	struct blk_request *rq;
+	while ((rq = TAILQ_FIRST(&list)) != NULL) {
+		TAILQ_REMOVE(&list, rq, entry);
+		struct blkdev *dev = rq->dev;
+
+		struct bio *bio = rq->bio, *next;
+		for (; bio; bio = next) {
+			next = bio->next;
+			bio->next = NULL;
+			bio->status = rq->status;
+			if (bio->end_io)
+				bio->end_io(bio);
+		}
+
+		struct blk_hwq *hwq = rq->hwq;
+		rq_put(dev, rq);
+		__atomic_fetch_sub(&hwq->inflight, 1, __ATOMIC_ACQ_REL);
+
+		if (kick && kick != hwq)
+			blk_run_hwq(kick);
+		kick = hwq;
+	}
+
+	if (kick)
+		blk_run_hwq(kick);
+}
+
+struct bio_waiter {
+	struct kevent ev;
+	int done;
+};
+
+static void bio_wake(struct bio *bio)
+{
+	struct bio_waiter *w = bio->private_data;
+	event_alarm(&w->ev);
+	// the waiter may free w once this is visible
+	__atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+}
+
+status_t blk_submit_wait(struct bio *bio)
+{
+	struct bio_waiter w;
+	event_init(&w.ev, 0);
+	w.done = 0;
+
+	bio->end_io = bio_wake;
+	bio->private_data = &w;
+	blk_submit(bio);
+
+	EXPECT(sched_wait_single(&w.ev, WAIT_MODE_BLOCK, WAIT_TYPE_ANY,
+				 TIMEOUT_INFINITE));
+	while (!__atomic_load_n(&w.done, __ATOMIC_ACQUIRE))
+		busyloop_hint();
+
+	return bio->status;
+}
+
+static status_t blk_bounce(struct blkdev *dev, enum bio_op op, sector_t sector,
+			   struct page *pages, size_t size)
+{
+	size_t npages = DIV_ROUNDUP(size, PAGE_SIZE);
+	struct bio *bio = bio_alloc(dev, op, sector, npages);
+	if (!bio)
+		return YAK_OOM;
+
+	for (size_t i = 0; i < npages; i++) {
+		size_t len = MIN((size_t)PAGE_SIZE, size - i * PAGE_SIZE);
+		EXPECT(bio_add_page(bio, &pages[i], len, 0));
+	}
+
+	status_t rv = blk_submit_wait(bio);
+	bio_free(bio);
+	return rv;
+}
+
+status_t blkdev_rw(struct blkdev *dev, enum bio_op op, voff_t offset,
+		   void *buf, size_t length, size_t *done)
+{
+	const size_t chunk = PAGE_SIZE << BLK_BOUNCE_ORDER;
+	const voff_t dev_size = dev->nsectors << SECTOR_SHIFT;
+
+	*done = 0;
+
+	if (offset >= dev_size)
+		return op == BIO_READ ? YAK_EOF : YAK_NOSPACE;
+
+	length = MIN(length, dev_size - offset);
+
+	struct page *pages = pmm_alloc_order(BLK_BOUNCE_ORDER);
+	if (!pages)
+		return YAK_OOM;
+	// bio vectors address the tail pages individually
+	pmm_split_order(pages, BLK_BOUNCE_ORDER);
+
+	char *bounce = (char *)page_to_mapped_addr(pages);
+	char *p = buf;
+	status_t rv = YAK_SUCCESS;
+
+	while (*done < length) {
+		voff_t pos = offset + *done;
+		voff_t start = ALIGN_DOWN(pos, SECTOR_SIZE);
+		size_t skip = pos - start;
+		size_t n = MIN(length - *done, chunk - skip);
+		size_t span = ALIGN_UP(skip + n, SECTOR_SIZE);
+		sector_t sector = start >> SECTOR_SHIFT;
+
+		if (op == BIO_READ) {
+			rv = blk_bounce(dev, BIO_READ, sector, pages, span);
+			IF_ERR(rv) break;
+			memcpy(p, bounce + skip, n);
+		} else {
+			// partial sectors need read-modify-write
+			if (skip != 0 || n != span) {
+				rv = blk_bounce(dev, BIO_READ, sector, pages,
+						span);
+				IF_ERR(rv) break;
+			}
+			memcpy(bounce + skip, p, n);
+			rv = blk_bounce(dev, BIO_WRITE, sector, pages, span);
+			IF_ERR(rv) break;
+		}
+
+		p += n;
+		*done += n;
+	}
+
+	for (size_t i = 0; i < (1UL << BLK_BOUNCE_ORDER); i++)
+		page_deref(&pages[i]);
+
+	return *done > 0 ? YAK_SUCCESS : rv;
+}
+
+static status_t blkdev_read(int minor, voff_t offset, void *buf, size_t length,
+			    size_t *read_bytes)
+{
+	struct blkdev *dev = blkdev_lookup(minor);
+	if (!dev)
+		return YAK_NODEV;
+
+	status_t rv = blkdev_rw(dev, BIO_READ, offset, buf, length, read_bytes);
+	if (rv == YAK_EOF) {
+		*read_bytes = 0;
+		return YAK_SUCCESS;
+	}
+	return rv;
+}
+
+static status_t blkdev_write(int minor, voff_t offset, const void *buf,
+			     size_t length, size_t *written_bytes)
+{
+	struct blkdev *dev = blkdev_lookup(minor);
+	if (!dev)
+		return YAK_NODEV;
+
+	return blkdev_rw(dev, BIO_WRITE, offset, (void *)buf, length,
+			 written_bytes);
+}
+
+static struct device_ops blkdev_ops = {
+	.dev_read = blkdev_read,
+	.dev_write = blkdev_write,
+	.dev_open = NULL,
+	.dev_ioctl = NULL,
+};
+
+struct blkdev *blkdev_lookup(int minor)
+{
+	if (minor < 0 || minor >= BLK_MAX_DEVS)
+		return NULL;
+	return __atomic_load_n(&blkdevs[minor], __ATOMIC_ACQUIRE);
+}
+
+struct blkdev *blkdev_find(const char *name)
+{
+	if (strncmp(name, "/dev/", 5) == 0)
+		name += 5;
+
+	for (int i = 0; i < BLK_MAX_DEVS; i++) {
+		struct blkdev *dev = blkdev_lookup(i);
+		if (dev && strcmp(dev->name, name) == 0)
+			return dev;
+	}
+
+	return NULL;
+}
+
+status_t blkdev_register(struct blkdev *dev)
+{
+	assert(dev->ops && dev->ops->queue_rq);
+	assert(dev->queue_depth > 0 && dev->max_segments > 0);
+	assert(dev->max_request_size >= PAGE_SIZE);
+
+	if (dev->nr_hw_queues == 0)
+		dev->nr_hw_queues = 1;
+	dev->nr_hw_queues = MIN(dev->nr_hw_queues, BLK_MAX_HW_QUEUES);
+
+	dev->hwqs = kcalloc(dev->nr_hw_queues, sizeof(struct blk_hwq));
+	if (!dev->hwqs)
+		return YAK_OOM;
+
+	for (size_t i = 0; i < dev->nr_hw_queues; i++) {
+		struct blk_hwq *hwq = &dev->hwqs[i];
+		hwq->dev = dev;
+		hwq->index = i;
+	}
+
+	dev->nswqs = cpus_online();
+	dev->swqs = kcalloc(dev->nswqs, sizeof(struct blk_swq));
+	if (!dev->swqs) {
+		kfree(dev->hwqs, dev->nr_hw_queues * sizeof(struct blk_hwq));
+		return YAK_OOM;
+	}
+
+	for (size_t i = 0; i < dev->nswqs; i++) {
+		struct blk_swq *swq = &dev->swqs[i];
+		swq->dev = dev;
+		// cpu i submits to hwq i % n
+		swq->hwq = &dev->hwqs[i % dev->nr_hw_queues];
+		spinlock_init(&swq->lock);
+		TAILQ_INIT(&swq->pending);
+	}
+
+	struct blk_request *pool =
+		kcalloc(BLK_NR_REQUESTS, sizeof(struct blk_request));
+	if (!pool) {
+		kfree(dev->swqs, dev->nswqs * sizeof(struct blk_swq));
+		kfree(dev->hwqs, dev->nr_hw_queues * sizeof(struct blk_hwq));
+		return YAK_OOM;
+	}
+
+	spinlock_init(&dev->rq_lock);
+	dev->rq_free = NULL;
+	for (size_t i = 0; i < BLK_NR_REQUESTS; i++) {
+		pool[i].driver_data = dev->rq_free;
+		dev->rq_free = &pool[i];
+	}
+	semaphore_init(&dev->rq_sem, BLK_NR_REQUESTS);
+
+	ipl_t ipl = spinlock_lock(&blkdevs_lock);
+	dev->minor = -1;
+	for (int i = 0; i < BLK_MAX_DEVS; i++) {
+		if (!blkdev_minors[i]) {
+			dev->minor = i;
+			blkdev_minors[i] = true;
+			break;
+		}
+	}
+	spinlock_unlock(&blkdevs_lock, ipl);
+
+	status_t rv = YAK_NOSPACE;
+	if (dev->minor < 0)
+		goto err;
+
+	rv = devfs_register(dev->name, VBLK, BLK_MAJOR, dev->minor, &blkdev_ops,
+			    &dev->vnode);
+	IF_ERR(rv)
+	{
+		ipl = spinlock_lock(&blkdevs_lock);
+		blkdev_minors[dev->minor] = false;
+		spinlock_unlock(&blkdevs_lock, ipl);
+		dev->minor = -1;
+		goto err;
+	}
+
+	__atomic_store_n(&blkdevs[dev->minor], dev, __ATOMIC_RELEASE);
+
+	pr_info("%s: %lu sectors, %u hw queues of depth %u\n", dev->name,
+		dev->nsectors, dev->nr_hw_queues, dev->queue_depth);
+	return YAK_SUCCESS;
+
+err:
+	kfree(pool, BLK_NR_REQUESTS * sizeof(struct blk_request));
+	kfree(dev->swqs, dev->nswqs * sizeof(struct blk_swq));
+	kfree(dev->hwqs, dev->nr_hw_queues * sizeof(struct blk_hwq));
+	return rv;
+}
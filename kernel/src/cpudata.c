@@ -33,6 +33,8 @@ size_t cpus_online()
 static size_t cpu_id = 0;
 
 extern void timer_update(struct dpc *dpc, void *ctx);
+extern void sched_slice_expire(struct dpc *dpc, void *ctx);
+extern void blk_done_dpc(struct dpc *dpc, void *ctx);
 
 static struct cpu *bsp_ptr;
 struct cpu **__all_cpus = NULL;
@@ -49,6 +51,10 @@ void cpudata_init(struct cpu *cpu, void *stack_top)
 		__all_cpus = &bsp_ptr;
 	}
 
+	// the arch code fills in the real topology, if it knows it
+	cpu->core_id = cpu->cpu_id;
+	cpu->llc_id = cpu->cpu_id;
+
 	cpu->kstack_top = NULL;
 
 	cpu->current_map = NULL;
@@ -57,6 +63,9 @@ void cpudata_init(struct cpu *cpu, void *stack_top)
 	cpu->current_thread = NULL;
 
 	cpu->softint_pending = 0;
+	cpu->idle_polling = 0;
+	cpu->idle_poll_ns = 0;
+	cpu->rcu_qs = 0;
 
 	spinlock_init(&curcpu_ptr()->sched_lock);
 	struct sched *sched = &curcpu_ptr()->sched;
@@ -72,6 +81,7 @@ void cpudata_init(struct cpu *cpu, void *stack_top)
 	sched->next_rq = &sched->rqs[1];
 
 	TAILQ_INIT(&sched->idle_rq);
+	sched->nr_ready = 0;
 
 	spinlock_init(&cpu->dpc_lock);
 	LIST_INIT(&cpu->dpc_queue);
@@ -80,6 +90,22 @@ void cpudata_init(struct cpu *cpu, void *stack_top)
 	HEAP_INIT(&cpu->timer_heap);
 	dpc_init(&cpu->timer_update_dpc, timer_update);
 
+	timer_init(&cpu->slice_timer);
+	dpc_init(&cpu->slice_dpc, sched_slice_expire);
+	cpu->slice_timer.dpc = &cpu->slice_dpc;
+	cpu->slice_end = 0;
+
+	for (size_t i = 0; i < CPU_TIME_NR; i++)
+		cpu->cpu_time[i] = 0;
+	cpu->irq_depth = 0;
+	for (size_t i = 0; i < 3; i++)
+		cpu->loadavg[i] = 0;
+
+	cpu->kstack_cached = 0;
+
+	TAILQ_INIT(&cpu->blk_done);
+	dpc_init(&cpu->blk_done_dpc, blk_done_dpc);
+
 	cpu->kstack_top = stack_top;
 	cpu->idle_thread.kstack_top = stack_top;
 
@@ -88,5 +114,6 @@ void cpudata_init(struct cpu *cpu, void *stack_top)
 
 	char idle_name[12];
 	npf_snprintf(idle_name, sizeof(idle_name), "idle%ld", cpu->cpu_id);
+	kthread_construct(&curcpu_ptr()->idle_thread);
 	kthread_init(&curcpu_ptr()->idle_thread, idle_name, 0, &kproc0, 0);
 }
@@ -1,119 +1,326 @@
 #include <assert.h>
+#include <string.h>
 #include <yak/heap.h>
 #include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/rcu.h>
 #include <yak/status.h>
 #include <yak/file.h>
 #include <yak/process.h>
+#include <yak/fs/epoll.h>
 #include <yak/fs/vfs.h>
+#include <yak-abi/fcntl.h>
 
-#define FD_LIMIT 65535
-#define FD_GROW_BY 4
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define BITMAP_WORDS(bits) DIV_ROUNDUP((bits), BITS_PER_LONG)
+
+#define FD_MIN_CAP ((int)BITS_PER_LONG)
 
 static void file_cleanup(struct file *file);
 GENERATE_REFMAINT(file, refcnt, file_cleanup);
 
 static void file_cleanup(struct file *file)
 {
+	// nobody can add items anymore without a reference
+	if (!LIST_EMPTY(&file->epitems))
+		epoll_release_file(file);
+
 	vnode_deref(file->vnode);
-	kfree(file, sizeof(struct file));
+	// lockless fd lookups may still be looking at the refcount
+	kfree_rcu(file, sizeof(struct file));
+}
+
+static bool file_ref_not_zero(struct file *file)
+{
+	unsigned long cnt = __atomic_load_n(&file->refcnt, __ATOMIC_RELAXED);
+	do {
+		if (cnt == 0)
+			return false;
+	} while (!__atomic_compare_exchange_n(&file->refcnt, &cnt, cnt + 1, 0,
+					      __ATOMIC_ACQUIRE,
+					      __ATOMIC_RELAXED));
+	return true;
+}
+
+void file_init(struct file *file)
+{
+	kmutex_init(&file->lock, "file");
+	file->offset = 0;
+	file->refcnt = 1;
+
+	file->vnode = NULL;
+	file->flags = 0;
+	LIST_INIT(&file->epitems);
+}
+
+struct file *file_alloc()
+{
+	struct file *file = kmalloc(sizeof(struct file));
+	if (file)
+		file_init(file);
+	return file;
 }
 
-int fd_getnext(struct kprocess *proc)
+/* the table, its slots and both bitmaps share one allocation */
+static size_t fdtable_size(int cap)
 {
-	for (int i = 0; i < proc->fd_cap; i++) {
-		if (proc->fds[i] == NULL)
-			return i;
+	size_t words = BITMAP_WORDS(cap);
+	return sizeof(struct fdtable) + cap * sizeof(struct fd *) +
+	       (words + BITMAP_WORDS(words)) * sizeof(unsigned long);
+}
+
+static struct fdtable *fdtable_alloc(int cap)
+{
+	struct fdtable *fdt = kzalloc(fdtable_size(cap));
+	if (!fdt)
+		return NULL;
+
+	fdt->cap = cap;
+	fdt->fds = (struct fd **)(fdt + 1);
+	fdt->open_fds = (unsigned long *)(fdt->fds + cap);
+	fdt->full_fds = fdt->open_fds + BITMAP_WORDS(cap);
+	return fdt;
+}
+
+// first clear bit at or after start, nbits if there is none
+static size_t find_next_zero(const unsigned long *map, size_t nbits,
+			     size_t start)
+{
+	for (size_t i = start; i < nbits;) {
+		unsigned long word = ~map[i / BITS_PER_LONG] &
+				     (~0UL << (i % BITS_PER_LONG));
+		if (word) {
+			i = ALIGN_DOWN(i, BITS_PER_LONG) + __builtin_ctzl(word);
+			return MIN(i, nbits);
+		}
+		i = ALIGN_DOWN(i, BITS_PER_LONG) + BITS_PER_LONG;
+	}
+	return nbits;
+}
+
+/*
+ * Lowest clear fd at or after start. Full words are skipped through
+ * full_fds, so this touches a handful of words even for huge tables.
+ */
+static int fdtable_find_free(struct fdtable *fdt, int start)
+{
+	size_t nwords = BITMAP_WORDS(fdt->cap);
+	size_t w = start / BITS_PER_LONG;
+	if (w >= nwords)
+		return -1;
+
+	unsigned long bits = ~fdt->open_fds[w] &
+			     (~0UL << (start % BITS_PER_LONG));
+	if (!bits) {
+		w = find_next_zero(fdt->full_fds, nwords, w + 1);
+		if (w >= nwords)
+			return -1;
+		bits = ~fdt->open_fds[w];
 	}
-	return -1;
+
+	return w * BITS_PER_LONG + __builtin_ctzl(bits);
+}
+
+static void fdtable_set(struct fdtable *fdt, int fd)
+{
+	size_t w = fd / BITS_PER_LONG;
+	fdt->open_fds[w] |= 1UL << (fd % BITS_PER_LONG);
+	if (fdt->open_fds[w] == ~0UL)
+		fdt->full_fds[w / BITS_PER_LONG] |= 1UL << (w % BITS_PER_LONG);
+}
+
+static void fdtable_clear(struct fdtable *fdt, int fd)
+{
+	size_t w = fd / BITS_PER_LONG;
+	fdt->open_fds[w] &= ~(1UL << (fd % BITS_PER_LONG));
+	fdt->full_fds[w / BITS_PER_LONG] &= ~(1UL << (w % BITS_PER_LONG));
+	if (fd < fdt->next_fd)
+		fdt->next_fd = fd;
+}
+
+struct file *fd_get_file(struct kprocess *proc, int fd)
+{
+	struct file *file = NULL;
+
+	ipl_t ipl = rcu_read_lock();
+	struct fdtable *fdt = rcu_dereference(proc->fdtable);
+	if (fdt && fd >= 0 && fd < fdt->cap) {
+		struct fd *desc = rcu_dereference(fdt->fds[fd]);
+		// a file whose last reference is gone is being closed
+		if (desc && file_ref_not_zero(desc->file))
+			file = desc->file;
+	}
+	rcu_read_unlock(ipl);
+
+	return file;
 }
 
 status_t fd_grow(struct kprocess *proc, int new_cap)
 {
-	int old_cap = proc->fd_cap;
-	if (new_cap < old_cap)
+	struct fdtable *old = proc->fdtable;
+	int old_cap = old ? old->cap : 0;
+	if (new_cap <= old_cap)
 		return YAK_SUCCESS;
 
-	struct fd **old_fds = proc->fds;
-
 	if (new_cap > FD_LIMIT) {
 		return YAK_MFILE;
 	}
 
-	struct fd **table = kcalloc(new_cap, sizeof(struct fd *));
-	if (!table)
+	// grow geometrically so n allocations cost O(n) copying overall
+	int cap = MAX(old_cap, FD_MIN_CAP);
+	while (cap < new_cap)
+		cap *= 2;
+
+	struct fdtable *fdt = fdtable_alloc(cap);
+	if (!fdt)
 		return YAK_OOM;
 
-	for (int i = 0; i < old_cap; i++)
-		table[i] = old_fds[i];
+	if (old) {
+		size_t words = BITMAP_WORDS(old_cap);
+		memcpy(fdt->fds, old->fds, old_cap * sizeof(struct fd *));
+		memcpy(fdt->open_fds, old->open_fds,
+		       words * sizeof(unsigned long));
+		memcpy(fdt->full_fds, old->full_fds,
+		       BITMAP_WORDS(words) * sizeof(unsigned long));
+		fdt->next_fd = old->next_fd;
+	}
 
-	proc->fds = table;
-	proc->fd_cap = new_cap;
+	rcu_assign_pointer(proc->fdtable, fdt);
 
-	kfree(old_fds, old_cap * sizeof(struct fd *));
+	if (old)
+		kfree_rcu(old, fdtable_size(old_cap));
 
 	return YAK_SUCCESS;
 }
 
-void file_init(struct file *file)
-{
-	kmutex_init(&file->lock, "file");
-	file->offset = 0;
-	file->refcnt = 1;
-
-	file->vnode = NULL;
-	file->flags = 0;
-}
-
-status_t fd_alloc_at(struct kprocess *proc, int fd)
+static status_t fd_install(struct kprocess *proc, int fd, struct file *file,
+			   unsigned int flags)
 {
-	status_t rv = fd_grow(proc, fd + 1);
-	IF_ERR(rv) return rv;
-
-	proc->fds[fd] = kmalloc(sizeof(struct fd));
-	struct fd *fdp = proc->fds[fd];
-	assert(fdp);
+	struct fd *desc = kmalloc(sizeof(struct fd));
+	if (!desc)
+		return YAK_OOM;
 
-	struct file *f = kmalloc(sizeof(struct file));
-	fdp->file = f;
+	desc->file = file;
+	desc->flags = flags;
 
-	file_init(f);
+	struct fdtable *fdt = proc->fdtable;
+	fdtable_set(fdt, fd);
+	rcu_assign_pointer(fdt->fds[fd], desc);
 
 	return YAK_SUCCESS;
 }
 
-status_t fd_alloc(struct kprocess *proc, int *fd)
+status_t fd_alloc(struct kprocess *proc, struct file *file,
+		  unsigned int flags, int *fd)
 {
-retry:
-	*fd = fd_getnext(proc);
-	if (*fd == -1) {
-		status_t res = fd_grow(proc, proc->fd_cap + FD_GROW_BY);
+	struct fdtable *fdt = proc->fdtable;
+	int nfd = fdt ? fdtable_find_free(fdt, fdt->next_fd) : -1;
+
+	if (nfd == -1) {
+		nfd = fdt ? fdt->cap : 0;
+		status_t res = fd_grow(proc, nfd + 1);
 		IF_ERR(res)
 		{
 			return res;
 		}
-		goto retry;
 	}
 
-	proc->fds[*fd] = kmalloc(sizeof(struct fd));
-	struct fd *fdp = proc->fds[*fd];
-	assert(fdp);
+	if (nfd >= FD_LIMIT)
+		return YAK_MFILE;
 
-	struct file *f = kmalloc(sizeof(struct file));
-	assert(f);
-	fdp->file = f;
+	status_t res = fd_install(proc, nfd, file, flags);
+	IF_ERR(res) return res;
 
-	file_init(f);
+	proc->fdtable->next_fd = nfd + 1;
+	*fd = nfd;
 
 	pr_debug("Alloc'd fd %d\n", *fd);
 
 	return YAK_SUCCESS;
 }
 
+status_t fd_alloc_at(struct kprocess *proc, int fd, struct file *file,
+		     unsigned int flags)
+{
+	if (fd < 0)
+		return YAK_INVALID_ARGS;
+
+	status_t rv = fd_grow(proc, fd + 1);
+	IF_ERR(rv) return rv;
+
+	assert(proc->fdtable->fds[fd] == NULL);
+	return fd_install(proc, fd, file, flags);
+}
+
 struct fd *fd_safe_get(struct kprocess *proc, int fd)
 {
-	if (!proc->fds || fd > proc->fd_cap) {
+	struct fdtable *fdt = proc->fdtable;
+	if (!fdt || fd < 0 || fd >= fdt->cap) {
 		return NULL;
 	}
 
-	return proc->fds[fd];
+	return fdt->fds[fd];
+}
+
+status_t fd_close(struct kprocess *proc, int fd)
+{
+	struct fd *desc = fd_safe_get(proc, fd);
+	if (!desc)
+		return YAK_BADF;
+
+	struct fdtable *fdt = proc->fdtable;
+	rcu_assign_pointer(fdt->fds[fd], NULL);
+	fdtable_clear(fdt, fd);
+
+	file_deref(desc->file);
+	kfree_rcu(desc, sizeof(struct fd));
+	return YAK_SUCCESS;
+}
+
+status_t fd_open(struct kprocess *proc, char *path, int flags, int *fdp)
+{
+	unsigned int file_flags = 0;
+	switch (flags & O_ACCMODE) {
+	case O_RDONLY:
+		file_flags |= FILE_READ;
+		break;
+	case O_WRONLY:
+		file_flags |= FILE_WRITE;
+		break;
+	case O_RDWR:
+		file_flags |= FILE_READ | FILE_WRITE;
+		break;
+	default:
+		return YAK_INVALID_ARGS;
+	}
+
+	struct vnode *vn;
+	status_t res = vfs_open(path, &vn);
+
+	if (res == YAK_NOENT && (flags & O_CREAT))
+		res = vfs_create(path, VREG, &vn);
+
+	IF_ERR(res) return res;
+
+	struct file *file = file_alloc();
+	if (!file) {
+		vnode_deref(vn);
+		return YAK_OOM;
+	}
+
+	// set up before it is published, lookups don't take the fd mutex
+	file->vnode = vn;
+	file->offset = 0;
+	file->flags = file_flags;
+
+	guard(mutex)(&proc->fd_mutex);
+
+	res = fd_alloc(proc, file, 0, fdp);
+	IF_ERR(res)
+	{
+		file_deref(file);
+		return res;
+	}
+
+	return YAK_SUCCESS;
 }
@@ -9,7 +9,9 @@
 #include <yak/hashtable.h>
 #include <yak/heap.h>
 #include <yak/log.h>
+#include <yak/poll.h>
 #include <yak/queue.h>
+#include <yak/rcu.h>
 #include <yak/status.h>
 #include <yak/fs/vfs.h>
 #include <yak/vm.h>
@@ -74,7 +76,7 @@ static struct vfs_ops *lookup_fs(const char *name)
 status_t vfs_lookup_path(const char *path, struct vnode *cwd, int flags,
 			 struct vnode **out, char **last_comp);
 
-status_t vfs_mount(const char *path, char *fsname)
+status_t vfs_mount(const char *path, char *fsname, const char *source)
 {
 	struct vfs_ops *ops = lookup_fs(fsname);
 	if (!ops)
@@ -87,12 +89,18 @@ status_t vfs_mount(const char *path, char *fsname)
 		goto exit;
 	}
 
-	res = ops->vfs_mount(vn);
+	// everything that can block happens before rcu walks are held off
+	struct vfs *vfs;
+	res = ops->vfs_mount(vn, source, &vfs);
 	IF_ERR(res)
 	{
 		goto exit;
 	}
 
+	ipl_t ipl = seqcount_write_begin(&vn->seq);
+	__atomic_store_n(&vn->mountedvfs, vfs, __ATOMIC_RELEASE);
+	seqcount_write_end(&vn->seq, ipl);
+
 	pr_info("mounted %s on %s\n", fsname, path);
 
 exit:
@@ -204,34 +212,55 @@ static size_t split_path(char *path)
 	return count;
 }
 
-status_t vfs_write(struct vnode *vp, voff_t offset, const void *buf,
-		   size_t length, size_t *writtenp)
-{
-	if (writtenp == NULL || vp->type == VDIR)
-		return YAK_INVALID_ARGS;
+/* position in an iovec, advanced as pages are copied */
+struct iov_iter {
+	const struct iovec *iov;
+	size_t off;
+};
 
-	if (vp->ops->vn_write) {
-		return vp->ops->vn_write(vp, offset, buf, length, writtenp);
+// copy len bytes between page memory and the iovec, crossing segments
+static void iov_copy(struct iov_iter *it, char *page, size_t len, bool to_page)
+{
+	while (len > 0) {
+		size_t n = MIN(len, it->iov->iov_len - it->off);
+		char *base = (char *)it->iov->iov_base + it->off;
+
+		if (to_page)
+			memcpy(page, base, n);
+		else
+			memcpy(base, page, n);
+
+		page += n;
+		len -= n;
+		it->off += n;
+		if (it->off == it->iov->iov_len) {
+			it->iov++;
+			it->off = 0;
+		}
 	}
+}
 
-	struct vm_object *obj = vp->vobj;
-	assert(obj);
-
-	if (length == 0)
-		return YAK_SUCCESS;
-
-	size_t written = 0;
-
-	size_t start_off = offset;
-	size_t end_off = offset + length;
+static size_t iov_length(const struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+	for (int i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	return total;
+}
 
-	VOP_LOCK(vp);
-	if (end_off > vp->filesize) {
-		vp->filesize = end_off;
-	}
-	VOP_UNLOCK(vp);
+/*
+ * Move length bytes between the page cache and the iovec. Each page is
+ * looked up once, no matter how many segments it spans.
+ */
+static status_t vfs_rw_pages(struct vnode *vn, voff_t offset,
+			     const struct iovec *iov, size_t length, bool write)
+{
+	struct vm_object *obj = vn->vobj;
+	assert(obj);
 
-	const char *src = buf;
+	struct iov_iter it = { .iov = iov, .off = 0 };
+	voff_t start_off = offset;
+	voff_t end_off = offset + length;
 
 	while (start_off < end_off) {
 		voff_t pageoff = ALIGN_DOWN(start_off, PAGE_SIZE);
@@ -241,80 +270,239 @@ status_t vfs_write(struct vnode *vp, voff_t offset, const void *buf,
 
 		struct page *pg;
 		// Lookup or allocate the page
-		status_t res = vm_lookuppage(obj, pageoff, 0, &pg);
+		status_t res = vm_lookuppage(obj, pageoff,
+					     write ? LOOKUP_WRITE : 0, &pg);
 		IF_ERR(res)
 		{
 			return res;
 		}
 
-		memcpy((char *)page_to_mapped_addr(pg) + page_offset, src,
-		       chunk);
+		iov_copy(&it, (char *)page_to_mapped_addr(pg) + page_offset,
+			 chunk, write);
 
-		// TODO: mark page as dirt?
-		// later, pager shall write it back
+		// the pager writes it back on the next sync
+		if (write)
+			vm_page_dirty(pg);
 
-		src += chunk;
 		start_off += chunk;
-		written += chunk;
 	}
 
-	*writtenp = written;
 	return YAK_SUCCESS;
 }
 
-status_t vfs_read(struct vnode *vn, voff_t offset, void *buf, size_t length,
-		  size_t *readp)
+// with the vnode lock held, until the data is copied in
+static status_t vfs_write_begin(struct vnode *vn, voff_t offset, size_t length)
+{
+	if (vn->ops->vn_write_begin) {
+		status_t res = vn->ops->vn_write_begin(vn, offset, length);
+		IF_ERR(res) return res;
+	}
+
+	if (offset + length > vn->filesize)
+		vn->filesize = offset + length;
+	return YAK_SUCCESS;
+}
+
+status_t vfs_writev(struct vnode *vp, voff_t offset, const struct iovec *iov,
+		    int iovcnt, size_t *writtenp)
 {
-	if (readp == NULL || vn->type == VDIR)
+	if (writtenp == NULL || vp->type == VDIR || iovcnt < 0)
 		return YAK_INVALID_ARGS;
 
-	if (vn->ops->vn_read) {
-		return vn->ops->vn_read(vn, offset, buf, length, readp);
+	*writtenp = 0;
+
+	if (vp->ops->vn_write) {
+		// no page cache to batch over, go segment by segment
+		for (int i = 0; i < iovcnt; i++) {
+			size_t n = 0;
+			status_t res = vp->ops->vn_write(vp, offset + *writtenp,
+							 iov[i].iov_base,
+							 iov[i].iov_len, &n);
+			IF_ERR(res)
+			{
+				return *writtenp ? YAK_SUCCESS : res;
+			}
+
+			*writtenp += n;
+			if (n < iov[i].iov_len)
+				break;
+		}
+		return YAK_SUCCESS;
 	}
 
-	struct vm_object *obj = vn->vobj;
-	assert(obj);
+	size_t length = iov_length(iov, iovcnt);
+	if (length == 0)
+		return YAK_SUCCESS;
+
+	VOP_LOCK(vp);
+	status_t res = vfs_write_begin(vp, offset, length);
+	if (IS_OK(res))
+		res = vfs_rw_pages(vp, offset, iov, length, true);
+	VOP_UNLOCK(vp);
+	IF_ERR(res) return res;
+
+	*writtenp = length;
+	return YAK_SUCCESS;
+}
+
+status_t vfs_readv(struct vnode *vn, voff_t offset, const struct iovec *iov,
+		   int iovcnt, size_t *readp)
+{
+	if (readp == NULL || vn->type == VDIR || iovcnt < 0)
+		return YAK_INVALID_ARGS;
+
+	*readp = 0;
+
+	if (vn->ops->vn_read) {
+		// a short read ends the transfer, like it would for read()
+		for (int i = 0; i < iovcnt; i++) {
+			size_t n = 0;
+			status_t res = vn->ops->vn_read(vn, offset + *readp,
+							iov[i].iov_base,
+							iov[i].iov_len, &n);
+			IF_ERR(res)
+			{
+				return *readp ? YAK_SUCCESS : res;
+			}
+
+			*readp += n;
+			if (n < iov[i].iov_len)
+				break;
+		}
+		return YAK_SUCCESS;
+	}
 
+	size_t length = iov_length(iov, iovcnt);
 	if (length == 0)
 		return YAK_SUCCESS;
 
 	if (offset >= vn->filesize) {
-		*readp = 0;
 		return YAK_EOF;
 	}
 
 	if (offset + length > vn->filesize)
 		length = vn->filesize - offset;
 
-	size_t read = 0;
-	char *dst = buf;
+	status_t res = vfs_rw_pages(vn, offset, iov, length, false);
+	IF_ERR(res) return res;
 
-	voff_t start_off = offset;
-	voff_t end_off = offset + length;
+	*readp = length;
+	return YAK_SUCCESS;
+}
 
-	while (start_off < end_off) {
-		voff_t pageoff = ALIGN_DOWN(start_off, PAGE_SIZE);
-		size_t page_offset = start_off - pageoff;
-		size_t chunk =
-			MIN(PAGE_SIZE - page_offset, end_off - start_off);
+status_t vfs_write(struct vnode *vp, voff_t offset, const void *buf,
+		   size_t length, size_t *writtenp)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = length };
+	return vfs_writev(vp, offset, &iov, 1, writtenp);
+}
 
-		struct page *pg;
-		// Lookup or retrieve the page
-		status_t res = vm_lookuppage(obj, pageoff, 0, &pg);
-		if (IS_ERR(res)) {
+status_t vfs_read(struct vnode *vn, voff_t offset, void *buf, size_t length,
+		  size_t *readp)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = length };
+	return vfs_readv(vn, offset, &iov, 1, readp);
+}
+
+status_t vfs_copy_range(struct vnode *src, voff_t srcoff, struct vnode *dst,
+			voff_t dstoff, size_t length, size_t *copiedp)
+{
+	if (copiedp == NULL || src->type == VDIR || dst->type == VDIR)
+		return YAK_INVALID_ARGS;
+
+	*copiedp = 0;
+
+	// the source has to live in the page cache
+	if (src->ops->vn_read || !src->vobj)
+		return YAK_NOT_SUPPORTED;
+
+	if (srcoff >= src->filesize)
+		return YAK_SUCCESS;
+
+	length = MIN(length, src->filesize - srcoff);
+
+	// destinations without a page cache are handed the source page
+	bool cached = dst->ops->vn_write == NULL;
+	status_t res = YAK_SUCCESS;
+	if (cached) {
+		assert(dst->vobj);
+		VOP_LOCK(dst);
+		res = vfs_write_begin(dst, dstoff, length);
+		IF_ERR(res)
+		{
+			VOP_UNLOCK(dst);
 			return res;
 		}
+	}
 
-		memcpy(dst, (char *)page_to_mapped_addr(pg) + page_offset,
-		       chunk);
+	size_t done = 0;
 
-		dst += chunk;
-		start_off += chunk;
-		read += chunk;
+	while (done < length) {
+		voff_t spos = srcoff + done;
+		voff_t dpos = dstoff + done;
+		voff_t spage = ALIGN_DOWN(spos, PAGE_SIZE);
+		size_t chunk = MIN(PAGE_SIZE - (spos - spage), length - done);
+		if (cached)
+			chunk = MIN(chunk, PAGE_SIZE - (dpos & (PAGE_SIZE - 1)));
+
+		struct page *spg;
+		res = vm_lookuppage(src->vobj, spage, 0, &spg);
+		IF_ERR(res) break;
+
+		char *from = (char *)page_to_mapped_addr(spg) + (spos - spage);
+
+		if (!cached) {
+			size_t n = 0;
+			res = dst->ops->vn_write(dst, dpos, from, chunk, &n);
+			IF_ERR(res) break;
+
+			done += n;
+			if (n < chunk)
+				break;
+			continue;
+		}
+
+		if (chunk == PAGE_SIZE) {
+			// both sides are page aligned
+			res = vm_object_copyin(dst->vobj, dpos, spg);
+		} else {
+			voff_t dpage = ALIGN_DOWN(dpos, PAGE_SIZE);
+			struct page *dpg;
+			res = vm_lookuppage(dst->vobj, dpage, LOOKUP_WRITE,
+					    &dpg);
+			if (IS_OK(res)) {
+				memcpy((char *)page_to_mapped_addr(dpg) +
+					       (dpos - dpage),
+				       from, chunk);
+				vm_page_dirty(dpg);
+			}
+		}
+		IF_ERR(res) break;
+
+		done += chunk;
 	}
 
-	*readp = read;
-	return YAK_SUCCESS;
+	if (cached)
+		VOP_UNLOCK(dst);
+
+	*copiedp = done;
+	return done ? YAK_SUCCESS : res;
+}
+
+status_t vfs_getdents(struct vnode *vn, struct dirent *buf, size_t bufsize,
+		      off_t *offset, size_t *bytes_read)
+{
+	if (vn->type != VDIR)
+		return YAK_NODIR;
+
+	if (!vn->ops->vn_getdents)
+		return YAK_NOT_SUPPORTED;
+
+	VOP_LOCK(vn);
+	status_t res = VOP_GETDENTS(vn, buf, bufsize, offset, bytes_read);
+	VOP_UNLOCK(vn);
+
+	return res;
 }
 
 status_t vfs_open(char *path, struct vnode **out)
@@ -342,6 +530,119 @@ status_t vfs_open(char *path, struct vnode **out)
 	return YAK_SUCCESS;
 }
 
+static bool vnode_ref_not_zero(struct vnode *vn)
+{
+	refcount_t cnt = __atomic_load_n(&vn->refcnt, __ATOMIC_RELAXED);
+	do {
+		if (cnt == 0)
+			return false;
+	} while (!__atomic_compare_exchange_n(&vn->refcnt, &cnt, cnt + 1, 0,
+					      __ATOMIC_ACQUIRE,
+					      __ATOMIC_RELAXED));
+	return true;
+}
+
+/*
+ * Optimistic walk without vnode locks or references. Every step is
+ * validated against the seqcount of the directory it was looked up in;
+ * only the final vnode is referenced (not locked).
+ * Returns YAK_BUSY if the locked walk has to take over, which includes
+ * running into a directory that is being written to.
+ */
+static status_t lookup_path_rcu(char *comp, size_t n_comps,
+				struct vnode *current, int flags, int want_dir,
+				struct vnode **out, char **lastp)
+{
+	status_t res = YAK_BUSY;
+
+	ipl_t ipl = rcu_read_lock();
+	unsigned int seq;
+	if (!seqcount_read_begin(&current->seq, &seq))
+		goto exit;
+
+	for (size_t i = 0; i < n_comps; i++) {
+		if (current->type != VDIR) {
+			res = YAK_NODIR;
+			goto exit;
+		}
+
+		*lastp = comp;
+
+		if (i + 1 == n_comps && (flags & VFS_LOOKUP_PARENT))
+			goto found;
+
+		if (!current->ops->vn_lookup_rcu)
+			goto exit;
+
+		struct vnode *next;
+		res = VOP_LOOKUP_RCU(current, comp, &next);
+		if (seqcount_read_retry(&current->seq, seq)) {
+			res = YAK_BUSY;
+			goto exit;
+		}
+
+		// a validated miss is as good as the locked walk's
+		if (res == YAK_NOENT)
+			goto exit;
+
+		IF_ERR(res)
+		{
+			res = YAK_BUSY;
+			goto exit;
+		}
+
+		res = YAK_BUSY;
+		if (!seqcount_read_begin(&next->seq, &seq))
+			goto exit;
+
+		struct vfs *mounted;
+		while ((mounted = __atomic_load_n(&next->mountedvfs,
+						  __ATOMIC_ACQUIRE))) {
+			struct vnode *root = VFS_GETROOT(mounted);
+			if (seqcount_read_retry(&next->seq, seq))
+				goto exit;
+
+			next = root;
+			if (!seqcount_read_begin(&next->seq, &seq))
+				goto exit;
+		}
+
+		// leave links to the locked walk
+		if (next->type == VLNK) {
+			res = YAK_BUSY;
+			goto exit;
+		}
+
+		current = next;
+		comp += strlen(comp) + 1;
+	}
+
+	if (want_dir && current->type != VDIR) {
+		res = YAK_NODIR;
+		goto exit;
+	}
+
+found:
+	if (!vnode_ref_not_zero(current)) {
+		res = YAK_BUSY;
+		goto exit;
+	}
+
+	if (seqcount_read_retry(&current->seq, seq)) {
+		rcu_read_unlock(ipl);
+		vnode_deref(current);
+		return YAK_BUSY;
+	}
+
+	rcu_read_unlock(ipl);
+	*out = current;
+	return YAK_SUCCESS;
+
+exit:
+	rcu_read_unlock(ipl);
+	return res;
+}
+
 status_t vfs_lookup_path(const char *path_, struct vnode *cwd, int flags,
 			 struct vnode **out, char **last_comp)
 {
@@ -371,6 +672,25 @@ status_t vfs_lookup_path(const char *path_, struct vnode *cwd, int flags,
 	if (last_comp)
 		*last_comp = NULL;
 
+	if (n_comps > 0) {
+		struct vnode *vn;
+		char *comp;
+		status_t res = lookup_path_rcu(path, n_comps, current, flags,
+					       want_dir, &vn, &comp);
+		if (res != YAK_BUSY) {
+			IF_ERR(res)
+			{
+				return res;
+			}
+
+			VOP_LOCK(vn);
+			*out = vn;
+			if (last_comp)
+				*last_comp = strndup(comp, strlen(comp) + 1);
+			return YAK_SUCCESS;
+		}
+	}
+
 	vnode_ref(current);
 	VOP_LOCK(current);
 
@@ -493,6 +813,22 @@ status_t vfs_ioctl(struct vnode *vn, unsigned long com, void *data)
 	return VOP_IOCTL(vn, com, data);
 }
 
+status_t vfs_fsync(struct vnode *vn)
+{
+	if (!vn->vobj)
+		return YAK_SUCCESS;
+
+	return vm_object_sync(vn->vobj);
+}
+
+short vfs_poll(struct vnode *vn, short events, struct poll_entry *pe)
+{
+	if (!vn->ops->vn_poll)
+		return events & (POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM);
+
+	return VOP_POLL(vn, events, pe);
+}
+
 status_t vfs_mmap(struct vnode *vn, struct vm_map *map, size_t length,
 		  voff_t offset, vm_prot_t prot, vm_inheritance_t inheritance,
 		  vaddr_t hint, int flags, vaddr_t *out)
@@ -516,40 +852,48 @@ void vfs_dump_rec(struct vnode *vn, const char *prefix)
 {
 	char buf[BUF_SIZE];
 	size_t bytes_read;
+	off_t dir_offset = 0;
 
 	if (!vn || !vn->ops->vn_getdents) {
 		pr_error("vnode does not have getdents\n");
 		return;
 	}
 
-	status_t res = VOP_GETDENTS(vn, (struct dirent *)buf, sizeof(buf),
-				    &bytes_read);
-	if (res != YAK_SUCCESS) {
-		pr_error("%s<failed to read dir>\n", prefix);
-		return;
-	}
-
-	size_t offset = 0;
-	while (offset < bytes_read) {
-		struct dirent *d = (struct dirent *)(buf + offset);
-		offset += d->d_reclen;
-
-		// Skip "." and ".."
-		if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
-			continue;
+	for (;;) {
+		status_t res = VOP_GETDENTS(vn, (struct dirent *)buf,
+					    sizeof(buf), &dir_offset,
+					    &bytes_read);
+		if (res != YAK_SUCCESS) {
+			pr_error("%s<failed to read dir>\n", prefix);
+			return;
+		}
 
-		// Print entry
-		printk(0, "%s  %s%s\n", prefix, d->d_name,
-		       (d->d_type == DT_DIR) ? "/" : "");
-
-		// Recurse if directory
-		if (d->d_type == DT_DIR) {
-			char new_prefix[128];
-			npf_snprintf(new_prefix, sizeof(new_prefix), "%s  ",
-				     prefix);
-			struct vnode *child;
-			VOP_LOOKUP(vn, d->d_name, &child);
-			vfs_dump_rec(child, new_prefix);
+		if (bytes_read == 0)
+			return;
+
+		size_t offset = 0;
+		while (offset < bytes_read) {
+			struct dirent *d = (struct dirent *)(buf + offset);
+			offset += d->d_reclen;
+
+			// Skip "." and ".."
+			if (strcmp(d->d_name, ".") == 0 ||
+			    strcmp(d->d_name, "..") == 0)
+				continue;
+
+			// Print entry
+			printk(0, "%s  %s%s\n", prefix, d->d_name,
+			       (d->d_type == DT_DIR) ? "/" : "");
+
+			// Recurse if directory
+			if (d->d_type == DT_DIR) {
+				char new_prefix[128];
+				npf_snprintf(new_prefix, sizeof(new_prefix),
+					     "%s  ", prefix);
+				struct vnode *child;
+				VOP_LOOKUP(vn, d->d_name, &child);
+				vfs_dump_rec(child, new_prefix);
+			}
 		}
 	}
 }
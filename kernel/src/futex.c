@@ -0,0 +1,302 @@
+#define pr_fmt(fmt) "futex: " fmt
+
+#include <yak/arch-mm.h>
+#include <yak/cpudata.h>
+#include <yak/futex.h>
+#include <yak/init.h>
+#include <yak/kevent.h>
+#include <yak/log.h>
+#include <yak/poll.h>
+#include <yak/process.h>
+#include <yak/queue.h>
+#include <yak/rwlock.h>
+#include <yak/spinlock.h>
+#include <yak/status.h>
+#include <yak/timer.h>
+#include <yak/vm/map.h>
+#include <yak/vm/object.h>
+
+#define FUTEX_HASH_BITS 8
+#define FUTEX_HASH_SIZE (1UL << FUTEX_HASH_BITS)
+
+struct futex_key {
+	// the backing object for shared futexes, the map otherwise
+	void *base;
+	uintptr_t off;
+	bool shared;
+};
+
+struct futex_waiter {
+	struct futex_key key;
+	uint32_t bitset;
+
+	// only changes on requeue, with both bucket locks held
+	struct futex_bucket *bucket;
+	bool queued;
+
+	struct kevent ev;
+	TAILQ_ENTRY(futex_waiter) entry;
+};
+
+struct futex_bucket {
+	struct spinlock lock;
+	TAILQ_HEAD(, futex_waiter) waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_HASH_SIZE];
+
+static struct futex_bucket *futex_hash(const struct futex_key *key)
+{
+	uint64_t h = ((uintptr_t)key->base ^ (key->off >> 2)) *
+		     0x9e3779b97f4a7c15ULL;
+	return &futex_table[h >> (64 - FUTEX_HASH_BITS)];
+}
+
+static bool key_eq(const struct futex_key *a, const struct futex_key *b)
+{
+	return a->base == b->base && a->off == b->off;
+}
+
+static void key_get(struct futex_key *key)
+{
+	if (key->shared)
+		vm_object_ref(key->base);
+}
+
+static void key_put(struct futex_key *key)
+{
+	if (key->shared)
+		vm_object_deref(key->base);
+}
+
+/*
+ * Only shared mappings of an object are keyed by it, so other
+ * processes mapping the same pages find the same waiters. Anything
+ * copy-on-write is private to this map anyway.
+ */
+static status_t futex_get_key(uint32_t *uaddr, bool shared,
+			      struct futex_key *key)
+{
+	vaddr_t addr = (vaddr_t)uaddr;
+	if (addr % sizeof(uint32_t) || addr < USER_VA_BASE ||
+	    addr >= USER_VA_END)
+		return YAK_INVALID_ARGS;
+
+	struct vm_map *map = curproc()->map;
+
+	key->base = map;
+	key->off = addr;
+	key->shared = false;
+
+	if (!shared)
+		return YAK_SUCCESS;
+
+	guard(rwlock)(&map->map_lock, TIMEOUT_INFINITE, RWLOCK_GUARD_SHARED);
+
+	struct vm_map_entry *entry = vm_map_lookup_entry_locked(map, addr);
+	if (!entry || entry->type != VM_MAP_ENT_OBJ)
+		return YAK_NULL_DEREF;
+
+	if (!entry->is_cow) {
+		key->base = entry->object;
+		key->off = entry->offset + (addr - entry->base);
+		key->shared = true;
+		key_get(key);
+	}
+
+	return YAK_SUCCESS;
+}
+
+// the waiter looks at queued under our lock, so it is still around
+static void futex_wake_locked(struct futex_bucket *fb, struct futex_waiter *w)
+{
+	TAILQ_REMOVE(&fb->waiters, w, entry);
+	w->queued = false;
+	event_alarm(&w->ev);
+}
+
+// returns whether we took ourselves off the queue, rather than a waker
+static bool futex_unqueue(struct futex_waiter *w)
+{
+	for (;;) {
+		struct futex_bucket *fb = __atomic_load_n(&w->bucket,
+							  __ATOMIC_ACQUIRE);
+		ipl_t ipl = spinlock_lock(&fb->lock);
+
+		// requeued while we were waiting for the lock
+		if (fb != w->bucket) {
+			spinlock_unlock(&fb->lock, ipl);
+			continue;
+		}
+
+		bool queued = w->queued;
+		if (queued) {
+			TAILQ_REMOVE(&fb->waiters, w, entry);
+			w->queued = false;
+		}
+
+		spinlock_unlock(&fb->lock, ipl);
+		return queued;
+	}
+}
+
+status_t futex_wait(uint32_t *uaddr, uint32_t val, uint32_t bitset,
+		    bool shared, nstime_t deadline)
+{
+	if (bitset == 0)
+		return YAK_INVALID_ARGS;
+
+	struct futex_waiter w;
+	status_t rv = futex_get_key(uaddr, shared, &w.key);
+	IF_ERR(rv) return rv;
+
+	w.bitset = bitset;
+	event_init(&w.ev, 0);
+
+	struct futex_bucket *fb = futex_hash(&w.key);
+	ipl_t ipl = spinlock_lock(&fb->lock);
+	w.bucket = fb;
+	w.queued = true;
+	TAILQ_INSERT_TAIL(&fb->waiters, &w, entry);
+	spinlock_unlock(&fb->lock, ipl);
+
+	/*
+	 * Reading the value may fault, so it is checked after queueing
+	 * rather than under the bucket lock. A waker stores the value before
+	 * looking at the queue, so one of us sees the other.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(uaddr, __ATOMIC_RELAXED) != val)
+		rv = YAK_AGAIN;
+	else
+		rv = poll_sleep(&w.ev, deadline);
+
+	// a wake that raced the timeout still counts
+	if (!futex_unqueue(&w))
+		rv = YAK_SUCCESS;
+
+	key_put(&w.key);
+	return rv;
+}
+
+status_t futex_wake(uint32_t *uaddr, int nr_wake, uint32_t bitset,
+		    bool shared, int *woken)
+{
+	if (bitset == 0)
+		return YAK_INVALID_ARGS;
+
+	struct futex_key key;
+	status_t rv = futex_get_key(uaddr, shared, &key);
+	IF_ERR(rv) return rv;
+
+	struct futex_bucket *fb = futex_hash(&key);
+	int n = 0;
+
+	ipl_t ipl = spinlock_lock(&fb->lock);
+
+	struct futex_waiter *w, *tmp;
+	TAILQ_FOREACH_SAFE(w, &fb->waiters, entry, tmp)
+	{
+		if (n >= nr_wake)
+			break;
+		if (!key_eq(&w->key, &key) || !(w->bitset & bitset))
+			continue;
+
+		futex_wake_locked(fb, w);
+		n++;
+	}
+
+	spinlock_unlock(&fb->lock, ipl);
+
+	key_put(&key);
+	*woken = n;
+	return YAK_SUCCESS;
+}
+
+status_t futex_requeue(uint32_t *uaddr, uint32_t *uaddr2, int nr_wake,
+		       int nr_requeue, const uint32_t *cmpval, bool shared,
+		       int *count)
+{
+	if (nr_wake < 0 || nr_requeue < 0)
+		return YAK_INVALID_ARGS;
+
+	struct futex_key key1, key2;
+	status_t rv = futex_get_key(uaddr, shared, &key1);
+	IF_ERR(rv) return rv;
+
+	rv = futex_get_key(uaddr2, shared, &key2);
+	IF_ERR(rv)
+	{
+		key_put(&key1);
+		return rv;
+	}
+
+	// may fault, so it can't happen under the bucket locks
+	if (cmpval && __atomic_load_n(uaddr, __ATOMIC_SEQ_CST) != *cmpval) {
+		key_put(&key1);
+		key_put(&key2);
+		return YAK_AGAIN;
+	}
+
+	struct futex_bucket *fb1 = futex_hash(&key1);
+	struct futex_bucket *fb2 = futex_hash(&key2);
+
+	// bucket locks nest in address order
+	struct futex_bucket *first = fb1 < fb2 ? fb1 : fb2;
+	struct futex_bucket *second = fb1 < fb2 ? fb2 : fb1;
+
+	ipl_t ipl = spinlock_lock(&first->lock);
+	if (second != first)
+		spinlock_lock_noipl(&second->lock);
+
+	int woken = 0, moved = 0;
+
+	struct futex_waiter *w, *tmp;
+	TAILQ_FOREACH_SAFE(w, &fb1->waiters, entry, tmp)
+	{
+		if (!key_eq(&w->key, &key1))
+			continue;
+
+		if (woken < nr_wake) {
+			futex_wake_locked(fb1, w);
+			woken++;
+			continue;
+		}
+
+		if (moved >= nr_requeue)
+			break;
+
+		// we hold a reference on key1, so this one can't be the last
+		key_put(&w->key);
+		w->key = key2;
+		key_get(&w->key);
+
+		if (fb1 != fb2) {
+			TAILQ_REMOVE(&fb1->waiters, w, entry);
+			TAILQ_INSERT_TAIL(&fb2->waiters, w, entry);
+			__atomic_store_n(&w->bucket, fb2, __ATOMIC_RELEASE);
+		}
+		moved++;
+	}
+
+	if (second != first)
+		spinlock_unlock_noipl(&second->lock);
+	spinlock_unlock(&first->lock, ipl);
+
+	key_put(&key1);
+	key_put(&key2);
+	*count = woken + moved;
+	return YAK_SUCCESS;
+}
+
+void futex_init()
+{
+	for (size_t i = 0; i < FUTEX_HASH_SIZE; i++) {
+		spinlock_init(&futex_table[i].lock);
+		TAILQ_INIT(&futex_table[i].waiters);
+	}
+}
+
+INIT_ENTAILS(futex);
+INIT_DEPS(futex);
+INIT_NODE(futex, futex_init);
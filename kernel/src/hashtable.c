@@ -27,6 +27,7 @@
 #include <yak/status.h>
 #include <yak/hashtable.h>
 #include <yak/log.h>
+#include <yak/rcu.h>
 
 #define TOMB (void *)1
 
@@ -78,16 +79,16 @@ static struct ht_entry *find_entry(hashtable_t *tbl, struct ht_entry *entries,
 	}
 }
 
-status_t ht_resize(struct hashtable *tbl, size_t new_cap)
+// a copy of the table with new_cap slots, without the tombstones
+static struct ht_entry *ht_rehash(struct hashtable *tbl, size_t new_cap,
+				  size_t *countp)
 {
 	struct ht_entry *entries = kzalloc(new_cap * sizeof(struct ht_entry));
 
 	if (!entries)
-		return YAK_OOM;
-
-	// reinsert all entries; removes the tombstones
-	tbl->count = 0;
+		return NULL;
 
+	size_t count = 0;
 	for (size_t i = 0; i < tbl->capacity; i++) {
 		struct ht_entry *entry = &tbl->entries[i];
 		if (entry->key == NULL)
@@ -99,49 +100,160 @@ status_t ht_resize(struct hashtable *tbl, size_t new_cap)
 		dest->key_len = entry->key_len;
 		dest->value = entry->value;
 
-		tbl->count++;
+		count++;
 	}
 
-	kfree(tbl->entries, tbl->capacity * sizeof(struct ht_entry));
+	*countp = count;
+	return entries;
+}
 
-	tbl->entries = entries;
-	tbl->capacity = new_cap;
+/*
+ * Publish entries before capacity; lockless readers must never index an
+ * array with a larger capacity. One that sees the old capacity with the
+ * new array can still miss, so tables read under a seqcount publish
+ * inside its write section. Returns the old array for kfree_rcu.
+ */
+static struct ht_entry *ht_publish(struct hashtable *tbl,
+				   struct ht_entry *entries, size_t new_cap,
+				   size_t count)
+{
+	struct ht_entry *old = tbl->entries;
+
+	__atomic_store_n(&tbl->entries, entries, __ATOMIC_RELEASE);
+	__atomic_store_n(&tbl->capacity, new_cap, __ATOMIC_RELEASE);
+	tbl->count = count;
+
+	return old;
+}
+
+status_t ht_resize(struct hashtable *tbl, size_t new_cap)
+{
+	size_t count;
+	struct ht_entry *entries = ht_rehash(tbl, new_cap, &count);
+	if (!entries)
+		return YAK_OOM;
+
+	size_t old_cap = tbl->capacity;
+	struct ht_entry *old = ht_publish(tbl, entries, new_cap, count);
+	kfree_rcu(old, old_cap * sizeof(struct ht_entry));
 
 	return YAK_SUCCESS;
 }
 
-status_t ht_set(struct hashtable *tbl, const void *key, size_t key_len,
-		void *value, int overwrite)
+// max load of 0.75
+static bool ht_fits(struct hashtable *tbl, size_t n)
 {
-	// max load of 0.75
-	// count + 1 > capacity * 0.75 | * 4
-	if ((tbl->count + 1) * 4 > tbl->capacity * 3) {
-		size_t new_cap = tbl->capacity == 0 ? 16 : tbl->capacity * 2;
-		status_t res = ht_resize(tbl, new_cap);
-		IF_ERR(res)
-		{
-			return res;
-		}
-	}
+	return (tbl->count + n) * 4 <= tbl->capacity * 3;
+}
+
+static size_t ht_grow_cap(struct hashtable *tbl, size_t n)
+{
+	size_t new_cap = tbl->capacity == 0 ? 16 : tbl->capacity * 2;
+	while ((tbl->count + n) * 4 > new_cap * 3)
+		new_cap *= 2;
+	return new_cap;
+}
+
+status_t ht_reserve(struct hashtable *tbl, size_t n)
+{
+	if (ht_fits(tbl, n))
+		return YAK_SUCCESS;
+
+	return ht_resize(tbl, ht_grow_cap(tbl, n));
+}
+
+status_t ht_set_owned(struct hashtable *tbl, void *key, size_t key_len,
+		      void *value)
+{
+	if (!ht_fits(tbl, 1))
+		return YAK_OOM;
 
 	struct ht_entry *entry =
 		find_entry(tbl, tbl->entries, tbl->capacity, key, key_len);
-	int new_key = (entry->key == NULL);
-	if (!new_key && !overwrite)
+	if (entry->key)
 		return YAK_EXISTS;
 
-	if (new_key && entry->value != TOMB)
+	if (entry->value != TOMB)
 		tbl->count++;
 
+	// the key is written last, so that lockless readers
+	// observing it also observe the value
 	entry->key_len = key_len;
+	entry->value = value;
+	__atomic_store_n(&entry->key, key, __ATOMIC_RELEASE);
+
+	return YAK_SUCCESS;
+}
+
+status_t ht_set(struct hashtable *tbl, const void *key, size_t key_len,
+		void *value, int overwrite)
+{
+	status_t res = ht_reserve(tbl, 1);
+	IF_ERR(res)
+	{
+		return res;
+	}
+
+	struct ht_entry *entry =
+		find_entry(tbl, tbl->entries, tbl->capacity, key, key_len);
+	if (entry->key) {
+		if (!overwrite)
+			return YAK_EXISTS;
+		entry->value = value;
+		return YAK_SUCCESS;
+	}
+
 	void *key_copy = kmalloc(key_len);
 	if (!key_copy)
 		return YAK_OOM;
 	memcpy(key_copy, key, key_len);
-	entry->key = key_copy;
-	entry->value = value;
 
-	return YAK_SUCCESS;
+	res = ht_set_owned(tbl, key_copy, key_len, value);
+	IF_ERR(res)
+	{
+		kfree(key_copy, key_len);
+	}
+	return res;
+}
+
+status_t ht_set_seq(struct hashtable *tbl, const void *key, size_t key_len,
+		    void *value, struct seqcount *sc)
+{
+	// a grown copy is built out here and swapped in inside the section
+	struct ht_entry *entries = NULL;
+	size_t new_cap = 0, count = 0;
+	if (!ht_fits(tbl, 1)) {
+		new_cap = ht_grow_cap(tbl, 1);
+		entries = ht_rehash(tbl, new_cap, &count);
+		if (!entries)
+			return YAK_OOM;
+	}
+
+	void *key_copy = kmalloc(key_len);
+	if (!key_copy) {
+		if (entries)
+			kfree(entries, new_cap * sizeof(struct ht_entry));
+		return YAK_OOM;
+	}
+	memcpy(key_copy, key, key_len);
+
+	struct ht_entry *old = NULL;
+	size_t old_cap = tbl->capacity;
+
+	ipl_t ipl = seqcount_write_begin(sc);
+	if (entries)
+		old = ht_publish(tbl, entries, new_cap, count);
+	status_t res = ht_set_owned(tbl, key_copy, key_len, value);
+	seqcount_write_end(sc, ipl);
+
+	if (old)
+		kfree_rcu(old, old_cap * sizeof(struct ht_entry));
+
+	IF_ERR(res)
+	{
+		kfree(key_copy, key_len);
+	}
+	return res;
 }
 
 void *ht_get(struct hashtable *tbl, const void *key, size_t key_len)
@@ -158,6 +270,40 @@ void *ht_get(struct hashtable *tbl, const void *key, size_t key_len)
 	return entry->value;
 }
 
+void *ht_get_rcu(struct hashtable *tbl, const void *key, size_t key_len)
+{
+	size_t capacity = __atomic_load_n(&tbl->capacity, __ATOMIC_ACQUIRE);
+	struct ht_entry *entries =
+		__atomic_load_n(&tbl->entries, __ATOMIC_ACQUIRE);
+
+	if (capacity == 0)
+		return NULL;
+
+	size_t index = tbl->hash(key, key_len) % capacity;
+
+	// bounded, the table may be modified beneath us
+	for (size_t i = 0; i < capacity; i++) {
+		struct ht_entry *entry = &entries[index];
+		void *entry_key =
+			__atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+
+		if (entry_key == NULL) {
+			if (__atomic_load_n(&entry->value, __ATOMIC_RELAXED) !=
+			    TOMB)
+				return NULL;
+		} else if (key_len == entry->key_len &&
+			   tbl->eq(key, entry_key, key_len)) {
+			void *value =
+				__atomic_load_n(&entry->value, __ATOMIC_RELAXED);
+			return value != TOMB ? value : NULL;
+		}
+
+		index = (index + 1) % capacity;
+	}
+
+	return NULL;
+}
+
 void ht_debug_dump(struct hashtable *tbl)
 {
 	pr_debug("=== dump hashtable %p ===\n", tbl);
@@ -181,9 +327,15 @@ bool ht_del(struct hashtable *tbl, const void *key, size_t key_len)
 	if (entry->key == NULL)
 		return false;
 
-	entry->key = NULL;
+	void *key_copy = entry->key;
+	size_t len = entry->key_len;
+
+	__atomic_store_n(&entry->key, NULL, __ATOMIC_RELEASE);
 	entry->key_len = 0;
 	entry->value = TOMB;
+
+	// lockless readers may still be comparing against it
+	kfree_rcu(key_copy, len);
 	return true;
 }
 
@@ -6,6 +6,16 @@
 #include <nanoprintf.h>
 #include <yak/panic.h>
 #include <yak/fs/vfs.h>
+#include <yak/fs/tmpfs.h>
+#include <yak/vm.h>
+#include <yak/vm/object.h>
+#include <yak/vm/physobj.h>
+#include <yak/heap.h>
+#include <yak/cpu.h>
+#include <yak/lz4.h>
+#include <yak/kevent.h>
+#include <yak/sched.h>
+#include <yak/wait.h>
 #include <yak/status.h>
 #include <yak/macro.h>
 #include <yak/log.h>
@@ -70,6 +80,54 @@ static uint64_t decode_octal(char *data, size_t size)
 	return sum;
 }
 
+static void tar_path(char *buf, size_t size, const char *path,
+		     struct tar_header *hdr)
+{
+	npf_snprintf(buf, size, "%s/%s%s", path, hdr->filename_prefix,
+		     hdr->filename);
+}
+
+/*
+ * Create the entry described by hdr. For regular files the (empty) vnode
+ * is returned in *file and the content size in *size.
+ */
+static void tar_entry(const char *path, struct tar_header *hdr,
+		      struct vnode **file, size_t *size)
+{
+	char pathbuf[4096];
+	struct vnode *vn;
+
+	*file = NULL;
+	*size = 0;
+
+	if (memcmp(hdr->magic, "ustar", 6) == 0) {
+		panic("bad tar magic\n");
+	}
+
+	tar_path(pathbuf, sizeof(pathbuf), path, hdr);
+
+	switch (hdr->filetype) {
+	case TAR_SYM:
+		//pr_debug("create sym %s -> %s\n", pathbuf, hdr->linkname);
+		vfs_symlink(pathbuf, hdr->linkname, &vn);
+		break;
+
+	case TAR_REG:
+		//pr_debug("create file %s\n", pathbuf);
+		EXPECT(vfs_create(pathbuf, VREG, file));
+		*size = decode_octal(hdr->filesize, sizeof(hdr->filesize));
+		break;
+
+	case TAR_DIR:
+		//pr_debug("create dir %s\n", pathbuf);
+		EXPECT(vfs_create(pathbuf, VDIR, &vn));
+		break;
+
+	default:
+		break;
+	}
+}
+
 void initrd_unpack_tar(const char *path, const char *data, size_t len)
 {
 	pr_debug("begin unpack ...\n");
@@ -78,8 +136,6 @@ void initrd_unpack_tar(const char *path, const char *data, size_t len)
 
 	size_t pos = 0;
 
-	char pathbuf[4096];
-
 	while (pos <= len) {
 		if (zero_filled >= 2)
 			break;
@@ -87,49 +143,307 @@ void initrd_unpack_tar(const char *path, const char *data, size_t len)
 		struct tar_header *hdr = (struct tar_header *)(data + pos);
 		pos += sizeof(struct tar_header);
 
-		if (memcmp(hdr->magic, "ustar", 6) == 0) {
-			panic("bad tar magic\n");
-		}
-
 		if (hdr->filetype == 0) {
 			zero_filled++;
 			continue;
 		}
 
-		npf_snprintf(pathbuf, sizeof(pathbuf), "%s/%s%s", path,
-			     hdr->filename_prefix, hdr->filename);
-
 		zero_filled = 0;
 
-		switch (hdr->filetype) {
-		case TAR_SYM:
-			//pr_debug("create sym %s -> %s\n", pathbuf, hdr->linkname);
-			vfs_symlink(pathbuf, hdr->linkname, &vn);
-			break;
-
-		case TAR_REG:
-			//pr_debug("create file %s\n", pathbuf);
-			EXPECT(vfs_create(pathbuf, VREG, &vn));
+		size_t size;
+		tar_entry(path, hdr, &vn, &size);
+		if (!vn)
+			continue;
 
-			size_t size = decode_octal(hdr->filesize,
-						   sizeof(hdr->filesize));
+		// back the file by the module itself instead of copying
+		paddr_t pa = v2p((vaddr_t)(data + pos));
+		struct vm_object *obj = vm_physobj_create(pa, size);
+		if (!obj || IS_ERR(tmpfs_import(vn, obj, size))) {
+			if (obj)
+				vm_object_deref(obj);
 
 			size_t written = -1;
 			EXPECT(vfs_write(vn, 0, (data + pos), size, &written));
+		}
 
-			pos += ALIGN_UP(size, 512);
-			break;
+		pos += ALIGN_UP(size, 512);
+	}
 
-		case TAR_DIR:
-			//pr_debug("create dir %s\n", pathbuf);
-			EXPECT(vfs_create(pathbuf, VDIR, &vn));
+	pr_debug("unpack complete\n");
+}
+
+/*
+ * Incremental tar parser for archives that don't exist contiguously in
+ * memory, fed chunk by chunk as they are decompressed.
+ */
+struct tar_stream {
+	const char *path;
+
+	struct tar_header hdr;
+	size_t hdr_fill;
+
+	// regular file currently being filled
+	struct vnode *file;
+	size_t file_off;
+	size_t file_left;
+
+	// padding up to the next header
+	size_t skip;
+
+	size_t zero_filled;
+	bool done;
+};
+
+static void tar_stream_init(struct tar_stream *ts, const char *path)
+{
+	memset(ts, 0, sizeof(struct tar_stream));
+	ts->path = path;
+}
 
+static void tar_stream_feed(struct tar_stream *ts, const char *data,
+			    size_t len)
+{
+	while (len > 0 && !ts->done) {
+		size_t n;
+
+		if (ts->file_left) {
+			n = MIN(len, ts->file_left);
+			size_t written = -1;
+			EXPECT(vfs_write(ts->file, ts->file_off, data, n,
+					 &written));
+			ts->file_off += n;
+			ts->file_left -= n;
+		} else if (ts->skip) {
+			n = MIN(len, ts->skip);
+			ts->skip -= n;
+		} else {
+			n = MIN(len, sizeof(struct tar_header) - ts->hdr_fill);
+			memcpy((char *)&ts->hdr + ts->hdr_fill, data, n);
+			ts->hdr_fill += n;
+
+			if (ts->hdr_fill == sizeof(struct tar_header)) {
+				ts->hdr_fill = 0;
+
+				if (ts->hdr.filetype == 0) {
+					if (++ts->zero_filled >= 2)
+						ts->done = true;
+				} else {
+					size_t size;
+					ts->zero_filled = 0;
+					tar_entry(ts->path, &ts->hdr, &ts->file,
+						  &size);
+					ts->file_off = 0;
+					ts->file_left = size;
+					ts->skip = ALIGN_UP(size, 512) - size;
+				}
+			}
+		}
+
+		data += n;
+		len -= n;
+	}
+}
+
+#define LZ4_WORKERS_MAX 8
+
+struct lz4_job {
+	struct kevent start, done;
+	bool quit;
+
+	struct lz4_block blk;
+	char *buf;
+	size_t cap;
+	size_t outlen;
+	status_t status;
+};
+
+static status_t lz4_job_run(struct lz4_job *job, const void *dict,
+			    size_t dictlen)
+{
+	if (job->blk.uncompressed) {
+		memcpy(job->buf, job->blk.data, job->blk.size);
+		job->outlen = job->blk.size;
+		return YAK_SUCCESS;
+	}
+
+	return lz4_decompress_block(job->blk.data, job->blk.size, job->buf,
+				    job->cap, dict, dictlen, &job->outlen);
+}
+
+static void lz4_job_reserve(struct lz4_job *job, size_t cap)
+{
+	if (job->cap >= cap)
+		return;
+
+	if (job->buf)
+		vm_kfree(job->buf, job->cap);
+
+	job->buf = vm_kalloc(cap, 0);
+	if (!job->buf)
+		panic("no memory for initrd decompression\n");
+	job->cap = cap;
+}
+
+static void lz4_worker(struct lz4_job *job)
+{
+	for (;;) {
+		sched_wait_single(&job->start, WAIT_MODE_BLOCK, WAIT_TYPE_ANY,
+				  TIMEOUT_INFINITE);
+		if (job->quit)
 			break;
 
-		default:
+		job->status = lz4_job_run(job, NULL, 0);
+		event_alarm(&job->done);
+	}
+
+	// the job may be freed as soon as this is seen
+	event_alarm(&job->done);
+	sched_exit_self();
+}
+
+static void lz4_job_finish(struct tar_stream *ts, struct lz4_job *job)
+{
+	sched_wait_single(&job->done, WAIT_MODE_BLOCK, WAIT_TYPE_ANY,
+			  TIMEOUT_INFINITE);
+	if (IS_ERR(job->status))
+		panic("corrupt lz4 block in initrd\n");
+
+	tar_stream_feed(ts, job->buf, job->outlen);
+}
+
+/*
+ * Blocks of independent frames are decompressed by one worker per cpu and
+ * fed to the tar parser in order; linked blocks need the previous output
+ * and are decompressed inline.
+ */
+static void initrd_unpack_lz4(const char *path, const char *data, size_t len)
+{
+	pr_debug("begin lz4 unpack ...\n");
+
+	struct lz4_frame fr;
+	lz4_frame_init(&fr, data, len);
+
+	struct tar_stream ts;
+	tar_stream_init(&ts, path);
+
+	size_t nworkers = MIN(cpus_online(), (size_t)LZ4_WORKERS_MAX);
+	if (nworkers < 2)
+		nworkers = 0;
+
+	// off our stack, the workers outlive this frame until they exit
+	struct lz4_job *jobs = NULL;
+	if (nworkers) {
+		jobs = kmalloc(nworkers * sizeof(struct lz4_job));
+		if (!jobs)
+			panic("no memory for initrd decompression\n");
+	}
+
+	for (size_t i = 0; i < nworkers; i++) {
+		struct lz4_job *job = &jobs[i];
+		memset(job, 0, sizeof(struct lz4_job));
+		event_init(&job->start, 0);
+		event_init(&job->done, 0);
+		EXPECT(kernel_thread_create("initrd_lz4", SCHED_PRIO_REAL_TIME,
+					    lz4_worker, job, 1, NULL));
+	}
+
+	// inline decompression, alternating so the last output is the dict
+	struct lz4_job linked[2];
+	memset(linked, 0, sizeof(linked));
+	size_t cur = 0;
+	bool have_dict = false;
+
+	size_t head = 0, inflight = 0;
+
+	for (;;) {
+		struct lz4_block blk;
+		status_t res = lz4_frame_next(&fr, &blk);
+		if (res == YAK_EOF)
 			break;
+		IF_ERR(res)
+		{
+			panic("corrupt lz4 frame in initrd: %s\n",
+			      status_str(res));
+		}
+
+		if (fr.independent && nworkers) {
+			if (inflight == nworkers) {
+				lz4_job_finish(&ts, &jobs[head]);
+				head = (head + 1) % nworkers;
+				inflight--;
+			}
+
+			struct lz4_job *job =
+				&jobs[(head + inflight) % nworkers];
+			lz4_job_reserve(job, fr.block_max);
+			job->blk = blk;
+			inflight++;
+			event_alarm(&job->start);
+
+			have_dict = false;
+			continue;
+		}
+
+		// keep the output in order
+		while (inflight) {
+			lz4_job_finish(&ts, &jobs[head]);
+			head = (head + 1) % nworkers;
+			inflight--;
 		}
+
+		struct lz4_job *job = &linked[cur], *prev = &linked[cur ^ 1];
+		lz4_job_reserve(job, fr.block_max);
+		job->blk = blk;
+
+		if (fr.independent || !have_dict)
+			res = lz4_job_run(job, NULL, 0);
+		else
+			res = lz4_job_run(job, prev->buf, prev->outlen);
+
+		if (IS_ERR(res))
+			panic("corrupt lz4 block in initrd\n");
+
+		tar_stream_feed(&ts, job->buf, job->outlen);
+
+		have_dict = true;
+		cur ^= 1;
 	}
 
-	pr_debug("unpack complete\n");
+	while (inflight) {
+		lz4_job_finish(&ts, &jobs[head]);
+		head = (head + 1) % nworkers;
+		inflight--;
+	}
+
+	for (size_t i = 0; i < nworkers; i++) {
+		jobs[i].quit = true;
+		event_alarm(&jobs[i].start);
+		sched_wait_single(&jobs[i].done, WAIT_MODE_BLOCK,
+				  WAIT_TYPE_ANY, TIMEOUT_INFINITE);
+		if (jobs[i].buf)
+			vm_kfree(jobs[i].buf, jobs[i].cap);
+	}
+
+	if (jobs)
+		kfree(jobs, nworkers * sizeof(struct lz4_job));
+
+	for (size_t i = 0; i < 2; i++) {
+		if (linked[i].buf)
+			vm_kfree(linked[i].buf, linked[i].cap);
+	}
+
+	if (!ts.done)
+		pr_warn("lz4 archive ended before the tar trailer\n");
+
+	pr_debug("lz4 unpack complete\n");
+}
+
+void initrd_unpack(const char *path, const char *data, size_t len)
+{
+	if (lz4_is_frame(data, len)) {
+		initrd_unpack_lz4(path, data, len);
+		return;
+	}
+
+	initrd_unpack_tar(path, data, len);
 }
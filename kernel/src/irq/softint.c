@@ -3,6 +3,7 @@
 #include <yak/ipl.h>
 #include <yak/cpudata.h>
 #include <yak/softint.h>
+#include <yak/rcu.h>
 
 #define PENDING(ipl) (1UL << ((ipl) - 1))
 
@@ -17,6 +18,9 @@ static void do_dpc_int(struct cpu *cpu)
 	softint_ack(cpu, IPL_DPC);
 	setipl(IPL_DPC);
 
+	// we came from below IPL_DPC, so no reader can be active
+	rcu_quiescent(cpu);
+
 	enable_interrupts();
 
 	dpc_queue_run(cpu);
@@ -59,6 +63,8 @@ void softint_issue(ipl_t ipl)
 void softint_issue_other(struct cpu *cpu, ipl_t ipl)
 {
 	__atomic_or_fetch(&cpu->softint_pending, PENDING(ipl),
-			  __ATOMIC_ACQUIRE);
-	plat_ipi(cpu);
+			  __ATOMIC_SEQ_CST);
+	// an idle cpu watching softint_pending wakes up by itself
+	if (!__atomic_load_n(&cpu->idle_polling, __ATOMIC_SEQ_CST))
+		plat_ipi(cpu);
 }
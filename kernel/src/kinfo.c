@@ -1,5 +1,6 @@
 #include <nanoprintf.h>
 #include <flanterm.h>
+#include <yak/acct.h>
 #include <yak/sched.h>
 #include <yak/vm/pmm.h>
 #include <yak/cpu.h>
@@ -41,8 +42,11 @@ static void kinfo_update_thread()
 			pmm_stat.free_pages >> 8, pmm_stat.usable_pages >> 8,
 			(pmm_stat.total_pages - pmm_stat.usable_pages) >> 8,
 			__atomic_load_n(&n_pagefaults, __ATOMIC_RELAXED));
-		// replace with system avg load
-		bufwrite("%ld active threads, %ld online CPUs", -1UL,
+		unsigned long avg[3];
+		acct_loadavg(NULL, avg);
+		bufwrite("load average: %lu.%02lu %lu.%02lu %lu.%02lu, %ld online CPUs",
+			 LOAD_INT(avg[0]), LOAD_FRAC(avg[0]), LOAD_INT(avg[1]),
+			 LOAD_FRAC(avg[1]), LOAD_INT(avg[2]), LOAD_FRAC(avg[2]),
 			 cpus_online());
 
 		flanterm_write(kinfo_flanterm_context, buf, len);
@@ -0,0 +1,250 @@
+#define pr_fmt(fmt) "lz4: " fmt
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <yak/lz4.h>
+#include <yak/macro.h>
+#include <yak/log.h>
+
+/*
+ * Decoder for the lz4 block and frame formats:
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+ */
+
+#define MIN_MATCH 4
+#define MAX_DISTANCE 65535
+
+static inline uint32_t read_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+	       ((uint32_t)p[3] << 24);
+}
+
+// extended lengths are a run of 255s terminated by a smaller byte
+static bool read_length(const uint8_t **ipp, const uint8_t *iend,
+			size_t *len)
+{
+	const uint8_t *ip = *ipp;
+	uint8_t b;
+	do {
+		if (ip >= iend)
+			return false;
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+	*ipp = ip;
+	return true;
+}
+
+status_t lz4_decompress_block(const void *src, size_t srclen, void *dst,
+			      size_t dstcap, const void *dict, size_t dictlen,
+			      size_t *outlen)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = ip + srclen;
+	uint8_t *op = dst;
+	uint8_t *const ostart = dst;
+	uint8_t *const oend = ostart + dstcap;
+
+	for (;;) {
+		if (ip >= iend)
+			return YAK_IO;
+
+		uint8_t token = *ip++;
+
+		size_t lit = token >> 4;
+		if (lit == 15 && !read_length(&ip, iend, &lit))
+			return YAK_IO;
+
+		if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+			return YAK_IO;
+
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+
+		// the last sequence only carries literals
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return YAK_IO;
+
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0)
+			return YAK_IO;
+
+		size_t mlen = token & 15;
+		if (mlen == 15 && !read_length(&ip, iend, &mlen))
+			return YAK_IO;
+		mlen += MIN_MATCH;
+
+		if (mlen > (size_t)(oend - op))
+			return YAK_IO;
+
+		size_t produced = op - ostart;
+		if (offset > produced) {
+			// match starts in the previous block
+			size_t back = offset - produced;
+			if (back > dictlen)
+				return YAK_IO;
+
+			const uint8_t *dp = dict;
+			dp += dictlen - back;
+			size_t n = MIN(back, mlen);
+			memcpy(op, dp, n);
+			op += n;
+			mlen -= n;
+
+			// the rest continues at the start of our output
+			const uint8_t *mp = ostart;
+			while (mlen--)
+				*op++ = *mp++;
+			continue;
+		}
+
+		const uint8_t *mp = op - offset;
+		if (offset >= mlen) {
+			memcpy(op, mp, mlen);
+			op += mlen;
+		} else {
+			// overlapping copy repeats the pattern
+			while (mlen--)
+				*op++ = *mp++;
+		}
+	}
+
+	*outlen = op - ostart;
+	return YAK_SUCCESS;
+}
+
+void lz4_frame_init(struct lz4_frame *fr, const void *data, size_t len)
+{
+	fr->pos = data;
+	fr->end = fr->pos + len;
+	fr->in_frame = false;
+	fr->block_checksum = false;
+	fr->content_checksum = false;
+	fr->independent = false;
+	fr->block_max = 0;
+}
+
+bool lz4_is_frame(const void *data, size_t len)
+{
+	return len >= 4 && read_le32(data) == LZ4_FRAME_MAGIC;
+}
+
+static status_t frame_header(struct lz4_frame *fr)
+{
+	for (;;) {
+		size_t left = fr->end - fr->pos;
+
+		// trailing padding after the last frame is fine
+		if (left < 4)
+			return YAK_EOF;
+
+		uint32_t magic = read_le32(fr->pos);
+
+		if ((magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+			if (left < 8)
+				return YAK_IO;
+			size_t skip = read_le32(fr->pos + 4);
+			if (skip > left - 8)
+				return YAK_IO;
+			fr->pos += 8 + skip;
+			continue;
+		}
+
+		if (magic != LZ4_FRAME_MAGIC) {
+			// zero padding between modules
+			if (magic == 0)
+				return YAK_EOF;
+			return YAK_IO;
+		}
+
+		// magic, FLG, BD and the header checksum
+		if (left < 7)
+			return YAK_IO;
+
+		uint8_t flg = fr->pos[4];
+		uint8_t bd = fr->pos[5];
+
+		if ((flg >> 6) != 1) {
+			pr_error("unsupported frame version %d\n", flg >> 6);
+			return YAK_NOT_SUPPORTED;
+		}
+
+		size_t hdrlen = 7;
+		// content size
+		if (flg & (1 << 3))
+			hdrlen += 8;
+		// dictionary id
+		if (flg & (1 << 0)) {
+			pr_error("dictionary frames are not supported\n");
+			return YAK_NOT_SUPPORTED;
+		}
+
+		if (left < hdrlen)
+			return YAK_IO;
+
+		unsigned int bsid = (bd >> 4) & 7;
+		if (bsid < 4)
+			return YAK_IO;
+
+		fr->independent = flg & (1 << 5);
+		fr->block_checksum = flg & (1 << 4);
+		fr->content_checksum = flg & (1 << 2);
+		fr->block_max = 1ULL << (8 + 2 * bsid);
+
+		fr->pos += hdrlen;
+		fr->in_frame = true;
+		return YAK_SUCCESS;
+	}
+}
+
+status_t lz4_frame_next(struct lz4_frame *fr, struct lz4_block *blk)
+{
+	for (;;) {
+		if (!fr->in_frame) {
+			status_t res = frame_header(fr);
+			IF_ERR(res)
+			{
+				return res;
+			}
+		}
+
+		if (fr->end - fr->pos < 4)
+			return YAK_IO;
+
+		uint32_t bsize = read_le32(fr->pos);
+		fr->pos += 4;
+
+		if (bsize == 0) {
+			// end mark
+			if (fr->content_checksum) {
+				if (fr->end - fr->pos < 4)
+					return YAK_IO;
+				fr->pos += 4;
+			}
+			fr->in_frame = false;
+			continue;
+		}
+
+		blk->uncompressed = bsize & (1U << 31);
+		blk->size = bsize & ~(1U << 31);
+		blk->data = fr->pos;
+
+		if (blk->size > fr->block_max)
+			return YAK_IO;
+
+		size_t need = blk->size + (fr->block_checksum ? 4 : 0);
+		if (need > (size_t)(fr->end - fr->pos))
+			return YAK_IO;
+
+		fr->pos += need;
+		return YAK_SUCCESS;
+	}
+}
@@ -5,10 +5,26 @@
 #include <yak/cpudata.h>
 #include <yak/log.h>
 #include <yak/kevent.h>
+#include <yak/macro.h>
+#include <yak/spinlock.h>
 
 // NOTE: this was chosen pretty arbitrarily
 #define LOCK_TRY_COUNT 50
 
+/*
+ * Priority inheritance: a thread blocking on a kmutex lends its priority
+ * to the owner, and on to the owner of whatever that one is blocked on.
+ * Owners keep the contended kmutexes they hold on pi_held, so they can
+ * drop back to what their remaining waiters need on release.
+ *
+ * The pi lock nests outside the thread and scheduler locks. It is one
+ * global lock rather than one per mutex because a boost walks a chain of
+ * mutexes and owners, and taking their locks along the way would need an
+ * order between arbitrary mutexes. Only contended acquires and releases
+ * of mutexes with waiters ever take it.
+ */
+static SPINLOCK(pi_lock);
+
 void kmutex_init(struct kmutex *mutex, [[maybe_unused]] const char *name)
 {
 	event_init(&mutex->event, 0);
@@ -16,6 +32,91 @@ void kmutex_init(struct kmutex *mutex, [[maybe_unused]] const char *name)
 	mutex->name = name;
 #endif
 	mutex->owner = NULL;
+
+	mutex->pi_waitcount = 0;
+	TAILQ_INIT(&mutex->pi_waiters);
+	mutex->pi_owner = NULL;
+}
+
+// highest priority among the threads blocked on what the thread holds
+static unsigned int pi_waiters_priority(struct kthread *thread)
+{
+	unsigned int priority = 0;
+
+	struct kmutex *mutex;
+	LIST_FOREACH(mutex, &thread->pi_held, pi_entry)
+	{
+		struct kthread *waiter;
+		TAILQ_FOREACH(waiter, &mutex->pi_waiters, pi_wait_entry)
+		{
+			priority = MAX(priority, sched_priority(waiter));
+		}
+	}
+
+	return priority;
+}
+
+// walk the chain of owners until a priority stays the same
+static void pi_adjust(struct kthread *owner)
+{
+	assert(spinlock_held(&pi_lock));
+
+	while (owner) {
+		if (!sched_set_pi_priority(owner, pi_waiters_priority(owner)))
+			break;
+
+		struct kmutex *mutex = owner->pi_blocked_on;
+		owner = mutex ? mutex->pi_owner : NULL;
+	}
+}
+
+static void pi_unlink(struct kmutex *mutex)
+{
+	LIST_REMOVE(mutex, pi_entry);
+	mutex->pi_owner = NULL;
+}
+
+static void pi_remove_waiter(struct kmutex *mutex, struct kthread *thread)
+{
+	TAILQ_REMOVE(&mutex->pi_waiters, thread, pi_wait_entry);
+	__atomic_sub_fetch(&mutex->pi_waitcount, 1, __ATOMIC_SEQ_CST);
+	thread->pi_blocked_on = NULL;
+
+	struct kthread *owner = mutex->pi_owner;
+	if (owner && TAILQ_EMPTY(&mutex->pi_waiters))
+		pi_unlink(mutex);
+
+	// we may have been what kept it boosted
+	pi_adjust(owner);
+}
+
+// returns false if the mutex was released before we got to boost its owner
+static bool pi_block(struct kmutex *mutex, struct kthread *thread)
+{
+	assert(spinlock_held(&pi_lock));
+
+	TAILQ_INSERT_TAIL(&mutex->pi_waiters, thread, pi_wait_entry);
+	thread->pi_blocked_on = mutex;
+
+	// pairs with kmutex_release, either it sees us or we see it gone
+	__atomic_add_fetch(&mutex->pi_waitcount, 1, __ATOMIC_SEQ_CST);
+	struct kthread *owner = __atomic_load_n(&mutex->owner,
+						__ATOMIC_SEQ_CST);
+	if (!owner) {
+		pi_remove_waiter(mutex, thread);
+		return false;
+	}
+
+	// the last owner may not have cleaned up yet, it adjusts itself then
+	if (mutex->pi_owner != owner) {
+		if (mutex->pi_owner)
+			pi_unlink(mutex);
+		mutex->pi_owner = owner;
+		LIST_INSERT_HEAD(&owner->pi_held, mutex, pi_entry);
+	}
+
+	pi_adjust(owner);
+	return true;
 }
 
 static status_t kmutex_acquire_common(struct kmutex *mutex, nstime_t timeout,
@@ -24,21 +125,34 @@ static status_t kmutex_acquire_common(struct kmutex *mutex, nstime_t timeout,
 	assert(mutex);
 	assert(mutex->owner != curthread());
 
+	struct kthread *thread = curthread();
+
 	while (1) {
 		for (int i = 0; i < LOCK_TRY_COUNT; i++) {
 			struct kthread *unlocked = NULL;
 			if (likely(__atomic_compare_exchange_n(
-				    &mutex->owner, &unlocked, curthread(), 0,
-				    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))) {
+				    &mutex->owner, &unlocked, thread, 0,
+				    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))) {
 				// we now own the mutex
 				return YAK_SUCCESS;
 			}
 			busyloop_hint();
 		}
 
+		ipl_t ipl = spinlock_lock(&pi_lock);
+		bool blocked = pi_block(mutex, thread);
+		spinlock_unlock(&pi_lock, ipl);
+
+		if (!blocked)
+			continue;
+
 		status_t status = sched_wait_single(mutex, waitmode,
 						    WAIT_TYPE_ANY, timeout);
 
+		ipl = spinlock_lock(&pi_lock);
+		pi_remove_waiter(mutex, thread);
+		spinlock_unlock(&pi_lock, ipl);
+
 		IF_ERR(status)
 		{
 			return status;
@@ -58,14 +172,30 @@ status_t kmutex_acquire_polling(struct kmutex *mutex, nstime_t timeout)
 
 void kmutex_release(struct kmutex *mutex)
 {
-	assert(mutex->owner == curthread());
+	struct kthread *thread = curthread();
+	assert(mutex->owner == thread);
 
 	// reset to non-owned
-	struct kthread *desired = curthread();
+	struct kthread *desired = thread;
 	if (likely(__atomic_compare_exchange_n(&mutex->owner, &desired, NULL, 0,
-					       __ATOMIC_ACQ_REL,
+					       __ATOMIC_SEQ_CST,
 					       __ATOMIC_RELAXED))) {
+		// pairs with pi_block, either we see its waiter or it sees us gone
+		if (likely(!__atomic_load_n(&mutex->pi_waitcount,
+					    __ATOMIC_SEQ_CST))) {
+			event_alarm(&mutex->event);
+			return;
+		}
+
+		// don't get preempted after dropping our boost but before the wakeup
+		ipl_t ipl = spinlock_lock(&pi_lock);
+		if (mutex->pi_owner == thread)
+			pi_unlink(mutex);
+		pi_adjust(thread);
+		spinlock_unlock_noipl(&pi_lock);
+
 		event_alarm(&mutex->event);
+		xipl(ipl);
 		return;
 	}
 
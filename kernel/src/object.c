@@ -32,14 +32,21 @@ int kobject_signal_locked(struct kobject_header *hdr, int unblock_all)
 		assert(wb);
 #endif
 		TAILQ_REMOVE(&hdr->wait_list, wb, entry);
+		wb->object = NULL;
 
 		hdr->waitcount -= 1;
 
 		struct kthread *thread = wb->thread;
 		spinlock_lock_noipl(&thread->thread_lock);
-		sched_wake_thread(thread, wb->status);
+		// the wait timed out already, leave the signal to others
+		bool waiting = thread->status == THREAD_WAITING;
+		if (waiting)
+			sched_wake_thread(thread, wb->status);
 		spinlock_unlock_noipl(&thread->thread_lock);
 
+		if (!waiting)
+			continue;
+
 		if (!unblock_all) {
 			return 1;
 		}
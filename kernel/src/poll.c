@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <yak/kevent.h>
+#include <yak/poll.h>
+#include <yak/queue.h>
+#include <yak/sched.h>
+#include <yak/spinlock.h>
+#include <yak/timer.h>
+#include <yak/wait.h>
+
+void pollhead_init(struct pollhead *ph)
+{
+	spinlock_init(&ph->lock);
+	LIST_INIT(&ph->entries);
+}
+
+void poll_entry_init(struct poll_entry *pe, short events,
+		     poll_notify_fn notify)
+{
+	pe->head = NULL;
+	pe->events = events;
+	pe->notify = notify;
+}
+
+void pollhead_attach(struct pollhead *ph, struct poll_entry *pe)
+{
+	assert(pe->head == NULL);
+
+	ipl_t ipl = spinlock_lock(&ph->lock);
+	LIST_INSERT_HEAD(&ph->entries, pe, list_entry);
+	pe->head = ph;
+	spinlock_unlock(&ph->lock, ipl);
+}
+
+void pollhead_detach(struct poll_entry *pe)
+{
+	struct pollhead *ph = pe->head;
+	if (!ph)
+		return;
+
+	// once this returns the callback isn't running anymore either
+	ipl_t ipl = spinlock_lock(&ph->lock);
+	LIST_REMOVE(pe, list_entry);
+	pe->head = NULL;
+	spinlock_unlock(&ph->lock, ipl);
+}
+
+void pollhead_notify(struct pollhead *ph, short revents)
+{
+	// an attach that raced us samples the new state under the caller's lock
+	if (LIST_EMPTY(&ph->entries))
+		return;
+
+	ipl_t ipl = spinlock_lock(&ph->lock);
+	struct poll_entry *pe;
+	LIST_FOREACH(pe, &ph->entries, list_entry)
+	{
+		if (revents & (pe->events | POLLERR | POLLHUP))
+			pe->notify(pe, revents);
+	}
+	spinlock_unlock(&ph->lock, ipl);
+}
+
+status_t poll_sleep(struct kevent *ev, nstime_t deadline)
+{
+	nstime_t timeout = TIMEOUT_INFINITE;
+
+	if (deadline != TIMER_INFINITE) {
+		nstime_t now = plat_getnanos();
+		if (now >= deadline)
+			return YAK_TIMEOUT;
+		timeout = deadline - now;
+	}
+
+	return sched_wait_single(ev, WAIT_MODE_BLOCK, WAIT_TYPE_ANY, timeout);
+}
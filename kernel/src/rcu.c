@@ -0,0 +1,131 @@
+#define pr_fmt(fmt) "rcu: " fmt
+
+#include <assert.h>
+#include <yak/rcu.h>
+#include <yak/cpu.h>
+#include <yak/cpudata.h>
+#include <yak/softint.h>
+#include <yak/spinlock.h>
+#include <yak/kevent.h>
+#include <yak/sched.h>
+#include <yak/init.h>
+#include <yak/heap.h>
+#include <yak/log.h>
+
+static struct kevent rcu_ev;
+static SPINLOCK(rcu_lock);
+static struct rcu_head *rcu_pending = NULL;
+
+void rcu_quiescent(struct cpu *cpu)
+{
+	__atomic_fetch_add(&cpu->rcu_qs, 1, __ATOMIC_RELEASE);
+}
+
+void synchronize_rcu()
+{
+	assert(curipl() == IPL_PASSIVE);
+
+	size_t cpu;
+
+	// a reader can't be active on the cpu we're running on
+	ipl_t ipl = ripl(IPL_DPC);
+	struct cpu *self = curcpu_ptr();
+	xipl(ipl);
+
+	for_each_cpu(cpu, &cpumask_active) {
+		struct cpu *other = getcpu(cpu);
+		if (other == self)
+			continue;
+
+		unsigned long snap =
+			__atomic_load_n(&other->rcu_qs, __ATOMIC_ACQUIRE);
+
+		// force a DPC softint, which only runs once the
+		// cpu dropped below IPL_DPC, i.e. left its reader
+		softint_issue_other(other, IPL_DPC);
+
+		while (__atomic_load_n(&other->rcu_qs, __ATOMIC_ACQUIRE) ==
+		       snap) {
+			busyloop_hint();
+		}
+	}
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+	head->func = func;
+
+	ipl_t ipl = spinlock_lock(&rcu_lock);
+	head->next = rcu_pending;
+	rcu_pending = head;
+	spinlock_unlock(&rcu_lock, ipl);
+
+	event_alarm(&rcu_ev);
+}
+
+struct rcu_kfree {
+	struct rcu_head head;
+	void *ptr;
+	size_t size;
+};
+
+static void rcu_kfree_cb(struct rcu_head *head)
+{
+	struct rcu_kfree *rk = (struct rcu_kfree *)head;
+	kfree(rk->ptr, rk->size);
+	kfree(rk, sizeof(struct rcu_kfree));
+}
+
+void kfree_rcu(void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	struct rcu_kfree *rk = kmalloc(sizeof(struct rcu_kfree));
+	if (!rk) {
+		// no memory to defer, wait it out here
+		synchronize_rcu();
+		kfree(ptr, size);
+		return;
+	}
+
+	rk->ptr = ptr;
+	rk->size = size;
+	call_rcu(&rk->head, rcu_kfree_cb);
+}
+
+static void rcu_thread_fn()
+{
+	for (;;) {
+		sched_wait_single(&rcu_ev, WAIT_MODE_BLOCK, WAIT_TYPE_ANY,
+				  TIMEOUT_INFINITE);
+
+		ipl_t ipl = spinlock_lock(&rcu_lock);
+		struct rcu_head *list = rcu_pending;
+		rcu_pending = NULL;
+		spinlock_unlock(&rcu_lock, ipl);
+
+		if (!list)
+			continue;
+
+		synchronize_rcu();
+
+		while (list) {
+			struct rcu_head *next = list->next;
+			list->func(list);
+			list = next;
+		}
+	}
+}
+
+void rcu_init()
+{
+	// kfree_rcu may already have been used during early boot
+	event_init(&rcu_ev, rcu_pending != NULL);
+	EXPECT(kernel_thread_create("rcu_thread", SCHED_PRIO_REAL_TIME,
+				    rcu_thread_fn, NULL, 1, NULL));
+}
+
+INIT_ENTAILS(rcu);
+INIT_DEPS(rcu);
+INIT_NODE(rcu, rcu_init);
@@ -1,13 +1,44 @@
+#define pr_fmt(fmt) "root: " fmt
+
 #include <yak/init.h>
+#include <yak/log.h>
 #include <yak/status.h>
 #include <yak/fs/vfs.h>
 
 void mount_root()
 {
-	EXPECT(vfs_mount("/", "tmpfs"));
+	EXPECT(vfs_mount("/", "tmpfs", NULL));
 }
 
 INIT_STAGE(rootfs);
 INIT_DEPS(rootfs, tmpfs);
 INIT_ENTAILS(rootfs, rootfs);
 INIT_NODE(rootfs, mount_root);
+
+#ifdef CONFIG_ROOT_DEV
+/*
+ * The boot tmpfs is needed until the block drivers are up, the disk is
+ * mounted on top of it afterwards. devfs is shared and mounted again.
+ */
+void mount_disk_root()
+{
+	status_t rv = vfs_mount("/", "ext2", CONFIG_ROOT_DEV);
+	IF_ERR(rv)
+	{
+		pr_warn("cannot mount %s: %s, staying on tmpfs\n",
+			CONFIG_ROOT_DEV, status_str(rv));
+		return;
+	}
+
+	struct vnode *vn;
+	rv = vfs_create("/dev", VDIR, &vn);
+	if (IS_ERR(rv) && rv != YAK_EXISTS)
+		pr_warn("cannot create /dev: %s\n", status_str(rv));
+
+	EXPECT(vfs_mount("/dev", "devfs", NULL));
+}
+
+INIT_ENTAILS(disk_root);
+INIT_DEPS(disk_root, ext2, ramdisk, virtio_blk_drv);
+INIT_NODE(disk_root, mount_disk_root);
+#endif
@@ -0,0 +1,320 @@
+#define pr_fmt(fmt) "acct: " fmt
+
+#include <assert.h>
+#include <string.h>
+#include <nanoprintf.h>
+#include <yak/acct.h>
+#include <yak/arch-cpu.h>
+#include <yak/cpu.h>
+#include <yak/cpudata.h>
+#include <yak/heap.h>
+#include <yak/init.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/process.h>
+#include <yak/sched.h>
+#include <yak/spinlock.h>
+#include <yak/timer.h>
+#include <yak/fs/devfs.h>
+
+// the bucket a thread is in when nothing special is going on
+static int thread_bucket(struct cpu *cpu, struct kthread *thread)
+{
+	if (thread->acct_user)
+		return CPU_TIME_USER;
+	if (thread == &cpu->idle_thread)
+		return CPU_TIME_IDLE;
+	return CPU_TIME_SYSTEM;
+}
+
+// interrupts must be off, else one could charge the same time again
+static void charge(struct cpu *cpu, struct kthread *thread, int bucket,
+		   nstime_t now)
+{
+	nstime_t delta = now - thread->acct_stamp;
+	thread->acct_stamp = now;
+
+	cpu->cpu_time[bucket] += delta;
+
+	switch (bucket) {
+	case CPU_TIME_USER:
+		thread->utime += delta;
+		break;
+	case CPU_TIME_IRQ:
+		thread->itime += delta;
+		break;
+	default:
+		thread->stime += delta;
+		break;
+	}
+}
+
+void acct_enter_kernel()
+{
+	int state = disable_interrupts();
+	struct cpu *cpu = curcpu_ptr();
+	struct kthread *thread = cpu->current_thread;
+
+	charge(cpu, thread, thread_bucket(cpu, thread), plat_getnanos());
+	thread->acct_user = false;
+
+	if (state)
+		enable_interrupts();
+}
+
+void acct_return_user()
+{
+	int state = disable_interrupts();
+	struct cpu *cpu = curcpu_ptr();
+	struct kthread *thread = cpu->current_thread;
+
+	charge(cpu, thread, thread_bucket(cpu, thread), plat_getnanos());
+	thread->acct_user = true;
+
+	if (state)
+		enable_interrupts();
+}
+
+// called with interrupts still off from the interrupt entry
+void acct_irq_enter()
+{
+	struct cpu *cpu = curcpu_ptr();
+	if (cpu->irq_depth++ == 0) {
+		struct kthread *thread = cpu->current_thread;
+		charge(cpu, thread, thread_bucket(cpu, thread),
+		       plat_getnanos());
+	}
+}
+
+// before the ipl drops again, dpcs and preemption aren't interrupt time
+void acct_irq_exit()
+{
+	int state = disable_interrupts();
+	struct cpu *cpu = curcpu_ptr();
+	if (--cpu->irq_depth == 0)
+		charge(cpu, cpu->current_thread, CPU_TIME_IRQ, plat_getnanos());
+
+	if (state)
+		enable_interrupts();
+}
+
+void acct_switch(struct kthread *from, struct kthread *to)
+{
+	struct cpu *cpu = curcpu_ptr();
+	nstime_t now = plat_getnanos();
+
+	charge(cpu, from, thread_bucket(cpu, from), now);
+	to->acct_stamp = now;
+}
+
+void acct_thread_times(struct kthread *thread, struct acct_times *times)
+{
+	times->utime = __atomic_load_n(&thread->utime, __ATOMIC_RELAXED);
+	times->stime = __atomic_load_n(&thread->stime, __ATOMIC_RELAXED);
+	times->itime = __atomic_load_n(&thread->itime, __ATOMIC_RELAXED);
+}
+
+void acct_process_times(struct kprocess *proc, struct acct_times *times)
+{
+	ipl_t ipl = spinlock_lock(&proc->thread_list_lock);
+
+	times->utime = proc->utime;
+	times->stime = proc->stime;
+	times->itime = proc->itime;
+
+	struct kthread *thread;
+	LIST_FOREACH(thread, &proc->thread_list, process_entry)
+	{
+		struct acct_times t;
+		acct_thread_times(thread, &t);
+		times->utime += t.utime;
+		times->stime += t.stime;
+		times->itime += t.itime;
+	}
+
+	spinlock_unlock(&proc->thread_list_lock, ipl);
+}
+
+void acct_thread_exit(struct kthread *thread)
+{
+	struct kprocess *proc = thread->owner_process;
+	assert(spinlock_held(&proc->thread_list_lock));
+
+	// the time since the last switch or kernel entry isn't charged yet
+	if (thread == curthread()) {
+		int state = disable_interrupts();
+		struct cpu *cpu = curcpu_ptr();
+		charge(cpu, thread, thread_bucket(cpu, thread),
+		       plat_getnanos());
+		if (state)
+			enable_interrupts();
+	}
+
+	proc->utime += thread->utime;
+	proc->stime += thread->stime;
+	proc->itime += thread->itime;
+
+	struct kprocess *parent = proc->parent_process;
+	if (proc->thread_count != 0 || !parent)
+		return;
+
+	// child locks nest inside the parent's nowhere else
+	spinlock_lock_noipl(&parent->thread_list_lock);
+	parent->cutime += proc->utime + proc->cutime;
+	parent->cstime += proc->stime + proc->cstime;
+	spinlock_unlock_noipl(&parent->thread_list_lock);
+}
+
+/*
+ * Every LOADAVG_INTERVAL each average moves towards the number of threads
+ * that are running or ready, by a factor of exp(-interval / period).
+ */
+#define LOADAVG_INTERVAL STIME(5)
+
+static const unsigned long loadavg_exp[3] = {
+	1884, // 1 minute
+	2014, // 5 minutes
+	2037, // 15 minutes
+};
+
+static unsigned long loadavg_decay(unsigned long avg, unsigned long exp,
+				   unsigned long active)
+{
+	unsigned long new = avg * exp + active * (LOADAVG_ONE - exp);
+	if (active >= avg)
+		new += LOADAVG_ONE - 1;
+	return new >> LOADAVG_SHIFT;
+}
+
+void acct_loadavg(struct cpu *cpu, unsigned long avg[3])
+{
+	for (size_t i = 0; i < 3; i++)
+		avg[i] = 0;
+
+	if (cpu) {
+		for (size_t i = 0; i < 3; i++)
+			avg[i] = __atomic_load_n(&cpu->loadavg[i],
+						 __ATOMIC_RELAXED);
+		return;
+	}
+
+	// the averages are linear, so the system is just the sum
+	size_t id;
+	for_each_cpu(id, &cpumask_active) {
+		for (size_t i = 0; i < 3; i++)
+			avg[i] += __atomic_load_n(&getcpu(id)->loadavg[i],
+						  __ATOMIC_RELAXED);
+	}
+}
+
+static void loadavg_fn()
+{
+	for (;;) {
+		ksleep(LOADAVG_INTERVAL);
+
+		size_t id;
+		for_each_cpu(id, &cpumask_active) {
+			struct cpu *cpu = getcpu(id);
+			size_t nr = sched_nr_running(cpu);
+			// don't count ourselves
+			if (cpu == curcpu_ptr() && nr)
+				nr--;
+
+			for (size_t i = 0; i < 3; i++) {
+				unsigned long avg = loadavg_decay(
+					cpu->loadavg[i], loadavg_exp[i],
+					nr * LOADAVG_ONE);
+				__atomic_store_n(&cpu->loadavg[i], avg,
+						 __ATOMIC_RELAXED);
+			}
+		}
+	}
+}
+
+/*
+ * /dev/stat: one line for the whole system and one per cpu, with the
+ * user, system, irq and idle time in milliseconds followed by the load
+ * averages.
+ */
+#define STAT_MAJOR 1
+#define STAT_LINE_MAX 128
+
+static size_t stat_line(char *buf, size_t size, const char *name,
+			const nstime_t *times, const unsigned long *avg)
+{
+	return npf_snprintf(buf, size,
+			    "%s %llu %llu %llu %llu %lu.%02lu %lu.%02lu %lu.%02lu\n",
+			    name, times[CPU_TIME_USER] / MSTIME(1),
+			    times[CPU_TIME_SYSTEM] / MSTIME(1),
+			    times[CPU_TIME_IRQ] / MSTIME(1),
+			    times[CPU_TIME_IDLE] / MSTIME(1), LOAD_INT(avg[0]),
+			    LOAD_FRAC(avg[0]), LOAD_INT(avg[1]),
+			    LOAD_FRAC(avg[1]), LOAD_INT(avg[2]),
+			    LOAD_FRAC(avg[2]));
+}
+
+static status_t stat_read([[maybe_unused]] int minor, voff_t offset,
+			  void *buf, size_t length, size_t *read_bytes)
+{
+	size_t size = (cpus_online() + 1) * STAT_LINE_MAX;
+	char *text = kmalloc(size);
+	if (!text)
+		return YAK_OOM;
+
+	nstime_t total[CPU_TIME_NR] = { 0 };
+	size_t id;
+	for_each_cpu(id, &cpumask_active) {
+		for (size_t i = 0; i < CPU_TIME_NR; i++)
+			total[i] += __atomic_load_n(&getcpu(id)->cpu_time[i],
+						    __ATOMIC_RELAXED);
+	}
+
+	unsigned long avg[3];
+	acct_loadavg(NULL, avg);
+	size_t len = stat_line(text, size, "cpu", total, avg);
+
+	for_each_cpu(id, &cpumask_active) {
+		struct cpu *cpu = getcpu(id);
+		nstime_t times[CPU_TIME_NR];
+		for (size_t i = 0; i < CPU_TIME_NR; i++)
+			times[i] = __atomic_load_n(&cpu->cpu_time[i],
+						   __ATOMIC_RELAXED);
+
+		char name[16];
+		npf_snprintf(name, sizeof(name), "cpu%zu", id);
+		acct_loadavg(cpu, avg);
+		len += stat_line(text + len, size - len, name, times, avg);
+		// snprintf counts what didn't fit too
+		len = MIN(len, size - 1);
+	}
+
+	size_t n = 0;
+	if ((size_t)offset < len) {
+		n = MIN(length, len - offset);
+		memcpy(buf, text + offset, n);
+	}
+
+	kfree(text, size);
+	*read_bytes = n;
+	return YAK_SUCCESS;
+}
+
+static struct device_ops stat_ops = {
+	.dev_read = stat_read,
+	.dev_write = NULL,
+	.dev_open = NULL,
+	.dev_ioctl = NULL,
+};
+
+void acct_init()
+{
+	kernel_thread_create("loadavg", SCHED_PRIO_REAL_TIME_END, loadavg_fn,
+			     NULL, 1, NULL);
+
+	struct vnode *vn;
+	EXPECT(devfs_register("stat", VCHR, STAT_MAJOR, 0, &stat_ops, &vn));
+}
+
+INIT_ENTAILS(acct);
+INIT_DEPS(acct, fs_devfs_mount);
+INIT_NODE(acct, acct_init);
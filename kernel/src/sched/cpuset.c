@@ -0,0 +1,248 @@
+#define pr_fmt(fmt) "cpuset: " fmt
+
+#include <assert.h>
+#include <string.h>
+#include <yak/cpu.h>
+#include <yak/cpuset.h>
+#include <yak/heap.h>
+#include <yak/log.h>
+#include <yak/process.h>
+#include <yak/queue.h>
+#include <yak/sched.h>
+#include <yak/spinlock.h>
+#include <yak/status.h>
+
+/*
+ * Lock order: cpuset_lock, then a process's thread_list_lock, then the
+ * thread locks. Membership, the cpus of every set and the affinity of
+ * every thread only change under cpuset_lock.
+ */
+static SPINLOCK(cpuset_lock);
+
+static struct cpuset cpuset_root = {
+	.name = CPUSET_ROOT,
+	.cpus = { .bits = { [0 ... CPUMASK_BITS_SIZE - 1] = ~0UL } },
+	.members = LIST_HEAD_INITIALIZER(cpuset_root.members),
+};
+
+static LIST_HEAD(, cpuset) cpusets = LIST_HEAD_INITIALIZER(cpusets);
+
+static struct cpuset *cpuset_find(const char *name)
+{
+	if (!strcmp(name, CPUSET_ROOT))
+		return &cpuset_root;
+
+	struct cpuset *cs;
+	LIST_FOREACH(cs, &cpusets, list_entry)
+	{
+		if (!strcmp(cs->name, name))
+			return cs;
+	}
+	return NULL;
+}
+
+static bool name_valid(const char *name)
+{
+	size_t len = strnlen(name, CPUSET_NAME_MAX);
+	return len > 0 && len < CPUSET_NAME_MAX;
+}
+
+// kernel threads belong to no set and may run anywhere
+static struct cpuset *proc_cpuset(struct kprocess *proc)
+{
+	return proc->cpuset ? proc->cpuset : &cpuset_root;
+}
+
+// like linux, an affinity that lost every cpu of the set widens to all of it
+static void thread_apply(struct kthread *thread, struct cpuset *cs)
+{
+	struct cpumask allowed;
+	if (!cpumask_and(&allowed, &thread->affinity, &cs->cpus))
+		allowed = cs->cpus;
+	sched_set_cpus_allowed(thread, &allowed);
+}
+
+static void proc_apply(struct kprocess *proc, struct cpuset *cs)
+{
+	assert(spinlock_held(&cpuset_lock));
+
+	spinlock_lock_noipl(&proc->thread_list_lock);
+
+	struct kthread *thread;
+	LIST_FOREACH(thread, &proc->thread_list, process_entry)
+	{
+		thread_apply(thread, cs);
+	}
+
+	spinlock_unlock_noipl(&proc->thread_list_lock);
+}
+
+// the process may be in the middle of kthread_init, so it is pointed at
+// the set before its threads are walked
+static void proc_move(struct kprocess *proc, struct cpuset *cs)
+{
+	if (proc->cpuset)
+		LIST_REMOVE(proc, cpuset_entry);
+
+	LIST_INSERT_HEAD(&cs->members, proc, cpuset_entry);
+	__atomic_store_n(&proc->cpuset, cs, __ATOMIC_RELEASE);
+
+	proc_apply(proc, cs);
+}
+
+void cpuset_fork(struct kprocess *child, struct kprocess *parent)
+{
+	ipl_t ipl = spinlock_lock(&cpuset_lock);
+	struct cpuset *cs = proc_cpuset(parent);
+	LIST_INSERT_HEAD(&cs->members, child, cpuset_entry);
+	child->cpuset = cs;
+	spinlock_unlock(&cpuset_lock, ipl);
+}
+
+status_t cpuset_define(const char *name, const struct cpumask *cpus)
+{
+	if (!name_valid(name) || !strcmp(name, CPUSET_ROOT))
+		return YAK_INVALID_ARGS;
+
+	struct cpumask online;
+	if (!cpumask_and(&online, cpus, &cpumask_active))
+		return YAK_INVALID_ARGS;
+
+	// allocated up front, we can't while holding the lock
+	struct cpuset *new = kzalloc(sizeof(struct cpuset));
+	if (!new)
+		return YAK_OOM;
+
+	ipl_t ipl = spinlock_lock(&cpuset_lock);
+
+	struct cpuset *cs = cpuset_find(name);
+	if (cs) {
+		cs->cpus = *cpus;
+
+		struct kprocess *proc;
+		LIST_FOREACH(proc, &cs->members, cpuset_entry)
+		{
+			proc_apply(proc, cs);
+		}
+	} else {
+		strcpy(new->name, name);
+		new->cpus = *cpus;
+		LIST_INIT(&new->members);
+		LIST_INSERT_HEAD(&cpusets, new, list_entry);
+	}
+
+	spinlock_unlock(&cpuset_lock, ipl);
+
+	if (cs)
+		kfree(new, sizeof(struct cpuset));
+	else
+		pr_debug("created %s\n", name);
+
+	// we may have just moved ourselves off this cpu
+	sched_migrate_self();
+	return YAK_SUCCESS;
+}
+
+status_t cpuset_destroy(const char *name)
+{
+	if (!name_valid(name))
+		return YAK_INVALID_ARGS;
+
+	ipl_t ipl = spinlock_lock(&cpuset_lock);
+
+	struct cpuset *cs = cpuset_find(name);
+	status_t rv = YAK_SUCCESS;
+	if (!cs)
+		rv = YAK_NOENT;
+	else if (cs == &cpuset_root || !LIST_EMPTY(&cs->members))
+		rv = YAK_BUSY;
+	else
+		LIST_REMOVE(cs, list_entry);
+
+	spinlock_unlock(&cpuset_lock, ipl);
+
+	if (IS_OK(rv))
+		kfree(cs, sizeof(struct cpuset));
+	return rv;
+}
+
+status_t cpuset_attach(struct kprocess *proc, const char *name)
+{
+	if (!name_valid(name))
+		return YAK_INVALID_ARGS;
+
+	ipl_t ipl = spinlock_lock(&cpuset_lock);
+
+	struct cpuset *cs = cpuset_find(name);
+	if (!cs) {
+		spinlock_unlock(&cpuset_lock, ipl);
+		return YAK_NOENT;
+	}
+
+	if (proc_cpuset(proc) != cs)
+		proc_move(proc, cs);
+
+	spinlock_unlock(&cpuset_lock, ipl);
+
+	sched_migrate_self();
+	return YAK_SUCCESS;
+}
+
+static struct kthread *find_thread(struct kprocess *proc, pid_t tid)
+{
+	assert(spinlock_held(&proc->thread_list_lock));
+
+	struct kthread *thread;
+	LIST_FOREACH(thread, &proc->thread_list, process_entry)
+	{
+		if (thread->tid == tid)
+			return thread;
+	}
+	return NULL;
+}
+
+status_t cpuset_set_affinity(struct kprocess *proc, pid_t tid,
+			     const struct cpumask *mask)
+{
+	ipl_t ipl = spinlock_lock(&cpuset_lock);
+	spinlock_lock_noipl(&proc->thread_list_lock);
+
+	struct cpuset *cs = proc_cpuset(proc);
+	struct kthread *thread = find_thread(proc, tid);
+
+	struct cpumask allowed, online;
+	status_t rv = YAK_SUCCESS;
+	if (!thread)
+		rv = YAK_NOENT;
+	else if (!cpumask_and(&allowed, mask, &cs->cpus) ||
+		 !cpumask_and(&online, &allowed, &cpumask_active))
+		rv = YAK_INVALID_ARGS;
+
+	if (IS_OK(rv)) {
+		thread->affinity = *mask;
+		sched_set_cpus_allowed(thread, &allowed);
+	}
+
+	spinlock_unlock_noipl(&proc->thread_list_lock);
+	spinlock_unlock(&cpuset_lock, ipl);
+
+	if (IS_OK(rv))
+		sched_migrate_self();
+	return rv;
+}
+
+status_t cpuset_get_affinity(struct kprocess *proc, pid_t tid,
+			     struct cpumask *mask)
+{
+	ipl_t ipl = spinlock_lock(&cpuset_lock);
+	spinlock_lock_noipl(&proc->thread_list_lock);
+
+	struct kthread *thread = find_thread(proc, tid);
+	if (thread)
+		cpumask_and(mask, &thread->cpus_allowed, &cpumask_active);
+
+	spinlock_unlock_noipl(&proc->thread_list_lock);
+	spinlock_unlock(&cpuset_lock, ipl);
+
+	return thread ? YAK_SUCCESS : YAK_NOENT;
+}
@@ -0,0 +1,69 @@
+#include <assert.h>
+#include <yak/arch-cpu.h>
+#include <yak/cpudata.h>
+#include <yak/idle.h>
+#include <yak/ipl.h>
+#include <yak/spinlock.h>
+#include <yak/timer.h>
+
+/*
+ * Like haltpoll: a sleep that ended within IDLE_POLL_MAX means the window
+ * was too short, a longer one that we spin for nothing.
+ */
+#define IDLE_POLL_START USTIME(10)
+#define IDLE_POLL_MAX USTIME(100)
+
+static void poll_adjust(struct cpu *cpu, nstime_t slept)
+{
+	nstime_t window = cpu->idle_poll_ns;
+
+	if (slept <= IDLE_POLL_MAX) {
+		window = window ? window * 2 : IDLE_POLL_START;
+		if (window > IDLE_POLL_MAX)
+			window = IDLE_POLL_MAX;
+	} else {
+		window /= 2;
+		if (window < IDLE_POLL_START)
+			window = 0;
+	}
+
+	cpu->idle_poll_ns = window;
+}
+
+static bool poll(struct cpu *cpu, nstime_t start)
+{
+	while (plat_getnanos() - start < cpu->idle_poll_ns) {
+		if (idle_work_pending(cpu))
+			return true;
+		busyloop_hint();
+	}
+	return idle_work_pending(cpu);
+}
+
+void cpu_idle(struct cpu *cpu)
+{
+	// nothing can switch the idle thread away above IPL_PASSIVE, so the
+	// flag never stays set while another thread runs here
+	assert(curipl() == IPL_DPC);
+
+	// pairs with the store of softint_pending in softint_issue_other
+	__atomic_store_n(&cpu->idle_polling, 1, __ATOMIC_SEQ_CST);
+
+	nstime_t start = plat_getnanos();
+	if (poll(cpu, start)) {
+		__atomic_store_n(&cpu->idle_polling, 0, __ATOMIC_RELAXED);
+		return;
+	}
+
+	disable_interrupts();
+
+	// halting can't see the write, so wakers have to send the ipi again
+	if (!plat_idle_watches())
+		__atomic_store_n(&cpu->idle_polling, 0, __ATOMIC_SEQ_CST);
+
+	nstime_t sleep = plat_getnanos();
+	plat_idle(cpu, timer_next_deadline());
+
+	__atomic_store_n(&cpu->idle_polling, 0, __ATOMIC_RELAXED);
+	poll_adjust(cpu, plat_getnanos() - sleep);
+}
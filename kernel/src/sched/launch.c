@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <yak/vm/kstack.h>
 #include <yak/vm/map.h>
 #include <yak/fs/vfs.h>
 #include <yak/sched.h>
@@ -52,13 +53,13 @@ status_t launch_elf(struct kprocess *proc, char *path, int priority,
 		return status;
 	}
 
-	struct kthread *thrd = kmalloc(sizeof(struct kthread));
+	struct kthread *thrd = kthread_alloc();
 	assert(thrd);
 	kthread_init(thrd, argv_strings[0], priority, proc, 1);
 
 	// Allocate kernel stack
-	vaddr_t stack_addr = (vaddr_t)vm_kalloc(KSTACK_SIZE, 0);
-	stack_addr += KSTACK_SIZE;
+	vaddr_t stack_addr = (vaddr_t)kstack_alloc();
+	assert(stack_addr);
 
 	thrd->kstack_top = (void *)stack_addr;
 
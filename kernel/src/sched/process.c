@@ -7,11 +7,12 @@
 #include <yak/mutex.h>
 #include <yak/hashtable.h>
 #include <yak/cpudata.h>
+#include <yak/cpuset.h>
 #include <yak/spinlock.h>
 
 struct kprocess kproc0;
 
-static uint64_t next_pid = 0;
+static pid_t next_pid = 0;
 
 struct id_map {
 	struct spinlock table_lock;
@@ -74,6 +75,11 @@ void insert_pgrp(struct pgrp *pgrp)
 	id_map_push(&pgid_table, pgrp->pgid, pgrp);
 }
 
+pid_t alloc_pid()
+{
+	return __atomic_fetch_add(&next_pid, 1, __ATOMIC_SEQ_CST);
+}
+
 struct kprocess *lookup_pid(pid_t pid)
 {
 	return id_map_find(&pid_table, pid);
@@ -93,12 +99,15 @@ void kprocess_init(struct kprocess *process)
 {
 	memset(process, 0, sizeof(struct kprocess));
 
-	process->pid = __atomic_fetch_add(&next_pid, 1, __ATOMIC_SEQ_CST);
+	process->pid = alloc_pid();
 	process->parent_process = NULL;
 
 	spinlock_init(&process->thread_list_lock);
 	LIST_INIT(&process->thread_list);
 	process->thread_count = 0;
+	TAILQ_INIT(&process->exited_threads);
+	process->nexited = 0;
+	event_init(&process->thread_exit_ev, 0);
 
 	if (likely(process != &kproc0)) {
 		process->map = kzalloc(sizeof(struct vm_map));
@@ -116,13 +125,14 @@ void uprocess_init(struct kprocess *process, struct kprocess *parent)
 	process->parent_process = parent;
 
 	kmutex_init(&process->fd_mutex, "fd");
-	process->fd_cap = 0;
-	process->fds = NULL;
+	process->fdtable = NULL;
 
 	spinlock_init(&process->jobctl_lock);
 	process->session = NULL;
 	process->pgrp = NULL;
 
+	cpuset_fork(process, parent);
+
 	id_map_push(&pid_table, process->pid, process);
 }
 
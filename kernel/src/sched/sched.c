@@ -9,12 +9,15 @@ From my rough understanding we have three classes:
 We have three different queues: idle, current, next
 
 idle queue is only ran once we don't have any thread whatsover on any other queue
-time-shared threads may not preempt any other thread
+time-shared threads may only preempt if interactive, and only batch threads
 real-time threads may preempt lower priority threads
 
 Threads may be deemed interactive and end up on current queues too / handled as realtime threads
 
-i'll implement everything very primitively. interactivity and other features will follow when userspace :^)
+Interactivity is scored from decayed run and sleep time like ULE does, the
+score also moves time-share threads around their base priority. Time-share
+threads get a slice from the per-cpu slice timer, real-time threads run
+until they block.
 
 The idea for the scheduler mechanisms are from MINTIA (by @hyenasky)
 See: https://github.com/xrarch/mintia2
@@ -24,11 +27,14 @@ See: https://github.com/xrarch/mintia2
 
 #include <assert.h>
 #include <string.h>
+#include <yak/acct.h>
 #include <yak/log.h>
 #include <yak/init.h>
 #include <yak/cpu.h>
+#include <yak/cpuset.h>
 #include <yak/kevent.h>
 #include <yak/dpc.h>
+#include <yak/idle.h>
 #include <yak/sched.h>
 #include <yak/softint.h>
 #include <yak/cpudata.h>
@@ -72,6 +78,109 @@ void sched_finalize_swtch(struct kthread *thread)
 	__atomic_store_n(&thread->switching, 0, __ATOMIC_RELEASE);
 }
 
+/*
+ * Interactivity, after ULE. The score runs from 0 for threads that only
+ * sleep to SCHED_INTERACT_MAX for ones that never do, and only the last
+ * SCHED_SLP_RUN_MAX or so of history counts.
+ */
+#define SCHED_SLICE MSTIME(10)
+#define SCHED_INTERACT_MAX 100
+#define SCHED_INTERACT_HALF (SCHED_INTERACT_MAX / 2)
+#define SCHED_INTERACT_THRESH 30
+#define SCHED_SLP_RUN_MAX STIME(5)
+// how far a score can move a thread from its base priority, either way
+#define SCHED_PRIO_SPREAD 4
+
+static bool is_time_share(struct kthread *thread)
+{
+	return thread->base_priority >= SCHED_PRIO_TIME_SHARE &&
+	       thread->base_priority <= SCHED_PRIO_TIME_SHARE_END;
+}
+
+static unsigned int interact_score(struct kthread *thread)
+{
+	nstime_t run = thread->run_time, slp = thread->sleep_time;
+
+	if (run > slp) {
+		nstime_t div = MAX(run / SCHED_INTERACT_HALF, (nstime_t)1);
+		return SCHED_INTERACT_MAX -
+		       MIN(slp / div, (nstime_t)SCHED_INTERACT_HALF);
+	} else if (slp > run) {
+		nstime_t div = MAX(slp / SCHED_INTERACT_HALF, (nstime_t)1);
+		return MIN(run / div, (nstime_t)SCHED_INTERACT_HALF);
+	}
+
+	return run ? SCHED_INTERACT_HALF : 0;
+}
+
+// forget old history, a long enough run or sleep on its own wipes it
+static void interact_decay(struct kthread *thread)
+{
+	nstime_t *run = &thread->run_time, *slp = &thread->sleep_time;
+	nstime_t sum = *run + *slp;
+
+	if (sum < SCHED_SLP_RUN_MAX)
+		return;
+
+	if (sum > SCHED_SLP_RUN_MAX * 2) {
+		if (*run > *slp) {
+			*run = SCHED_SLP_RUN_MAX;
+			*slp = 1;
+		} else {
+			*slp = SCHED_SLP_RUN_MAX;
+			*run = 1;
+		}
+	} else if (sum > SCHED_SLP_RUN_MAX / 5 * 6) {
+		*run /= 2;
+		*slp /= 2;
+	} else {
+		*run = *run / 5 * 4;
+		*slp = *slp / 5 * 4;
+	}
+}
+
+// only while the thread is off the run queues, they are indexed by it
+static void sched_prio_update(struct kthread *thread)
+{
+	unsigned int priority = thread->base_priority;
+
+	if (is_time_share(thread)) {
+		interact_decay(thread);
+
+		int score = interact_score(thread);
+		thread->interactive = score < SCHED_INTERACT_THRESH;
+
+		int prio = (int)thread->base_priority +
+			   (SCHED_INTERACT_HALF - score) * SCHED_PRIO_SPREAD /
+				   SCHED_INTERACT_HALF;
+		priority = MIN(MAX(prio, SCHED_PRIO_TIME_SHARE),
+			       SCHED_PRIO_TIME_SHARE_END);
+	}
+
+	thread->priority = MAX(priority, thread->pi_priority);
+}
+
+static void sched_charge(struct kthread *thread, nstime_t now)
+{
+	assert(spinlock_held(&thread->thread_lock));
+	thread->run_time += now - thread->slice_start;
+	thread->slice_start = now;
+	sched_prio_update(thread);
+}
+
+void sched_fork(struct kthread *parent, struct kthread *child)
+{
+	child->affinity = parent->affinity;
+	child->cpus_allowed = parent->cpus_allowed;
+
+	child->run_time = parent->run_time;
+	child->sleep_time = parent->sleep_time;
+	sched_prio_update(child);
+
+	// leaves through _syscall_fork_return, which doesn't account
+	child->acct_user = true;
+}
+
 [[gnu::no_instrument_function]]
 static void swtch(struct kthread *current, struct kthread *thread)
 {
@@ -81,9 +190,22 @@ static void swtch(struct kthread *current, struct kthread *thread)
 	assert(spinlock_held(&current->thread_lock));
 	assert(!spinlock_held(&thread->thread_lock));
 
-	current->affinity_cpu = curcpu_ptr();
+	nstime_t now = plat_getnanos();
+	current->last_ran = now;
+
+	thread->slice_start = now;
+	if (is_time_share(thread)) {
+		curcpu().slice_end = now + SCHED_SLICE;
+		// already armed means an earlier expiry, which re-arms itself
+		timer_install(&curcpu_ptr()->slice_timer, SCHED_SLICE);
+	}
 
+	// an interrupt in between would charge the wrong thread
+	int state = disable_interrupts();
+	acct_switch(current, thread);
 	curcpu().current_thread = thread;
+	if (state)
+		enable_interrupts();
 	curcpu().kstack_top = thread->kstack_top;
 
 	if (unlikely(thread->vm_ctx != NULL)) {
@@ -102,6 +224,8 @@ static void swtch(struct kthread *current, struct kthread *thread)
 	assert(current == curthread());
 }
 
+static struct cpu *select_wake_cpu(struct kthread *thread);
+
 [[gnu::no_instrument_function]]
 void sched_preempt(struct cpu *cpu)
 {
@@ -123,9 +247,16 @@ void sched_preempt(struct cpu *cpu)
 	__atomic_store_n(&current->switching, 1, __ATOMIC_RELAXED);
 
 	if (current != &cpu->idle_thread) {
-		spinlock_lock_noipl(&cpu->sched_lock);
-		sched_insert(cpu, current, 0);
-		spinlock_unlock_noipl(&cpu->sched_lock);
+		sched_charge(current, plat_getnanos());
+
+		// its affinity may have changed while it was running here
+		struct cpu *to = cpu;
+		if (!cpumask_test(&current->cpus_allowed, cpu->cpu_id))
+			to = select_wake_cpu(current);
+
+		spinlock_lock_noipl(&to->sched_lock);
+		sched_insert(to, current, to != cpu);
+		spinlock_unlock_noipl(&to->sched_lock);
 	} else {
 		// the idle thread remains ready
 		current->status = THREAD_READY;
@@ -155,6 +286,7 @@ static struct kthread *select_next(struct cpu *cpu, unsigned int priority)
 		if (TAILQ_EMPTY(rq)) {
 			sched->current_rq->mask &= ~(1UL << next_priority);
 		}
+		sched->nr_ready--;
 		thread->status = THREAD_SWITCHING;
 		return thread;
 	} else if (sched->next_rq->mask) {
@@ -172,6 +304,7 @@ static struct kthread *select_next(struct cpu *cpu, unsigned int priority)
 		// only run idle priority if no other threads are ready
 		struct kthread *thread = TAILQ_FIRST(&sched->idle_rq);
 		TAILQ_REMOVE(&sched->idle_rq, thread, rq_entry);
+		sched->nr_ready--;
 		thread->status = THREAD_SWITCHING;
 		return thread;
 	}
@@ -179,6 +312,232 @@ static struct kthread *select_next(struct cpu *cpu, unsigned int priority)
 	return NULL;
 }
 
+/*
+ * Run from the slice timer. A time-share thread that used up its slice
+ * goes to the back, behind whatever else is ready on this cpu.
+ */
+void sched_slice_expire([[maybe_unused]] struct dpc *dpc,
+			[[maybe_unused]] void *ctx)
+{
+	struct cpu *cpu = curcpu_ptr();
+	struct kthread *current = cpu->current_thread;
+
+	// blocked or switched to something without a slice in the meantime
+	if (current == &cpu->idle_thread || !is_time_share(current))
+		return;
+
+	nstime_t now = plat_getnanos();
+	if (now < cpu->slice_end) {
+		timer_install(&cpu->slice_timer, cpu->slice_end - now);
+		return;
+	}
+
+	spinlock_lock_noipl(&current->thread_lock);
+	sched_charge(current, now);
+	spinlock_unlock_noipl(&current->thread_lock);
+
+	// holds up a real-time thread on a kmutex, keep it going
+	if (current->priority >= SCHED_PRIO_REAL_TIME) {
+		cpu->slice_end = now + SCHED_SLICE;
+		timer_install(&cpu->slice_timer, SCHED_SLICE);
+		return;
+	}
+
+	spinlock_lock_noipl(&cpu->sched_lock);
+	struct sched *sched = &cpu->sched;
+	if (!cpu->next_thread &&
+	    (sched->current_rq->mask || sched->next_rq->mask)) {
+		struct kthread *next = select_next(cpu, 0);
+		next->status = THREAD_NEXT;
+		cpu->next_thread = next;
+	}
+	bool rotate = cpu->next_thread != NULL;
+	spinlock_unlock_noipl(&cpu->sched_lock);
+
+	// softint picks up next_thread once the dpcs are done
+	if (!rotate) {
+		cpu->slice_end = now + SCHED_SLICE;
+		timer_install(&cpu->slice_timer, SCHED_SLICE);
+	}
+}
+
+/*
+ * Load balancing: a cpu about to go idle steals from the busiest queue,
+ * and a periodic pass pushes work to cpus that sit idle. Threads that
+ * ran within SCHED_MIGRATE_COST are left where their cache is.
+ */
+#define SCHED_MIGRATE_COST USTIME(500)
+#define SCHED_BALANCE_INTERVAL MSTIME(20)
+
+static struct kthread *balancer_thread = NULL;
+
+static size_t cpu_load(struct cpu *cpu)
+{
+	size_t load = __atomic_load_n(&cpu->sched.nr_ready, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&cpu->current_thread, __ATOMIC_RELAXED) !=
+	    &cpu->idle_thread)
+		load++;
+	return load;
+}
+
+size_t sched_nr_running(struct cpu *cpu)
+{
+	return cpu_load(cpu);
+}
+
+static bool can_migrate(struct kthread *thread, struct cpu *to, nstime_t now)
+{
+	if (!cpumask_test(&thread->cpus_allowed, to->cpu_id))
+		return false;
+	return now - thread->last_ran >= SCHED_MIGRATE_COST;
+}
+
+// take a thread that may run on to off from's queues, highest priority first
+static struct kthread *sched_detach(struct cpu *from, struct cpu *to)
+{
+	assert(spinlock_held(&from->sched_lock));
+	struct sched *sched = &from->sched;
+	struct runqueue *rqs[] = { sched->current_rq, sched->next_rq };
+	nstime_t now = plat_getnanos();
+
+	for (size_t i = 0; i < elementsof(rqs); i++) {
+		struct runqueue *rq = rqs[i];
+		uint32_t mask = rq->mask;
+
+		while (mask) {
+			unsigned int prio = 31 - __builtin_clz(mask);
+			mask &= ~(1UL << prio);
+
+			struct kthread *thread;
+			TAILQ_FOREACH(thread, &rq->queue[prio], rq_entry)
+			{
+				if (!can_migrate(thread, to, now))
+					continue;
+
+				TAILQ_REMOVE(&rq->queue[prio], thread,
+					     rq_entry);
+				if (TAILQ_EMPTY(&rq->queue[prio]))
+					rq->mask &= ~(1UL << prio);
+				sched->nr_ready--;
+				// off-queue until the caller inserts it
+				thread->status = THREAD_SWITCHING;
+				return thread;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Only one sched_lock is held at a time, the thread is off-queue in
+ * between. Work from our own cache domain is taken first.
+ */
+static struct kthread *sched_steal(struct cpu *self)
+{
+	struct cpu *victim = NULL, *near = NULL;
+	size_t max = 0, near_max = 0, i;
+
+	for_each_cpu(i, &cpumask_active) {
+		struct cpu *cpu = getcpu(i);
+		if (cpu == self)
+			continue;
+
+		size_t nr = __atomic_load_n(&cpu->sched.nr_ready,
+					    __ATOMIC_RELAXED);
+		if (nr > max) {
+			max = nr;
+			victim = cpu;
+		}
+		if (cpu->llc_id == self->llc_id && nr > near_max) {
+			near_max = nr;
+			near = cpu;
+		}
+	}
+
+	if (near)
+		victim = near;
+	if (!victim)
+		return NULL;
+
+	spinlock_lock_noipl(&victim->sched_lock);
+	struct kthread *thread = sched_detach(victim, self);
+	spinlock_unlock_noipl(&victim->sched_lock);
+
+	if (thread)
+		thread->last_cpu = self;
+
+	return thread;
+}
+
+// run by the idle thread, picks up work that was queued behind its back
+void sched_idle(struct cpu *cpu)
+{
+	assert(curipl() == IPL_DPC);
+
+	spinlock_lock_noipl(&cpu->sched_lock);
+	struct kthread *next = cpu->next_thread ? NULL : select_next(cpu, 0);
+	if (next)
+		sched_insert(cpu, next, 0);
+	spinlock_unlock_noipl(&cpu->sched_lock);
+
+	if (next || cpu->next_thread)
+		return;
+
+	next = sched_steal(cpu);
+	if (next) {
+		spinlock_lock_noipl(&cpu->sched_lock);
+		sched_insert(cpu, next, 0);
+		spinlock_unlock_noipl(&cpu->sched_lock);
+	}
+}
+
+/*
+ * Move one thread from the busiest to the idlest cpu. A difference of
+ * one would only move the imbalance around, so it takes two.
+ */
+static void sched_balance()
+{
+	struct cpu *busiest = NULL, *idlest = NULL;
+	size_t max = 0, min = SIZE_MAX, i;
+
+	for_each_cpu(i, &cpumask_active) {
+		struct cpu *cpu = getcpu(i);
+		size_t load = cpu_load(cpu);
+		if (load > max) {
+			max = load;
+			busiest = cpu;
+		}
+		if (load < min) {
+			min = load;
+			idlest = cpu;
+		}
+	}
+
+	if (!busiest || busiest == idlest || max < min + 2)
+		return;
+
+	ipl_t ipl = spinlock_lock(&busiest->sched_lock);
+	struct kthread *thread = sched_detach(busiest, idlest);
+	spinlock_unlock_noipl(&busiest->sched_lock);
+
+	if (thread) {
+		spinlock_lock_noipl(&idlest->sched_lock);
+		sched_insert(idlest, thread, idlest != curcpu_ptr());
+		spinlock_unlock_noipl(&idlest->sched_lock);
+	}
+
+	xipl(ipl);
+}
+
+static void balancer_fn()
+{
+	for (;;) {
+		ksleep(SCHED_BALANCE_INTERVAL);
+		sched_balance();
+	}
+}
+
 #if 0
 // call this from preemption handler
 static void do_reschedule()
@@ -194,12 +553,19 @@ static void do_reschedule()
 }
 #endif
 
+void kthread_construct(struct kthread *thread)
+{
+	spinlock_init(&thread->thread_lock);
+
+	thread->timeout_wait_block.thread = thread;
+	thread->timeout_wait_block.object = &thread->timeout_timer;
+	timer_init(&thread->timeout_timer);
+}
+
 void kthread_init(struct kthread *thread, const char *name,
 		  unsigned int initial_priority, struct kprocess *process,
 		  int user_thread)
 {
-	spinlock_init(&thread->thread_lock);
-
 	thread->switching = 0;
 
 	strncpy(thread->name, name, sizeof(thread->name) - 1);
@@ -212,19 +578,40 @@ void kthread_init(struct kthread *thread, const char *name,
 	thread->wait_blocks = NULL;
 
 	thread->timeout_wait_block.status = YAK_TIMEOUT;
-	thread->timeout_wait_block.thread = thread;
-	thread->timeout_wait_block.object = &thread->timeout_timer;
-	timer_init(&thread->timeout_timer);
 
+	thread->base_priority = initial_priority;
 	thread->priority = initial_priority;
 	thread->status = THREAD_UNDEFINED;
 
-	thread->affinity_cpu = NULL;
+	thread->pi_priority = 0;
+	thread->pi_blocked_on = NULL;
+	LIST_INIT(&thread->pi_held);
+
+	thread->run_time = 0;
+	thread->sleep_time = 0;
+	thread->slice_start = 0;
+	thread->last_ran = 0;
+	thread->interactive = false;
+	sched_prio_update(thread);
+
+	thread->utime = 0;
+	thread->stime = 0;
+	thread->itime = 0;
+	thread->acct_stamp = 0;
+	thread->acct_user = false;
+
+	cpumask_fill(&thread->affinity);
 	thread->last_cpu = NULL;
 
 	thread->vm_ctx = NULL;
 
 	ipl_t ipl = spinlock_lock(&process->thread_list_lock);
+	thread->tid = process->thread_count ? alloc_pid() : process->pid;
+	// cpuset_attach changes the set under this lock too
+	if (process->cpuset)
+		thread->cpus_allowed = process->cpuset->cpus;
+	else
+		cpumask_fill(&thread->cpus_allowed);
 	__atomic_fetch_add(&process->thread_count, 1, __ATOMIC_ACQUIRE);
 
 	LIST_INSERT_HEAD(&process->thread_list, thread, process_entry);
@@ -235,11 +622,8 @@ void kthread_init(struct kthread *thread, const char *name,
 }
 
 [[gnu::no_instrument_function]]
-void sched_yield(struct kthread *current, struct cpu *cpu)
+static void switch_away(struct kthread *current, struct cpu *cpu)
 {
-	assert(current);
-	assert(cpu);
-	assert(spinlock_held(&current->thread_lock));
 	spinlock_lock_noipl(&cpu->sched_lock);
 	// anything is fine now
 	struct kthread *next = cpu->next_thread;
@@ -252,6 +636,12 @@ void sched_yield(struct kthread *current, struct cpu *cpu)
 
 	spinlock_unlock_noipl(&cpu->sched_lock);
 
+	if (!next) {
+		next = sched_steal(cpu);
+		if (next)
+			next->status = THREAD_SWITCHING;
+	}
+
 	if (next) {
 		wait_for_switch(next);
 		swtch(current, next);
@@ -260,21 +650,39 @@ void sched_yield(struct kthread *current, struct cpu *cpu)
 	}
 }
 
+[[gnu::no_instrument_function]]
+void sched_yield(struct kthread *current, struct cpu *cpu)
+{
+	assert(current);
+	assert(cpu);
+	assert(spinlock_held(&current->thread_lock));
+
+	if (current != &cpu->idle_thread)
+		sched_charge(current, plat_getnanos());
+
+	switch_away(current, cpu);
+}
+
 void sched_insert(struct cpu *cpu, struct kthread *thread, int isOther)
 {
-	// TODO: update thread stats maybe?
 	thread->last_cpu = cpu;
-	thread->status = THREAD_READY;
+	// pairs with sched_set_pi_priority, which requeues ready threads
+	__atomic_store_n(&thread->status, THREAD_READY, __ATOMIC_SEQ_CST);
+
+	// a thread in flight between queues may have inherited meanwhile
+	thread->priority = MAX(thread->priority,
+			       __atomic_load_n(&thread->pi_priority,
+					       __ATOMIC_SEQ_CST));
 
 	struct sched *sched = &cpu->sched;
 	assert(spinlock_held(&cpu->sched_lock));
 
 	struct kthread *current = cpu->current_thread, *next = cpu->next_thread;
 	struct kthread *comp = next ? next : current;
+	unsigned int comp_priority = sched_priority(comp);
 
-	// TODO: check interactivity ??
 	if (thread->priority >= SCHED_PRIO_REAL_TIME) {
-		if (thread->priority <= comp->priority) {
+		if (thread->priority <= comp_priority) {
 			thread_queue_t *list =
 				&sched->current_rq->queue[thread->priority];
 
@@ -290,22 +698,27 @@ void sched_insert(struct cpu *cpu, struct kthread *thread, int isOther)
 			TAILQ_INSERT_TAIL(list, thread, rq_entry);
 			assert(TAILQ_FIRST(list) != NULL);
 			sched->current_rq->mask |= (1UL << thread->priority);
+			sched->nr_ready++;
+			return;
+		}
+	} else if (comp != &cpu->idle_thread) {
+		if (thread->priority == SCHED_PRIO_IDLE) {
+			TAILQ_INSERT_TAIL(&sched->idle_rq, thread, rq_entry);
+			sched->nr_ready++;
 			return;
 		}
-	} else {
-		if (comp != &cpu->idle_thread) {
-			if (thread->priority == SCHED_PRIO_IDLE) {
-				TAILQ_INSERT_TAIL(&sched->idle_rq, thread,
-						  rq_entry);
-			} else {
-				TAILQ_INSERT_TAIL(
-					&sched->next_rq->queue[thread->priority],
-					thread, rq_entry);
-				sched->next_rq->mask |=
-					(1UL << thread->priority);
-			}
 
-			// these cannot preempt, ever
+		// interactive threads skip ahead of the batch in next_rq, and
+		// may preempt a lower priority batch thread
+		if (!thread->interactive || comp->interactive ||
+		    thread->priority <= comp_priority) {
+			struct runqueue *rq = thread->interactive ?
+						      sched->current_rq :
+						      sched->next_rq;
+			TAILQ_INSERT_TAIL(&rq->queue[thread->priority], thread,
+					  rq_entry);
+			rq->mask |= (1UL << thread->priority);
+			sched->nr_ready++;
 			return;
 		}
 	}
@@ -330,16 +743,21 @@ void sched_insert(struct cpu *cpu, struct kthread *thread, int isOther)
 }
 
 static size_t count = 0;
-static struct cpu *find_cpu()
+static struct cpu *find_cpu(const struct cpumask *allowed)
 {
 	assert(cpus_online() != 0);
 
-	size_t cpu, i = 0,
-		    desired = __atomic_fetch_add(&count, 1, __ATOMIC_ACQUIRE) %
-			      cpus_online();
+	size_t cpu, i = 0, n = 0;
+	for_each_cpu(cpu, &cpumask_active) {
+		if (cpumask_test(allowed, cpu))
+			n++;
+	}
+
+	size_t desired = n ? __atomic_fetch_add(&count, 1, __ATOMIC_ACQUIRE) % n :
+			     0;
 
 	for_each_cpu(cpu, &cpumask_active) {
-		if (i++ == desired)
+		if (cpumask_test(allowed, cpu) && i++ == desired)
 			return getcpu(cpu);
 	}
 
@@ -348,15 +766,61 @@ static struct cpu *find_cpu()
 	return curcpu_ptr();
 }
 
+/*
+ * Keep a waking thread near its cache: the cpu it last ran on if that is
+ * idle, else an idle cpu sharing a core or the last level cache with it.
+ * Only when the whole cache domain is busy do we look farther out.
+ */
+static struct cpu *select_wake_cpu(struct kthread *thread)
+{
+	const struct cpumask *allowed = &thread->cpus_allowed;
+	struct cpu *prev = thread->last_cpu;
+	if (!prev || !cpumask_test(allowed, prev->cpu_id))
+		return find_cpu(allowed);
+	if (cpu_load(prev) == 0)
+		return prev;
+
+	struct cpu *sibling = NULL, *llc = NULL, *remote = NULL;
+	size_t i;
+	for_each_cpu(i, &cpumask_active) {
+		struct cpu *cpu = getcpu(i);
+		if (cpu == prev || !cpumask_test(allowed, i) ||
+		    cpu_load(cpu) != 0)
+			continue;
+
+		if (cpu->core_id == prev->core_id) {
+			sibling = cpu;
+			break;
+		} else if (cpu->llc_id == prev->llc_id) {
+			if (!llc)
+				llc = cpu;
+		} else if (!remote) {
+			remote = cpu;
+		}
+	}
+
+	if (sibling)
+		return sibling;
+	if (llc)
+		return llc;
+	// a cold cache beats waiting behind someone else
+	if (remote)
+		return remote;
+	return prev;
+}
+
 void sched_resume_locked(struct kthread *thread)
 {
 	assert(spinlock_held(&thread->thread_lock));
 
-	struct cpu *cpu = thread->affinity_cpu;
-	if (!cpu) {
-		cpu = find_cpu();
+	// the score decides where it is queued, so charge the sleep first
+	if (thread->status == THREAD_WAITING) {
+		thread->sleep_time += plat_getnanos() - thread->last_ran;
+		sched_prio_update(thread);
 	}
 
+	struct cpu *cpu = select_wake_cpu(thread);
+
 	spinlock_lock_noipl(&cpu->sched_lock);
 	sched_insert(cpu, thread, cpu != curcpu_ptr());
 	spinlock_unlock_noipl(&cpu->sched_lock);
@@ -369,6 +833,168 @@ void sched_resume(struct kthread *thread)
 	spinlock_unlock(&thread->thread_lock, ipl);
 }
 
+// take a ready thread back off the queues of the cpu it was inserted on
+static void sched_unqueue(struct cpu *cpu, struct kthread *thread)
+{
+	assert(spinlock_held(&cpu->sched_lock));
+	struct sched *sched = &cpu->sched;
+
+	sched->nr_ready--;
+
+	if (thread->priority == SCHED_PRIO_IDLE) {
+		TAILQ_REMOVE(&sched->idle_rq, thread, rq_entry);
+		return;
+	}
+
+	for (size_t i = 0; i < elementsof(sched->rqs); i++) {
+		struct runqueue *rq = &sched->rqs[i];
+		thread_queue_t *q = &rq->queue[thread->priority];
+
+		struct kthread *t;
+		TAILQ_FOREACH(t, q, rq_entry)
+		{
+			if (t != thread)
+				continue;
+
+			TAILQ_REMOVE(q, thread, rq_entry);
+			if (TAILQ_EMPTY(q))
+				rq->mask &= ~(1UL << thread->priority);
+			return;
+		}
+	}
+
+	panic("ready thread %s not on the queues of its cpu\n", thread->name);
+}
+
+// the current thread's priority dropped, something queued may now beat it
+static void sched_check_preempt(struct cpu *cpu, struct kthread *current)
+{
+	spinlock_lock_noipl(&cpu->sched_lock);
+
+	uint32_t mask = cpu->sched.current_rq->mask;
+	if (!cpu->next_thread && mask &&
+	    (unsigned int)(31 - __builtin_clz(mask)) > current->priority) {
+		struct kthread *next = select_next(cpu, 0);
+		next->status = THREAD_NEXT;
+		cpu->next_thread = next;
+		softint_issue(IPL_DPC);
+	}
+
+	spinlock_unlock_noipl(&cpu->sched_lock);
+}
+
+/*
+ * A ready thread is requeued at its new priority. A waiting one picks it
+ * up when it wakes, and one running elsewhere is compared by
+ * sched_priority until it is charged next.
+ */
+bool sched_set_pi_priority(struct kthread *thread, unsigned int priority)
+{
+	assert(curipl() == IPL_DPC);
+	spinlock_lock_noipl(&thread->thread_lock);
+
+	if (thread->pi_priority == priority) {
+		spinlock_unlock_noipl(&thread->thread_lock);
+		return false;
+	}
+
+	__atomic_store_n(&thread->pi_priority, priority, __ATOMIC_SEQ_CST);
+
+	if (thread == curthread()) {
+		sched_prio_update(thread);
+		sched_check_preempt(curcpu_ptr(), thread);
+		spinlock_unlock_noipl(&thread->thread_lock);
+		return true;
+	}
+
+	for (;;) {
+		struct cpu *cpu = __atomic_load_n(&thread->last_cpu,
+						  __ATOMIC_RELAXED);
+		if (__atomic_load_n(&thread->status, __ATOMIC_SEQ_CST) !=
+			    THREAD_READY ||
+		    !cpu)
+			break;
+
+		spinlock_lock_noipl(&cpu->sched_lock);
+		bool queued = thread->status == THREAD_READY &&
+			      thread->last_cpu == cpu;
+		if (queued) {
+			sched_unqueue(cpu, thread);
+			sched_prio_update(thread);
+			sched_insert(cpu, thread, cpu != curcpu_ptr());
+		}
+		spinlock_unlock_noipl(&cpu->sched_lock);
+
+		if (queued)
+			break;
+	}
+
+	spinlock_unlock_noipl(&thread->thread_lock);
+	return true;
+}
+
+/*
+ * A queued thread is moved right away. One running elsewhere moves the
+ * next time it is preempted or wakes up, the current thread has to call
+ * sched_migrate_self once it holds no other locks.
+ */
+void sched_set_cpus_allowed(struct kthread *thread,
+			    const struct cpumask *allowed)
+{
+	ipl_t ipl = spinlock_lock(&thread->thread_lock);
+	thread->cpus_allowed = *allowed;
+
+	for (;;) {
+		struct cpu *cpu = __atomic_load_n(&thread->last_cpu,
+						  __ATOMIC_RELAXED);
+		if (thread->status != THREAD_READY || !cpu ||
+		    cpumask_test(allowed, cpu->cpu_id))
+			break;
+
+		// stealing can move it without taking the thread lock
+		spinlock_lock_noipl(&cpu->sched_lock);
+		bool queued = thread->status == THREAD_READY &&
+			      thread->last_cpu == cpu;
+		if (queued)
+			sched_unqueue(cpu, thread);
+		spinlock_unlock_noipl(&cpu->sched_lock);
+
+		if (queued) {
+			sched_resume_locked(thread);
+			break;
+		}
+	}
+
+	spinlock_unlock(&thread->thread_lock, ipl);
+}
+
+void sched_migrate_self()
+{
+	struct kthread *current = curthread();
+	ipl_t ipl = spinlock_lock(&current->thread_lock);
+	struct cpu *cpu = curcpu_ptr();
+
+	struct cpu *to = cpu;
+	if (!cpumask_test(&current->cpus_allowed, cpu->cpu_id))
+		to = select_wake_cpu(current);
+
+	// none of the allowed cpus are online, stay
+	if (to == cpu) {
+		spinlock_unlock(&current->thread_lock, ipl);
+		return;
+	}
+
+	__atomic_store_n(&current->switching, 1, __ATOMIC_RELAXED);
+	sched_charge(current, plat_getnanos());
+
+	spinlock_lock_noipl(&to->sched_lock);
+	sched_insert(to, current, 1);
+	spinlock_unlock_noipl(&to->sched_lock);
+
+	switch_away(current, cpu);
+	xipl(ipl);
+}
+
 void thread_reaper_fn()
 {
 	for (;;) {
@@ -398,12 +1024,32 @@ void sched_dynamic_init()
 {
 	kernel_thread_create("reaper_thread", SCHED_PRIO_REAL_TIME_END,
 			     thread_reaper_fn, NULL, 1, &reaper_thread);
+	kernel_thread_create("balancer", SCHED_PRIO_REAL_TIME_END, balancer_fn,
+			     NULL, 1, &balancer_thread);
 }
 
 INIT_ENTAILS(sched_dyn);
 INIT_DEPS(sched_dyn);
 INIT_NODE(sched_dyn, sched_dynamic_init);
 
+// an exited thread stops counting right away, not once it is reaped
+static void thread_unlink(struct kthread *thread)
+{
+	struct kprocess *process = thread->owner_process;
+
+	spinlock_lock_noipl(&process->thread_list_lock);
+	if (0 ==
+	    __atomic_sub_fetch(&process->thread_count, 1, __ATOMIC_ACQUIRE)) {
+		pr_warn("no thread left for process (implement destroying processes)\n");
+		if (process->pid == 1)
+			panic("attempted to kill init!\n");
+	}
+
+	LIST_REMOVE(thread, process_entry);
+	acct_thread_exit(thread);
+	spinlock_unlock_noipl(&process->thread_list_lock);
+}
+
 [[gnu::noreturn]]
 void sched_exit_self()
 {
@@ -411,6 +1057,8 @@ void sched_exit_self()
 
 	struct kthread *thread = curthread();
 
+	thread_unlink(thread);
+
 	spinlock_lock_noipl(&thread->thread_lock);
 
 	thread->status = THREAD_TERMINATING;
@@ -432,6 +1080,12 @@ void idle_loop()
 	setipl(IPL_PASSIVE);
 	while (1) {
 		assert(curipl() == IPL_PASSIVE);
-		asm volatile("sti; hlt");
+
+		// switches away once the ipl drops if there was work
+		ipl_t ipl = ripl(IPL_DPC);
+		struct cpu *cpu = curcpu_ptr();
+		sched_idle(cpu);
+		cpu_idle(cpu);
+		xipl(ipl);
 	}
 }
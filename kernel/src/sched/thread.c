@@ -1,49 +1,53 @@
 #include <yak/sched.h>
 #include <yak/log.h>
 #include <yak/heap.h>
+#include <yak/init.h>
+#include <yak/vm/kmem.h>
+#include <yak/vm/kstack.h>
 
-void kthread_destroy(struct kthread *thread)
-{
-	assert(thread->status == THREAD_TERMINATING);
+static kmem_cache_t *kthread_cache;
 
-	struct kprocess *process = thread->owner_process;
-
-	ipl_t ipl = spinlock_lock(&process->thread_list_lock);
-	if (0 ==
-	    __atomic_sub_fetch(&process->thread_count, 1, __ATOMIC_ACQUIRE)) {
-		pr_warn("no thread left for process (implement destroying processes)\n");
-		if (process->pid == 1)
-			panic("attempted to kill init!\n");
-	}
+static int kthread_ctor(void *obj, [[maybe_unused]] void *private,
+			[[maybe_unused]] int kmflag)
+{
+	kthread_construct(obj);
+	return 0;
+}
 
-	LIST_REMOVE(thread, process_entry);
+struct kthread *kthread_alloc()
+{
+	return kmem_cache_alloc(kthread_cache, KM_SLEEP);
+}
 
-	spinlock_unlock(&process->thread_list_lock, ipl);
+void kthread_free(struct kthread *thread)
+{
+	kmem_cache_free(kthread_cache, thread);
+}
 
-	vaddr_t stack_base = (vaddr_t)thread->kstack_top - KSTACK_SIZE;
-	vm_kfree((void *)stack_base, KSTACK_SIZE);
+void kthread_destroy(struct kthread *thread)
+{
+	assert(thread->status == THREAD_TERMINATING);
 
-	kfree(thread, sizeof(struct kthread));
+	kthread_context_destroy(thread);
+	kstack_free(thread->kstack_top);
+	kthread_free(thread);
 }
 
 status_t kernel_thread_create(const char *name, unsigned int priority,
 			      void *entry, void *context, int instant_launch,
 			      struct kthread **out)
 {
-	struct kthread *thread = kmalloc(sizeof(struct kthread));
+	struct kthread *thread = kthread_alloc();
 	if (!thread)
 		return YAK_OOM;
 
-	kthread_init(thread, name, priority, &kproc0, 0);
-
-	vaddr_t stack_addr = (vaddr_t)vm_kalloc(KSTACK_SIZE, 0);
-
-	if (stack_addr == 0) {
-		kfree(thread, sizeof(struct kthread));
+	void *stack_top = kstack_alloc();
+	if (!stack_top) {
+		kthread_free(thread);
 		return YAK_OOM;
 	}
 
-	void *stack_top = (void *)(stack_addr + KSTACK_SIZE);
+	kthread_init(thread, name, priority, &kproc0, 0);
 
 	kthread_context_init(thread, stack_top, entry, context, NULL);
 
@@ -55,3 +59,14 @@ status_t kernel_thread_create(const char *name, unsigned int priority,
 
 	return YAK_SUCCESS;
 }
+
+static void kthread_cache_init()
+{
+	kthread_cache = kmem_cache_create("kthread", sizeof(struct kthread), 64,
+					  kthread_ctor, NULL, NULL, NULL, NULL,
+					  KM_SLEEP);
+}
+
+INIT_ENTAILS(kthread_cache_node, bsp_ready);
+INIT_DEPS(kthread_cache_node, heap_ready_stage);
+INIT_NODE(kthread_cache_node, kthread_cache_init);
@@ -15,7 +15,7 @@
 void sched_wake_thread(struct kthread *thread, status_t status)
 {
 	assert(spinlock_held(&thread->thread_lock));
-	assert(thread->status = THREAD_WAITING);
+	assert(thread->status == THREAD_WAITING);
 	thread->wait_status = status;
 	sched_resume_locked(thread);
 }
@@ -83,22 +83,42 @@ poll_exit:
 	thread->wait_type = wait_type;
 	thread->status = THREAD_WAITING;
 
-	if (timeout != 0) {
-		struct timer *tt = &thread->timeout_timer;
+	struct timer *tt = &thread->timeout_timer;
+	if (timeout != TIMEOUT_INFINITE) {
+		// the timer is queued on this cpu and can't fire before we're
+		// off-cpu, its waker then waits for our thread lock
 		timer_reset(tt);
-		timer_install(tt, timeout);
+		spinlock_lock_noipl(&tt->hdr.obj_lock);
 		tt->hdr.waitcount = 1;
+		thread->timeout_wait_block.object = tt;
 		TAILQ_INSERT_TAIL(&tt->hdr.wait_list,
 				  &thread->timeout_wait_block, entry);
+		spinlock_unlock_noipl(&tt->hdr.obj_lock);
+		timer_install(tt, timeout);
 	}
 
-	sched_yield(thread, thread->last_cpu);
+	sched_yield(thread, curcpu_ptr());
 	assert(!spinlock_held(&thread->thread_lock));
 
-	// TODO: dequeue timer waitblock
-	assert(timeout == 0);
+	if (timeout != TIMEOUT_INFINITE) {
+		timer_uninstall(tt);
+		spinlock_lock_noipl(&tt->hdr.obj_lock);
+		if (tt->hdr.waitcount) {
+			TAILQ_REMOVE(&tt->hdr.wait_list,
+				     &thread->timeout_wait_block, entry);
+			tt->hdr.waitcount = 0;
+		}
+		spinlock_unlock_noipl(&tt->hdr.obj_lock);
+	}
 
 	if (YAK_TIMEOUT == thread->wait_status) {
+		// a signal that comes in now skips us, see kobject_signal_locked
+		spinlock_lock_noipl(&obj->obj_lock);
+		if (wb->object) {
+			TAILQ_REMOVE(&obj->wait_list, wb, entry);
+			obj->waitcount -= 1;
+		}
+		spinlock_unlock_noipl(&obj->obj_lock);
 		goto exit;
 	}
 
@@ -21,6 +21,9 @@ static const char *status_names[] = {
 	"end of file",
 	"too many files",
 	"permission denied",
+	"bad file descriptor",
+	"broken pipe",
+	"try again",
 };
 
 const char *status_str(status_t status)
@@ -65,6 +68,12 @@ int status_errno(status_t status)
 		return ENOTSUP;
 	case YAK_PERM_DENIED:
 		return EPERM;
+	case YAK_BADF:
+		return EBADF;
+	case YAK_PIPE:
+		return EPIPE;
+	case YAK_AGAIN:
+		return EAGAIN;
 	case YAK_EOF:
 		return 0; // may be wrong?
 	default:
@@ -11,7 +11,9 @@ DEFINE_SYSCALL(SYS_EXECVE, execve, const char *user_path, char **user_argv,
 	       char **user_envp)
 {
 	struct kprocess *proc = curproc();
-	assert(proc->thread_count == 1);
+	// there is no way to take the other threads down yet
+	if (__atomic_load_n(&proc->thread_count, __ATOMIC_ACQUIRE) != 1)
+		return SYS_ERR(EBUSY);
 
 	// block for the autofree'd resources
 	{
@@ -55,7 +57,7 @@ DEFINE_SYSCALL(SYS_EXECVE, execve, const char *user_path, char **user_argv,
 		vm_map_init(new_map);
 		proc->map = new_map;
 
-		status_t rv = launch_elf(proc, path, curthread()->priority,
+		status_t rv = launch_elf(proc, path, curthread()->base_priority,
 					 argv, envp);
 		if (IS_ERR(rv)) {
 			// TODO: destroy new map!
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <yak/file.h>
 #include <yak/mutex.h>
 #include <yak/types.h>
@@ -6,59 +7,24 @@
 #include <yak/cpudata.h>
 #include <yak/syscall.h>
 #include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/fs/pipe.h>
 #include <yak/fs/vfs.h>
 #include <yak/status.h>
 #include <yak-abi/errno.h>
 #include <yak-abi/seek-whence.h>
 #include <yak-abi/fcntl.h>
+#include <yak-abi/uio.h>
 
 DEFINE_SYSCALL(SYS_OPEN, open, char *filename, int flags, int mode)
 {
 	pr_debug("sys_open: %s %d %d\n", filename, flags, mode);
-	struct kprocess *proc = curproc();
-
-	unsigned int file_flags = 0;
-	switch (flags & O_ACCMODE) {
-	case O_RDONLY:
-		file_flags |= FILE_READ;
-		break;
-	case O_WRONLY:
-		file_flags |= FILE_WRITE;
-		break;
-	case O_RDWR:
-		file_flags |= FILE_READ | FILE_WRITE;
-		break;
-	default:
-		return SYS_ERR(EINVAL);
-	}
-
-	struct vnode *vn;
-	status_t res = vfs_open(filename, &vn);
-
-	if (res == YAK_NOENT) {
-		if (flags & O_CREAT) {
-			RET_ERRNO_ON_ERR(vfs_create(filename, VREG, &vn));
-		} else {
-			// file does not exist
-			return SYS_ERR(ENOENT);
-		}
-	} else {
-		RET_ERRNO_ON_ERR(res);
-	}
-
-	guard(mutex)(&proc->fd_mutex);
 
 	int fd;
-	RET_ERRNO_ON_ERR(fd_alloc(proc, &fd));
+	RET_ERRNO_ON_ERR(fd_open(curproc(), filename, flags, &fd));
 
-	struct fd *desc = proc->fds[fd];
 	// TODO: e.g. cloexec, ...
 
-	struct file *file = desc->file;
-	file->vnode = vn;
-	file->offset = 0;
-	file->flags = file_flags;
-
 	return SYS_OK(fd);
 }
 
@@ -67,20 +33,8 @@ DEFINE_SYSCALL(SYS_CLOSE, close, int fd)
 	pr_debug("sys_close(%d)\n", fd);
 	struct kprocess *proc = curproc();
 
-	kmutex_acquire(&proc->fd_mutex, TIMEOUT_INFINITE);
-	struct fd *desc = fd_safe_get(proc, fd);
-	if (!desc) {
-		kmutex_release(&proc->fd_mutex);
-		return SYS_ERR(EBADF);
-	}
-	proc->fds[fd] = NULL;
-	kmutex_release(&proc->fd_mutex);
-
-	struct file *file = desc->file;
-
-	kfree(desc, sizeof(struct fd));
-
-	file_deref(file);
+	guard(mutex)(&proc->fd_mutex);
+	RET_ERRNO_ON_ERR(fd_close(proc, fd));
 
 	return SYS_OK(0);
 }
@@ -94,32 +48,30 @@ DEFINE_SYSCALL(SYS_DUP2, dup2, int oldfd, int newfd)
 
 	struct fd *src_fd = fd_safe_get(proc, oldfd);
 
-	if (src_fd == NULL) {
+	if (src_fd == NULL || newfd < -1 || newfd >= FD_LIMIT) {
 		return SYS_ERR(EBADF);
 	} else if (oldfd == newfd) {
 		return SYS_OK(0);
 	}
 
-	struct fd *dest_fd = NULL;
+	struct file *file = src_fd->file;
+	file_ref(file);
 
+	status_t rv;
 	if (newfd == -1) {
-		RET_ERRNO_ON_ERR(fd_alloc(proc, &newfd));
+		rv = fd_alloc(proc, file, src_fd->flags, &newfd);
 	} else {
-		if (newfd >= proc->fd_cap) {
-			fd_grow(proc, newfd + 1);
-		} else {
-			dest_fd = fd_safe_get(proc, newfd);
-			file_deref(dest_fd->file);
-			dest_fd->file = NULL;
-		}
+		// an open newfd is closed first
+		if (fd_safe_get(proc, newfd))
+			EXPECT(fd_close(proc, newfd));
+		rv = fd_alloc_at(proc, newfd, file, src_fd->flags);
 	}
 
-	dest_fd = proc->fds[newfd];
-	assert(dest_fd != NULL);
-
-	dest_fd->flags = src_fd->flags;
-	dest_fd->file = src_fd->file;
-	file_ref(src_fd->file);
+	IF_ERR(rv)
+	{
+		file_deref(file);
+		return SYS_ERR(status_errno(rv));
+	}
 
 	return SYS_OK(newfd);
 }
@@ -128,17 +80,9 @@ DEFINE_SYSCALL(SYS_WRITE, write, int fd, const char *buf, size_t count)
 {
 	pr_extra_debug("sys_write: %d %p %ld\n", fd, buf, count);
 
-	struct kprocess *proc = curproc();
-	struct file *file;
-
-	{
-		guard(mutex)(&proc->fd_mutex);
-		struct fd *desc = fd_safe_get(proc, fd);
-		if (!desc) {
-			return SYS_ERR(EBADF);
-		}
-		file = desc->file;
-		file_ref(file);
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file) {
+		return SYS_ERR(EBADF);
 	}
 
 	guard_ref_adopt(file, file);
@@ -160,17 +104,9 @@ DEFINE_SYSCALL(SYS_READ, read, int fd, char *buf, size_t count)
 {
 	pr_extra_debug("sys_read: %d %p %ld\n", fd, buf, count);
 
-	struct kprocess *proc = curproc();
-	struct file *file;
-
-	{
-		guard(mutex)(&proc->fd_mutex);
-		struct fd *desc = fd_safe_get(proc, fd);
-		if (!desc) {
-			return SYS_ERR(EBADF);
-		}
-		file = desc->file;
-		file_ref(file);
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file) {
+		return SYS_ERR(EBADF);
 	}
 
 	guard_ref_adopt(file, file);
@@ -188,17 +124,387 @@ DEFINE_SYSCALL(SYS_READ, read, int fd, char *buf, size_t count)
 	return SYS_OK(delta);
 }
 
-DEFINE_SYSCALL(SYS_SEEK, seek, int fd, off_t offset, int whence)
+// userspace can change its iovec under us, so only a copy is looked at
+static int iov_fetch(const struct iovec *uiov, size_t iovcnt,
+		     struct iovec **out)
+{
+	*out = NULL;
+	if (iovcnt > IOV_MAX)
+		return EINVAL;
+	if (iovcnt == 0)
+		return 0;
+
+	struct iovec *iov = kmalloc(iovcnt * sizeof(struct iovec));
+	if (!iov)
+		return ENOMEM;
+
+	memcpy(iov, uiov, iovcnt * sizeof(struct iovec));
+	*out = iov;
+	return 0;
+}
+
+// only on kernel copies, see iov_fetch
+static int iov_check(const struct iovec *iov, int iovcnt)
+{
+	if (iovcnt < 0 || iovcnt > IOV_MAX)
+		return EINVAL;
+
+	// the total has to fit the signed return value
+	size_t total = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > (SIZE_MAX >> 1) - total)
+			return EINVAL;
+		total += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+/*
+ * Positional I/O leaves the file offset alone, vectored I/O moves the
+ * whole iovec in one vfs call so page lookups are shared by segments.
+ */
+static struct syscall_result do_rw(int fd, const struct iovec *iov,
+				   int iovcnt, off_t offset, bool write)
+{
+	int err = iov_check(iov, iovcnt);
+	if (err)
+		return SYS_ERR(err);
+
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(file, file);
+
+	if (!(file->flags & (write ? FILE_WRITE : FILE_READ)))
+		return SYS_ERR(EBADF);
+
+	// -1 means the file offset
+	bool positional = offset != -1;
+	if (positional && file->vnode->type == VFIFO)
+		return SYS_ERR(ESPIPE);
+	if (!positional)
+		offset = __atomic_load_n(&file->offset, __ATOMIC_SEQ_CST);
+
+	size_t done = 0;
+	status_t res = write ? vfs_writev(file->vnode, offset, iov, iovcnt,
+					  &done) :
+			       vfs_readv(file->vnode, offset, iov, iovcnt,
+					 &done);
+	if (res != YAK_EOF)
+		RET_ERRNO_ON_ERR(res);
+
+	if (!positional)
+		__atomic_fetch_add(&file->offset, done, __ATOMIC_SEQ_CST);
+
+	return SYS_OK(done);
+}
+
+DEFINE_SYSCALL(SYS_PREAD, pread, int fd, void *buf, size_t count,
+	       off_t offset)
+{
+	if (offset < 0)
+		return SYS_ERR(EINVAL);
+
+	struct iovec iov = { .iov_base = buf, .iov_len = count };
+	return do_rw(fd, &iov, 1, offset, false);
+}
+
+DEFINE_SYSCALL(SYS_PWRITE, pwrite, int fd, const void *buf, size_t count,
+	       off_t offset)
 {
+	if (offset < 0)
+		return SYS_ERR(EINVAL);
+
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = count };
+	return do_rw(fd, &iov, 1, offset, true);
+}
+
+static struct syscall_result do_rwv(int fd, const struct iovec *uiov,
+				    int iovcnt, off_t offset, bool write)
+{
+	if (iovcnt < 0)
+		return SYS_ERR(EINVAL);
+
+	struct iovec *iov;
+	int err = iov_fetch(uiov, iovcnt, &iov);
+	if (err)
+		return SYS_ERR(err);
+
+	guard(autofree)(iov, iovcnt * sizeof(struct iovec));
+	return do_rw(fd, iov, iovcnt, offset, write);
+}
+
+DEFINE_SYSCALL(SYS_READV, readv, int fd, const struct iovec *iov, int iovcnt)
+{
+	return do_rwv(fd, iov, iovcnt, -1, false);
+}
+
+DEFINE_SYSCALL(SYS_WRITEV, writev, int fd, const struct iovec *iov,
+	       int iovcnt)
+{
+	return do_rwv(fd, iov, iovcnt, -1, true);
+}
+
+DEFINE_SYSCALL(SYS_PREADV, preadv, int fd, const struct iovec *iov,
+	       int iovcnt, off_t offset)
+{
+	if (offset < 0)
+		return SYS_ERR(EINVAL);
+
+	return do_rwv(fd, iov, iovcnt, offset, false);
+}
+
+DEFINE_SYSCALL(SYS_PWRITEV, pwritev, int fd, const struct iovec *iov,
+	       int iovcnt, off_t offset)
+{
+	if (offset < 0)
+		return SYS_ERR(EINVAL);
+
+	return do_rwv(fd, iov, iovcnt, offset, true);
+}
+
+/*
+ * Copies between two files inside the kernel. A NULL offset pointer
+ * means the file offset is used and advanced instead.
+ */
+static struct syscall_result do_copy(int in_fd, off_t *in_offp, int out_fd,
+				     off_t *out_offp, size_t len,
+				     bool regular_only)
+{
+	struct file *in = fd_get_file(curproc(), in_fd);
+	if (!in)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(in, file);
+
+	struct file *out = fd_get_file(curproc(), out_fd);
+	if (!out)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(out, file);
+
+	if (!(in->flags & FILE_READ) || !(out->flags & FILE_WRITE))
+		return SYS_ERR(EBADF);
+
+	if (regular_only &&
+	    (in->vnode->type != VREG || out->vnode->type != VREG))
+		return SYS_ERR(EINVAL);
+
+	off_t in_off = in_offp ? *in_offp :
+				 __atomic_load_n(&in->offset, __ATOMIC_SEQ_CST);
+	off_t out_off = out_offp ?
+				*out_offp :
+				__atomic_load_n(&out->offset, __ATOMIC_SEQ_CST);
+	if (in_off < 0 || out_off < 0)
+		return SYS_ERR(EINVAL);
+
+	len = MIN(len, SIZE_MAX >> 1);
+
+	if (in->vnode == out->vnode && (size_t)in_off < out_off + len &&
+	    (size_t)out_off < in_off + len)
+		return SYS_ERR(EINVAL);
+
+	size_t done = 0;
+	status_t res;
+	// pipes take page references instead of copies
+	if (vn_is_pipe(out->vnode))
+		res = pipe_splice_in(out->vnode, in->vnode, in_off, len, &done);
+	else
+		res = vfs_copy_range(in->vnode, in_off, out->vnode, out_off,
+				     len, &done);
+	if (res == YAK_NOT_SUPPORTED)
+		return SYS_ERR(EINVAL);
+	RET_ERRNO_ON_ERR(res);
+
+	if (in_offp)
+		*in_offp = in_off + done;
+	else
+		__atomic_fetch_add(&in->offset, done, __ATOMIC_SEQ_CST);
+
+	if (out_offp)
+		*out_offp = out_off + done;
+	else
+		__atomic_fetch_add(&out->offset, done, __ATOMIC_SEQ_CST);
+
+	return SYS_OK(done);
+}
+
+DEFINE_SYSCALL(SYS_COPY_FILE_RANGE, copy_file_range, int fd_in,
+	       off_t *off_in, int fd_out, off_t *off_out, size_t len,
+	       unsigned int flags)
+{
+	if (flags != 0)
+		return SYS_ERR(EINVAL);
+
+	return do_copy(fd_in, off_in, fd_out, off_out, len, true);
+}
+
+DEFINE_SYSCALL(SYS_SENDFILE, sendfile, int out_fd, int in_fd, off_t *offset,
+	       size_t count)
+{
+	return do_copy(in_fd, offset, out_fd, NULL, count, false);
+}
+
+DEFINE_SYSCALL(SYS_PIPE, pipe, int *fds, int flags)
+{
+	if (flags != 0)
+		return SYS_ERR(EINVAL);
+
 	struct kprocess *proc = curproc();
+
+	struct file *files[2] = { file_alloc(), file_alloc() };
+	struct vnode *vns[2];
+	status_t rv = YAK_OOM;
+
+	if (files[0] && files[1])
+		rv = pipe_create(&vns[0], &vns[1]);
+
+	IF_ERR(rv)
+	{
+		for (int i = 0; i < 2; i++) {
+			if (files[i])
+				kfree(files[i], sizeof(struct file));
+		}
+		return SYS_ERR(status_errno(rv));
+	}
+
+	files[0]->vnode = vns[0];
+	files[0]->flags = FILE_READ;
+	files[1]->vnode = vns[1];
+	files[1]->flags = FILE_WRITE;
+
 	guard(mutex)(&proc->fd_mutex);
 
-	struct fd *desc = proc->fds[fd];
-	if (!desc) {
+	int rfd, wfd;
+	rv = fd_alloc(proc, files[0], 0, &rfd);
+	IF_ERR(rv)
+	{
+		file_deref(files[0]);
+		file_deref(files[1]);
+		return SYS_ERR(status_errno(rv));
+	}
+
+	rv = fd_alloc(proc, files[1], 0, &wfd);
+	IF_ERR(rv)
+	{
+		EXPECT(fd_close(proc, rfd));
+		file_deref(files[1]);
+		return SYS_ERR(status_errno(rv));
+	}
+
+	fds[0] = rfd;
+	fds[1] = wfd;
+	return SYS_OK(0);
+}
+
+/*
+ * One side has to be a pipe. Data coming from a file is queued as page
+ * cache references, whole pipe pages going to a file change owners.
+ */
+DEFINE_SYSCALL(SYS_SPLICE, splice, int fd_in, off_t *off_in, int fd_out,
+	       off_t *off_out, size_t len, [[maybe_unused]] unsigned int flags)
+{
+	struct file *in = fd_get_file(curproc(), fd_in);
+	if (!in)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(in, file);
+
+	struct file *out = fd_get_file(curproc(), fd_out);
+	if (!out)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(out, file);
+
+	if (!(in->flags & FILE_READ) || !(out->flags & FILE_WRITE))
+		return SYS_ERR(EBADF);
+
+	bool in_pipe = vn_is_pipe(in->vnode);
+	bool out_pipe = vn_is_pipe(out->vnode);
+	if (in_pipe == out_pipe)
+		return SYS_ERR(EINVAL);
+
+	if ((in_pipe && off_in) || (out_pipe && off_out))
+		return SYS_ERR(ESPIPE);
+
+	struct file *file = in_pipe ? out : in;
+	off_t *offp = in_pipe ? off_out : off_in;
+
+	off_t off = offp ? *offp :
+			   __atomic_load_n(&file->offset, __ATOMIC_SEQ_CST);
+	if (off < 0)
+		return SYS_ERR(EINVAL);
+
+	len = MIN(len, SIZE_MAX >> 1);
+
+	size_t done = 0;
+	status_t res = in_pipe ? pipe_splice_out(in->vnode, out->vnode, off,
+						 len, &done) :
+				 pipe_splice_in(out->vnode, in->vnode, off,
+						len, &done);
+	if (res == YAK_NOT_SUPPORTED)
+		return SYS_ERR(EINVAL);
+	RET_ERRNO_ON_ERR(res);
+
+	if (offp)
+		*offp = off + done;
+	else
+		__atomic_fetch_add(&file->offset, done, __ATOMIC_SEQ_CST);
+
+	return SYS_OK(done);
+}
+
+/*
+ * User pages sit behind anons in the caller's amap and can't be lifted
+ * out, so even SPLICE_F_GIFT copies into pages the pipe owns. Those can
+ * still change owners when spliced on to a file.
+ */
+DEFINE_SYSCALL(SYS_VMSPLICE, vmsplice, int fd, const struct iovec *uiov,
+	       size_t nr_segs, [[maybe_unused]] unsigned int flags)
+{
+	struct iovec *iov;
+	int err = iov_fetch(uiov, nr_segs, &iov);
+	if (err)
+		return SYS_ERR(err);
+
+	guard(autofree)(iov, nr_segs * sizeof(struct iovec));
+
+	err = iov_check(iov, nr_segs);
+	if (err)
+		return SYS_ERR(err);
+
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(file, file);
+
+	if (!vn_is_pipe(file->vnode))
+		return SYS_ERR(EBADF);
+
+	size_t done = 0;
+	status_t res = (file->flags & FILE_WRITE) ?
+			       vfs_writev(file->vnode, 0, iov, nr_segs, &done) :
+			       vfs_readv(file->vnode, 0, iov, nr_segs, &done);
+	RET_ERRNO_ON_ERR(res);
+
+	return SYS_OK(done);
+}
+
+DEFINE_SYSCALL(SYS_SEEK, seek, int fd, off_t offset, int whence)
+{
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file) {
 		return SYS_ERR(EBADF);
 	}
 
-	struct file *file = desc->file;
+	guard_ref_adopt(file, file);
+	guard(mutex)(&file->lock);
+
+	if (file->vnode->type == VFIFO)
+		return SYS_ERR(ESPIPE);
 
 	switch (whence) {
 	case SEEK_SET:
@@ -226,17 +532,9 @@ DEFINE_SYSCALL(SYS_SEEK, seek, int fd, off_t offset, int whence)
 DEFINE_SYSCALL(SYS_FALLOCATE, fallocate, int fd, int mode, off_t offset,
 	       off_t size)
 {
-	struct kprocess *proc = curproc();
-	struct file *file;
-
-	{
-		guard(mutex)(&proc->fd_mutex);
-		struct fd *desc = fd_safe_get(proc, fd);
-		if (!desc) {
-			return SYS_ERR(EBADF);
-		}
-		file = desc->file;
-		file_ref(file);
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file) {
+		return SYS_ERR(EBADF);
 	}
 
 	guard_ref_adopt(file, file);
@@ -245,7 +543,54 @@ DEFINE_SYSCALL(SYS_FALLOCATE, fallocate, int fd, int mode, off_t offset,
 		return SYS_ERR(EBADF);
 	}
 
+	if (file->vnode->type == VFIFO)
+		return SYS_ERR(ESPIPE);
+
 	status_t rv = VOP_FALLOCATE(file->vnode, mode, offset, size);
 	RET_ERRNO_ON_ERR(rv);
 	return SYS_OK(0);
 }
+
+DEFINE_SYSCALL(SYS_FSYNC, fsync, int fd)
+{
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file) {
+		return SYS_ERR(EBADF);
+	}
+
+	guard_ref_adopt(file, file);
+
+	RET_ERRNO_ON_ERR(vfs_fsync(file->vnode));
+	return SYS_OK(0);
+}
+
+/*
+ * The file offset holds the d_off cookie of the last returned entry,
+ * so listings can resume across calls.
+ */
+DEFINE_SYSCALL(SYS_GETDENTS, getdents, int fd, struct dirent *buf,
+	       size_t count)
+{
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file) {
+		return SYS_ERR(EBADF);
+	}
+
+	guard_ref_adopt(file, file);
+
+	if (!(file->flags & FILE_READ)) {
+		return SYS_ERR(EBADF);
+	}
+
+	// keep concurrent listings from reusing the same cookie
+	guard(mutex)(&file->lock);
+
+	off_t offset = file->offset;
+	size_t bytes_read = 0;
+	status_t res = vfs_getdents(file->vnode, buf, count, &offset,
+				    &bytes_read);
+	RET_ERRNO_ON_ERR(res);
+	file->offset = offset;
+
+	return SYS_OK(bytes_read);
+}
@@ -7,6 +7,7 @@
 #include <yak/queue.h>
 #include <yak/log.h>
 #include <yak/jobctl.h>
+#include <yak/vm/kstack.h>
 #include <yak/vm/map.h>
 
 void _syscall_fork_return();
@@ -35,29 +36,29 @@ DEFINE_SYSCALL(SYS_FORK, fork)
 	{
 		guard(mutex)(&cur_proc->fd_mutex);
 
-		EXPECT(fd_grow(new_proc, cur_proc->fd_cap));
+		struct fdtable *fdt = cur_proc->fdtable;
+		int cap = fdt ? fdt->cap : 0;
+		EXPECT(fd_grow(new_proc, cap));
 
-		for (int i = 0; i < cur_proc->fd_cap; i++) {
+		for (int i = 0; i < cap; i++) {
 			struct fd *desc = fd_safe_get(cur_proc, i);
 			if (!desc)
 				continue;
-			struct fd *desc_copy = kmalloc(sizeof(struct fd));
-			desc_copy->file = desc->file;
-			desc_copy->flags = desc->flags;
 			file_ref(desc->file);
-			new_proc->fds[i] = desc_copy;
-			assert(fd_safe_get(new_proc, i));
+			EXPECT(fd_alloc_at(new_proc, i, desc->file,
+					   desc->flags));
 		}
 	}
 
-	struct kthread *new_thread = kmalloc(sizeof(struct kthread));
+	struct kthread *new_thread = kthread_alloc();
 	assert(new_thread);
-	kthread_init(new_thread, cur_thread->name, cur_thread->priority,
+	kthread_init(new_thread, cur_thread->name, cur_thread->base_priority,
 		     new_proc, 1);
+	sched_fork(cur_thread, new_thread);
 	kthread_context_copy(cur_thread, new_thread);
 
-	vaddr_t stack_addr = (vaddr_t)vm_kalloc(KSTACK_SIZE, 0);
-	stack_addr += KSTACK_SIZE;
+	vaddr_t stack_addr = (vaddr_t)kstack_alloc();
+	assert(stack_addr);
 	new_thread->kstack_top = (void *)stack_addr;
 
 	stack_addr -= sizeof(struct syscall_frame);
@@ -0,0 +1,63 @@
+#include <yak/futex.h>
+#include <yak/log.h>
+#include <yak/status.h>
+#include <yak/syscall.h>
+#include <yak/timer.h>
+#include <yak/timespec.h>
+#include <yak/types.h>
+#include <yak-abi/errno.h>
+#include <yak-abi/futex.h>
+
+static int timespec_to_ns(const struct timespec *ts, nstime_t *ns)
+{
+	if (ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= (long)STIME(1))
+		return EINVAL;
+	*ns = STIME((nstime_t)ts->tv_sec) + ts->tv_nsec;
+	return 0;
+}
+
+/*
+ * FUTEX_WAIT takes a relative timeout, FUTEX_WAIT_BITSET an absolute
+ * one on the boot time clock. For the requeue ops the timeout slot
+ * carries nr_requeue instead, as on Linux.
+ */
+DEFINE_SYSCALL(SYS_FUTEX, futex, uint32_t *uaddr, int op, uint32_t val,
+	       const struct timespec *timeout, uint32_t *uaddr2, uint32_t val3)
+{
+	bool shared = !(op & FUTEX_PRIVATE_FLAG);
+	int cmd = op & FUTEX_CMD_MASK;
+
+	nstime_t deadline = TIMER_INFINITE;
+	int n = 0;
+	int err;
+
+	if (cmd == FUTEX_WAIT || cmd == FUTEX_WAKE)
+		val3 = FUTEX_BITSET_MATCH_ANY;
+
+	switch (cmd) {
+	case FUTEX_WAIT:
+	case FUTEX_WAIT_BITSET:
+		if (timeout) {
+			nstime_t ns;
+			if ((err = timespec_to_ns(timeout, &ns)))
+				return SYS_ERR(err);
+			deadline = cmd == FUTEX_WAIT ? plat_getnanos() + ns : ns;
+		}
+		RET_ERRNO_ON_ERR(futex_wait(uaddr, val, val3, shared, deadline));
+		return SYS_OK(0);
+	case FUTEX_WAKE:
+	case FUTEX_WAKE_BITSET:
+		RET_ERRNO_ON_ERR(futex_wake(uaddr, MIN(val, (uint32_t)INT32_MAX),
+					    val3, shared, &n));
+		return SYS_OK(n);
+	case FUTEX_REQUEUE:
+	case FUTEX_CMP_REQUEUE:
+		RET_ERRNO_ON_ERR(futex_requeue(
+			uaddr, uaddr2, MIN(val, (uint32_t)INT32_MAX),
+			(int)MIN((uintptr_t)timeout, (uintptr_t)INT32_MAX),
+			cmd == FUTEX_CMP_REQUEUE ? &val3 : NULL, shared, &n));
+		return SYS_OK(n);
+	default:
+		return SYS_ERR(ENOSYS);
+	}
+}
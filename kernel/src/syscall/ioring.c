@@ -0,0 +1,73 @@
+#include <yak/cpudata.h>
+#include <yak/file.h>
+#include <yak/heap.h>
+#include <yak/log.h>
+#include <yak/status.h>
+#include <yak/syscall.h>
+#include <yak/types.h>
+#include <yak/fs/ioring.h>
+#include <yak/fs/vfs.h>
+#include <yak-abi/errno.h>
+#include <yak-abi/ioring.h>
+
+DEFINE_SYSCALL(SYS_IORING_SETUP, ioring_setup, unsigned int entries,
+	       struct ioring_params *params)
+{
+	if (!params)
+		return SYS_ERR(EFAULT);
+
+	struct kprocess *proc = curproc();
+
+	struct ioring_params p = *params;
+	p.sq_entries = entries;
+
+	struct file *file = file_alloc();
+	if (!file)
+		return SYS_ERR(ENOMEM);
+
+	struct vnode *vn;
+	status_t rv = ioring_create(proc, &p, &vn);
+	IF_ERR(rv)
+	{
+		kfree(file, sizeof(struct file));
+		return SYS_ERR(status_errno(rv));
+	}
+
+	file->vnode = vn;
+	file->flags = FILE_READ | FILE_WRITE;
+
+	guard(mutex)(&proc->fd_mutex);
+
+	int fd;
+	rv = fd_alloc(proc, file, 0, &fd);
+	IF_ERR(rv)
+	{
+		// the mapping stays, like any other mapping of a closed fd
+		file_deref(file);
+		return SYS_ERR(status_errno(rv));
+	}
+
+	*params = p;
+	return SYS_OK(fd);
+}
+
+DEFINE_SYSCALL(SYS_IORING_ENTER, ioring_enter, int fd, unsigned int to_submit,
+	       unsigned int min_complete, unsigned int flags)
+{
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return SYS_ERR(EINVAL);
+
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(file, file);
+
+	if (!vn_is_ioring(file->vnode))
+		return SYS_ERR(EINVAL);
+
+	uint32_t submitted;
+	RET_ERRNO_ON_ERR(ioring_enter(file->vnode, to_submit, min_complete,
+				      flags, &submitted));
+	return SYS_OK(submitted);
+}
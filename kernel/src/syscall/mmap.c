@@ -99,16 +99,9 @@ DEFINE_SYSCALL(SYS_MMAP, mmap, void *hint, unsigned long len,
 		rv = vm_map(proc->map, NULL, len, pgoff, vm_prot, inheritance,
 			    VM_CACHE_DEFAULT, (vaddr_t)hint, vmflags, &out);
 	} else {
-		struct file *file;
-
-		{
-			guard(mutex)(&proc->fd_mutex);
-			struct fd *desc = fd_safe_get(proc, fd);
-			if (!desc) {
-				return SYS_ERR(EBADF);
-			}
-			file = desc->file;
-			file_ref(file);
+		struct file *file = fd_get_file(proc, fd);
+		if (!file) {
+			return SYS_ERR(EBADF);
 		}
 
 		guard_ref_adopt(file, file);
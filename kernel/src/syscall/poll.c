@@ -0,0 +1,236 @@
+#include <yak/cpudata.h>
+#include <yak/file.h>
+#include <yak/heap.h>
+#include <yak/kevent.h>
+#include <yak/log.h>
+#include <yak/macro.h>
+#include <yak/poll.h>
+#include <yak/status.h>
+#include <yak/syscall.h>
+#include <yak/timer.h>
+#include <yak/timespec.h>
+#include <yak/types.h>
+#include <yak/fs/epoll.h>
+#include <yak/fs/vfs.h>
+#include <yak-abi/errno.h>
+#include <yak-abi/epoll.h>
+#include <yak-abi/poll.h>
+
+// same as the fd table limit, more can't be distinct anyway
+#define POLL_MAX_FDS 65536
+#define EP_MAX_EVENTS (INT32_MAX / sizeof(struct epoll_event))
+
+struct poll_slot {
+	struct poll_entry pe;
+	struct kevent *ev;
+	struct file *file;
+	int fd;
+	short events;
+	short revents;
+};
+
+static void poll_notify(struct poll_entry *pe, [[maybe_unused]] short revents)
+{
+	struct poll_slot *slot = container_of(pe, struct poll_slot, pe);
+	event_alarm(slot->ev);
+}
+
+/*
+ * The first pass attaches to every pollhead, so once nothing was ready
+ * we only have to sleep until one of them fires and look again.
+ */
+static status_t do_poll(struct pollfd *fds, size_t nfds, nstime_t timeout,
+			int *nready)
+{
+	struct kprocess *proc = curproc();
+
+	// nfds may be 0, poll() is then just a sleep
+	size_t nslots = MAX(nfds, (size_t)1);
+	struct poll_slot *slots = kcalloc(nslots, sizeof(struct poll_slot));
+	if (!slots)
+		return YAK_OOM;
+
+	struct kevent ev;
+	event_init(&ev, 0);
+
+	for (size_t i = 0; i < nfds; i++) {
+		slots[i].ev = &ev;
+		slots[i].fd = fds[i].fd;
+		slots[i].events = fds[i].events;
+		poll_entry_init(&slots[i].pe, slots[i].events, poll_notify);
+		if (slots[i].fd >= 0)
+			slots[i].file = fd_get_file(proc, slots[i].fd);
+	}
+
+	nstime_t deadline = TIMER_INFINITE;
+	if (timeout != TIMER_INFINITE)
+		deadline = plat_getnanos() + timeout;
+
+	bool attached = false;
+	int n;
+
+	for (;;) {
+		n = 0;
+
+		for (size_t i = 0; i < nfds; i++) {
+			struct poll_slot *slot = &slots[i];
+			slot->revents = 0;
+
+			if (slot->fd < 0)
+				continue;
+
+			if (!slot->file) {
+				slot->revents = POLLNVAL;
+			} else {
+				// not worth attaching once we won't sleep
+				bool attach = !attached && n == 0 && timeout != 0;
+				slot->revents = vfs_poll(slot->file->vnode,
+							 slot->events,
+							 attach ? &slot->pe :
+								  NULL);
+			}
+
+			if (slot->revents)
+				n++;
+		}
+
+		if (n || timeout == 0)
+			break;
+
+		attached = true;
+
+		if (poll_sleep(&ev, deadline) == YAK_TIMEOUT)
+			break;
+	}
+
+	for (size_t i = 0; i < nfds; i++) {
+		pollhead_detach(&slots[i].pe);
+		if (slots[i].file)
+			file_deref(slots[i].file);
+		fds[i].revents = slots[i].revents;
+	}
+
+	kfree(slots, nslots * sizeof(struct poll_slot));
+
+	*nready = n;
+	return YAK_SUCCESS;
+}
+
+DEFINE_SYSCALL(SYS_POLL, poll, struct pollfd *fds, size_t nfds, int timeout)
+{
+	if (nfds > POLL_MAX_FDS)
+		return SYS_ERR(EINVAL);
+
+	nstime_t ns = timeout < 0 ? TIMER_INFINITE : MSTIME((nstime_t)timeout);
+
+	int n;
+	RET_ERRNO_ON_ERR(do_poll(fds, nfds, ns, &n));
+	return SYS_OK(n);
+}
+
+/* there are no signals yet, so the mask has nothing to do */
+DEFINE_SYSCALL(SYS_PPOLL, ppoll, struct pollfd *fds, size_t nfds,
+	       const struct timespec *tmo, [[maybe_unused]] const void *sigmask,
+	       [[maybe_unused]] size_t sigsetsize)
+{
+	if (nfds > POLL_MAX_FDS)
+		return SYS_ERR(EINVAL);
+
+	nstime_t ns = TIMER_INFINITE;
+	if (tmo) {
+		if (tmo->tv_sec < 0 || tmo->tv_nsec < 0 ||
+		    tmo->tv_nsec >= (long)STIME(1))
+			return SYS_ERR(EINVAL);
+		ns = STIME((nstime_t)tmo->tv_sec) + tmo->tv_nsec;
+	}
+
+	int n;
+	RET_ERRNO_ON_ERR(do_poll(fds, nfds, ns, &n));
+	return SYS_OK(n);
+}
+
+DEFINE_SYSCALL(SYS_EPOLL_CREATE, epoll_create, int flags)
+{
+	if (flags != 0)
+		return SYS_ERR(EINVAL);
+
+	struct kprocess *proc = curproc();
+
+	struct file *file = file_alloc();
+	if (!file)
+		return SYS_ERR(ENOMEM);
+
+	struct vnode *vn;
+	status_t rv = epoll_create(&vn);
+	IF_ERR(rv)
+	{
+		kfree(file, sizeof(struct file));
+		return SYS_ERR(status_errno(rv));
+	}
+
+	file->vnode = vn;
+	file->flags = FILE_READ | FILE_WRITE;
+
+	guard(mutex)(&proc->fd_mutex);
+
+	int fd;
+	rv = fd_alloc(proc, file, 0, &fd);
+	IF_ERR(rv)
+	{
+		file_deref(file);
+		return SYS_ERR(status_errno(rv));
+	}
+
+	return SYS_OK(fd);
+}
+
+DEFINE_SYSCALL(SYS_EPOLL_CTL, epoll_ctl, int epfd, int op, int fd,
+	       const struct epoll_event *event)
+{
+	struct file *epf = fd_get_file(curproc(), epfd);
+	if (!epf)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(epf, file);
+
+	struct file *file = fd_get_file(curproc(), fd);
+	if (!file)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(file, file);
+
+	if (!vn_is_epoll(epf->vnode) || epf == file)
+		return SYS_ERR(EINVAL);
+
+	struct epoll_event ev = { 0 };
+	if (op != EPOLL_CTL_DEL) {
+		if (!event)
+			return SYS_ERR(EFAULT);
+		ev = *event;
+	}
+
+	RET_ERRNO_ON_ERR(epoll_ctl(epf->vnode, op, file, fd, &ev));
+	return SYS_OK(0);
+}
+
+DEFINE_SYSCALL(SYS_EPOLL_WAIT, epoll_wait, int epfd,
+	       struct epoll_event *events, int maxevents, int timeout)
+{
+	if (maxevents <= 0 || (size_t)maxevents > EP_MAX_EVENTS)
+		return SYS_ERR(EINVAL);
+
+	struct file *epf = fd_get_file(curproc(), epfd);
+	if (!epf)
+		return SYS_ERR(EBADF);
+
+	guard_ref_adopt(epf, file);
+
+	if (!vn_is_epoll(epf->vnode))
+		return SYS_ERR(EINVAL);
+
+	nstime_t ns = timeout < 0 ? TIMER_INFINITE : MSTIME((nstime_t)timeout);
+
+	int n;
+	RET_ERRNO_ON_ERR(epoll_wait(epf->vnode, events, maxevents, ns, &n));
+	return SYS_OK(n);
+}
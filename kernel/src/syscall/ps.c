@@ -1,3 +1,5 @@
+#include <string.h>
+#include <yak/acct.h>
 #include <yak/process.h>
 #include <yak/queue.h>
 #include <yak/jobctl.h>
@@ -9,11 +11,15 @@
 #include <yak/syscall.h>
 #include <yak/timespec.h>
 #include <yak-abi/errno.h>
+#include <yak-abi/resource.h>
 #include <yak-abi/syscall.h>
 
 DEFINE_SYSCALL(SYS_EXIT, exit, int rc)
 {
 	pr_debug("sys_exit() is a stub: exit with code %d\n", rc);
+	struct kprocess *proc = curproc();
+	if (__atomic_load_n(&proc->thread_count, __ATOMIC_ACQUIRE) == 1)
+		kprocess_drop_thread_exits(proc);
 	sched_exit_self();
 }
 
@@ -109,3 +115,69 @@ DEFINE_SYSCALL(SYS_SLEEP, sleep, struct timespec *req, struct timespec *rem)
 
 	return SYS_OK(0);
 }
+
+static void ns_to_timeval(nstime_t ns, struct rusage_timeval *tv)
+{
+	tv->tv_sec = ns / STIME(1);
+	tv->tv_usec = (ns % STIME(1)) / 1000;
+}
+
+static long ns_to_ticks(nstime_t ns)
+{
+	return ns / (STIME(1) / TIMES_CLK_TCK);
+}
+
+// interrupts are charged to whoever they hit, count them as system time
+DEFINE_SYSCALL(SYS_GETRUSAGE, getrusage, int who, struct rusage *usage)
+{
+	if (!usage)
+		return SYS_ERR(EFAULT);
+
+	struct kprocess *proc = curproc();
+	struct acct_times times;
+
+	switch (who) {
+	case RUSAGE_SELF:
+		acct_process_times(proc, &times);
+		break;
+	case RUSAGE_THREAD:
+		acct_thread_times(curthread(), &times);
+		break;
+	case RUSAGE_CHILDREN: {
+		ipl_t ipl = spinlock_lock(&proc->thread_list_lock);
+		times.utime = proc->cutime;
+		times.stime = proc->cstime;
+		times.itime = 0;
+		spinlock_unlock(&proc->thread_list_lock, ipl);
+		break;
+	}
+	default:
+		return SYS_ERR(EINVAL);
+	}
+
+	memset(usage, 0, sizeof(struct rusage));
+	ns_to_timeval(times.utime, &usage->ru_utime);
+	ns_to_timeval(times.stime + times.itime, &usage->ru_stime);
+	return SYS_OK(0);
+}
+
+// returns the ticks since boot
+DEFINE_SYSCALL(SYS_TIMES, times, struct tms *buf)
+{
+	if (buf) {
+		struct kprocess *proc = curproc();
+		struct acct_times times;
+		acct_process_times(proc, &times);
+
+		ipl_t ipl = spinlock_lock(&proc->thread_list_lock);
+		nstime_t cutime = proc->cutime, cstime = proc->cstime;
+		spinlock_unlock(&proc->thread_list_lock, ipl);
+
+		buf->tms_utime = ns_to_ticks(times.utime);
+		buf->tms_stime = ns_to_ticks(times.stime + times.itime);
+		buf->tms_cutime = ns_to_ticks(cutime);
+		buf->tms_cstime = ns_to_ticks(cstime);
+	}
+
+	return SYS_OK(ns_to_ticks(plat_getnanos()));
+}
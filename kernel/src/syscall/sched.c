@@ -0,0 +1,114 @@
+#include <string.h>
+#include <yak/cpu.h>
+#include <yak/cpudata.h>
+#include <yak/cpuset.h>
+#include <yak/macro.h>
+#include <yak/process.h>
+#include <yak/status.h>
+#include <yak/syscall.h>
+#include <yak-abi/errno.h>
+#include <yak-abi/sched.h>
+
+// a process id names its main thread, anything else one of our threads
+static struct kprocess *tid_owner(pid_t *tid)
+{
+	if (*tid == 0) {
+		*tid = curthread()->tid;
+		return curproc();
+	}
+
+	struct kprocess *proc = lookup_pid(*tid);
+	return proc ? proc : curproc();
+}
+
+static status_t copy_name(char *buf, const char *name)
+{
+	if (!name)
+		return YAK_INVALID_ARGS;
+
+	size_t len = strnlen(name, CPUSET_NAME_MAX);
+	if (len == 0 || len == CPUSET_NAME_MAX)
+		return YAK_INVALID_ARGS;
+
+	memcpy(buf, name, len + 1);
+	return YAK_SUCCESS;
+}
+
+// cpus past the end of the user mask are not in it
+static status_t copy_mask(struct cpumask *mask, size_t size, const void *umask)
+{
+	if (!umask || size == 0)
+		return YAK_INVALID_ARGS;
+
+	cpumask_zero(mask);
+	memcpy(mask, umask, MIN(size, sizeof(struct cpumask)));
+	return YAK_SUCCESS;
+}
+
+DEFINE_SYSCALL(SYS_SCHED_SETAFFINITY, sched_setaffinity, pid_t tid,
+	       size_t size, const void *umask)
+{
+	struct cpumask mask;
+	RET_ERRNO_ON_ERR(copy_mask(&mask, size, umask));
+
+	struct kprocess *proc = tid_owner(&tid);
+	status_t rv = cpuset_set_affinity(proc, tid, &mask);
+	if (rv == YAK_NOENT)
+		return SYS_ERR(ESRCH);
+	RET_ERRNO_ON_ERR(rv);
+	return SYS_OK(0);
+}
+
+// returns how many bytes of the mask were written, like linux
+DEFINE_SYSCALL(SYS_SCHED_GETAFFINITY, sched_getaffinity, pid_t tid,
+	       size_t size, void *umask)
+{
+	if (!umask || size < sizeof(cpumask_word_t) ||
+	    size % sizeof(cpumask_word_t))
+		return SYS_ERR(EINVAL);
+
+	struct cpumask mask;
+	struct kprocess *proc = tid_owner(&tid);
+	if (IS_ERR(cpuset_get_affinity(proc, tid, &mask)))
+		return SYS_ERR(ESRCH);
+
+	size_t n = MIN(size, sizeof(struct cpumask));
+	memcpy(umask, &mask, n);
+	return SYS_OK(n);
+}
+
+DEFINE_SYSCALL(SYS_CPUSET_CREATE, cpuset_create, const char *uname,
+	       size_t size, const void *umask)
+{
+	char name[CPUSET_NAME_MAX];
+	RET_ERRNO_ON_ERR(copy_name(name, uname));
+
+	struct cpumask mask;
+	RET_ERRNO_ON_ERR(copy_mask(&mask, size, umask));
+
+	RET_ERRNO_ON_ERR(cpuset_define(name, &mask));
+	return SYS_OK(0);
+}
+
+DEFINE_SYSCALL(SYS_CPUSET_DESTROY, cpuset_destroy, const char *uname)
+{
+	char name[CPUSET_NAME_MAX];
+	RET_ERRNO_ON_ERR(copy_name(name, uname));
+
+	RET_ERRNO_ON_ERR(cpuset_destroy(name));
+	return SYS_OK(0);
+}
+
+DEFINE_SYSCALL(SYS_CPUSET_ATTACH, cpuset_attach, pid_t pid,
+	       const char *uname)
+{
+	char name[CPUSET_NAME_MAX];
+	RET_ERRNO_ON_ERR(copy_name(name, uname));
+
+	struct kprocess *proc = pid ? lookup_pid(pid) : curproc();
+	if (!proc)
+		return SYS_ERR(ESRCH);
+
+	RET_ERRNO_ON_ERR(cpuset_attach(proc, name));
+	return SYS_OK(0);
+}
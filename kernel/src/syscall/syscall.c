@@ -5,29 +5,61 @@
 #include <yak/init.h>
 #include <yak/log.h>
 
-#define SYSCALL_LIST                        \
-	X(SYS_DEBUG_SLEEP, sys_debug_sleep) \
-	X(SYS_DEBUG_LOG, sys_debug_log)     \
-	X(SYS_EXIT, sys_exit)               \
-	X(SYS_WRITE, sys_write)             \
-	X(SYS_READ, sys_read)               \
-	X(SYS_CLOSE, sys_close)             \
-	X(SYS_OPEN, sys_open)               \
-	X(SYS_FORK, sys_fork)               \
-	X(SYS_EXECVE, sys_execve)           \
-	X(SYS_MMAP, sys_mmap)               \
-	X(SYS_MUNMAP, sys_munmap)           \
-	X(SYS_MPROTECT, sys_mprotect)       \
-	X(SYS_SEEK, sys_seek)               \
-	X(SYS_GETPID, sys_getpid)           \
-	X(SYS_GETPPID, sys_getppid)         \
-	X(SYS_GETPGID, sys_getpgid)         \
-	X(SYS_GETSID, sys_getsid)           \
-	X(SYS_SLEEP, sys_sleep)             \
-	X(SYS_DUP2, sys_dup2)               \
-	X(SYS_SETSID, sys_setsid)           \
-	X(SYS_SETPGID, sys_setpgid)         \
-	X(SYS_FALLOCATE, sys_fallocate)     \
+#define SYSCALL_LIST                                    \
+	X(SYS_DEBUG_SLEEP, sys_debug_sleep)             \
+	X(SYS_DEBUG_LOG, sys_debug_log)                 \
+	X(SYS_EXIT, sys_exit)                           \
+	X(SYS_WRITE, sys_write)                         \
+	X(SYS_READ, sys_read)                           \
+	X(SYS_CLOSE, sys_close)                         \
+	X(SYS_OPEN, sys_open)                           \
+	X(SYS_FORK, sys_fork)                           \
+	X(SYS_EXECVE, sys_execve)                       \
+	X(SYS_MMAP, sys_mmap)                           \
+	X(SYS_MUNMAP, sys_munmap)                       \
+	X(SYS_MPROTECT, sys_mprotect)                   \
+	X(SYS_SEEK, sys_seek)                           \
+	X(SYS_GETPID, sys_getpid)                       \
+	X(SYS_GETPPID, sys_getppid)                     \
+	X(SYS_GETPGID, sys_getpgid)                     \
+	X(SYS_GETSID, sys_getsid)                       \
+	X(SYS_SLEEP, sys_sleep)                         \
+	X(SYS_DUP2, sys_dup2)                           \
+	X(SYS_SETSID, sys_setsid)                       \
+	X(SYS_SETPGID, sys_setpgid)                     \
+	X(SYS_FALLOCATE, sys_fallocate)                 \
+	X(SYS_GETDENTS, sys_getdents)                   \
+	X(SYS_PREAD, sys_pread)                         \
+	X(SYS_PWRITE, sys_pwrite)                       \
+	X(SYS_READV, sys_readv)                         \
+	X(SYS_WRITEV, sys_writev)                       \
+	X(SYS_PREADV, sys_preadv)                       \
+	X(SYS_PWRITEV, sys_pwritev)                     \
+	X(SYS_COPY_FILE_RANGE, sys_copy_file_range)     \
+	X(SYS_SENDFILE, sys_sendfile)                   \
+	X(SYS_PIPE, sys_pipe)                           \
+	X(SYS_SPLICE, sys_splice)                       \
+	X(SYS_VMSPLICE, sys_vmsplice)                   \
+	X(SYS_POLL, sys_poll)                           \
+	X(SYS_PPOLL, sys_ppoll)                         \
+	X(SYS_EPOLL_CREATE, sys_epoll_create)           \
+	X(SYS_EPOLL_CTL, sys_epoll_ctl)                 \
+	X(SYS_EPOLL_WAIT, sys_epoll_wait)               \
+	X(SYS_IORING_SETUP, sys_ioring_setup)           \
+	X(SYS_IORING_ENTER, sys_ioring_enter)           \
+	X(SYS_FSYNC, sys_fsync)                         \
+	X(SYS_FUTEX, sys_futex)                         \
+	X(SYS_THREAD_CREATE, sys_thread_create)         \
+	X(SYS_THREAD_EXIT, sys_thread_exit)             \
+	X(SYS_THREAD_JOIN, sys_thread_join)             \
+	X(SYS_GETTID, sys_gettid)                       \
+	X(SYS_SCHED_SETAFFINITY, sys_sched_setaffinity) \
+	X(SYS_SCHED_GETAFFINITY, sys_sched_getaffinity) \
+	X(SYS_CPUSET_CREATE, sys_cpuset_create)         \
+	X(SYS_CPUSET_DESTROY, sys_cpuset_destroy)       \
+	X(SYS_CPUSET_ATTACH, sys_cpuset_attach)         \
+	X(SYS_GETRUSAGE, sys_getrusage)                 \
+	X(SYS_TIMES, sys_times)                         \
 	X(SYS_ARCHCTL, sys_archctl)
 
 #define X(num, fn) extern long fn();
@@ -0,0 +1,205 @@
+#include <assert.h>
+#include <string.h>
+#include <yak/cpudata.h>
+#include <yak/heap.h>
+#include <yak/kevent.h>
+#include <yak/log.h>
+#include <yak/process.h>
+#include <yak/queue.h>
+#include <yak/sched.h>
+#include <yak/spinlock.h>
+#include <yak/syscall.h>
+#include <yak/wait.h>
+#include <yak/vm/kstack.h>
+#include <yak/vm/map.h>
+#include <yak-abi/errno.h>
+
+void _syscall_fork_return();
+
+// unjoined exit records past this drop the oldest one
+#define THREAD_EXIT_MAX 256
+
+struct thread_exit {
+	pid_t tid;
+	int code;
+	TAILQ_ENTRY(thread_exit) list_entry;
+};
+
+void kprocess_drop_thread_exits(struct kprocess *process)
+{
+	struct thread_exit_list list = TAILQ_HEAD_INITIALIZER(list);
+
+	ipl_t ipl = spinlock_lock(&process->thread_list_lock);
+	TAILQ_CONCAT(&list, &process->exited_threads, list_entry);
+	process->nexited = 0;
+	spinlock_unlock(&process->thread_list_lock, ipl);
+
+	struct thread_exit *te, *tmp;
+	TAILQ_FOREACH_SAFE(te, &list, list_entry, tmp)
+	{
+		kfree(te, sizeof(struct thread_exit));
+	}
+}
+
+/*
+ * The new thread shares everything with the process and leaves the
+ * syscall like a forked child would, just at entry on its own stack.
+ */
+DEFINE_SYSCALL(SYS_THREAD_CREATE, thread_create, void *entry, void *stack,
+	       void *arg, unsigned long tls)
+{
+	struct kprocess *proc = curproc();
+	struct kthread *cur_thread = curthread();
+
+	// sysret to a non-canonical address faults in ring 0 on the user stack
+	if ((uintptr_t)entry < USER_VA_BASE || (uintptr_t)entry >= USER_VA_END ||
+	    (uintptr_t)stack < USER_VA_BASE || (uintptr_t)stack > USER_VA_END)
+		return SYS_ERR(EFAULT);
+
+	struct kthread *new_thread = kthread_alloc();
+	if (!new_thread)
+		return SYS_ERR(ENOMEM);
+
+	vaddr_t stack_addr = (vaddr_t)kstack_alloc();
+	if (!stack_addr) {
+		kthread_free(new_thread);
+		return SYS_ERR(ENOMEM);
+	}
+
+	kthread_init(new_thread, cur_thread->name, cur_thread->base_priority,
+		     proc, 1);
+	sched_fork(cur_thread, new_thread);
+	kthread_context_copy(cur_thread, new_thread);
+	kthread_set_tls(new_thread, tls);
+
+	new_thread->kstack_top = (void *)stack_addr;
+
+	stack_addr -= sizeof(struct syscall_frame);
+	assert((stack_addr & 0xF) == 0);
+
+	struct syscall_frame *new_frame = (void *)stack_addr;
+	memcpy(new_frame, __syscall_ctx, sizeof(struct syscall_frame));
+
+	CTX_SYS_IP(new_frame) = (uintptr_t)entry;
+	CTX_SYS_SP(new_frame) = (uintptr_t)stack;
+	CTX_SYS_ARG0(new_frame) = (uintptr_t)arg;
+	new_frame->rax = 0;
+	new_frame->rdx = 0;
+
+	uint64_t *sp = (uint64_t *)stack_addr;
+	sp -= 2;
+	*sp = (uint64_t)_syscall_fork_return;
+
+	new_thread->pcb.rsp = (uint64_t)sp;
+
+	pid_t tid = new_thread->tid;
+	sched_resume(new_thread);
+
+	return SYS_OK(tid);
+}
+
+DEFINE_SYSCALL(SYS_THREAD_EXIT, thread_exit, int code)
+{
+	struct kprocess *proc = curproc();
+
+	struct thread_exit *te = kmalloc(sizeof(struct thread_exit));
+	if (te) {
+		te->tid = curthread()->tid;
+		te->code = code;
+
+		struct thread_exit *dropped = NULL;
+		bool last;
+
+		ipl_t ipl = spinlock_lock(&proc->thread_list_lock);
+		// nobody is left to join, and nobody can create a joiner
+		last = proc->thread_count == 1;
+		if (!last) {
+			TAILQ_INSERT_HEAD(&proc->exited_threads, te, list_entry);
+			if (++proc->nexited > THREAD_EXIT_MAX) {
+				dropped = TAILQ_LAST(&proc->exited_threads,
+						     thread_exit_list);
+				TAILQ_REMOVE(&proc->exited_threads, dropped,
+					     list_entry);
+				proc->nexited--;
+			}
+		}
+		spinlock_unlock(&proc->thread_list_lock, ipl);
+
+		if (last) {
+			kfree(te, sizeof(struct thread_exit));
+			kprocess_drop_thread_exits(proc);
+		} else {
+			event_alarm(&proc->thread_exit_ev);
+		}
+
+		if (dropped)
+			kfree(dropped, sizeof(struct thread_exit));
+	} else {
+		// joiners see ESRCH instead of the code
+		pr_warn("no memory to record exit of thread %lld\n",
+			curthread()->tid);
+	}
+
+	sched_exit_self();
+}
+
+// looks at the exit records first, a live thread can already have one
+static struct thread_exit *find_exit(struct kprocess *proc, pid_t tid,
+				     bool *alive)
+{
+	struct thread_exit *te;
+	TAILQ_FOREACH(te, &proc->exited_threads, list_entry)
+	{
+		if (te->tid == tid) {
+			TAILQ_REMOVE(&proc->exited_threads, te, list_entry);
+			proc->nexited--;
+			return te;
+		}
+	}
+
+	struct kthread *thread;
+	*alive = false;
+	LIST_FOREACH(thread, &proc->thread_list, process_entry)
+	{
+		if (thread->tid == tid) {
+			*alive = true;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+DEFINE_SYSCALL(SYS_THREAD_JOIN, thread_join, pid_t tid, int *code)
+{
+	struct kprocess *proc = curproc();
+
+	if (tid == curthread()->tid)
+		return SYS_ERR(EDEADLK);
+
+	for (;;) {
+		bool alive;
+		ipl_t ipl = spinlock_lock(&proc->thread_list_lock);
+		struct thread_exit *te = find_exit(proc, tid, &alive);
+		spinlock_unlock(&proc->thread_list_lock, ipl);
+
+		if (te) {
+			if (code)
+				*code = te->code;
+			kfree(te, sizeof(struct thread_exit));
+			return SYS_OK(0);
+		}
+
+		if (!alive)
+			return SYS_ERR(ESRCH);
+
+		// wakes every joiner, the others just look again
+		sched_wait_single(&proc->thread_exit_ev, WAIT_MODE_BLOCK,
+				  WAIT_TYPE_ANY, TIMEOUT_INFINITE);
+	}
+}
+
+DEFINE_SYSCALL(SYS_GETTID, gettid)
+{
+	return SYS_OK(curthread()->tid);
+}
@@ -22,6 +22,7 @@ void timer_init(struct timer *timer)
 	timer->cpu = NULL;
 	timer->state = TIMER_STATE_UNUSED;
 	timer->deadline = 0;
+	timer->dpc = NULL;
 }
 
 void timer_reset(struct timer *timer)
@@ -93,6 +94,17 @@ status_t timer_install(struct timer *timer, nstime_t ns_delta)
 	return YAK_SUCCESS;
 }
 
+nstime_t timer_next_deadline()
+{
+	struct cpu *cpu = curcpu_ptr();
+	int state = spinlock_lock_interrupts(&cpu->timer_lock);
+	nstime_t deadline = HEAP_EMPTY(&cpu->timer_heap) ?
+				    TIMER_INFINITE :
+				    HEAP_PEEK(&cpu->timer_heap)->deadline;
+	spinlock_unlock_interrupts(&cpu->timer_lock, state);
+	return deadline;
+}
+
 // run from DPC context
 void timer_update([[maybe_unused]] struct dpc *dpc, [[maybe_unused]] void *ctx)
 {
@@ -130,6 +142,9 @@ void timer_update([[maybe_unused]] struct dpc *dpc, [[maybe_unused]] void *ctx)
 
 		root->hdr.signalstate = 1;
 
+		if (root->dpc)
+			dpc_enqueue(root->dpc, root);
+
 		spinlock_unlock_noipl(&root->hdr.obj_lock);
 		spinlock_unlock_noipl(&curcpu_ptr()->timer_lock);
 	} while (1);
@@ -214,28 +214,27 @@ static struct vm_anon *vm_amap_fill_locked(struct vm_amap *amap, voff_t offset,
 					   struct page **ppage,
 					   unsigned int flags)
 {
-	struct page *page = NULL;
-	if (IS_ERR(vm_lookuppage(amap->obj, offset, 0, &page))) {
-		// object does not contain offset
-		// -> fault should fail with SIGSEGV or some kind of OOB?
-		pr_error("lookuppage returned an error\n");
-		*ppage = NULL;
-		return NULL;
-	}
-
 	// create l3/l2/l1 if needed, amap already locked
 	struct vm_anon **panon =
 		vm_amap_lookup(amap, offset, VM_AMAP_CREATE | VM_AMAP_LOCKED);
 
-	// someone else was faster!
+	// someone else was faster! The object may have swapped its page
+	// for a written copy since, the anon keeps the one it was filled with.
 	if (*panon != NULL) {
 		struct vm_anon *anon = *panon;
-		// TODO: what if we page out?
-		assert(anon->page == page);
 		*ppage = anon->page;
 		return anon;
 	}
 
+	struct page *page = NULL;
+	if (IS_ERR(vm_lookuppage(amap->obj, offset, 0, &page))) {
+		// object does not contain offset
+		// -> fault should fail with SIGSEGV or some kind of OOB?
+		pr_error("lookuppage returned an error\n");
+		*ppage = NULL;
+		return NULL;
+	}
+
 	*panon = vm_anon_create(page, offset);
 	*ppage = page;
 	return *panon;
@@ -1,12 +1,14 @@
 #include <stddef.h>
 #include <assert.h>
 #include <yak/heap.h>
+#include <yak/cleanup.h>
 #include <yak/macro.h>
 #include <yak/tree.h>
 #include <yak/vm/map.h>
 #include <yak/vm/pmm.h>
 #include <yak/vm/page.h>
 #include <yak/vm/object.h>
+#include <yak/vm/aobj.h>
 
 struct vm_aobj {
 	struct vm_object obj;
@@ -32,14 +34,14 @@ status_t anon_pager_get(struct vm_object *obj, voff_t offset,
 	return YAK_SUCCESS;
 }
 
-uintptr_t anon_pager_put(struct vm_object *object, struct page **pages,
-			 voff_t offset)
+status_t anon_pager_put(struct vm_object *object, struct page **pages,
+			unsigned int npages)
 {
 	(void)object;
 	(void)pages;
-	(void)offset;
+	(void)npages;
 	// TODO: swap out
-	return 0;
+	return YAK_SUCCESS;
 }
 
 void anon_pager_cleanup(struct vm_object *object)
@@ -73,3 +75,79 @@ struct vm_object *vm_aobj_create()
 	vm_object_common_init(&aobj->obj, &anon_pagerops);
 	return &aobj->obj;
 }
+
+// largest block that is aligned at off, fits and covers no resident page
+static unsigned int reserve_order(struct vm_object *obj, voff_t off,
+				  voff_t end)
+{
+	for (unsigned int order = BUDDY_ORDERS - 1; order > 0; order--) {
+		size_t size = PAGE_SIZE << order;
+		if (!IS_ALIGNED_POW2(off, size) || off + size > end)
+			continue;
+
+		struct page key = (struct page){ .offset = off };
+		struct page *pg = RBT_NFIND(vm_page_tree, &obj->memq, &key);
+		if (!pg || pg->offset >= off + size)
+			return order;
+	}
+
+	return 0;
+}
+
+status_t vm_aobj_reserve(struct vm_object *obj, voff_t offset, size_t length)
+{
+	if (obj->pg_ops != &anon_pagerops)
+		return YAK_NOT_SUPPORTED;
+
+	voff_t off = ALIGN_DOWN(offset, PAGE_SIZE);
+	voff_t end = ALIGN_UP(offset + length, PAGE_SIZE);
+
+	guard(mutex)(&obj->obj_lock);
+
+	// what we added, to take it back out if we run out of memory
+	TAILQ_HEAD(, page) added = TAILQ_HEAD_INITIALIZER(added);
+
+	while (off < end) {
+		struct page key = (struct page){ .offset = off };
+		if (RBT_FIND(vm_page_tree, &obj->memq, &key)) {
+			off += PAGE_SIZE;
+			continue;
+		}
+
+		unsigned int order = reserve_order(obj, off, end);
+		struct page *pg;
+		while ((pg = pmm_alloc_order(order)) == NULL && order > 0)
+			order--;
+
+		if (!pg) {
+			while ((pg = TAILQ_FIRST(&added)) != NULL) {
+				TAILQ_REMOVE(&added, pg, tailq_entry);
+				RBT_REMOVE(vm_page_tree, &obj->memq, pg);
+				pg->flags = 0;
+				vm_pagefree(pg);
+			}
+			return YAK_OOM;
+		}
+
+		page_zero(pg, order);
+		pmm_split_order(pg, order);
+
+		unsigned long flags = 0;
+#ifdef PMAP_HAS_LARGE_PAGE_SIZES
+		if (((size_t)PAGE_SIZE << order) >= PMAP_LARGE_PAGE_SIZES[0])
+			flags |= VM_PG_LARGE;
+#endif
+
+		for (size_t i = 0; i < (1UL << order); i++) {
+			pg[i].vmobj = obj;
+			pg[i].offset = off + i * PAGE_SIZE;
+			pg[i].flags |= flags;
+			RBT_INSERT(vm_page_tree, &obj->memq, &pg[i]);
+			TAILQ_INSERT_TAIL(&added, &pg[i], tailq_entry);
+		}
+
+		off += PAGE_SIZE << order;
+	}
+
+	return YAK_SUCCESS;
+}
@@ -18,6 +18,41 @@
 
 size_t n_pagefaults;
 
+#ifdef PMAP_HAS_LARGE_PAGE_SIZES
+/*
+ * Map the whole large page around address if the object backs it with a
+ * physically contiguous run, e.g. after tmpfs fallocate reserved it.
+ */
+static bool fault_map_large(struct vm_map *map, struct vm_map_entry *entry,
+			    vaddr_t address)
+{
+	const size_t size = PMAP_LARGE_PAGE_SIZES[0];
+	vaddr_t base = ALIGN_DOWN(address, size);
+
+	if (base < entry->base || base + size > entry->end)
+		return false;
+
+	voff_t offset = base - entry->base + entry->offset;
+	if (!IS_ALIGNED_POW2(offset, size))
+		return false;
+
+	struct page *page;
+	if (IS_ERR(vm_lookuppage(entry->object, offset, LOOKUP_ONLY, &page)))
+		return false;
+
+	if (!(page->flags & VM_PG_LARGE) ||
+	    !IS_ALIGNED_POW2(page_to_addr(page), size))
+		return false;
+
+	if (!pmap_is_vacant(&map->pmap, base, 1))
+		return false;
+
+	pmap_map(&map->pmap, base, page_to_addr(page), 1, entry->protection,
+		 entry->cache);
+	return true;
+}
+#endif
+
 // TODO: fault_flags are also used in map.c:VM_PREFILL!!!
 status_t vm_handle_fault(struct vm_map *map, vaddr_t address,
 			 unsigned long fault_flags)
@@ -100,8 +135,10 @@ status_t vm_handle_fault(struct vm_map *map, vaddr_t address,
 			// anons page read-only, regardless of the protection.
 			// If an attempt to write is made, we shall meet again :)
 			// Either, the anons refcount is now 1, or we copy.
+			// Pages over memory that isn't ours, like the initrd
+			// module, are treated as shared with their object.
 			pr_extra_debug("fault %lx\n", address);
-			if (anon->refcnt > 1) {
+			if (anon->refcnt > 1 || (page->flags & VM_PG_RDONLY)) {
 				pr_extra_debug("cow %lx\n", address);
 				if (fault_flags & VM_FAULT_READ) {
 					prot &= ~VM_WRITE;
@@ -114,9 +151,10 @@ status_t vm_handle_fault(struct vm_map *map, vaddr_t address,
 
 					*panon = copied_anon;
 
-					// safe: can't hit free condition
-					vm_anon_deref(anon);
+					// the amap held the last reference if
+					// it was only read-only
 					kmutex_release(&anon->anon_lock);
+					vm_anon_deref(anon);
 
 					anon = copied_anon;
 					// reacquire new anons lock
@@ -133,8 +171,20 @@ status_t vm_handle_fault(struct vm_map *map, vaddr_t address,
 			kmutex_release(&anon->anon_lock);
 		} else {
 			// No cow & thus no amap associated
-			EXPECT(vm_lookuppage(entry->object, backing_offset, 0,
-					     &page));
+#ifdef PMAP_HAS_LARGE_PAGE_SIZES
+			if (fault_map_large(map, entry, address)) {
+				rwlock_release_exclusive(&map->map_lock);
+				return YAK_SUCCESS;
+			}
+#endif
+			// shared mappings never map a VM_PG_RDONLY page, so
+			// it can be swapped for a copy without a shootdown
+			EXPECT(vm_lookuppage(entry->object, backing_offset,
+					     LOOKUP_WRITE, &page));
+			// stores through the mapping aren't tracked, assume
+			// the page gets written once it is mapped writable
+			if (entry->protection & VM_WRITE)
+				vm_page_dirty(page);
 			pmap_map(&map->pmap, address, page_to_addr(page), 0,
 				 entry->protection, entry->cache);
 		}
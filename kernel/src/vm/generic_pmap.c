@@ -16,6 +16,42 @@
 #define PTE_LOAD(p) (__atomic_load_n((p), __ATOMIC_SEQ_CST))
 #define PTE_STORE(p, x) (__atomic_store_n((p), (x), __ATOMIC_SEQ_CST))
 
+static inline void pmap_invalidate(vaddr_t va)
+{
+	asm volatile("invlpg (%0)" ::"r"(va) : "memory");
+}
+
+static inline size_t pmap_level_size(size_t level)
+{
+#ifdef PMAP_HAS_LARGE_PAGE_SIZES
+	return level == 0 ? PAGE_SIZE : PMAP_LARGE_PAGE_SIZES[level - 1];
+#else
+	(void)level;
+	return PAGE_SIZE;
+#endif
+}
+
+// replace a large mapping by a table mapping the same range, 0 without memory
+static pte_t pte_demote(pte_t *ptep, uintptr_t va, size_t lvl)
+{
+	pte_t pte = PTE_LOAD(ptep);
+
+	uintptr_t pa = pmm_alloc();
+	if (!pa)
+		return 0;
+
+	pte_t *table = (pte_t *)p2v(pa);
+	for (size_t i = 0; i < PMAP_LEVEL_ENTRIES[lvl - 1]; i++) {
+		table[i] = pte_split(pte, lvl, i);
+	}
+
+	pte_t dir = pte_make_dir(pa);
+	PTE_STORE(ptep, dir);
+	pmap_invalidate(ALIGN_DOWN(va, pmap_level_size(lvl)));
+
+	return dir;
+}
+
 static pte_t *pte_fetch(struct pmap *pmap, uintptr_t va, size_t atLevel,
 			int alloc)
 {
@@ -48,8 +84,14 @@ static pte_t *pte_fetch(struct pmap *pmap, uintptr_t va, size_t atLevel,
 
 			pte = pte_make_dir(pa);
 			PTE_STORE(ptep, pte);
-		} else {
-			assert(!pte_is_large(pte, lvl));
+		} else if (pte_is_large(pte, lvl)) {
+			// lookups find nothing below a large page
+			if (!alloc)
+				return NULL;
+
+			// smaller mapping inside a large page: split it up
+			pte = pte_demote(ptep, va, lvl);
+			assert(!pte_is_zero(pte));
 		}
 
 		table = (uint64_t *)p2v(pte_paddr(pte));
@@ -58,6 +100,41 @@ static pte_t *pte_fetch(struct pmap *pmap, uintptr_t va, size_t atLevel,
 	return NULL;
 }
 
+// find the leaf pte mapping va, whatever its level
+static pte_t *pte_leaf(struct pmap *pmap, uintptr_t va, size_t *levelp)
+{
+	pte_t *table = (pte_t *)p2v(pmap->top_level);
+
+	for (size_t lvl = PMAP_LEVELS - 1;; lvl--) {
+		size_t index = (va >> PMAP_LEVEL_SHIFTS[lvl]) &
+			       ((1ULL << PMAP_LEVEL_BITS[lvl]) - 1);
+		pte_t *ptep = &table[index];
+		pte_t pte = PTE_LOAD(ptep);
+
+		if (pte_is_zero(pte))
+			return NULL;
+
+		if (lvl == 0 || pte_is_large(pte, lvl)) {
+			*levelp = lvl;
+			return ptep;
+		}
+
+		table = (pte_t *)p2v(pte_paddr(pte));
+	}
+}
+
+/*
+ * Get a large leaf out of the way of an operation on part of it. Without
+ * memory for a table the whole leaf is dropped, user mappings fault back.
+ */
+static void pte_break_large(pte_t *ptep, uintptr_t va, size_t lvl)
+{
+	if (pte_is_zero(pte_demote(ptep, va, lvl))) {
+		PTE_STORE(ptep, 0);
+		pmap_invalidate(ALIGN_DOWN(va, pmap_level_size(lvl)));
+	}
+}
+
 void pmap_kernel_bootstrap(struct pmap *pmap)
 {
 	pmap->top_level = pmm_alloc_zeroed();
@@ -85,11 +162,6 @@ void pmap_init(struct pmap *pmap)
 	}
 }
 
-static inline void pmap_invalidate(vaddr_t va)
-{
-	asm volatile("invlpg (%0)" ::"r"(va) : "memory");
-}
-
 void pmap_map(struct pmap *pmap, uintptr_t va, uintptr_t pa, size_t level,
 	      vm_prot_t prot, vm_cache_t cache)
 {
@@ -104,9 +176,35 @@ void pmap_map(struct pmap *pmap, uintptr_t va, uintptr_t pa, size_t level,
 
 	if (!pte_is_zero(pte)) {
 		pmap_invalidate(va);
+
+		if (level > 0 && !pte_is_large(pte, level)) {
+			// a leftover empty table got replaced by a large page
+			assert(pte_check_pt_empty(level - 1,
+						  (pte_t *)p2v(pte_paddr(pte))));
+			pmm_free(pte_paddr(pte));
+		}
 	}
 }
 
+bool pmap_is_vacant(struct pmap *pmap, uintptr_t va, size_t level)
+{
+	size_t leaf_level;
+	pte_t *ppte = pte_leaf(pmap, va, &leaf_level);
+	if (ppte)
+		return false;
+
+	ppte = pte_fetch(pmap, va, level, 0);
+	if (!ppte)
+		return true;
+
+	pte_t pte = PTE_LOAD(ppte);
+	if (pte_is_zero(pte))
+		return true;
+
+	return level > 0 &&
+	       pte_check_pt_empty(level - 1, (pte_t *)p2v(pte_paddr(pte)));
+}
+
 paddr_t pmap_unmap(struct pmap *pmap, uintptr_t va, size_t level)
 {
 	pte_t *ppte = pte_fetch(pmap, va, level, 0);
@@ -122,14 +220,31 @@ paddr_t pmap_unmap(struct pmap *pmap, uintptr_t va, size_t level)
 void pmap_protect_range(struct pmap *pmap, vaddr_t va, size_t length,
 			vm_prot_t prot, vm_cache_t cache, size_t level)
 {
-#ifdef PMAP_HAS_LARGE_PAGE_SIZES
-	size_t pgsz = level == 0 ? PAGE_SIZE : PMAP_LARGE_PAGE_SIZES[level - 1];
-#else
-	size_t pgsz = PAGE_SIZE;
-#endif
+	size_t pgsz = pmap_level_size(level);
 
 	for (uintptr_t i = 0; i < length; i += pgsz) {
-		pte_t *ppte = pte_fetch(pmap, va + i, level, 0);
+		size_t leaf_level;
+		pte_t *ppte = pte_leaf(pmap, va + i, &leaf_level);
+		if (ppte && leaf_level > level) {
+			size_t leaf_size = pmap_level_size(leaf_level);
+			if (!IS_ALIGNED_POW2(va + i, leaf_size) ||
+			    length - i < leaf_size) {
+				pte_break_large(ppte, va + i, leaf_level);
+				// look again at what it was split into
+				i -= pgsz;
+				continue;
+			}
+
+			// covers the whole large page
+			PTE_STORE(ppte, pte_make(leaf_level,
+						 pte_paddr(PTE_LOAD(ppte)), prot,
+						 cache));
+			pmap_invalidate(va + i);
+			i += leaf_size - pgsz;
+			continue;
+		}
+
+		ppte = pte_fetch(pmap, va + i, level, 0);
 		if (ppte) {
 			pte_t pte = PTE_LOAD(ppte);
 			if (pte_is_zero(pte))
@@ -146,12 +261,28 @@ void pmap_protect_range(struct pmap *pmap, vaddr_t va, size_t length,
 void pmap_unmap_range(struct pmap *pmap, uintptr_t va, size_t length,
 		      size_t level)
 {
-#ifdef PMAP_HAS_LARGE_PAGE_SIZES
-	size_t pgsz = level == 0 ? PAGE_SIZE : PMAP_LARGE_PAGE_SIZES[level - 1];
-#else
-	size_t pgsz = PAGE_SIZE;
-#endif
+	size_t pgsz = pmap_level_size(level);
+
 	for (uintptr_t i = 0; i < length; i += pgsz) {
+		size_t leaf_level;
+		pte_t *ppte = pte_leaf(pmap, va + i, &leaf_level);
+		if (ppte && leaf_level > level) {
+			size_t leaf_size = pmap_level_size(leaf_level);
+			if (!IS_ALIGNED_POW2(va + i, leaf_size) ||
+			    length - i < leaf_size) {
+				pte_break_large(ppte, va + i, leaf_level);
+				// look again at what it was split into
+				i -= pgsz;
+				continue;
+			}
+
+			// covers the whole large page
+			PTE_STORE(ppte, 0);
+			pmap_invalidate(va + i);
+			i += leaf_size - pgsz;
+			continue;
+		}
+
 		pmap_unmap(pmap, va + i, level);
 	}
 }
@@ -16,7 +16,7 @@
 #define KM_SMALLSLAB_MAX (PAGE_SIZE / 8)
 #define KM_PAGES_MAX 64
 
-#define KM_IS_SMALL(cp) ((cp)->chunk_size <= KM_SMALLSLAB_MAX)
+#define KM_IS_SMALL(cp) ((cp)->small)
 
 typedef LIST_HEAD(slablist, kmem_slab) slablist_t;
 typedef SLIST_HEAD(buflist, kmem_bufctl) buflist_t;
@@ -51,6 +51,11 @@ typedef struct kmem_cache {
 	size_t max_chunks;
 	size_t slab_size;
 
+	// small slabs keep the slab header and free list in the page itself
+	bool small;
+	// where the free list link sits in a small slab chunk
+	size_t bufctl_offset;
+
 	int (*constructor)(void *obj, void *private, int kmflag);
 	void (*destructor)(void *obj, void *private);
 	void (*reclaim)(void *private);
@@ -271,8 +276,24 @@ kmem_cache_t *kmem_cache_create(char *name, size_t size, size_t align,
 	cp->private = private;
 
 	size_t chunksize = ALIGN_UP(size, align);
+	cp->small = chunksize <= KM_SMALLSLAB_MAX;
+
+	// a constructed object survives being freed, so the free list link
+	// of a small slab has to go behind it instead of over it. If that
+	// doesn't fit, use a large slab, whose bufctls live outside the chunk.
+	cp->bufctl_offset = 0;
+	if (constructor && cp->small) {
+		size_t offset = ALIGN_UP(size, _Alignof(kmem_bufctl_t));
+		size_t padded = ALIGN_UP(offset + sizeof(kmem_bufctl_t), align);
+		if (padded <= KM_SMALLSLAB_MAX) {
+			chunksize = padded;
+			cp->bufctl_offset = offset;
+		} else {
+			cp->small = false;
+		}
+	}
 
-	if (chunksize <= KM_SMALLSLAB_MAX) {
+	if (cp->small) {
 		pr_debug("init small slab (%ld)\n", chunksize);
 		cp->chunk_size = chunksize;
 		cp->max_chunks = (PAGE_SIZE - SLAB_SIZE) / chunksize;
@@ -351,6 +372,22 @@ static void slab_init(kmem_cache_t *parent, kmem_slab_t *sp, void *large_base)
 	sp->free_count = 0;
 }
 
+/*
+ * Objects are constructed once, when their slab is created, and keep that
+ * state across alloc and free. Destructors would run when a slab is given
+ * back, which doesn't happen yet.
+ */
+static void slab_construct(kmem_cache_t *cp, void *obj)
+{
+	if (cp->constructor == NULL)
+		return;
+
+	int rv = cp->constructor(obj, cp->private, KM_SLEEP);
+	if (rv < 0) {
+		assert(!"handle constructor failure\n");
+	}
+}
+
 static kmem_slab_t *create_small_slab(kmem_cache_t *cp)
 {
 	kmem_slab_t *sp;
@@ -363,12 +400,15 @@ static kmem_slab_t *create_small_slab(kmem_cache_t *cp)
 	slab_init(cp, sp, NULL);
 
 	for (size_t i = 0; i < cp->max_chunks; i++) {
+		void *obj = (void *)((uintptr_t)pg + cp->chunk_size * i +
+				     sp->color * cp->align);
 		kmem_bufctl_t *bufctl =
-			(void *)((uintptr_t)pg + cp->chunk_size * i +
-				 sp->color * cp->align);
+			(void *)((uintptr_t)obj + cp->bufctl_offset);
 
 		assert((uintptr_t)bufctl < (uintptr_t)sp);
 
+		slab_construct(cp, obj);
+
 		SLIST_INSERT_HEAD(&sp->freelist, bufctl, freelist_entry);
 		sp->free_count++;
 	}
@@ -406,6 +446,7 @@ static kmem_slab_t *create_large_slab(kmem_cache_t *cp)
 		bp->base = (void *)((uintptr_t)pg + cp->chunk_size * i +
 				    sp->color * cp->align);
 		bp->slab = sp;
+		slab_construct(cp, bp->base);
 		SLIST_INSERT_HEAD(&sp->freelist, &bp->bufctl, freelist_entry);
 		sp->free_count++;
 	}
@@ -449,7 +490,7 @@ static void *slab_alloc(kmem_cache_t *cp, kmem_slab_t *sp,
 	*bufctlp = bufctl;
 
 	if (KM_IS_SMALL(cp)) {
-		return (void *)bufctl;
+		return (void *)((uintptr_t)bufctl - cp->bufctl_offset);
 	} else {
 		kmem_large_bufctl_t *lbp = (kmem_large_bufctl_t *)bufctl;
 		assert(lbp->slab == sp);
@@ -485,10 +526,6 @@ void kmem_cache_free(kmem_cache_t *cp, void *obj)
 
 	kmutex_acquire(&cp->mutex, TIMEOUT_INFINITE);
 
-	if (cp->destructor != NULL) {
-		cp->destructor(obj, cp->private);
-	}
-
 	kmem_slab_t *sp;
 	kmem_bufctl_t *bp;
 
@@ -496,7 +533,7 @@ void kmem_cache_free(kmem_cache_t *cp, void *obj)
 		sp = (kmem_slab_t *)(ALIGN_UP((uintptr_t)obj + 1, PAGE_SIZE) -
 				     SLAB_SIZE);
 
-		bp = obj;
+		bp = (void *)((uintptr_t)obj + cp->bufctl_offset);
 	} else {
 		kmem_large_bufctl_t *lbp;
 		lbp = hashtable_lookup(cp, obj);
@@ -515,7 +552,7 @@ void kmem_cache_free(kmem_cache_t *cp, void *obj)
 	kmutex_release(&cp->mutex);
 }
 
-void *kmem_cache_alloc(kmem_cache_t *cp, int kmflag)
+void *kmem_cache_alloc(kmem_cache_t *cp, [[maybe_unused]] int kmflag)
 {
 	// TODO: magazines
 
@@ -535,13 +572,6 @@ void *kmem_cache_alloc(kmem_cache_t *cp, int kmflag)
 	kmem_bufctl_t *bufctl;
 	void *addr = slab_alloc(cp, sp, &bufctl);
 
-	if (cp->constructor != NULL) {
-		int rv = cp->constructor(addr, cp->private, kmflag);
-		if (rv < 0) {
-			assert(!"handle free\n");
-		}
-	}
-
 	kmutex_release(&cp->mutex);
 	return addr;
 }
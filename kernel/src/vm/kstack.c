@@ -0,0 +1,99 @@
+#include <yak/arch-mm.h>
+#include <yak/cpudata.h>
+#include <yak/ipl.h>
+#include <yak/spinlock.h>
+#include <yak/vm/kstack.h>
+#include <yak/vm/map.h>
+#include <yak/vm/pmap.h>
+#include <yak/vm/pmm.h>
+#include <yak/vm/vmem.h>
+
+#define KSTACK_GUARD PAGE_SIZE
+#define KSTACK_SPAN (KSTACK_SIZE + KSTACK_GUARD)
+
+extern vmem_t heap_arena;
+
+// kept in the lowest word of a free stack
+struct kstack_link {
+	struct kstack_link *next;
+};
+
+/*
+ * Stacks past the per-cpu caches. They are never unmapped: without tlb
+ * shootdowns another cpu could still hold a stale translation.
+ */
+static SPINLOCK(spare_lock);
+static struct kstack_link *spare_stacks;
+
+static void *kstack_map()
+{
+	void *span = vmem_alloc(&heap_arena, KSTACK_SPAN, VM_SLEEP);
+	if (!span)
+		return NULL;
+
+	// the guard page is the bottom of the span and stays unmapped
+	vaddr_t base = (vaddr_t)span + KSTACK_GUARD;
+	for (size_t i = 0; i < KSTACK_SIZE; i += PAGE_SIZE) {
+		struct page *pg = pmm_alloc_order(0);
+		if (pg) {
+			pmap_map(&kmap()->pmap, base + i, page_to_addr(pg), 0,
+				 VM_RW, VM_CACHE_DEFAULT);
+			continue;
+		}
+
+		// nobody else has seen these yet, so unmapping is fine
+		while (i > 0) {
+			i -= PAGE_SIZE;
+			pmm_free(pmap_unmap(&kmap()->pmap, base + i, 0));
+		}
+		vmem_free(&heap_arena, span, KSTACK_SPAN);
+		return NULL;
+	}
+
+	return (void *)(base + KSTACK_SIZE);
+}
+
+void *kstack_alloc()
+{
+	// stay on this cpu while touching its cache
+	ipl_t ipl = ripl(IPL_DPC);
+	struct cpu *cpu = curcpu_ptr();
+	void *top = NULL;
+	if (cpu->kstack_cached > 0)
+		top = cpu->kstack_cache[--cpu->kstack_cached];
+	xipl(ipl);
+
+	if (top)
+		return top;
+
+	ipl = spinlock_lock(&spare_lock);
+	struct kstack_link *link = spare_stacks;
+	if (link)
+		spare_stacks = link->next;
+	spinlock_unlock(&spare_lock, ipl);
+
+	if (link)
+		return (void *)((vaddr_t)link + KSTACK_SIZE);
+
+	return kstack_map();
+}
+
+void kstack_free(void *top)
+{
+	ipl_t ipl = ripl(IPL_DPC);
+	struct cpu *cpu = curcpu_ptr();
+	if (cpu->kstack_cached < KSTACK_CACHE_SIZE) {
+		cpu->kstack_cache[cpu->kstack_cached++] = top;
+		top = NULL;
+	}
+	xipl(ipl);
+
+	if (!top)
+		return;
+
+	struct kstack_link *link = (void *)((vaddr_t)top - KSTACK_SIZE);
+	ipl = spinlock_lock(&spare_lock);
+	link->next = spare_stacks;
+	spare_stacks = link;
+	spinlock_unlock(&spare_lock, ipl);
+}
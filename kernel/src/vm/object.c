@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <string.h>
 #include <yak/cleanup.h>
+#include <yak/macro.h>
 #include <yak/mutex.h>
 #include <yak/types.h>
 #include <yak/tree.h>
@@ -13,9 +15,35 @@ void vm_object_common_init(struct vm_object *obj, struct vm_pagerops *pgops)
 	RBT_INIT(vm_page_tree, &obj->memq);
 	obj->pg_ops = pgops;
 	obj->refcnt = 1;
+	obj->flags = 0;
+}
+
+/*
+ * Swap a read-only page for a private copy before it is written. Nothing
+ * maps such a page shared, see vm_handle_fault; private mappings get it
+ * through an anon, which holds its own reference.
+ */
+static status_t page_make_writable(struct vm_object *obj, struct page **pgp)
+{
+	struct page *pg = *pgp;
+	if (!(pg->flags & VM_PG_RDONLY))
+		return YAK_SUCCESS;
+
+	struct page *copy = vm_pagealloc(obj, pg->offset);
+	if (!copy)
+		return YAK_OOM;
+
+	memcpy((void *)page_to_mapped_addr(copy),
+	       (void *)page_to_mapped_addr(pg), PAGE_SIZE);
+
+	RBT_REMOVE(vm_page_tree, &obj->memq, pg);
+	RBT_INSERT(vm_page_tree, &obj->memq, copy);
+	page_deref(pg);
+
+	*pgp = copy;
+	return YAK_SUCCESS;
 }
 
-#define LOOKUP_ONLY 0x1
 status_t vm_lookuppage(struct vm_object *obj, voff_t offset, int flags,
 		       struct page **pagep)
 {
@@ -25,6 +53,10 @@ status_t vm_lookuppage(struct vm_object *obj, voff_t offset, int flags,
 	struct page *pg = RBT_FIND(vm_page_tree, &obj->memq, &key);
 
 	if (pg) {
+		if (flags & LOOKUP_WRITE) {
+			status_t res = page_make_writable(obj, &pg);
+			IF_ERR(res) return res;
+		}
 		*pagep = pg;
 		return YAK_SUCCESS;
 	}
@@ -34,20 +66,161 @@ status_t vm_lookuppage(struct vm_object *obj, voff_t offset, int flags,
 		return YAK_NOENT;
 	}
 
+	struct page *pages[VM_MAX_READAHEAD + 1];
 	unsigned int npages = 1;
-	status_t res = obj->pg_ops->pgo_get(obj, offset, &pg, &npages, 0, VM_RW,
-					    flags);
+
+	// read ahead over the following pages that aren't resident yet
+	unsigned int ra = MIN(obj->pg_ops->pgo_readahead, VM_MAX_READAHEAD);
+	while (npages <= ra) {
+		key.offset = offset + (voff_t)npages * PAGE_SIZE;
+		if (RBT_FIND(vm_page_tree, &obj->memq, &key))
+			break;
+		npages++;
+	}
+
+	status_t res = obj->pg_ops->pgo_get(obj, offset, pages, &npages, 0,
+					    VM_RW, flags);
 	if (IS_ERR(res)) {
 		return res;
 	}
 
-	RBT_INSERT(vm_page_tree, &obj->memq, pg);
+	assert(npages >= 1);
+	for (unsigned int i = 0; i < npages; i++)
+		RBT_INSERT(vm_page_tree, &obj->memq, pages[i]);
 
+	pg = pages[0];
+	if (flags & LOOKUP_WRITE) {
+		res = page_make_writable(obj, &pg);
+		IF_ERR(res) return res;
+	}
 	*pagep = pg;
 
 	return YAK_SUCCESS;
 }
 
+void vm_page_dirty(struct page *pg)
+{
+	unsigned long old = __atomic_fetch_or(&pg->flags, VM_PG_DIRTY,
+					      __ATOMIC_RELAXED);
+	if (!(old & VM_PG_DIRTY))
+		__atomic_fetch_or(&pg->vmobj->flags, VM_OBJ_DIRTY,
+				  __ATOMIC_RELEASE);
+}
+
+status_t vm_object_copyin(struct vm_object *obj, voff_t offset,
+			  struct page *src)
+{
+	assert(IS_ALIGNED_POW2(offset, PAGE_SIZE));
+	guard(mutex)(&obj->obj_lock);
+
+	struct page key = (struct page){ .offset = offset };
+	struct page *pg = RBT_FIND(vm_page_tree, &obj->memq, &key);
+
+	// the whole page is replaced, don't have the pager fill it first
+	if (pg && (pg->flags & VM_PG_RDONLY)) {
+		RBT_REMOVE(vm_page_tree, &obj->memq, pg);
+		page_deref(pg);
+		pg = NULL;
+	}
+
+	if (!pg) {
+		pg = vm_pagealloc(obj, offset);
+		if (!pg)
+			return YAK_OOM;
+		RBT_INSERT(vm_page_tree, &obj->memq, pg);
+	}
+
+	memcpy((void *)page_to_mapped_addr(pg), (void *)page_to_mapped_addr(src),
+	       PAGE_SIZE);
+	vm_page_dirty(pg);
+	return YAK_SUCCESS;
+}
+
+status_t vm_object_donate(struct vm_object *obj, voff_t offset,
+			  struct page *pg)
+{
+	assert(IS_ALIGNED_POW2(offset, PAGE_SIZE));
+	guard(mutex)(&obj->obj_lock);
+
+	struct page key = (struct page){ .offset = offset };
+	struct page *old = RBT_FIND(vm_page_tree, &obj->memq, &key);
+
+	if (old && (old->flags & VM_PG_RDONLY)) {
+		RBT_REMOVE(vm_page_tree, &obj->memq, old);
+		page_deref(old);
+		old = NULL;
+	}
+
+	if (old) {
+		memcpy((void *)page_to_mapped_addr(old),
+		       (void *)page_to_mapped_addr(pg), PAGE_SIZE);
+		vm_page_dirty(old);
+		page_deref(pg);
+		return YAK_SUCCESS;
+	}
+
+	pg->vmobj = obj;
+	pg->offset = offset;
+	RBT_INSERT(vm_page_tree, &obj->memq, pg);
+	vm_page_dirty(pg);
+	return YAK_SUCCESS;
+}
+
+static status_t sync_run(struct vm_object *obj, struct page **run,
+			 unsigned int n)
+{
+	status_t rv = obj->pg_ops->pa_put(obj, run, n);
+	IF_ERR(rv)
+	{
+		// keep them around for the next attempt
+		for (unsigned int i = 0; i < n; i++)
+			vm_page_dirty(run[i]);
+	}
+	return rv;
+}
+
+status_t vm_object_sync(struct vm_object *obj)
+{
+	guard(mutex)(&obj->obj_lock);
+
+	if (!(__atomic_fetch_and(&obj->flags, ~VM_OBJ_DIRTY,
+				 __ATOMIC_ACQUIRE) &
+	      VM_OBJ_DIRTY))
+		return YAK_SUCCESS;
+
+	struct page *run[VM_MAX_READAHEAD];
+	unsigned int n = 0;
+	status_t rv = YAK_SUCCESS, res;
+
+	// cluster consecutive dirty pages into one put
+	struct page *pg;
+	RBT_FOREACH(pg, vm_page_tree, &obj->memq)
+	{
+		if (!(__atomic_fetch_and(&pg->flags, ~VM_PG_DIRTY,
+					 __ATOMIC_RELAXED) &
+		      VM_PG_DIRTY))
+			continue;
+
+		if (n > 0 && (n == VM_MAX_READAHEAD ||
+			      run[n - 1]->offset + PAGE_SIZE != pg->offset)) {
+			res = sync_run(obj, run, n);
+			if (IS_ERR(res))
+				rv = res;
+			n = 0;
+		}
+
+		run[n++] = pg;
+	}
+
+	if (n > 0) {
+		res = sync_run(obj, run, n);
+		if (IS_ERR(res))
+			rv = res;
+	}
+
+	return rv;
+}
+
 static void vm_object_cleanup(struct vm_object *obj)
 {
 	assert(obj->pg_ops->pgo_cleanup);
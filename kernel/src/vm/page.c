@@ -41,6 +41,7 @@ void page_free(struct page *pg)
 		// e.g. fake device page
 		kfree(pg, sizeof(struct page));
 	} else {
+		pg->flags &= ~(VM_PG_LARGE | VM_PG_DIRTY);
 		pmm_free_pages_order(pg, pg->order);
 	}
 }
@@ -0,0 +1,130 @@
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <yak/heap.h>
+#include <yak/macro.h>
+#include <yak/tree.h>
+#include <yak/vm/map.h>
+#include <yak/vm/page.h>
+#include <yak/vm/object.h>
+#include <yak/vm/physobj.h>
+
+struct vm_physobj {
+	struct vm_object obj;
+	paddr_t base;
+	size_t size;
+};
+
+static struct page *phys_fake_page(paddr_t pa, voff_t offset,
+				   struct vm_object *obj)
+{
+	struct page *pg = kzalloc(sizeof(struct page));
+	if (!pg)
+		return NULL;
+
+	pg->pfn = pa >> PAGE_SHIFT;
+	pg->shares = 1;
+	pg->vmobj = obj;
+	pg->offset = offset;
+	// the module is bootloader memory, writes go to a copy
+	pg->flags = VM_PG_FAKE | VM_PG_RDONLY;
+	pg->order = 0;
+
+	return pg;
+}
+
+// partial or misaligned page: copy what's valid, zero the rest
+static struct page *phys_copy_page(struct vm_physobj *pobj, voff_t offset)
+{
+	struct page *pg = vm_pagealloc(&pobj->obj, offset);
+	if (!pg)
+		return NULL;
+
+	size_t valid = 0;
+	if (offset < pobj->size)
+		valid = MIN((size_t)PAGE_SIZE, pobj->size - offset);
+
+	char *dst = (char *)page_to_mapped_addr(pg);
+	memcpy(dst, (void *)p2v(pobj->base + offset), valid);
+	memset(dst + valid, 0, PAGE_SIZE - valid);
+
+	return pg;
+}
+
+status_t phys_pager_get(struct vm_object *obj, voff_t offset,
+			struct page **pages, unsigned int *npages,
+			[[maybe_unused]] unsigned int centeridx,
+			[[maybe_unused]] vm_prot_t access_type,
+			[[maybe_unused]] unsigned int flags)
+{
+	assert(IS_ALIGNED_POW2(offset, PAGE_SIZE));
+	struct vm_physobj *pobj = (struct vm_physobj *)obj;
+
+	unsigned int i;
+	for (i = 0; i < *npages; i++) {
+		voff_t off = offset + i * PAGE_SIZE;
+		paddr_t pa = pobj->base + off;
+
+		if (off + PAGE_SIZE <= pobj->size &&
+		    IS_ALIGNED_POW2(pa, PAGE_SIZE)) {
+			// no copy until the first write
+			pages[i] = phys_fake_page(pa, off, obj);
+		} else {
+			pages[i] = phys_copy_page(pobj, off);
+		}
+
+		if (!pages[i]) {
+			*npages = i;
+			return YAK_OOM;
+		}
+	}
+
+	return YAK_SUCCESS;
+}
+
+status_t phys_pager_put(struct vm_object *object, struct page **pages,
+			unsigned int npages)
+{
+	(void)object;
+	(void)pages;
+	(void)npages;
+	// nowhere to write back to
+	return YAK_SUCCESS;
+}
+
+void phys_pager_cleanup(struct vm_object *object)
+{
+	struct page *elm, *tmp;
+	RBT_FOREACH_SAFE(elm, vm_page_tree, &object->memq, tmp)
+	{
+		page_deref(elm);
+	}
+
+	kfree(object, sizeof(struct vm_physobj));
+}
+
+void phys_pager_ref(struct vm_object *object)
+{
+	__atomic_fetch_add(&object->refcnt, 1, __ATOMIC_SEQ_CST);
+}
+
+struct vm_pagerops phys_pagerops = {
+	.pgo_name = "phys",
+	.pgo_init = NULL,
+	.pgo_get = phys_pager_get,
+	.pa_put = phys_pager_put,
+	.pgo_ref = phys_pager_ref,
+	.pgo_cleanup = phys_pager_cleanup,
+};
+
+struct vm_object *vm_physobj_create(paddr_t base, size_t size)
+{
+	struct vm_physobj *pobj = kzalloc(sizeof(struct vm_physobj));
+	if (!pobj)
+		return NULL;
+
+	vm_object_common_init(&pobj->obj, &phys_pagerops);
+	pobj->base = base;
+	pobj->size = size;
+	return &pobj->obj;
+}
@@ -463,6 +463,17 @@ void pmm_free_pages_order(struct page *page, unsigned int order)
 	zone_free(lookup_zone(page_to_addr(page)), page, order);
 }
 
+void pmm_split_order(struct page *page, unsigned int order)
+{
+	assert(page->order == order);
+	assert(page->shares == 1);
+
+	for (size_t i = 0; i < (1UL << order); i++) {
+		page[i].order = 0;
+		page[i].shares = 1;
+	}
+}
+
 void pmm_dump()
 {
 	printk(0, "\n=== PMM DUMP ===\n");
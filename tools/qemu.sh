@@ -1,13 +1,14 @@
 #!/bin/bash
 
 usage() { 
-	echo "Usage: $0 -[skPDGpV] <ARCH> <BUILDDIR>"
+	echo "Usage: $0 -[skPDGpV] [-b <disk image>] <ARCH> <BUILDDIR>"
 	exit 1
 }
 
 native=0
 enable_kvm=0
 debug=0
+disk=""
 
 qemu_args="${QEMU_OPTARGS}"
 print_command=0
@@ -16,7 +17,7 @@ if [[ "${QEMU_PRINT}" -eq 1 ]]; then
 	print_command=1
 fi
 
-while getopts "skPDnGVp" optc; do
+while getopts "skPDnGVpb:" optc; do
 	case "${optc}" in
 	s) qemu_args="$qemu_args -serial stdio" ;;
 	k) enable_kvm=1 ;;
@@ -29,6 +30,7 @@ while getopts "skPDnGVp" optc; do
 		;;
 	p) qemu_args="$qemu_args -debugcon stdio" ;;
 	V) print_command=1 ;;
+	b) disk="${OPTARG}" ;;
 	*)
 		usage
 		;;
@@ -117,6 +119,11 @@ qemu_args="$qemu_args -cdrom ${iso}"
 qemu_args="$qemu_args -smp $qemu_cores"
 qemu_args="$qemu_args -m $qemu_mem"
 
+if [[ -n "$disk" ]]; then
+	qemu_args="$qemu_args -drive file=$disk,if=none,id=vd0,format=raw"
+	qemu_args="$qemu_args -device virtio-blk-pci,drive=vd0,num-queues=$qemu_cores"
+fi
+
 if [[ $print_command -eq 1 ]]; then
 	echo "${qemu_command}" "${qemu_args}"
 	exit